@@ -1,9 +1,28 @@
 
 #include <Arduino.h>
-#include "EspMQTTClient.h"
+#include <mqtt_transport.h>
+#include <publish_scheduler.h>
+#include <network.h>
+#include <session_recorder.h>
+#include <epoch_clock.h>
+#include <json_pool.h>
+#include <power_save.h>
+#include <latency_histogram.h>
+#include <profiler.h>
+#include <player_stats.h>
+#include <round_engine.h>
+#include <event_parser.h>
+#include <led_math.h>
+#include <net_util.h>
+#include <broker_list.h>
+#include <touch_gestures.h>
 #include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "hal/gpio_ll.h"
 #include <HTTPClient.h>
 #include <Update.h>
+#include "mbedtls/base64.h"
 #include <ArduinoJson.h>
 #include <secrets.h>
 #include <time.h>
@@ -33,12 +52,43 @@
 #define EVENT_OTA 4
 #define EVENT_TOUCH 6
 
-#define FIRST 1;
-#define SECOND 2;
-#define OTHER 3;
+#define SESSION_DUMP_BYTES 320   // Dump bytes per MQTT message, their base64 fits a lane payload and so does the largest REC_EVENT
+
+#define BENCH_TOLERANCE_PCT 25   // Slowdown against the baseline that counts as a regression
+#define TRANSPORT_BENCH_MESSAGES 200 // Touch sized publishes timed by {"event":"bench","action":"transport"}
+#define TRANSPORT_BENCH_WAIT 5000    // ms to wait for them to come back from the broker
+
+#define TOUCH_PIN 4
+#define EDGE_RING_SIZE 16       // Edges the ISR can buffer between two loop() passes
+
+#define OFFLINE_QUEUE_SIZE 8    // Touches kept while MQTT is down, oldest are dropped first
+
+#define MQTT_BUFFER_SIZE 1024      // Max MQTT packet, a base64 firmware chunk plus its JSON envelope must fit
+
+#define OTA_CHUNK_MAX 512      // Largest firmware chunk accepted over MQTT, before base64
+#define OTA_WINDOW 8           // Chunks that may arrive ahead of the next one to write, the publisher never sends further
+#define OTA_ACK_EVERY 4        // Chunks written between cumulative acks, the publisher's window slides on these
+#define OTA_NACK_MS 200        // Gap age before missing chunks are re-requested, a few broker round trips
+#define OTA_STALL_MS 3000      // Silence before we ask the publisher to resend from our position
+#define OTA_ABORT_MS 60000     // Silence before the update is abandoned
+
+// Live credential test in the provisioning portal, nothing is saved until the broker answers
+#define PROVISION_IDLE    0
+#define PROVISION_JOINING 1        // Station joining next to the AP, waiting for DHCP
+#define PROVISION_MQTT    2        // Joined, waiting for the broker
+#define PROVISION_DONE    3        // Saved, the AP stays up a moment so the page can show it
+#define PROVISION_FAILED  4
+#define PROVISION_JOIN_TIMEOUT 15000 // ms to associate and get an address
+#define PROVISION_MQTT_TIMEOUT 10000 // ms for the broker once the network is up
+#define PROVISION_HANDOFF 3000       // ms the AP stays up after success
+
+#define RECONNECT_MIN_DELAY 250    // ms before the first broker reconnection attempt
+#define RECONNECT_MAX_DELAY 15000  // Backoff ceiling, matches EspMQTTClient's old fixed delay
 
 #define logLevelSerial  DEBUG // Set the default log level
 #define logLevelMQTT  INFO // Set the default MQTT log level
+#define LOG_ENTRY_LEN 192  // Longest sendLogf() entry, longer ones are cut
+#define OPTIONS_LEN 2048   // Room for the scanned network list in the portal
 
 #define  redLEDs 0
 #define  blueLEDs 1
@@ -46,6 +96,10 @@
 #define  whiteLEDs 3
 #define Logging "remote"
 
+#define SUMMARY_INTERVAL 60000 // ms between telemetry summaries on the device's summary topic
+
+#define TRACE_SAMPLE_EVERY 1 // Publish the stage timings of every Nth touch on the trace channel (0 disables tracing)
+
 const int REDPIN = 16;
 const int GREENPIN = 32;//17
 const int BLUEPIN = 17;//21;
@@ -57,10 +111,12 @@ unsigned long startMillis;
 unsigned long currentMillis;
 unsigned long eventTime;
 unsigned long syncTime;
+uint64_t syncEpoch;        // Epoch ms of the last sync, start of the current round window
 unsigned long deltaTime;
-uint8_t debouceTime = 50;
+uint8_t debouceTime = 50;   // ms after a sync in which touches are ignored
+uint16_t reorderWindow = 150; // ms to collect touches after the first one before the round is judged
 
-String options = "";
+char options[OPTIONS_LEN] = ""; // <option> list of scanned networks for the portal
 
 
 //Device ID stuff
@@ -78,7 +134,6 @@ const char* ntpServer = "pool.ntp.org";
 const long gmtOffset_sec = -28800; // Adjust for your timezone, e.g., PST (UTC-8)
 // Daylight offset in seconds (e.g., for daylight saving time: 3600)
 const int daylightOffset_sec = -25200; // Adjust for your timezone, e.g., -25200 for PDT (UTC-7)
-unsigned long bootTimeMillis;
 
 //static 
 
@@ -88,28 +143,139 @@ struct Button {
   volatile unsigned long touchTime = 0;
   volatile unsigned long delta = 9999999;
   volatile bool pressed = false;
+  volatile uint32_t traceID = 0;         // Sequence number stamped on every touch, echoed by remote devices
+  volatile unsigned long touchMicros = 0; // micros() captured in the ISR, start of the latency trace
+  uint8_t power = POWER_ACTIVE;           // Power state the press found the device in
+};
+
+// Config documents: retained on funger/rooms/<room>/config (funger/config without a room) and
+// funger/device/<id>/config as {"version":n, "maxBrightness":.., ...}. Versions only go up.
+#define CONFIG_LAYOUT 2 // Bump when DeviceConfig changes, fields added since a stored layout start from defaults
+
+#define CONFIG_LEGACY 0 // Single field "display"/"game" events, no version
+#define CONFIG_ROOM   1
+#define CONFIG_DEVICE 2
+
+// Fields a device document sets, the room document leaves those alone
+#define CFG_MAX_BRIGHTNESS   0x0001
+#define CFG_NIGHT_BRIGHTNESS 0x0002
+#define CFG_NIGHT_START      0x0004
+#define CFG_NIGHT_END        0x0008
+#define CFG_WINDOW           0x0010
+#define CFG_GLITCH           0x0020
+#define CFG_LAN              0x0040
+#define CFG_IDLE             0x0080
+
+// Everything configurable, persisted as one NVS blob so a document is applied completely or not at all
+struct DeviceConfig {
+  uint8_t layout = CONFIG_LAYOUT;
+  uint32_t roomVersion = 0;
+  uint32_t deviceVersion = 0;
+  uint16_t deviceFields = 0;   // CFG_* bits present in the last device document
+  uint8_t maxBrightness = 100;
+  uint8_t nightBrightness = 50;
+  uint8_t nightStart = 20;
+  uint8_t nightEnd = 7;
+  uint16_t reorderWindow = 150;
+  uint16_t glitchMicros = 3000;
+  bool lan = true;
+  uint16_t idleAfter = 300;    // s without room activity before the idle power mode, 0 never idles (layout 2)
+};
+
+// Reaction round: the coordinator picks a start instant on the shared clock, every device lights up
+// at that instant from an esp_timer and times reactions against its own trigger
+struct GoRound {
+  volatile bool armed = false;      // Timer running, touches now are false starts
+  volatile bool fired = false;      // Timer went off, loop() hasn't taken over yet
+  bool live = false;                // Current round was started by a go trigger
+  uint32_t id = 0;                  // Round number chosen by the coordinator
+  uint64_t atMicros = 0;            // Requested start instant, epoch us
+  uint32_t lead = 0;                // ms of notice we got before the start instant
+  int64_t triggerMicros = 0;        // esp_timer time the LEDs flipped, same timebase as micros()/millis()
+  int64_t triggerEpochMicros = 0;   // The same instant on the epoch clock
+  LEDstruct colors;                 // Prepared go color, the timer callback only writes the pins
+};
+
+// Inbound traffic and outcome of one round as seen by this device, published when the round closes
+struct RoundStats {
+  uint32_t round = 0;          // Local round counter, incremented every time a round closes
+  uint16_t messages = 0;       // All messages received on the subscribed topics during the round
+  uint16_t touches = 0;        // Remote touch events received
+  uint16_t syncs = 0;          // Sync events received (fan-out of every device's decision)
+  char winner[18] = "";        // deviceID this device believes won the round
+  unsigned long startedAt = 0; // millis() when the round opened
+  uint32_t decideMax = 0;      // Worst decision latency in us (receive to judged) during the round
+  uint8_t placement = NOT_PLACED; // This device's placement
+  int32_t heapBlocks = 0;      // Allocated heap blocks when the round opened, steady gameplay shouldn't change it
+  uint32_t jsonHeap = 0;       // JSON pool heap fallbacks when the round opened
 };
 
-struct LEDstruct {
-  uint8_t redBrightness = 0;
-  uint8_t greenBrightness = 0;
-  uint8_t blueBrightness = 0;
-  uint8_t whiteBrightness = 0;
-  uint8_t maxBrightness = 100; // Max brightness percentage (0-100) 
-  uint8_t nightBrightness = 100; // Night mode brightness percentage (0-100)
-  uint8_t nightEnd = 7; // Hour when night mode ends (0-23)
-  uint8_t nightStart = 20; // Hour when night mode starts (0-
+// Touch captured while MQTT was disconnected, replayed with its original time on reconnect
+struct OfflineTouch {
+  uint64_t at = 0;       // Epoch ms of the ISR
+  uint32_t delta = 0;    // ms since our last sync when the touch happened
+  uint32_t traceID = 0;
 };
 
-struct Event {
-  bool newEvent = false;
-  unsigned long eventTime = 0;
-  uint64_t deviceID = 0;
+// Firmware image delivered once over a shared MQTT topic as numbered chunks
+struct OtaSession {
+  bool active = false;
+  char id[24] = "";            // Session name, part of the topics
+  char chunkTopic[64] = "";    // funger/ota/<id>/chunks, published once for the whole room
+  char ackTopic[64] = "";      // funger/ota/<id>/ack, our progress and selective re-requests
+  uint32_t size = 0;
+  uint16_t chunks = 0;
+  uint16_t chunkSize = 0;
+  uint16_t next = 0;           // Next chunk to write, everything below is in flash
+  uint16_t lastAcked = 0;
+  uint16_t ahead = 0;          // Highest chunk seen beyond the window, proof that the ones before it were sent
+  uint8_t window[OTA_WINDOW][OTA_CHUNK_MAX]; // Chunks that arrived ahead of `next`, slot = index % OTA_WINDOW
+  uint16_t windowLength[OTA_WINDOW];
+  uint16_t windowChunk[OTA_WINDOW];          // Chunk index held by each slot, 0xFFFF when empty
+  unsigned long lastChunk = 0;  // millis() of the last useful chunk
+  unsigned long gapSince = 0;   // millis() since chunk `next` has been missing with later ones buffered
+  unsigned long lastRequest = 0;
+  uint16_t duplicates = 0;
 };
 
-struct NetworkInfo {
-  String ssid;
-  int32_t rssi;
+// Cumulative counters at the start of the current summary window, the summary reports the deltas
+// so an aggregator can add up windows and devices without tracking counter resets
+struct SummaryWindow {
+  unsigned long startedAt = 0;
+  uint32_t publishes = 0;
+  uint32_t failures = 0;
+  uint32_t received = 0;
+  uint32_t dropped = 0;  // Summed over all lanes
+  uint16_t reconnects = 0;
+  uint32_t rounds = 0;
+};
+
+// Cost of turning documents into text or back, per message
+struct JsonTiming {
+  uint32_t count = 0;
+  uint64_t micros = 0;
+  uint32_t maxMicros = 0;
+  void add(uint32_t us) { count++; micros += us; if (us > maxMicros) maxMicros = us; }
+  uint32_t average() const { return count ? (uint32_t)(micros / count) : 0; }
+};
+
+// Credentials from the portal being tried while the AP stays up
+struct ProvisionTest {
+  uint8_t state = PROVISION_IDLE;
+  unsigned long startedAt = 0;  // millis() the current step started
+  char ssid[33] = "";
+  char pass[65] = "";
+  char deviceName[33] = "";
+  volatile uint8_t reason = 0;  // Last station disconnect reason, written by the WiFi event task
+  char message[80] = "";        // Progress or failure shown by the portal page
+};
+
+// One hot function under the on-device micro-benchmark
+struct BenchCase {
+  const char* name;
+  void (*run)(uint32_t i); // One operation, i varies the input so nothing gets folded away
+  uint32_t iterations;
+  uint32_t budgetNs;       // Ceiling per op used until a measured baseline is saved, catches gross regressions only
 };
 
 struct tm timeinfo;
@@ -117,14 +283,64 @@ struct tm timeinfo;
 //=================================== End Structure Def ==========================================
 
 HTTPClient OTAclient;
-EspMQTTClient* client;
+MqttTransport* client;
+PublishScheduler publisher;
+LanBus lanBus;
+bool lanEnabled = true;   // Multicast game events to LAN peers next to MQTT
+bool lanDelivery = false; // The event being handled by recieveEvents() came over the LAN
 WebServer server(80);
 DNSServer dnsServer; // DNS server for captive portal
+bool portalActive = false; // Provisioning AP and web server are up
+ProvisionTest provision;
+wifi_event_id_t provisionEvent = 0;
 Preferences prefs;
 
 Button touchBtn;
+TouchEdge touchEdges[EDGE_RING_SIZE];
+volatile uint8_t edgeHead = 0; // Written by the ISR
+uint8_t edgeTail = 0;          // Read by loop()
+TouchGestures gestures;
+SessionRecorder recorder;
+GoRound goRound;
+EpochClock epochClock;
+PowerSaver powerSaver;
+Profiler profiler;
+esp_timer_handle_t goTimer;
+DeviceConfig deviceConfig;
+uint32_t configSkips = 0; // Config documents ignored because their version was already applied
+int16_t sessionDumpNext = -1; // Next record to publish while a session dump is running
 LEDstruct colors;
-Event event;
+Round currentRound;
+OtaSession otaSession;
+RoundStats roundStats;
+JsonTiming serializeTiming;
+JsonTiming deserializeTiming;
+uint32_t jsonOversized = 0; // Documents not published because they didn't fit a lane payload
+SummaryWindow summaryWindow;
+LatencyHistogram touchLatency;   // Local touches, us from the ISR to published
+LatencyHistogram transitLatency; // Remote touches, ms from the sender's publish to our receive
+PlayerStats playerStats;         // Our own reaction deltas and placements, kept across reboots
+bool playerStatsDirty = false;   // Changed since the room last heard our summary
+uint32_t playerStatsSaved = 0;   // playerStats.count at the last NVS write
+Leaderboard leaderboard;         // Latest summary of every player heard in the room
+
+// Broker reconnection bookkeeping
+bool mqttWasConnected = false;    // Seen a connection since boot, later connections are reconnects
+unsigned long disconnectedAt = 0; // millis() when the connection dropped
+unsigned long nextReconnectAt = 0; // millis() of the next expected reconnection attempt
+uint8_t reconnectAttempts = 0;
+uint32_t lastReconnectMs = 0;     // Disconnect to playable time of the last outage
+uint32_t maxReconnectMs = 0;
+uint16_t reconnects = 0;
+LEDstruct savedColors;            // What the LEDs showed before the offline animation took over
+
+// Broker failover
+BrokerList brokerList;
+int8_t pendingBroker = -1;        // Switch requested from inside a message callback, applied by checkFailover()
+bool transportBenchPending = false; // Requested from inside a message callback, it drives client->loop() itself
+unsigned long lastProbe = 0;
+OfflineTouch offlineTouches[OFFLINE_QUEUE_SIZE];
+uint8_t offlineCount = 0;
 
 const char* timeZone = "PST8PDT,M3.2.0,M11.1.0"; // Set your timezone, e.g., "PST8PDT,M3.2.0,M11.1.0" for Pacific Time
 
@@ -142,41 +358,145 @@ char MQTTp[] = MQTT_PASSWORD;
 char mqttuser[] = "green1green1green1"; 
 char deviceID[18];
 char deviceChannel[40];    
+char mqttClientID[24];     // fungers-<deviceID>, stable so the broker can resume our persistent session
+char room[25];             // Game room this device plays in, empty for the legacy fleet-wide topic
+char eventTopic[64];       // funger/rooms/<room>/events, or funger/events/ when no room is assigned
+char traceChannel[48];     // funger/device/<id>/trace, receives sampled touch latency breakdowns
+char logChannel[48];       // funger/device/<id>/logs
+char summaryTopic[48];     // funger/device/<id>/summary, periodic mergeable telemetry
+char roomConfigTopic[64];  // Retained config of the room
+char staleRoom[25];        // Room left while offline, still subscribed in the broker's persistent session
+bool roomStale = false;    // staleRoom is set, unsubscribed on the next connect
+char deviceConfigTopic[48]; // Retained config of this device
+uint32_t tracesSeen = 0;   // Number of traces considered for sampling
 char FW_Version[] = "1.0.6";
 char HW_Version[]  = "1";
 
 void IRAM_ATTR touchEvent(void);
+void pollTouchGestures();
+void onTouchGesture(TouchGesture gesture, uint32_t at, uint32_t duration);
+void sendGesture(const char* gesture, uint32_t at, uint32_t duration);
 void display(struct LEDstruct);
 void setLEDColors(uint8_t, uint8_t, uint8_t, uint8_t);
-void sendJSON(const JsonDocument&, const char*);
+LEDstruct scaledColors(uint8_t red, uint8_t blue, uint8_t green, uint8_t white);
+uint64_t epochMicros();
+bool armGo(uint64_t at, uint32_t round);
+void goTimerFired(void* arg);
+void goTriggered();
+bool sendJSON(const JsonDocument&, const char*, uint8_t lane = LANE_CONTROL);
+void sendGameEvent(JsonDocument& json);
+void recieveLanEvents(const char* msg, size_t length);
 bool fetchOTA(const String& HOST, bool persist = true);
+bool startOtaSession(JsonDocument& json);
+void receiveOtaChunk(const char* msg, size_t length);
+void writeOtaChunk(const uint8_t* data, size_t len);
+void otaSessionLoop();
+void requestOtaChunks(bool stalled);
+void endOtaSession(bool success);
 void syncNTP();
 void colorBars();
-void calcCurrentTimeMillis();
 void printCurrentTimeMillis();
-void removeColons(char*);
+uint64_t epochMillis();
+void publishTrace(const TouchTrace&);
+void closeRound();
+void recieveEvents(const char* msg, size_t length);
+void publishStats();
+void publishSummary();
+void publishProfile();
+void loadPlayerStats();
+void publishPlayerStats();
+void publishLeaderboard();
+void startSummaryWindow();
+void scheduleReconnect();
+void startTransport();
+void probeBrokers();
+void checkFailover();
+void switchBroker(uint8_t index);
+bool queueTouch(const char* device, unsigned long delta, const TouchTrace& trace, unsigned long now);
+void startSessionDump(bool serial);
+void loadConfig();
+void useConfig();
+void saveConfig();
+bool applyConfig(JsonDocument& json, uint8_t scope, uint32_t version);
+int8_t configField(JsonDocument& json, const char* key, uint16_t bit, uint8_t scope, uint16_t& fields, long low, long high, long& value);
+void receiveConfig(const char* msg, size_t length, uint8_t scope);
+void receiveRoomConfig(const char* msg, size_t length);
+void receiveDeviceConfig(const char* msg, size_t length);
+void dumpSessionPart();
+void reportSessionReplay();
+void runBenchmarks(bool saveBaseline);
+void runTransportBench();
+void decideRound();
+void storeOfflineTouch();
+void replayOfflineTouches();
+bool setRoom(const char* newRoom, bool persist = true);
+void roomTopics(const char* name, char* events, char* config);
 void startProvisioningAP();
 void handleSave();
+void handleStatus();
 void handleRoot();
-float cubicEaseInOut(float t);
-int interpolate(int start, int end, float t);
+void onProvisionWifiEvent(arduino_event_id_t event, arduino_event_info_t info);
+void provisionLoop();
+void failProvisioning(const char* reason);
+void finishProvisioning();
+void buildDeviceTopics();
+void startGame();
 void hsvToRgb(float h, float s, float v, float& r, float& g, float& b);
 void handleNotFound();
 void factoryReset();
 void sendLog(const String& log, int msgLevel = INFO);
-String getMacAddress();
+void sendLog(const char* log, int msgLevel = INFO);
+void sendLogf(int msgLevel, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void writeLog(const char* entry, int msgLevel);
+void getMacAddress(char* mac);
+int32_t heapBlocks();
 std::vector<NetworkInfo> scanNetworks();
 
 // HTML page served for Wi-Fi provisioning
 
 const char* psavePage = R"rawliteral(
-        "text/html",
-        "<html><body>
-        <h3>Credentials saved!</h3>"
-        "<p>Rebooting...</p>
-            <img class="center" src="data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAAH0AAAB9CAMAAAC4XpwXAAACslBMVEVHcEwsKzAXGicnJywZHCcaHCg1MzheW1tMSkolJSwtLTIaHCcYGye9s6klJSsvMDUbHCcnJi0+Oz8cHSceHychISkaHCcjIysiIysaHCgeICkpKS8dHigeHiYvLzQgISkhICgcHSchISoZGydza2gcHSggICgfICgWFiAZGycrKzAeHyoaGyeEungaHCdevUa4vqlNwjBJwyxavEJOwDJMwzBcvEJIxihWwD1euktUvzlJxSpNwDD/uGj/t2f+WyoYGyj+uGj/t2j/XCoXGyX+Wir/WyoYGSj/WioYGSUUGSUVGicUFyX/XSsbGSX+uGf/uGr9XCpjLiYzICX3Wy0qHCP/zYUdHCT/umsiISX+vG4gGSNT0SMrHiRIJiX+kTYkHCTyWi5RKCX/umg8IyX+tmaIOiktJieRPSn9uWnPUCyhQipZKyX5XS3uWSzVUizITyz+yX+XPyp7NifqWS39WTA6SFDCTCzhVixXSTqoRCqtRyu6Siz+s2NyMyY1Ly2ySCz+sF/9o1H1j0LeUixHxiQzPkj7uGtnQyr1xYI7KyXnVi78rFtjUT8oLzr/xHj+wHJqMCb7qFX7n0lONCdKOzLihTkuN0E7tyEcICyJbUv5lj/0tm3rr2hsVkA+MiTbVS6TcU7XoWL0smnFlFtZ0ydRQjX8mkEfJTOpf1K0i1luTCrfqGXVfjhzXEJRziV9Y0g4Q00aLSS2oxnjuXy8cTSuhFWpZTNzZRgXJyTUrXSZeVIqZSKulRizlGhPRh0peiNBqiQmVyMfRyK46FTmrGegh1/An27um1T6ZjfJeTaEUy1bPSnEdDXcjUPXwBaejxZ31zT3gkr0wHmwcTvPmVyOWi8tmiAzhyQ/vyD3e0SbfBnDrhlBmyja7mPNeznOohXnrRb4cj3p0BQaNSLmbj+0p1BoAAAAPXRSTlMAFv0c4c8RBAdOKuf6AUUj1jsMwnmA3FmX658yq6NYj3G5YfcCymmGf/Fps/QF7xsCpb4vdLAi2lENP+6LXR4VSwAAEgRJREFUaN7smelPG+kZwM2REMDhCOEMWZMQQGkIhEA2p0fzjkYaeWaUsbpb7HEhjuJOpyP1Qy0VtXxwLdtFdogtkG0s1sZQsAFxI8ShQBqR+46U+6iSlVbb/6PvzBhCuu2X4PGnPLJsGGv0e5/7ecYq1Vf5Kl/lq/w/2bmvtLa29pucPalHZxVqasrVFIWqc4uq8lMMzykrJ2idged5A0niBbUp1T97B0XxncPXV1dXJ8NjP5DqiozUwUvLKYPv3uVWaw8U6+LdPh1+JGX4vFyKX7vc2mMSBMBgemPPqg8/X7kzNfCMGoK922rtFQDQYhiAJzBFfVR6XVZK6MUoHrZaTXqoNwDwBT+N02NUQ3ZKVC8g+xatJkQrClRf+jDG7VRRWipCTo3ebe1ltFsFA+5hHN+bAnoZbl+1Cp/RAYYId/qoEuWrzq4DdOflXuhuRjoAkFUXGOOEAVVe+bQCetBqgtGOMJjAwLATD8EIjCU6RtUo7vn8THreahQV1muNemh0SfmBO1HTmqFa8bDPyaXDVkGrhdk+PTkZZfQi3R22902M2ImKQ8rrHrbqoactr/oM7RNGINM77ezyIFmSobzfoeX1en2sk52fvINJugP3wMjg2oShulTpmaIGRp1IvzM27DbCuJNTDhMGBkbsqEb5jPNdhnQtNz2AMYKAJOiw5Mc6qSKFe01WJaSbtHqAwRdIJLxWrzdatMZhXW6OsvRD+2G1MUklBoBYVJDoiBBdW44ZJ1l1aSroMMv1DBOd7ZsU8QAIwzi7bJm2U8XK0ndv0BkEFld6LCr5faCTpAfdsTFqv8JdPkGHdhfCNGGflvweg3SfW5gld6SlwvLiWGEM6yBdzD7BPUjTs27Tmi4zX2k6jHkRzsEog5aHcL3bGO/riztcK+cbCpXPdxMQbK73z++HO+MChGMMcEej3p86/vKbdGWDPm0HPWs1Ydzz7zs6HjgH3HpJd8v08LSro+Pv36FVCvc4ctgqAO+DDiiukdm4kWE4zBS/uCbSf6dwyhXWG65bBUGmP/fRswNGKAPD7KT/QceVC5Sylf4gyt7rgW5/DuEP7ncSbOdEPD7hY30x4Hz/7yBRqWjCayj7Yg9sLw7XT++dxmUDReMsa6DZSaMb2GI++sAu5YdKsbnYOMEYZ7+71E5QKMrGLbD+GWdpRbtcfiYZbjVtTNL66aHf//lPf7hAEH13xAumMN1QqSnNUcr62Wox6Da3CPf8pSsdHf+4QM+7xX+NYZqkKXVmRaEyA14ZCd0u7U/iWMHoR4b+9tfvr/zRPmIRbWGJD/rghEei5XU7lak1g6LbN00vTA5d+PWl7mUgHgZed7sHVq/P8jRaqcCAmV1tuCtN8xsrFCeMhH3zcXdixhEvWXpf3Osk0OQv9Fn7CTHfNkhauMsAi+CGmw2zaQ89QEDv4uD59KTvVftyyXlY5DdIQFqlAAL7Lba5ViJawCCmxTEyc594y7EzZ3Ynaa7RoPw9q1ur37S8FHzSWCsulYkTAAZgvddZebxuPHn8dJJUzyQGpanqc0G0CBQ4UnOJrxAGMC98dIEYeKe6mo4mp85VULDG67W/wEMeApUXpEPIzsdgEZaWynNdLclR/ZvD5OxlEyMA5r/AUFl4KTbiTpQB6BGgHbFTdSrV6eNnm6Wbjx7b7rMqyr7aA36ptzhSw8sTU7GtVoFj7pFdquazstu/bWrZngP2ouiaVQD/y+yCEH319PFjP6PdtD3inteV5Ktaus5J8OPbdH9OCTm2aPoU73K0y3a3PfXwvOHxfW7T8whmWTYcLlQ1dZ2S4Scat/eYDmev9+gB+OTuDRSw3feQOEF0P7UBBhOrAfyC0b7iiSpVS1NjMuBpNXTniy01Vg43UXEM+Gd4qqIsvf1Hv5jqmBQHiDbaR1QcO3o6GXBVXr3h7mZ7AZLZJbvDOscFnrDq7Jxyw0qAA0CsvjZ/IOC3DZI1Yq0/dG7bcFUxJS1NyIbLN+wPCy0XmOGJuj1FpCficCOMwPnHA16H3zZhkHeLU+e2C991hBqLMQj2iY4k6Aikux5TO9KKqe6QE0MwzhlxWFtbW3tgxm/tNEe/bf7Smpu2g5w3YhiyJeSg+TEOAZDuNK9cVJcWHjasjDsA5oh4WyWBxbYo8aPF0cYzLSdOnj31xc+G8WELgslVXe5k4hE4N9znMK85FNRV7oSmdzkx4Ij0yvTWCUO51OdUzU0nu7q6TjY1f+k0WaIb1iLYJ6/LbxiwOWC6R8yv8cz8Wrz9ybiNsY2bEvQRPv2gdPepsydPtJxp/OJ6I9L1m6VEMr4Y9hjihzwuYF66WJ2XUUBMQeUxZ8LyrQNjZJ1s+ObGbVW6tAJq2AidLJUYKd3Ed4xj/C6/nnGaZ3j0V6q9OLsU8Qq2gGx6K6QnZ7HaU0QPcgzQbqVLfy2vBDDBbw7xcHvN2IEHQ+MOzOEV8dbeV3yylkoNOXRfi4nAjcCHJ+AQbDYY4aDlH7aj0MWl9bgnNO7FOM7UaxL8Pl2ynhtnV7MvHSKdYSQ6JnkdiY0FXZzXbF4x1OfBqlCXbvD8GHF6HQ6H/+mUAVUfyE7KXpdWQ8BShjEiH0hGx8T0H+GDLmfE7PLIv0zsLEvHux8thUJPH74eOk/iOrS+LCmTdVU6uzLu5TBRZJ9jMNde/tbjMpvNS+1ombQ8HawmaF1791A3qyPwW+s3FyhCkwzt04qo7pmI0wEnK6mNcxjgvBEP/RrCZ4KUPD/nFxA/31rAKZrEr95av9H/7sMtvD4pvs8+TARnzJBvk3oLYvMGIkvt/EOz+WFQp66SpvZi4urb/jfr165dW38D2c9uP7vxM1GZDOXzMwkq+ARqOh5wQgmMizqTntDDRzyl1uyRuwFxs79rrutdf3//u6650dsfb4+uo0n5zQDSUYJ/HTJviGspSKHdQzxOlBfL3aTwML7eP9fW1jY3J7633f748dmHqw37kkDPKEH7uuH89OhJCAaaK/RkiidQFKfQ8so8KeKy8o4QV99I9IQ8uw1Nv5BeWbj9ZSqrggq+9LA0yXY/nprywKhGCzQV+zW1hbJfd1c1EMTCZ/S20dHR/gWCyE3CM8S8hvNToSUPbyBpmiZRtF6To9p9aMuKSbA6GHRto1vwbXMfrhp4PHP7xj8kVrIZ18zKI08wyKKo5vPHM3upoX910ws3396AgQexbXNd/Tfe3lwgh/45RCRhnd5TpkZFt4dmoAf+06659CaOZXE8PPMiBMgT8igSmjwqmai+gS0Zv3Bs6dpGVmQZGYQoBBgQUEUEiGERZdGRIrEqZVUsI/UqU5u0NFGk7g9Qve9edKvng8y5JmlNV41ITVftpv6KiDG2f/ece86599pOLLg+eGSSvP/t7v7kWPj+Xz/+ADn3zx9+/Mf3wvHJ/bvf79nIF1hGh6JugTdefgt97tz64BHM5Bap3f76293t/d9PtIQt7eTt/e2739/fnghf5jbe2rPAoc/pO1qIfli+gX5Ffvvdz7++f//Lu7ufQHfvfoHtu9u3V9eJ+Be6j+Lwbz6PPvcHg9PTK9Ho4t6zVaxne0vL5OXlNam9vL+9/ekd1t3Pt9+9fXlyfXl+Tga+wDOL0Iw/urpxEF+eDe8f+nzOBEmykPMg+/PyzZtL0PX11QnW1dX19eWb85vXr8/Jz39mEVpcCMcSIxrGPm79IWC9wbSbm3OsmxsAY51fs59v+7znEZNIkP9VV9jW13/WzfnlFXn0/LNjfm4muu4JHzrJj4wWBFJ48D5uwBvbbnAA9MT1NUn64ptf5M7tpGPGv7L4LHKwBX0/Gz6KxXzOP9rgix2Gw7FRG2zBBs/G3Afbf8Htc1Mhr2N+Jhj8+Ny5ySmva2ZmLej3T688f9SK37+2Nr27seVxz9pye7YiS9PzfyHVXdurWwuegDt8dOTZnvvfWu11zc9gzTs+Ak96Hd6nW+P3kIKeMgxFSee0Wb/L5cLnTDkcIfsKDns8DzkeLzU5P729vbJm7/W6RnJAXzuCm7B/+vENQMf2ejzg2doNTj1xf0rP5ju1YvXs7GIo87PL7uWN+bmVA49nYXd6Iw7/tqcm/Fsej2fdPzfxTTCy7GNJZ/hgenJqJ77sdsMfnBFc9Bw5QfgNQOi+uem4UzIMw+SPNtbGPwRID0UKxHCMWOA1RTH59c2wlIJTY7xpGPrhtiuALyW5g6GlMGtke72yIu0vPT/UlQdJRz4zLfd6PTmnJxbWJrbDUrrQqhb7jZwU8I+bPidlleNogiYIWqxLjeqwoxy6pUGr2Mkls91iMa97or5yrViThdVVZ6pXa1pqppo3fGF88NnZ8GxYS7Nm/UK1VDVz2k5Lnp1ZrTFEDGJEqyonxj2/2RFGdAocIOaNmkhlygJrtkTKko/zIiNWsj43W4CNkr7vU9oqQ9Acg6y2SZotiuIYkDU4Vs5gP6JpDlXTQkzqVWAb7KHFrjluqrniLGc4jqsUa91OIWdURaQOkqxRo1BGPi6IxCuxrZNsgUJAJ1NtBBACWktVFdYoikBgGMoaJHOn6BWNEILvfVNQigzAERxs5aVx0+xNm870lZSpSwmligh1wCaMGkOrchLoCDWzAg8bYkmSGhl80UoFUVaDBDpDE81qtdpKC7lThqjkG32VoCvlZBmOQ6eFRqfZN/bHLTE2nVmgU21JYGFYUaoMZw1YIVWjCBXbDm6hSho7oitVChGVejZbGpZSJAl0wmpA0BkJIXfBMKc5wWhxiGgkByq0ss4nzKzCr06Op1fA9lpZ7jXSAlyfsWQBe35EZwDfzILt2PP4olZBZ5OSYgojOu6mhCABnQJ6gq0zNJU/LlcgAvoKywq+jbG1d2Q7p2ZU1eromK7+Jx1+4qDnbdv1EoUQGGjm0qCcZtO7hXpd1oS0bXsy1RJp1BCUGodotSXr7BNvQY7o0JsEElsmhC7zEHUjOkQYgZrlEb1D0UzXFMrD5kWzOUxjOoEgVVopId1kiGYvW1IJopJl+UETp1GllJbc/k+wHbKDQDYdWQOBhH5nMJ2CGFMR6ndsepciqL6e7FlQmSAhjSpOAATdlmIxHWUgzxDTTbGk1rtAkG8I0t0z/wm2Q6XI1CWbLmO6aNtOgdu70BDIcrGu9zFdE3oWxdCc1cN0fJ4K/sB0ggB/08MyLAJZqdxVIevQMEsuPUVnmGpPlsuKgOnqA93Od0TVyxVEgPupgt4GOvZyv3tKPNDVkjyQ0yyfbnIErdKIOLXhEG9Go0rTNNXWxr0aM8p3qiM5nbF9pzKkkNVLCkbx0fNi3QSTcf/m+bpIMBdpgTRTbYq2BnbUyUkB5ju25yv5IvyeFcgEKWmswKer4KIzZdwbWQ/53tHim/7pZShfBILK08sgBhKtLtKQ5uUK0AkxfyxnoJi1DV7IFSkILlxt1IGu6bqEPQ8x37AIom1Ct+dLZV0wuxRNXOTCa0/brh+8mAgtaBBehFpsAU+sGVIJl3cJjIdRSMwnlSJF02q30WiBj6uKgb8W+6CGBp4Hem7IEWA8KzfRRbtRr3A0M3zCdrvSAn0S35qXMxwEsQgBqzYEqW2XONgJIwukMdvLQG4wKs5PK89j218hPDq3zBFdKyEOtXWjBSWYgboPB7e1cYublUfb1/+Gl8YmjCO4ljNWxyDBEzRVknioIRymk2Yd6jj+maO6eJTBAcHRNPNIT0KRg9JotETcVzjoTsfHPKZDwShJ+BWSF0tOpZ3BY22lpDhjWt2y1HziyDloWlZT9i3EUvlTi0IMpXZzrNPsiAy2nBP7Zm4oikWFTXVFGKf5dB8uAkOvOOxpY/M9uK8U2u16ll3FE0rvBmnK9U6nLpvOyK5TGTQGxv5OQIP5jGwury0daulCv9YqDQxyPULm8g/KspoMn1JMSufrhTQrpeRS7fS0VodaN7bUhiIJCYI2ERhFpndplmV1nWXdS17vRkxI8IeR0IrbySaFcHRuasXjlHQjpfPhXa9rK8HyPC/wfJIMzLIJXoivxCVe4tmF3WVWMnI5Q3Iu+J9Yqe6sbkRWFx8D85uZxcjWViQ6A64I+Rf3Fv0hWNrs7O1Fg5P29DsSXw4cLOEvju29B+241hbhiPmJ+Z3d3d2oawLWQgG3O7D+CauLuckXf5rGv5iaGvMg94XX5fiEVcOUYzTT/qqv+qqv+qr/L/0bMKZE3r8nIPgAAAAASUVORK5CYII=" />
-        </body></html>"
-    )rawliteral";
+<!DOCTYPE HTML>
+<html lang="en">
+<head>
+  <meta charset="UTF-8" />
+  <meta name="viewport" content="width=device-width, initial-scale=1.0"/>
+  <title>Fungers WiFi Setup</title>
+  <style>
+    body { background: #FFFDF9; color: #232323; font-family: 'Poppins', sans-serif; font-weight: 600; text-align: center; padding: 1rem; }
+    .center { display: block; margin-left: auto; margin-right: auto; width: 50%; }
+    .ok { color: #4CAF50; }
+    .fail { color: #FF5722; }
+  </style>
+</head>
+<body>
+  <img class="center" src="data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAAH0AAAB9CAMAAAC4XpwXAAACslBMVEVHcEwsKzAXGicnJywZHCcaHCg1MzheW1tMSkolJSwtLTIaHCcYGye9s6klJSsvMDUbHCcnJi0+Oz8cHSceHychISkaHCcjIysiIysaHCgeICkpKS8dHigeHiYvLzQgISkhICgcHSchISoZGydza2gcHSggICgfICgWFiAZGycrKzAeHyoaGyeEungaHCdevUa4vqlNwjBJwyxavEJOwDJMwzBcvEJIxihWwD1euktUvzlJxSpNwDD/uGj/t2f+WyoYGyj+uGj/t2j/XCoXGyX+Wir/WyoYGSj/WioYGSUUGSUVGicUFyX/XSsbGSX+uGf/uGr9XCpjLiYzICX3Wy0qHCP/zYUdHCT/umsiISX+vG4gGSNT0SMrHiRIJiX+kTYkHCTyWi5RKCX/umg8IyX+tmaIOiktJieRPSn9uWnPUCyhQipZKyX5XS3uWSzVUizITyz+yX+XPyp7NifqWS39WTA6SFDCTCzhVixXSTqoRCqtRyu6Siz+s2NyMyY1Ly2ySCz+sF/9o1H1j0LeUixHxiQzPkj7uGtnQyr1xYI7KyXnVi78rFtjUT8oLzr/xHj+wHJqMCb7qFX7n0lONCdKOzLihTkuN0E7tyEcICyJbUv5lj/0tm3rr2hsVkA+MiTbVS6TcU7XoWL0smnFlFtZ0ydRQjX8mkEfJTOpf1K0i1luTCrfqGXVfjhzXEJRziV9Y0g4Q00aLSS2oxnjuXy8cTSuhFWpZTNzZRgXJyTUrXSZeVIqZSKulRizlGhPRh0peiNBqiQmVyMfRyK46FTmrGegh1/An27um1T6ZjfJeTaEUy1bPSnEdDXcjUPXwBaejxZ31zT3gkr0wHmwcTvPmVyOWi8tmiAzhyQ/vyD3e0SbfBnDrhlBmyja7mPNeznOohXnrRb4cj3p0BQaNSLmbj+0p1BoAAAAPXRSTlMAFv0c4c8RBAdOKuf6AUUj1jsMwnmA3FmX658yq6NYj3G5YfcCymmGf/Fps/QF7xsCpb4vdLAi2lENP+6LXR4VSwAAEgRJREFUaN7smelPG+kZwM2REMDhCOEMWZMQQGkIhEA2p0fzjkYaeWaUsbpb7HEhjuJOpyP1Qy0VtXxwLdtFdogtkG0s1sZQsAFxI8ShQBqR+46U+6iSlVbb/6PvzBhCuu2X4PGnPLJsGGv0e5/7ecYq1Vf5Kl/lq/w/2bmvtLa29pucPalHZxVqasrVFIWqc4uq8lMMzykrJ2idged5A0niBbUp1T97B0XxncPXV1dXJ8NjP5DqiozUwUvLKYPv3uVWaw8U6+LdPh1+JGX4vFyKX7vc2mMSBMBgemPPqg8/X7kzNfCMGoK922rtFQDQYhiAJzBFfVR6XVZK6MUoHrZaTXqoNwDwBT+N02NUQ3ZKVC8g+xatJkQrClRf+jDG7VRRWipCTo3ebe1ltFsFA+5hHN+bAnoZbl+1Cp/RAYYId/qoEuWrzq4DdOflXuhuRjoAkFUXGOOEAVVe+bQCetBqgtGOMJjAwLATD8EIjCU6RtUo7vn8THreahQV1muNemh0SfmBO1HTmqFa8bDPyaXDVkGrhdk+PTkZZfQi3R22902M2ImKQ8rrHrbqoactr/oM7RNGINM77ezyIFmSobzfoeX1en2sk52fvINJugP3wMjg2oShulTpmaIGRp1IvzM27DbCuJNTDhMGBkbsqEb5jPNdhnQtNz2AMYKAJOiw5Mc6qSKFe01WJaSbtHqAwRdIJLxWrzdatMZhXW6OsvRD+2G1MUklBoBYVJDoiBBdW44ZJ1l1aSroMMv1DBOd7ZsU8QAIwzi7bJm2U8XK0ndv0BkEFld6LCr5faCTpAfdsTFqv8JdPkGHdhfCNGGflvweg3SfW5gld6SlwvLiWGEM6yBdzD7BPUjTs27Tmi4zX2k6jHkRzsEog5aHcL3bGO/riztcK+cbCpXPdxMQbK73z++HO+MChGMMcEej3p86/vKbdGWDPm0HPWs1Ydzz7zs6HjgH3HpJd8v08LSro+Pv36FVCvc4ctgqAO+DDiiukdm4kWE4zBS/uCbSf6dwyhXWG65bBUGmP/fRswNGKAPD7KT/QceVC5Sylf4gyt7rgW5/DuEP7ncSbOdEPD7hY30x4Hz/7yBRqWjCayj7Yg9sLw7XT++dxmUDReMsa6DZSaMb2GI++sAu5YdKsbnYOMEYZ7+71E5QKMrGLbD+GWdpRbtcfiYZbjVtTNL66aHf//lPf7hAEH13xAumMN1QqSnNUcr62Wox6Da3CPf8pSsdHf+4QM+7xX+NYZqkKXVmRaEyA14ZCd0u7U/iWMHoR4b+9tfvr/zRPmIRbWGJD/rghEei5XU7lak1g6LbN00vTA5d+PWl7mUgHgZed7sHVq/P8jRaqcCAmV1tuCtN8xsrFCeMhH3zcXdixhEvWXpf3Osk0OQv9Fn7CTHfNkhauMsAi+CGmw2zaQ89QEDv4uD59KTvVftyyXlY5DdIQFqlAAL7Lba5ViJawCCmxTEyc594y7EzZ3Ynaa7RoPw9q1ur37S8FHzSWCsulYkTAAZgvddZebxuPHn8dJJUzyQGpanqc0G0CBQ4UnOJrxAGMC98dIEYeKe6mo4mp85VULDG67W/wEMeApUXpEPIzsdgEZaWynNdLclR/ZvD5OxlEyMA5r/AUFl4KTbiTpQB6BGgHbFTdSrV6eNnm6Wbjx7b7rMqyr7aA36ptzhSw8sTU7GtVoFj7pFdquazstu/bWrZngP2ouiaVQD/y+yCEH319PFjP6PdtD3inteV5Ktaus5J8OPbdH9OCTm2aPoU73K0y3a3PfXwvOHxfW7T8whmWTYcLlQ1dZ2S4Scat/eYDmev9+gB+OTuDRSw3feQOEF0P7UBBhOrAfyC0b7iiSpVS1NjMuBpNXTniy01Vg43UXEM+Gd4qqIsvf1Hv5jqmBQHiDbaR1QcO3o6GXBVXr3h7mZ7AZLZJbvDOscFnrDq7Jxyw0qAA0CsvjZ/IOC3DZI1Yq0/dG7bcFUxJS1NyIbLN+wPCy0XmOGJuj1FpCficCOMwPnHA16H3zZhkHeLU+e2C991hBqLMQj2iY4k6Aikux5TO9KKqe6QE0MwzhlxWFtbW3tgxm/tNEe/bf7Smpu2g5w3YhiyJeSg+TEOAZDuNK9cVJcWHjasjDsA5oh4WyWBxbYo8aPF0cYzLSdOnj31xc+G8WELgslVXe5k4hE4N9znMK85FNRV7oSmdzkx4Ij0yvTWCUO51OdUzU0nu7q6TjY1f+k0WaIb1iLYJ6/LbxiwOWC6R8yv8cz8Wrz9ybiNsY2bEvQRPv2gdPepsydPtJxp/OJ6I9L1m6VEMr4Y9hjihzwuYF66WJ2XUUBMQeUxZ8LyrQNjZJ1s+ObGbVW6tAJq2AidLJUYKd3Ed4xj/C6/nnGaZ3j0V6q9OLsU8Qq2gGx6K6QnZ7HaU0QPcgzQbqVLfy2vBDDBbw7xcHvN2IEHQ+MOzOEV8dbeV3yylkoNOXRfi4nAjcCHJ+AQbDYY4aDlH7aj0MWl9bgnNO7FOM7UaxL8Pl2ynhtnV7MvHSKdYSQ6JnkdiY0FXZzXbF4x1OfBqlCXbvD8GHF6HQ6H/+mUAVUfyE7KXpdWQ8BShjEiH0hGx8T0H+GDLmfE7PLIv0zsLEvHux8thUJPH74eOk/iOrS+LCmTdVU6uzLu5TBRZJ9jMNde/tbjMpvNS+1ombQ8HawmaF1791A3qyPwW+s3FyhCkwzt04qo7pmI0wEnK6mNcxjgvBEP/RrCZ4KUPD/nFxA/31rAKZrEr95av9H/7sMtvD4pvs8+TARnzJBvk3oLYvMGIkvt/EOz+WFQp66SpvZi4urb/jfr165dW38D2c9uP7vxM1GZDOXzMwkq+ARqOh5wQgmMizqTntDDRzyl1uyRuwFxs79rrutdf3//u6650dsfb4+uo0n5zQDSUYJ/HTJviGspSKHdQzxOlBfL3aTwML7eP9fW1jY3J7633f748dmHqw37kkDPKEH7uuH89OhJCAaaK/RkiidQFKfQ8so8KeKy8o4QV99I9IQ8uw1Nv5BeWbj9ZSqrggq+9LA0yXY/nprywKhGCzQV+zW1hbJfd1c1EMTCZ/S20dHR/gWCyE3CM8S8hvNToSUPbyBpmiZRtF6To9p9aMuKSbA6GHRto1vwbXMfrhp4PHP7xj8kVrIZ18zKI08wyKKo5vPHM3upoX910ws3396AgQexbXNd/Tfe3lwgh/45RCRhnd5TpkZFt4dmoAf+06659CaOZXE8PPMiBMgT8igSmjwqmai+gS0Zv3Bs6dpGVmQZGYQoBBgQUEUEiGERZdGRIrEqZVUsI/UqU5u0NFGk7g9Qve9edKvng8y5JmlNV41ITVftpv6KiDG2f/ece86599pOLLg+eGSSvP/t7v7kWPj+Xz/+ADn3zx9+/Mf3wvHJ/bvf79nIF1hGh6JugTdefgt97tz64BHM5Bap3f76293t/d9PtIQt7eTt/e2739/fnghf5jbe2rPAoc/pO1qIfli+gX5Ffvvdz7++f//Lu7ufQHfvfoHtu9u3V9eJ+Be6j+Lwbz6PPvcHg9PTK9Ho4t6zVaxne0vL5OXlNam9vL+9/ekd1t3Pt9+9fXlyfXl+Tga+wDOL0Iw/urpxEF+eDe8f+nzOBEmykPMg+/PyzZtL0PX11QnW1dX19eWb85vXr8/Jz39mEVpcCMcSIxrGPm79IWC9wbSbm3OsmxsAY51fs59v+7znEZNIkP9VV9jW13/WzfnlFXn0/LNjfm4muu4JHzrJj4wWBFJ48D5uwBvbbnAA9MT1NUn64ptf5M7tpGPGv7L4LHKwBX0/Gz6KxXzOP9rgix2Gw7FRG2zBBs/G3Afbf8Htc1Mhr2N+Jhj8+Ny5ySmva2ZmLej3T688f9SK37+2Nr27seVxz9pye7YiS9PzfyHVXdurWwuegDt8dOTZnvvfWu11zc9gzTs+Ak96Hd6nW+P3kIKeMgxFSee0Wb/L5cLnTDkcIfsKDns8DzkeLzU5P729vbJm7/W6RnJAXzuCm7B/+vENQMf2ejzg2doNTj1xf0rP5ju1YvXs7GIo87PL7uWN+bmVA49nYXd6Iw7/tqcm/Fsej2fdPzfxTTCy7GNJZ/hgenJqJ77sdsMfnBFc9Bw5QfgNQOi+uem4UzIMw+SPNtbGPwRID0UKxHCMWOA1RTH59c2wlIJTY7xpGPrhtiuALyW5g6GlMGtke72yIu0vPT/UlQdJRz4zLfd6PTmnJxbWJrbDUrrQqhb7jZwU8I+bPidlleNogiYIWqxLjeqwoxy6pUGr2Mkls91iMa97or5yrViThdVVZ6pXa1pqppo3fGF88NnZ8GxYS7Nm/UK1VDVz2k5Lnp1ZrTFEDGJEqyonxj2/2RFGdAocIOaNmkhlygJrtkTKko/zIiNWsj43W4CNkr7vU9oqQ9Acg6y2SZotiuIYkDU4Vs5gP6JpDlXTQkzqVWAb7KHFrjluqrniLGc4jqsUa91OIWdURaQOkqxRo1BGPi6IxCuxrZNsgUJAJ1NtBBACWktVFdYoikBgGMoaJHOn6BWNEILvfVNQigzAERxs5aVx0+xNm870lZSpSwmligh1wCaMGkOrchLoCDWzAg8bYkmSGhl80UoFUVaDBDpDE81qtdpKC7lThqjkG32VoCvlZBmOQ6eFRqfZN/bHLTE2nVmgU21JYGFYUaoMZw1YIVWjCBXbDm6hSho7oitVChGVejZbGpZSJAl0wmpA0BkJIXfBMKc5wWhxiGgkByq0ss4nzKzCr06Op1fA9lpZ7jXSAlyfsWQBe35EZwDfzILt2PP4olZBZ5OSYgojOu6mhCABnQJ6gq0zNJU/LlcgAvoKywq+jbG1d2Q7p2ZU1eromK7+Jx1+4qDnbdv1EoUQGGjm0qCcZtO7hXpd1oS0bXsy1RJp1BCUGodotSXr7BNvQY7o0JsEElsmhC7zEHUjOkQYgZrlEb1D0UzXFMrD5kWzOUxjOoEgVVopId1kiGYvW1IJopJl+UETp1GllJbc/k+wHbKDQDYdWQOBhH5nMJ2CGFMR6ndsepciqL6e7FlQmSAhjSpOAATdlmIxHWUgzxDTTbGk1rtAkG8I0t0z/wm2Q6XI1CWbLmO6aNtOgdu70BDIcrGu9zFdE3oWxdCc1cN0fJ4K/sB0ggB/08MyLAJZqdxVIevQMEsuPUVnmGpPlsuKgOnqA93Od0TVyxVEgPupgt4GOvZyv3tKPNDVkjyQ0yyfbnIErdKIOLXhEG9Go0rTNNXWxr0aM8p3qiM5nbF9pzKkkNVLCkbx0fNi3QSTcf/m+bpIMBdpgTRTbYq2BnbUyUkB5ju25yv5IvyeFcgEKWmswKer4KIzZdwbWQ/53tHim/7pZShfBILK08sgBhKtLtKQ5uUK0AkxfyxnoJi1DV7IFSkILlxt1IGu6bqEPQ8x37AIom1Ct+dLZV0wuxRNXOTCa0/brh+8mAgtaBBehFpsAU+sGVIJl3cJjIdRSMwnlSJF02q30WiBj6uKgb8W+6CGBp4Hem7IEWA8KzfRRbtRr3A0M3zCdrvSAn0S35qXMxwEsQgBqzYEqW2XONgJIwukMdvLQG4wKs5PK89j218hPDq3zBFdKyEOtXWjBSWYgboPB7e1cYublUfb1/+Gl8YmjCO4ljNWxyDBEzRVknioIRymk2Yd6jj+maO6eJTBAcHRNPNIT0KRg9JotETcVzjoTsfHPKZDwShJ+BWSF0tOpZ3BY22lpDhjWt2y1HziyDloWlZT9i3EUvlTi0IMpXZzrNPsiAy2nBP7Zm4oikWFTXVFGKf5dB8uAkOvOOxpY/M9uK8U2u16ll3FE0rvBmnK9U6nLpvOyK5TGTQGxv5OQIP5jGwury0daulCv9YqDQxyPULm8g/KspoMn1JMSufrhTQrpeRS7fS0VodaN7bUhiIJCYI2ERhFpndplmV1nWXdS17vRkxI8IeR0IrbySaFcHRuasXjlHQjpfPhXa9rK8HyPC/wfJIMzLIJXoivxCVe4tmF3WVWMnI5Q3Iu+J9Yqe6sbkRWFx8D85uZxcjWViQ6A64I+Rf3Fv0hWNrs7O1Fg5P29DsSXw4cLOEvju29B+241hbhiPmJ+Z3d3d2oawLWQgG3O7D+CauLuckXf5rGv5iaGvMg94XX5fiEVcOUYzTT/qqv+qqv+qr/L/0bMKZE3r8nIPgAAAAASUVORK5CYII=" />
+  <h3 id="state">Testing WiFi...</h3>
+  <p id="detail">Joining the network</p>
+  <p><a id="retry" href="/" style="display:none">Try again</a></p>
+  <script>
+    // The device tries the credentials while this page polls, the connection may drop for a moment
+    // while the access point moves to the network's channel
+    function poll() {
+      fetch('/status').then(function(r) { return r.json(); }).then(function(s) {
+        var state = document.getElementById('state');
+        document.getElementById('detail').textContent = s.message;
+        if (s.state == 'done') {
+          state.textContent = 'Connected!';
+          state.className = 'ok';
+        } else if (s.state == 'failed') {
+          state.textContent = 'Could not connect';
+          state.className = 'fail';
+          document.getElementById('retry').style.display = 'inline';
+        } else {
+          setTimeout(poll, 500);
+        }
+      }).catch(function() { setTimeout(poll, 1000); });
+    }
+    poll();
+  </script>
+</body>
+</html>
+)rawliteral";
 
 const char* provisioningPage = R"rawliteral(
 <!DOCTYPE HTML>
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+
+#ifdef MQTT_TLS
+#define MQTT_PORT 8883
+#else
+#define MQTT_PORT 1883
+#endif
+#define MAX_BROKERS 4
+#define BROKER_PROBE_INTERVAL 15000 // ms between RTT probes, one broker per probe
+#define BROKER_PROBE_TIMEOUT 250    // ms a probe may block loop() at most
+#define BROKER_MAX_RTT 400          // Probes slower than this count as unhealthy
+#define BROKER_HEALTHY_STREAK 2     // Consecutive good probes before a broker is trusted again
+#define BROKER_FAILOVER_MS 5000     // Time without a broker connection before failing over
+
+// One entry of the ordered broker list. The order is the room's preference, the probes decide health.
+struct BrokerInfo {
+  char host[48] = "";
+  uint16_t port = MQTT_PORT;
+  uint16_t rtt = 0;     // TCP connect time of the last probe in ms
+  uint8_t streak = BROKER_HEALTHY_STREAK; // Consecutive successful probes, optimistic until probed
+  bool healthy = true;
+};
+
+// The ordered broker list and the failover rule. Probing and connecting stay with the caller, this
+// only keeps the results and decides, with the clock passed in, so the host tests can drive it.
+class BrokerList {
+public:
+  // Parse "host[:port],host[:port],...". The active broker stays active if it is still listed,
+  // otherwise the new list starts from the top. False leaves the current list alone.
+  bool load(const char* list);
+
+  uint8_t count() const { return _count; }
+  uint8_t active() const { return _active; }
+  const BrokerInfo& at(uint8_t index) const { return _brokers[index]; }
+  const BrokerInfo& current() const { return _brokers[_active]; }
+
+  // Index of the broker due for a probe, brokers are probed in turn
+  uint8_t nextProbe();
+  void recordProbe(uint8_t index, bool reachable, uint16_t rtt);
+
+  // Once per loop() pass. Every device of a room walks the same ordered list and uses the first
+  // healthy broker, so the room converges on one broker instead of each device chasing its own
+  // fastest. Returns the broker to switch to, -1 to stay.
+  int8_t select(bool connected, unsigned long now);
+  // The transport was recreated for index, the new connection gets the full failover time
+  void setActive(uint8_t index, unsigned long now);
+
+private:
+  BrokerInfo _brokers[MAX_BROKERS];
+  uint8_t _count = 0;
+  uint8_t _active = 0;
+  uint8_t _probeIndex = 0;
+  unsigned long _offlineSince = 0; // millis() since we've had no broker connection, 0 while connected
+};
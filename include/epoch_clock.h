@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_timer.h"
+
+// Disciplined wall clock on top of esp_timer. SNTP results are treated as samples: the first one
+// (or one that is way off) steps the clock, later ones estimate the crystal's frequency error and
+// slew the remaining offset out, so timestamps never jump. Between samples, and through network
+// outages, the clock keeps running on the estimated frequency (holdover).
+#define CLOCK_SNTP_INTERVAL 300000  // ms between SNTP requests
+#define CLOCK_HISTORY 8             // Samples kept for the frequency estimate
+#define CLOCK_MIN_BASELINE 900000000LL // us of sample history needed before trusting a frequency estimate
+#define CLOCK_MAX_PPM 200           // Frequency corrections beyond this are clamped, no crystal is that bad
+#define CLOCK_SLEW_PPM 500          // Rate at which offsets are slewed out, 10ms takes 20s
+#define CLOCK_STEP_US 1000000LL     // Offsets beyond this are stepped, slewing them would take hours
+#define CLOCK_OUTLIER_US 50000LL    // Samples this far off are ignored unless they keep coming
+
+struct ClockStats {
+  uint32_t samples = 0;
+  uint32_t steps = 0;
+  uint32_t rejected = 0;     // Outlier samples ignored
+  int32_t lastError = 0;     // us between the last sample and what the clock predicted
+  int64_t lastSample = 0;    // esp_timer us of the last accepted sample, 0 before the first
+};
+
+class EpochClock {
+public:
+  // Starts SNTP once, the clock runs on the system time until the first sample arrives
+  void begin(const char* server, const char* timeZone);
+
+  // Epoch microseconds. Lock free and in IRAM, safe from ISRs and other tasks.
+  int64_t IRAM_ATTR now64() const { return predict(esp_timer_get_time()); }
+
+  bool synced() const { return _synced; }
+  int32_t frequencyPpb() const;      // Current frequency correction
+  uint32_t holdoverSeconds() const;  // Time since the last accepted sample
+  const ClockStats& stats() const { return _stats; }
+
+  // One SNTP result, local is the esp_timer time it was taken at
+  void addSample(int64_t local, int64_t epoch);
+
+private:
+  // epoch = baseEpoch + dt + dt * freq + min(dt, slewLength) * slew, rates scaled by 2^32
+  struct Model {
+    int64_t baseLocal = 0;
+    int64_t baseEpoch = 0;
+    int64_t freq = 0;
+    int64_t slew = 0;
+    int64_t slewLength = 0;
+  };
+  struct Sample {
+    int64_t local;
+    int64_t epoch;
+  };
+
+  int64_t IRAM_ATTR predict(int64_t local) const {
+    const Model& m = _models[_active];
+    int64_t dt = local - m.baseLocal;
+    int64_t slewDt = dt < m.slewLength ? dt : m.slewLength;
+    return m.baseEpoch + dt + ((dt * m.freq) >> 32) + ((slewDt * m.slew) >> 32);
+  }
+  void publish(const Model& model);
+  static void onSntpSync(struct timeval* tv);
+
+  // Written by the SNTP task only, readers use whichever model _active points at
+  Model _models[2];
+  volatile uint8_t _active = 0;
+  bool _synced = false;
+  uint8_t _outliers = 0;
+  Sample _history[CLOCK_HISTORY];
+  uint8_t _historyCount = 0;
+  ClockStats _stats;
+  static EpochClock* _instance;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <round_engine.h>
+
+// The parsing half of recieveEvents(): a payload from the event topic or the device channel
+// becomes a GameEvent, GreenGame.cpp then acts on it. No device state is touched here, so the
+// host tests cover it and a session replay goes through the same parse the live event did.
+#define EVENT_MAX_PAYLOAD 1024 // Longer payloads are rejected unparsed, nothing we accept comes close
+
+#define GAME_EVENT_INVALID 0 // Not JSON, too long, or a game event missing what the round needs
+#define GAME_EVENT_TOUCH   1
+#define GAME_EVENT_SYNC    2
+#define GAME_EVENT_GO      3
+#define GAME_EVENT_COMMAND 4 // Everything else, the caller reads it from the document
+
+#define GO_MIN_LEAD 20    // ms of notice needed to arm the go timer
+#define GO_MAX_LEAD 10000 // ms, go instants further out are treated as bogus
+
+struct GameEvent {
+  uint8_t type = GAME_EVENT_INVALID;
+  const char* reason = "";   // Why the event is GAME_EVENT_INVALID
+  char device[18] = "";      // Sender, "" when the event names none
+  bool sequenced = false;    // Carries a LAN bus sequence number, seq and boot are valid
+  uint32_t seq = 0;
+  uint32_t boot = 0;
+  unsigned long delta = 0;   // touch: ms since the sender's sync
+  bool replay = false;       // touch: pressed offline and published after the reconnect
+  uint64_t at = 0;           // touch replay: epoch ms of the press, go: epoch ms of the start instant
+  uint32_t round = 0;        // go
+  TouchTrace trace;          // touch: origin and the sender's stages
+};
+
+// Fills `json` as deserializeJson() would, it stays valid for GAME_EVENT_COMMAND handling
+uint8_t parseEvent(JsonDocument& json, const char* msg, size_t length, GameEvent& event);
+// The delta a touch competes with. A replayed offline touch counts from the current sync rather
+// than the one it was pressed under, and is refused (false) when it happened before that sync.
+bool touchDelta(const GameEvent& event, uint64_t syncEpoch, unsigned long& delta);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Fixed memory for JsonDocuments. ArduinoJson 7 takes every slot pool and string from the heap,
+// so each event parsed or published cost a handful of malloc/free pairs. A document now leases an
+// arena for its lifetime, its allocations bump through it and the arena is reset in one go when
+// the document goes away. Documents that outgrow their arena, or are created while every arena is
+// leased, fall back to the heap and are counted, so the stats show when the sizes below are wrong.
+// Documents are only created from the loop() task, the pool is not locked.
+#define JSON_ARENAS 4         // Documents alive at once: a command, its reply and a log line is three deep
+#define JSON_ARENA_SIZE 2560  // Bytes per arena, an OTA chunk or the stats report fits
+#define JSON_ARENA_ALIGN 8
+
+struct JsonPoolStats {
+  uint32_t leases = 0;          // Documents that got an arena
+  uint32_t exhausted = 0;       // Documents that found every arena leased and used the heap
+  uint32_t allocations = 0;     // Blocks served from arenas
+  uint32_t heapAllocations = 0; // Blocks that had to come from the heap, should stay at 0
+  uint16_t peakBytes = 0;       // Most arena memory a single document used
+  uint8_t peakLeased = 0;       // Most arenas leased at the same time
+};
+
+// Plain heap, counted. Used for documents that find no free arena and for arena overflows.
+class JsonHeapAllocator : public ArduinoJson::Allocator {
+public:
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t size) override;
+
+private:
+  friend class JsonPool;
+  JsonPoolStats* _stats = nullptr;
+};
+
+// Bump allocator over a fixed block. Only the newest block can grow or shrink in place, everything
+// else is given back when the arena is reset.
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t size) override;
+
+private:
+  friend class JsonPool;
+  bool owns(const void* ptr) const { return ptr >= _memory && ptr < _memory + JSON_ARENA_SIZE; }
+  void reset();
+
+  alignas(JSON_ARENA_ALIGN) uint8_t _memory[JSON_ARENA_SIZE];
+  size_t _used = 0;
+  size_t _last = SIZE_MAX; // Offset of the newest block, SIZE_MAX when there is none
+  bool _leased = false;
+  JsonHeapAllocator* _heap = nullptr;
+  JsonPoolStats* _stats = nullptr;
+};
+
+class JsonPool {
+public:
+  JsonPool();
+  // A free arena, or the counted heap when all of them are leased
+  ArduinoJson::Allocator* acquire();
+  void release(ArduinoJson::Allocator* allocator);
+
+  uint8_t leased() const;
+  const JsonPoolStats& stats() const { return _stats; }
+
+private:
+  JsonArena _arenas[JSON_ARENAS];
+  JsonHeapAllocator _heap;
+  JsonPoolStats _stats;
+};
+
+extern JsonPool jsonPool;
+
+// Drop-in for JsonDocument that lives in the pool, use it for every document on the event paths
+class PooledJsonDocument : public JsonDocument {
+public:
+  PooledJsonDocument() : PooledJsonDocument(jsonPool.acquire()) {}
+  ~PooledJsonDocument() {
+    clear(); // Give back heap fallbacks before the arena is handed to the next document
+    jsonPool.release(_allocator);
+  }
+  PooledJsonDocument(const PooledJsonDocument&) = delete;
+  PooledJsonDocument& operator=(const PooledJsonDocument&) = delete;
+
+private:
+  explicit PooledJsonDocument(ArduinoJson::Allocator* allocator) : JsonDocument(allocator), _allocator(allocator) {}
+  ArduinoJson::Allocator* _allocator;
+};
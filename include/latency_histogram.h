@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Log scale latency histogram with fixed bucket edges, so histograms from any number of devices
+// and windows merge by adding counts. Values below 4 get a bucket each, above that every power
+// of two is split into 4 buckets (19% wide):
+//   e = floor(log2(v)), index = 4 * e + ((v >> (e - 2)) & 3) - 4, lower edge = (4 + sub) << (e - 2)
+// 124 buckets cover the whole uint32_t range at 248 bytes.
+#define HISTOGRAM_BUCKETS 124
+
+class LatencyHistogram {
+public:
+  void add(uint32_t value);
+  void clear();
+
+  uint32_t count() const { return _count; }
+  uint32_t max() const { return _max; }
+  // Midpoint of the bucket holding quantile q (0..1), 0 when empty
+  uint32_t quantile(float q) const;
+  // Non-empty buckets as [index, count] pairs, what an aggregator needs to merge
+  void write(JsonArray buckets) const;
+
+  static uint8_t bucketOf(uint32_t value);
+  static uint32_t bucketLow(uint8_t index);
+
+private:
+  uint16_t _buckets[HISTOGRAM_BUCKETS] = {};
+  uint32_t _count = 0;
+  uint32_t _max = 0;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Arduino.h>
+
+struct LEDstruct {
+  uint8_t redBrightness = 0;
+  uint8_t greenBrightness = 0;
+  uint8_t blueBrightness = 0;
+  uint8_t whiteBrightness = 0;
+  uint8_t maxBrightness = 100; // Max brightness percentage (0-100) 
+  uint8_t nightBrightness = 100; // Night mode brightness percentage (0-100)
+  uint8_t nightEnd = 7; // Hour when night mode ends (0-23)
+  uint8_t nightStart = 20; // Hour when night mode starts (0-
+};
+
+int interpolate(int start, int end, float t);
+// Cubic easing in/out: accelerating then decelerating
+float cubicEaseInOut(float t);
+// base with the color applied under its day/night brightness limits for the given local hour
+LEDstruct scaleColors(const LEDstruct& base, uint8_t red, uint8_t blue, uint8_t green, uint8_t white, int hour);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+
+// MQTT backend selection, pick one with a build flag in platformio.ini:
+//   -D MQTT_TRANSPORT_ESP_IDF       ESP-IDF native esp-mqtt client, event driven on its own task
+//   -D MQTT_TRANSPORT_PUBSUBCLIENT  PubSubClient directly, without EspMQTTClient's Strings on top
+//   -D MQTT_TRANSPORT_SOCKET        Plain MQTT 3.1.1 over a POSIX socket, for the native build
+// Without a flag the EspMQTTClient library is used.
+#if !defined(MQTT_TRANSPORT_ESP_IDF) && !defined(MQTT_TRANSPORT_PUBSUBCLIENT) && !defined(MQTT_TRANSPORT_SOCKET)
+#define MQTT_TRANSPORT_ESPMQTTCLIENT
+#endif
+
+// -D MQTT_TLS switches the broker connection to MQTT over TLS on port 8883, pinned to MQTT_CA_CERT
+// from secrets.h. EspMQTTClient only speaks plain TCP. PubSubClient runs over TlsSessionClient,
+// which resumes the TLS session on reconnects and failovers. esp-mqtt doesn't let the session out,
+// so it pays a full handshake every time.
+#if defined(MQTT_TLS) && !defined(MQTT_TRANSPORT_ESP_IDF) && !defined(MQTT_TRANSPORT_PUBSUBCLIENT)
+#error "MQTT_TLS requires -D MQTT_TRANSPORT_PUBSUBCLIENT or -D MQTT_TRANSPORT_ESP_IDF"
+#endif
+
+// Called from loop() context for every message on a subscribed topic.
+// payload is NUL terminated, length excludes the terminator.
+typedef void (*MqttMessageHandler)(const char* payload, size_t length);
+
+// Publish cost counters kept by every backend so they can be compared on the same broker
+struct TransportStats {
+  uint32_t publishes = 0;        // Successful publish() calls
+  uint32_t failures = 0;         // publish() calls the backend refused
+  uint64_t publishMicros = 0;    // Total time spent inside publish()
+  uint32_t publishMaxMicros = 0; // Slowest single publish()
+  uint32_t heapChurn = 0;        // Sum of free heap drops observed across publish() calls
+  uint32_t received = 0;         // Messages handed to subscription handlers
+  uint32_t connects = 0;         // Broker sessions established
+  uint32_t connectMillis = 0;    // Last TCP (+TLS handshake) + MQTT CONNECT time, 0 if the backend can't tell
+  uint32_t connectMaxMillis = 0;
+  int32_t connectHeap = 0;       // Free heap consumed by the last connection, the TLS context dominates it
+  uint32_t tlsResumed = 0;       // Connections that resumed a cached TLS session, the rest paid a full handshake
+  uint32_t fullConnectMillis = 0; // connectMillis and connectHeap of the last full handshake and of the last resumed one
+  int32_t fullConnectHeap = 0;
+  uint32_t resumedConnectMillis = 0;
+  int32_t resumedConnectHeap = 0;
+};
+
+class MqttTransport {
+public:
+  virtual ~MqttTransport() {}
+
+  virtual const char* name() const = 0;
+  virtual void enableLastWillMessage(const char* topic, const char* message, bool retain = false) = 0;
+  virtual void setKeepAlive(uint16_t seconds) = 0;
+  // Clean session off, the broker keeps QoS 1 subscriptions and queued messages across reconnects.
+  // Must be called before the first loop().
+  virtual void enablePersistentSession() = 0;
+  // Delay before the next broker reconnection attempt, can be changed while disconnected
+  virtual void setReconnectDelay(uint32_t milliseconds) = 0;
+  // Largest MQTT packet the client will send or accept, firmware chunks need more than the default
+  virtual void setBufferSize(uint16_t bytes) = 0;
+  // Connect over TLS and only accept a broker certificate signed by caCertPem (kept in flash, must outlive
+  // the transport). Must be called before the first loop(). Returns false if the backend has no TLS.
+  virtual bool enableTls(const char* caCertPem) { return false; }
+
+  // Must be called from loop(), dispatches received messages and calls onConnectionEstablished()
+  virtual void loop() = 0;
+  virtual bool isWifiConnected() = 0;
+  virtual bool wifiConnectFailed() = 0;
+  virtual bool isMqttConnected() = 0;
+
+  virtual bool subscribe(const char* topic, MqttMessageHandler handler, uint8_t qos = 0) = 0;
+  virtual bool unsubscribe(const char* topic) = 0;
+
+  bool publish(const char* topic, const char* payload, bool retain = false);
+  const TransportStats& stats() const { return _stats; }
+
+protected:
+  virtual bool doPublish(const char* topic, const char* payload, bool retain) = 0;
+  TransportStats _stats;
+};
+
+// Creates the backend selected at build time. The strings must outlive the transport.
+MqttTransport* createMqttTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                                   const char* user, const char* password, const char* clientName, uint16_t port);
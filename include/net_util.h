@@ -0,0 +1,17 @@
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+#define NETWORKS_MAX 10 // Networks offered by the provisioning portal
+
+struct NetworkInfo {
+  String ssid;
+  int32_t rssi;
+};
+
+// Strongest first, one entry per SSID, hidden networks left out, at most NETWORKS_MAX
+std::vector<NetworkInfo> dedupeNetworks(std::vector<NetworkInfo>& networks);
+
+// MAC as 12 upper case hex digits without separators, out must hold 13 chars
+void formatMac(const uint8_t mac[6], char* out);
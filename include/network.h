@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <mqtt_transport.h>
+
+// LAN event bus: touch and sync events are multicast straight to the other boards on the venue
+// network next to the normal MQTT publish. Whichever copy arrives first is used, the other one is
+// dropped by accept(), so losing multicast (client isolation, IGMP snooping, no peers) only costs
+// latency, never events.
+#define LAN_GROUP_IP 239, 255, 70, 71 // Site local multicast group
+#define LAN_PORT 4571
+#define LAN_MAX_PEERS 8
+#define LAN_BEACON_INTERVAL 2000 // ms between discovery beacons
+#define LAN_PEER_TIMEOUT 6000    // A peer without beacons or events for this long no longer counts as reachable
+#define LAN_SEQ_WINDOW 32        // Recent sequence numbers remembered per peer for duplicate detection
+#define LAN_PACKET_MAX 512
+#define LAN_VERSION 2            // 2 added the boot nonce
+
+#define LAN_PACKET_BEACON 1
+#define LAN_PACKET_EVENT 2
+
+struct __attribute__((packed)) LanHeader {
+  char magic[2];   // "FG"
+  uint8_t version;
+  uint8_t type;    // LAN_PACKET_*
+  uint32_t seq;    // Per sender event counter, 0 for beacons
+  uint32_t boot;   // Random per boot of the sender, its counter starts over when this changes
+  char device[18];
+  char room[25];   // Packets from other rooms sharing the LAN are ignored
+};
+
+struct LanPeer {
+  char device[18] = "";
+  IPAddress ip;
+  unsigned long lastSeen = 0; // millis() of the last packet over the LAN, 0 if only heard over MQTT
+  unsigned long lastActive = 0; // millis() of the last packet or event from either path, for eviction
+  uint32_t boot = 0;          // Boot nonce the sequence state below belongs to
+  uint32_t highest = 0;       // Highest event sequence accepted from any path
+  uint32_t seen = 0;          // Bit i set when highest - i was accepted
+  uint32_t lanHighest = 0;    // Highest sequence that came over the LAN, for loss counting
+};
+
+struct LanStats {
+  uint32_t sent = 0;
+  uint32_t sendFailures = 0;
+  uint32_t received = 0;   // Event packets from peers in our room
+  uint32_t lost = 0;       // Gaps in the per peer LAN sequence
+  uint32_t duplicates = 0; // Second copies dropped by accept(), normally the MQTT one
+  uint32_t lanFirst = 0;   // Events where the LAN copy won the race
+  uint32_t mqttFirst = 0;  // Events from LAN peers that only or first arrived over MQTT
+  uint32_t foreign = 0;    // Packets from other rooms or bad headers
+};
+
+class LanBus {
+public:
+  // device and room are kept by pointer and must outlive the bus, room may change while running.
+  // Received events are handed to handler from loop().
+  bool begin(const char* device, const char* room, MqttMessageHandler handler);
+  void end();
+  bool active() const { return _active; }
+
+  // Call from loop(), reads packets and sends beacons
+  void loop();
+
+  // Next sequence number for an outgoing event, put it in both the LAN and the MQTT copy together
+  // with boot(), so receivers can tell a restarted counter from old duplicates
+  uint32_t nextSeq() { return ++_seq; }
+  uint32_t boot() const { return _boot; }
+  // Multicasts an event if any peer is reachable, the MQTT publish happens regardless
+  bool send(uint32_t seq, const char* payload);
+
+  // First copy of (device, boot, seq) from either path returns true, later copies false
+  bool accept(const char* device, uint32_t boot, uint32_t seq, bool viaLan);
+
+  uint8_t peers() const; // Peers heard over the LAN recently
+  const LanStats& stats() const { return _stats; }
+
+private:
+  bool sendPacket(uint8_t type, uint32_t seq, const char* payload);
+  LanPeer* findPeer(const char* device, bool create);
+  void syncBoot(LanPeer* peer, uint32_t boot);
+
+  WiFiUDP _udp;
+  bool _active = false;
+  const char* _device = nullptr;
+  const char* _room = nullptr;
+  MqttMessageHandler _handler = nullptr;
+  uint32_t _seq = 0;
+  uint32_t _boot = 0;
+  unsigned long _lastBeacon = 0;
+  LanPeer _peers[LAN_MAX_PEERS];
+  LanStats _stats;
+  char _packet[LAN_PACKET_MAX + 1];
+};
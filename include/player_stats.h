@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <latency_histogram.h>
+
+// Streaming statistics of this device's own reaction deltas, updated once per decided round
+// and never holding more than the fixed histogram: Welford mean/variance, min/max, log buckets
+// for the quantiles and a count per placement (FIRST/SECOND/OTHER, index = placement - 1).
+#define PLAYER_STATS_LAYOUT 1
+#define PLAYER_PLACES 3
+#define ROOM_PLAYERS 16          // Peers kept for the leaderboard, the one heard from longest ago makes room
+
+struct PlayerStats {
+  uint8_t layout = PLAYER_STATS_LAYOUT;
+  uint32_t count = 0;
+  double mean = 0;              // ms
+  double m2 = 0;                // Sum of squared differences from the mean
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint32_t places[PLAYER_PLACES] = {};
+  LatencyHistogram deltas;
+
+  void add(uint32_t delta, uint8_t placement);
+  void clear() { *this = PlayerStats(); }
+  float variance() const { return count > 1 ? m2 / count : 0; }
+  // The compact form peers merge: n, mean, var, min, p50, p90 and the placement counts
+  void write(JsonDocument& json) const;
+};
+
+// Latest summary of one player in the room, cumulative so a newer one replaces the older
+struct PlayerEntry {
+  char device[18] = "";
+  uint32_t count = 0;
+  float mean = 0;
+  float variance = 0;
+  uint32_t min = 0;
+  uint32_t p50 = 0;
+  uint32_t p90 = 0;
+  uint32_t places[PLAYER_PLACES] = {};
+  unsigned long seenAt = 0;     // millis() of the last summary
+};
+
+// Room leaderboard built from the players' compact summaries, no raw touches involved
+class Leaderboard {
+public:
+  // Takes a peer's summary, false when it isn't one
+  bool update(const JsonDocument& json);
+  void set(const char* device, const PlayerStats& stats);
+  void clear() { _count = 0; }
+  uint8_t count() const { return _count; }
+
+  // Players ranked by median delta, then the room as one player merged from all of them.
+  // Rows are [device, n, p50, p90, mean, first, second, other], dropped from the slow end
+  // until the document fits maxBytes.
+  void write(JsonDocument& json, size_t maxBytes) const;
+
+private:
+  PlayerEntry* find(const char* device);
+  PlayerEntry _players[ROOM_PLAYERS];
+  uint8_t _count = 0;
+};
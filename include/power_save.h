@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Idle power mode. After a stretch without room activity the CPU clocks down, the radio sleeps
+// between DTIM beacons and loop() blocks instead of spinning. A touch edge wakes the loop task
+// straight from the ISR and any activity restores full speed before the touch is published.
+// Touch-to-publish latency is kept per state, so the idle policy can be checked against the game.
+#define POWER_ACTIVE 0
+#define POWER_IDLE   1
+#define POWER_STATES 2
+
+#define POWER_ACTIVE_CPU_MHZ 240
+#define POWER_IDLE_CPU_MHZ 80   // Lowest clock the WiFi driver still runs on
+#define POWER_IDLE_WAIT_MS 20   // Longest loop() blocks per pass while idle, a touch cuts it short
+
+struct PowerLatency {
+  uint32_t touches = 0;     // Local touches published from this state
+  uint64_t totalMicros = 0; // ISR to publish() returned
+  uint32_t maxMicros = 0;
+};
+
+struct PowerStats {
+  uint32_t idleEntries = 0;
+  uint64_t idleMillis = 0;  // Time spent idle, not counting the current stretch
+  PowerLatency latency[POWER_STATES];
+};
+
+class PowerSaver {
+public:
+  // loopTask is notified by wakeFromISR(), seconds = 0 keeps the device active
+  void begin(TaskHandle_t loopTask, uint16_t idleAfter);
+  void setIdleAfter(uint16_t seconds) { _idleAfter = seconds; }
+
+  // Room or local activity: leave idle now and restart the inactivity timer
+  void activity();
+  // Once per loop() pass while playing: enter idle when due, block for a while when idle
+  void loop();
+  void IRAM_ATTR wakeFromISR();
+
+  uint8_t state() const { return _state; }
+  uint32_t idleSeconds() const;
+  void recordTouch(uint8_t state, uint32_t micros);
+  const PowerStats& stats() const { return _stats; }
+
+private:
+  void enterIdle();
+  void leaveIdle();
+
+  TaskHandle_t _loopTask = nullptr;
+  uint16_t _idleAfter = 0;
+  unsigned long _lastActivity = 0;
+  unsigned long _idleSince = 0;
+  volatile uint8_t _state = POWER_ACTIVE;
+  PowerStats _stats;
+};
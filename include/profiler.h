@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "esp_timer.h"
+
+// Where loop() is and how long it has been there. loop() tags its phases, an esp_timer watches
+// the loop heartbeat from outside and notes every pass that runs past LOOP_STALL_MS together with
+// the phase it is stuck in. The notes and the current phase live in RTC memory that survives a
+// watchdog or panic reset, so the next boot can tell what the device was doing when it hung.
+#define LOOP_STALL_MS 500            // A loop() pass longer than this is a stall
+#define LOOP_STALL_RESTART_MS 60000  // Stalled this long outside an OTA: restart so the stall gets reported
+#define PROFILE_CHECK_MS 100         // Stall detector period
+#define PROFILE_RING 8               // Stalls kept across a reset
+#define PROFILE_TASKS 20             // Tasks read from FreeRTOS per report
+#define PROFILE_REPORT_TASKS 12      // Rows that fit a report, tasks short on stack first, then the busiest
+#define PROFILE_STACK_LOW 1024       // Bytes of stack never used below which a task goes to the top of the report
+
+enum LoopPhase : uint8_t {
+  PHASE_SETUP,
+  PHASE_LOOP,      // Between the tagged phases
+  PHASE_PORTAL,    // Captive DNS and web server
+  PHASE_MQTT,      // Transport loop, outside our handlers
+  PHASE_EVENT,     // recieveEvents() and the other subscription handlers
+  PHASE_TOUCH,
+  PHASE_DECIDE,
+  PHASE_PUBLISH,   // Publish scheduler pump
+  PHASE_LAN,
+  PHASE_OTA,
+  PHASE_NTP,
+  PHASE_SCAN,      // WiFi scan
+  PHASE_FAILOVER,  // Broker probes and switching
+  PHASE_COUNT
+};
+
+struct __attribute__((packed)) StallRecord {
+  uint32_t at;        // millis() into the boot when the stall was noticed
+  uint32_t duration;  // ms the pass had been running, still growing if the reset hit mid stall
+  uint8_t phase;
+};
+
+class Profiler {
+public:
+  // Reads what the previous boot left in RTC memory, then starts over for this boot
+  void begin();
+  // Called at the top of every loop() pass, arms the stall detector on the first call
+  void loopStart();
+  void setPhase(uint8_t phase);
+  uint8_t phase() const { return _phase; }
+
+  // Reset reason, the phase at the reset and the stalls of the previous boot, once per boot
+  // and only when there is something to say. Returns false when there is nothing.
+  bool takeBootReport(JsonDocument& json);
+  // Stack high-water marks and CPU share per task since the last call, plus this boot's loop stalls
+  void report(JsonDocument& json);
+
+  static const char* phaseName(uint8_t phase);
+
+private:
+  static void check(void* arg);
+  void noteStall(uint32_t duration);
+
+  volatile uint8_t _phase = PHASE_SETUP;
+  volatile uint32_t _passStart = 0; // millis() at the start of the current loop() pass
+  volatile bool _stalled = false;   // The current pass is already in the ring
+  uint32_t _passStartMicros = 0;
+  uint32_t _maxPassMicros = 0;      // Longest pass since the last report
+  uint32_t _stalls = 0;
+  esp_timer_handle_t _timer = nullptr;
+
+  // Previous boot, copied out of RTC memory by begin()
+  esp_reset_reason_t _resetReason = ESP_RST_UNKNOWN;
+  uint8_t _resetPhase = PHASE_SETUP;
+  uint8_t _previousCount = 0;
+  StallRecord _previous[PROFILE_RING];
+  bool _reported = false;
+
+  // Run time counters at the last report, for the CPU share
+  uint32_t _lastTotal = 0;
+  uint32_t _lastTaskNumber[PROFILE_TASKS] = {};
+  uint32_t _lastTaskTime[PROFILE_TASKS] = {};
+};
+
+// Tags a phase for the rest of the scope and puts the outer phase back afterwards
+class PhaseScope {
+public:
+  PhaseScope(Profiler& profiler, uint8_t phase) : _profiler(profiler), _outer(profiler.phase()) { profiler.setPhase(phase); }
+  ~PhaseScope() { _profiler.setPhase(_outer); }
+
+private:
+  Profiler& _profiler;
+  uint8_t _outer;
+};
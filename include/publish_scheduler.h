@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+#include <mqtt_transport.h>
+
+// Outbound lanes, lower number is served first
+#define LANE_GAME      0 // Touch and sync events, they decide rounds and are never rate limited
+#define LANE_CONTROL   1 // Connection announcements and replies to commands
+#define LANE_TELEMETRY 2 // Round and go reports, traces, session dumps: every message is its own record
+#define LANE_SUMMARY   3 // Periodic cumulative summaries, a newer one replaces a queued one
+#define LANE_LOG       4 // sendLog() entries
+#define PUBLISH_LANES  5
+
+#define LANE_TOPIC_LEN   64
+#define LANE_PAYLOAD_LEN 512
+
+// What a full lane does with the next message
+enum LanePolicy : uint8_t {
+  DROP_OLDEST, // Make room by discarding the message that waited longest
+  COALESCE     // Replace the queued message with the same topic, drop the newest otherwise
+};
+
+struct LaneConfig {
+  uint16_t ratePerSec; // Token refill rate, 0 means unlimited
+  uint8_t burst;       // Bucket size
+  uint8_t depth;       // Queue slots, at most LANE_MAX_DEPTH
+  LanePolicy policy;
+};
+
+struct LaneStats {
+  uint32_t sent = 0;
+  uint32_t dropped = 0;
+  uint32_t coalesced = 0;
+  uint8_t depth = 0;        // Messages waiting right now
+  uint8_t maxDepth = 0;     // Highest depth seen
+  uint32_t maxWaitMs = 0;   // Longest time a message sat in the queue
+  uint32_t totalWaitMs = 0; // Sum of queue wait over sent messages, for the average
+};
+
+#define LANE_MAX_DEPTH 6
+
+struct QueuedMessage {
+  char topic[LANE_TOPIC_LEN];
+  char payload[LANE_PAYLOAD_LEN];
+  bool retain;
+  unsigned long queuedAt;
+};
+
+// Priority scheduler in front of MqttTransport::publish(). Each lane has its own token bucket
+// so a burst of logs can never sit in front of the message that decides a round.
+class PublishScheduler {
+public:
+  void begin(MqttTransport* transport);
+  // Swap the transport underneath, queued messages are kept for the new one
+  void setTransport(MqttTransport* transport) { _transport = transport; }
+
+  // Publishes right away when the lane is idle and has a token, queues otherwise
+  bool publish(uint8_t lane, const char* topic, const char* payload, bool retain = false);
+
+  // Call from loop(), sends queued messages in lane priority order as tokens allow
+  void pump();
+
+  const LaneStats& stats(uint8_t lane) const { return _lanes[lane].stats; }
+
+private:
+  struct Lane {
+    LaneConfig config;
+    LaneStats stats;
+    QueuedMessage queue[LANE_MAX_DEPTH];
+    uint8_t head = 0;
+    float tokens = 0;
+  };
+
+  void refill();
+  bool takeToken(Lane& lane);
+  bool higherPriorityWaiting(uint8_t lane) const;
+  bool enqueue(Lane& lane, const char* topic, const char* payload, bool retain);
+  QueuedMessage& at(Lane& lane, uint8_t index) { return lane.queue[(lane.head + index) % lane.config.depth]; }
+
+  MqttTransport* _transport = nullptr;
+  Lane _lanes[PUBLISH_LANES];
+  unsigned long _lastRefill = 0;
+};
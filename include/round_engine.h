@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Round placements
+#define NOT_PLACED 0
+#define FIRST 1
+#define SECOND 2
+#define OTHER 3
+
+#define ROUND_QUEUE_SIZE 8      // Touches that can be judged in a single round, the best ones are kept
+#define ROUND_HOLDOFF 2000      // ms a decided round waits for the winner's sync before accepting new touches
+
+// Per-stage timestamps of a touch as it travels ISR -> loop -> publish -> remote receive -> remote decision
+struct TouchTrace {
+  uint32_t id = 0;           // traceID of the originating touch
+  char origin[18] = "";      // deviceID of the originating device
+  uint64_t isrEpoch = 0;     // Epoch ms of the ISR on the originating device
+  uint32_t isrToPickup = 0;  // us between the ISR and loop() noticing the touch
+  uint32_t pickupToPub = 0;  // us between loop() pickup and handing the payload to publish()
+  uint32_t publishTime = 0;  // us spent inside client->publish() (local only)
+  uint64_t pubEpoch = 0;     // Epoch ms just before publish() on the originating device
+  uint64_t recvEpoch = 0;    // Epoch ms when the remote recieveEvents() parsed the event
+  unsigned long recvMicros = 0; // micros() at remote receive, used for the decision stage
+  uint32_t recvToDecide = 0; // us between the remote receive and loop() picking the event up
+  uint32_t decide = 0;       // us the remote loop() spent judging the event
+  bool lan = false;          // Arrived over the LAN bus rather than the broker
+  uint8_t power = 0;         // POWER_* state the touch woke the sender from (local only), 0 is active
+};
+
+// One touch competing in the current round, local or remote
+struct RoundTouch {
+  unsigned long delta = 0;  // ms since the sender's last sync
+  char device[18] = "";     // deviceID of the sender, tiebreak when deltas are equal
+  TouchTrace trace;
+};
+
+// Touches collected during the reorder window, judged together once the window closes
+struct Round {
+  RoundTouch touches[ROUND_QUEUE_SIZE];
+  uint8_t count = 0;
+  uint8_t dropped = 0;           // Touches turned away or evicted by a better one while the queue was full
+  unsigned long windowStart = 0; // millis() of the first touch of the round
+  bool decided = false;          // Round judged, waiting for the winner's sync
+  unsigned long decidedAt = 0;
+  uint8_t placement = NOT_PLACED; // Where this device finished in the last decided round
+};
+
+// The round engine only sees the clock through `now`, so a recorded session replays to the same
+// decisions and the host tests can drive it without a device.
+bool roundAddTouch(Round& r, const char* device, unsigned long delta, const TouchTrace& trace, unsigned long now);
+// Deterministic ordering every device agrees on: earliest delta, then lowest deviceID
+bool touchBefore(const RoundTouch& a, const RoundTouch& b);
+// Orders the round and returns where `self` placed
+uint8_t rankRound(Round& r, const char* self);
+void finishRound(Round& r, unsigned long now);
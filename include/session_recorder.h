@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Everything the round engine consumed, in the order it consumed it, so a disputed round can be
+// dumped and replayed through the same code later. Events from other devices are kept as the raw
+// payload they arrived as and go back through parseEvent() on replay, every record carries the
+// clock state it was made under.
+#define SESSION_RECORDS 256        // ~12KB of RAM, the oldest records are overwritten
+#define SESSION_PAYLOAD_BYTES 8192 // Raw event payloads, ~50 touches with traces
+#define SESSION_EVENT_MAX 256      // Longer payloads are cut and can't be replayed, a traced touch is ~170
+
+#define REC_TOUCH  1 // value = delta, device = who touched, local touches only
+#define REC_SYNC   2 // device = who sent the sync, "go" for a go trigger, written once syncEpoch moved
+#define REC_DECIDE 3 // value = touches judged, flags = our placement, device = winner
+#define REC_WINDOW 4 // value = reorder window in ms, written at boot and whenever it changes
+#define REC_EVENT  5 // value = payload bytes kept, device = sender, a game event from another device
+
+#define REC_FLAG_LOCAL     0x01 // Touch came from this device
+#define REC_FLAG_LAN       0x02 // Event came over the LAN bus
+#define REC_FLAG_DUPLICATE 0x04 // Event was the second copy of one already handled, the dedupe dropped it
+#define REC_FLAG_CUT       0x08 // Payload was longer than SESSION_EVENT_MAX
+#define REC_FLAG_LOST      0x10 // Payload was overwritten before the dump, set in dumps only
+
+struct __attribute__((packed)) SessionRecord {
+  uint32_t at;        // millis() when the engine saw it, the replay clock
+  uint32_t value;
+  uint8_t type;       // REC_*
+  uint8_t flags;
+  char device[18];
+  uint64_t epoch;     // epochMillis() at the same instant, epoch - at is the clock offset
+  uint64_t syncEpoch; // syncEpoch in effect, replayed touches are measured from it
+  uint32_t payload;   // REC_EVENT: offset into the payload ring, counted from the first byte ever written
+};
+
+// What a replay found. Rounds are only judged from the first round boundary in the ring, and not
+// after a payload that could not be read back until the next boundary.
+struct ReplayResult {
+  uint16_t rounds = 0;
+  uint16_t mismatched = 0;     // Rounds judged differently than the recorded decision
+  int16_t firstMismatch = -1;  // Record index of the first mismatched decision
+  uint16_t events = 0;         // Payloads parsed
+  uint16_t rejected = 0;       // Payloads the parser refused, as it did live
+  uint16_t duplicates = 0;
+  uint16_t unreadable = 0;     // Payloads cut or lost, their round is not judged
+  uint16_t clockMismatched = 0; // Records whose syncEpoch differs from the one the replay rebuilt
+};
+
+class SessionRecorder {
+public:
+  // Where record() reads the clock state, epochMillis() and the device's syncEpoch
+  void setClock(uint64_t (*epochMillis)(), const uint64_t* syncEpoch) { _epochMillis = epochMillis; _syncEpoch = syncEpoch; }
+  // Returns the millis() stamped on the record, hand it to the engine so a replay sees the same clock
+  uint32_t record(uint8_t type, uint32_t value, const char* device = "", uint8_t flags = 0);
+  uint32_t recordEvent(const char* device, const char* payload, size_t length, uint8_t flags = 0);
+  // Flag the newest record after the fact, e.g. REC_FLAG_DUPLICATE once the dedupe has spoken
+  void markLast(uint8_t flags);
+  void clear() { _head = 0; _count = 0; _payloadHead = 0; }
+  // Hold the ring still while it is being dumped, records made meanwhile are lost
+  void pause(bool paused) { _paused = paused; }
+
+  uint16_t count() const { return _count; }
+  // i = 0 is the oldest record still in the ring
+  const SessionRecord& at(uint16_t i) const { return _records[(_head + SESSION_RECORDS - _count + i) % SESSION_RECORDS]; }
+  uint32_t overwritten() const { return _overwritten; }
+  // Copies a REC_EVENT payload out of the ring, false when it has been overwritten since
+  bool payload(const SessionRecord& rec, char* out, size_t size) const;
+
+  // Dump format: each record as stored, a REC_EVENT one followed by its payload bytes. Writes the
+  // records from `first` on that fit `size` and returns the bytes used, `records` says how many.
+  size_t write(uint16_t first, uint8_t* out, size_t size, uint16_t& records) const;
+  // Appends a dump written by write(), false when it is truncated
+  bool load(const uint8_t* data, size_t length);
+
+private:
+  SessionRecord& append();
+  SessionRecord& last() { return _records[(_head + SESSION_RECORDS - 1) % SESSION_RECORDS]; }
+  void storePayload(SessionRecord& rec, const char* payload, size_t length);
+
+  SessionRecord _records[SESSION_RECORDS];
+  uint16_t _head = 0; // Next slot to write
+  uint16_t _count = 0;
+  uint32_t _overwritten = 0;
+  char _payloads[SESSION_PAYLOAD_BYTES];
+  uint32_t _payloadHead = 0; // Payload bytes ever written, the ring offset is this modulo its size
+  bool _paused = false;
+  uint64_t (*_epochMillis)() = nullptr;
+  const uint64_t* _syncEpoch = nullptr;
+};
+
+// Feeds the recording back through parseEvent() and the round engine with the recorded millis()
+// as the clock, and compares every decision with the one recorded. Runs the same on the device
+// and on the host (tools/session_replay), `self` is the device the session was recorded on.
+ReplayResult replaySession(const SessionRecorder& recorder, const char* self);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+
+// TLS client for the PubSubClient backend that keeps the session of every broker it talked to, so
+// a reconnect or a failover back to a known broker resumes it (TLS 1.2 session ticket or session
+// id) instead of paying a full handshake with the certificate chain. The session of the last
+// broker is also kept in NVS, the first connect after a reboot resumes too. Only brokers whose
+// certificate is signed by the CA given to setCACert() are accepted.
+#define TLS_SESSION_SLOTS 2          // Brokers whose sessions are kept in RAM, the active one and a failover target
+#define TLS_SESSION_BYTES 2048       // A serialized session, mbedtls keeps the broker certificate in it
+#define TLS_HANDSHAKE_TIMEOUT 5000   // ms for TCP connect and handshake together
+#define TLS_IO_TIMEOUT 2000          // ms a write may wait for the socket
+
+class TlsSessionClient : public Client {
+public:
+  ~TlsSessionClient() override;
+
+  // PEM, kept in flash and must outlive the client
+  void setCACert(const char* caCertPem) { _caCert = caCertPem; }
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* host, uint16_t port) override;
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override { return -1; } // PubSubClient never peeks
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+  // The last connect() resumed a cached session, no certificate was exchanged
+  bool resumed() const { return _resumed; }
+
+private:
+  bool configure();
+  static int netSend(void* ctx, const unsigned char* buf, size_t length);
+  static int netRecv(void* ctx, unsigned char* buf, size_t length);
+  static int onVerify(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags);
+
+  WiFiClient _net;
+  const char* _caCert = nullptr;
+  bool _configured = false; // Config, CA chain and RNG are set up once and shared by every connection
+  bool _open = false;       // _ssl is set up and needs freeing
+  bool _verified = false;   // The broker sent its certificate, so this was a full handshake
+  bool _resumed = false;
+  mbedtls_ssl_context _ssl;
+  mbedtls_ssl_config _conf;
+  mbedtls_x509_crt _ca;
+  mbedtls_entropy_context _entropy;
+  mbedtls_ctr_drbg_context _drbg;
+};
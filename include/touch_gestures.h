@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define LONG_PRESS_MS 5000      // Hold this long to clear the WiFi settings (TODO #4)
+#define DOUBLE_TAP_MS 300       // Max gap between a release and the next press for a double tap
+
+// Raw pin edge captured by the ISR, the gesture state machine in loop() decides what it means
+struct TouchEdge {
+  uint32_t micros;
+  uint8_t level;
+};
+
+enum TouchState : uint8_t {
+  TOUCH_IDLE,
+  TOUCH_PRESS_PENDING,   // Rising edge seen, waiting out the glitch window
+  TOUCH_PRESSED,
+  TOUCH_RELEASE_PENDING  // Falling edge seen, a quick rise means it was a bounce
+};
+
+enum TouchGesture : uint8_t {
+  GESTURE_PRESS,      // duration 0
+  GESTURE_RELEASE,    // duration = how long it was held
+  GESTURE_LONG_PRESS, // duration = held so far, fires once per press
+  GESTURE_DOUBLE_TAP  // duration = gap since the previous release, follows the press that completed it
+};
+
+// at is the micros() of the edge the gesture started with, not the time it was recognised
+typedef void (*TouchGestureHandler)(TouchGesture gesture, uint32_t at, uint32_t duration);
+
+// Debounce state machine for both edges of the touch pin, fed the ISR's edges in order plus a poll
+// for the time based transitions. Only sees time through the edges and poll(), so the host tests
+// drive it with synthetic edge traces.
+class TouchGestures {
+public:
+  void setHandler(TouchGestureHandler handler) { _handler = handler; }
+  // Edges are judged by the level read in the ISR, so a missed edge can't leave the machine inverted
+  void edge(const TouchEdge& edge);
+  // Settles a pending edge, fires the long press and expires a double tap that didn't come
+  void poll(uint32_t now);
+  TouchState state() const { return _state; }
+
+  uint16_t glitchMicros = 3000; // Edges that reverse faster than this are bounces, not presses or releases
+  uint32_t glitches = 0;        // Edges rejected as bounces
+  uint32_t overflows = 0;       // Edges lost because loop() fell behind the ISR, counted by the ISR
+
+private:
+  void settle(uint32_t now);
+  void press(uint32_t at);
+  void release(uint32_t at);
+  void emit(TouchGesture gesture, uint32_t at, uint32_t duration) {
+    if (_handler != nullptr) _handler(gesture, at, duration);
+  }
+
+  TouchGestureHandler _handler = nullptr;
+  TouchState _state = TOUCH_IDLE;
+  uint32_t _edgeMicros = 0;    // Edge the pending state is waiting on
+  uint32_t _pressMicros = 0;   // Onset of the current press, its timestamp for the game
+  uint32_t _releaseMicros = 0; // Last confirmed release
+  bool _longSent = false;      // Long press already fired for the current press
+  bool _tapPending = false;    // Last press was short and may start a double tap
+  bool _secondTap = false;     // Current press completed a double tap
+};
@@ -0,0 +1,334 @@
+#include <mini_broker.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+
+bool MiniBroker::start(uint16_t port) {
+  if (_running) return true;
+  _listen = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(_listen, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(_listen, 64) != 0) {
+    close(_listen);
+    _listen = -1;
+    return false;
+  }
+  socklen_t len = sizeof(addr);
+  getsockname(_listen, (struct sockaddr*)&addr, &len);
+  _port = ntohs(addr.sin_port);
+  _running = true;
+  _thread = std::thread(&MiniBroker::run, this);
+  return true;
+}
+
+void MiniBroker::stop() {
+  // Clients see their connection drop, the same as a broker going away
+  if (!_running) return;
+  _running = false;
+  _thread.join();
+  for (Client& client : _clients) close(client.fd);
+  _clients.clear();
+  _pending.clear();
+  _retained.clear();
+  _sessions.clear();
+  close(_listen);
+  _listen = -1;
+  _stats.clients = 0;
+}
+
+uint64_t MiniBroker::nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void MiniBroker::run() {
+  std::vector<struct pollfd> fds;
+  while (_running) {
+    fds.clear();
+    fds.push_back({ _listen, POLLIN, 0 });
+    for (const Client& client : _clients) fds.push_back({ client.fd, POLLIN, 0 });
+    int timeout = 20; // Also how quickly stop() is noticed
+    if (!_pending.empty()) {
+      uint64_t now = nowMs();
+      int due = _pending.front().dueMs > now ? (int)(_pending.front().dueMs - now) : 0;
+      if (due < timeout) timeout = due;
+    }
+    poll(fds.data(), fds.size(), timeout);
+    if (_kick.exchange(false)) {
+      while (!_clients.empty()) drop(_clients.front().fd, true);
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(_listen, nullptr, nullptr);
+      if (fd >= 0) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        Client client;
+        client.fd = fd;
+        _clients.push_back(client);
+      }
+    }
+    for (size_t i = 1; i < fds.size(); i++) {
+      if (fds[i].revents == 0) continue;
+      Client* client = find(fds[i].fd);
+      if (client != nullptr) readClient(*client);
+    }
+
+    // Packets whose injected latency has passed, in arrival order
+    uint64_t now = nowMs();
+    while (!_pending.empty() && _pending.front().dueMs <= now) {
+      Pending pending = std::move(_pending.front());
+      _pending.pop_front();
+      Client* client = find(pending.fd);
+      if (client != nullptr) handle(*client, pending.packet);
+    }
+  }
+}
+
+MiniBroker::Client* MiniBroker::find(int fd) {
+  for (Client& client : _clients) {
+    if (client.fd == fd) return &client;
+  }
+  return nullptr;
+}
+
+void MiniBroker::readClient(Client& client) {
+  char buffer[4096];
+  ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    drop(client.fd, true);
+    return;
+  }
+  if (n < 0) return;
+  client.rx.append(buffer, n);
+
+  while (true) {
+    size_t remaining = 0;
+    size_t header = 1;
+    uint32_t multiplier = 1;
+    bool complete = false;
+    while (header < client.rx.size() && header <= 4) {
+      uint8_t digit = client.rx[header++];
+      remaining += (digit & 0x7F) * multiplier;
+      multiplier *= 128;
+      if (!(digit & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || header + remaining > client.rx.size()) return;
+    std::string packet = client.rx.substr(0, header + remaining);
+    client.rx.erase(0, header + remaining);
+    _pending.push_back({ nowMs() + _latencyMs, client.fd, packet });
+  }
+}
+
+static uint16_t readShort(const std::string& s, size_t at) {
+  return ((uint8_t)s[at] << 8) | (uint8_t)s[at + 1];
+}
+
+static std::string readString(const std::string& s, size_t& at) {
+  if (at + 2 > s.size()) return "";
+  uint16_t length = readShort(s, at);
+  std::string value = s.substr(at + 2, length);
+  at += 2 + length;
+  return value;
+}
+
+void MiniBroker::handle(Client& client, const std::string& packet) {
+  uint8_t type = (uint8_t)packet[0];
+  size_t at = 1;
+  while ((uint8_t)packet[at] & 0x80) at++;
+  at++;
+
+  switch (type >> 4) {
+    case 1: { // CONNECT
+      readString(packet, at); // Protocol name
+      at += 1;                // Level
+      uint8_t flags = packet[at++];
+      at += 2;                // Keepalive, the broker never times clients out
+      client.id = readString(packet, at);
+      if (flags & 0x04) {
+        client.willTopic = readString(packet, at);
+        client.willMessage = readString(packet, at);
+        client.willRetain = flags & 0x20;
+      }
+      client.persistent = !(flags & 0x02);
+      bool resumed = false;
+      for (size_t i = 0; i < _sessions.size(); i++) {
+        if (_sessions[i].first != client.id) continue;
+        if (client.persistent) {
+          client.filters = _sessions[i].second;
+          resumed = true;
+        }
+        _sessions.erase(_sessions.begin() + i);
+        break;
+      }
+      client.connected = true;
+      _stats.connects++;
+      _stats.clients++;
+      sendPacket(client, 0x20, std::string(resumed ? "\x01\x00" : "\x00\x00", 2)); // Session present
+      break;
+    }
+    case 3: { // PUBLISH
+      uint8_t qos = (type >> 1) & 0x03;
+      std::string topic = readString(packet, at);
+      if (qos > 0) {
+        sendPacket(client, 0x40, packet.substr(at, 2));
+        at += 2;
+      }
+      _stats.published++;
+      publish(topic, packet.substr(at), type & 0x01);
+      break;
+    }
+    case 8: { // SUBSCRIBE
+      std::string id = packet.substr(at, 2);
+      at += 2;
+      std::string codes;
+      std::vector<std::string> added;
+      while (at < packet.size()) {
+        std::string filter = readString(packet, at);
+        at++; // Requested QoS, everything goes out at 0
+        client.filters.push_back(filter);
+        added.push_back(filter);
+        codes += '\0';
+      }
+      sendPacket(client, 0x90, id + codes);
+      for (const auto& retained : _retained) {
+        for (const std::string& filter : added) {
+          if (!matches(filter, retained.first)) continue;
+          std::string body;
+          body += (char)(retained.first.size() >> 8);
+          body += (char)(retained.first.size() & 0xFF);
+          body += retained.first + retained.second;
+          sendPacket(client, 0x31, body);
+          break;
+        }
+      }
+      break;
+    }
+    case 10: { // UNSUBSCRIBE
+      std::string id = packet.substr(at, 2);
+      at += 2;
+      while (at < packet.size()) {
+        std::string filter = readString(packet, at);
+        for (size_t i = 0; i < client.filters.size(); i++) {
+          if (client.filters[i] == filter) client.filters.erase(client.filters.begin() + i--);
+        }
+      }
+      sendPacket(client, 0xB0, id);
+      break;
+    }
+    case 12: // PINGREQ
+      sendPacket(client, 0xD0, "");
+      break;
+    case 14: // DISCONNECT, a clean one so no will
+      drop(client.fd, false);
+      break;
+    default:
+      break;
+  }
+}
+
+void MiniBroker::publish(const std::string& topic, const std::string& payload, bool retain) {
+  if (retain) {
+    bool replaced = false;
+    for (size_t i = 0; i < _retained.size(); i++) {
+      if (_retained[i].first != topic) continue;
+      if (payload.empty()) {
+        _retained.erase(_retained.begin() + i);
+      } else {
+        _retained[i].second = payload;
+      }
+      replaced = true;
+      break;
+    }
+    if (!replaced && !payload.empty()) _retained.push_back({ topic, payload });
+  }
+  std::string body;
+  body += (char)(topic.size() >> 8);
+  body += (char)(topic.size() & 0xFF);
+  body += topic + payload;
+  // Index loop, a failed send drops the client and changes _clients
+  for (size_t i = 0; i < _clients.size(); i++) {
+    Client& client = _clients[i];
+    if (!client.connected) continue;
+    for (const std::string& filter : client.filters) {
+      if (matches(filter, topic)) {
+        _stats.delivered++;
+        sendPacket(client, 0x30, body);
+        break;
+      }
+    }
+  }
+}
+
+void MiniBroker::sendPacket(Client& client, uint8_t type, const std::string& body) {
+  std::string packet(1, (char)type);
+  size_t length = body.size();
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    packet += (char)(length > 0 ? digit | 0x80 : digit);
+  } while (length > 0);
+  packet += body;
+
+  size_t sent = 0;
+  while (sent < packet.size()) {
+    ssize_t n = send(client.fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = { client.fd, POLLOUT, 0 };
+      if (poll(&pfd, 1, 1000) > 0) continue;
+    }
+    if (n <= 0) return; // The next read notices the dead connection
+    sent += n;
+  }
+}
+
+void MiniBroker::drop(int fd, bool sendWill) {
+  for (size_t i = 0; i < _clients.size(); i++) {
+    if (_clients[i].fd != fd) continue;
+    Client client = _clients[i];
+    _clients.erase(_clients.begin() + i);
+    close(fd);
+    for (size_t j = 0; j < _pending.size(); j++) {
+      if (_pending[j].fd == fd) _pending.erase(_pending.begin() + j--); // The fd number gets reused
+    }
+    if (client.connected) _stats.clients--;
+    if (client.connected && client.persistent) _sessions.push_back({ client.id, client.filters });
+    if (sendWill && client.connected && !client.willTopic.empty()) {
+      publish(client.willTopic, client.willMessage, client.willRetain);
+    }
+    return;
+  }
+}
+
+bool MiniBroker::matches(const std::string& filter, const std::string& topic) {
+  size_t f = 0, t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') return true;
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') t++;
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t]) return false;
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
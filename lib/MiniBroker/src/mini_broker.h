@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Just enough of an MQTT 3.1.1 broker for the host tests and the fleet simulator, so neither needs
+// mosquitto installed: CONNECT, SUBSCRIBE with + and # filters, QoS 0 fan-out (QoS 1 publishes are
+// acked and forwarded at QoS 0), retained messages, will messages, PINGREQ, and persistent sessions
+// that keep a client's subscriptions by client id across reconnects (not messages sent meanwhile,
+// nor across stop()). Runs on its own thread on a loopback port. setLatency() holds every inbound
+// packet that long before it is handled, which is what a slow or distant broker looks like to a
+// client, kick() drops every connection the way a network outage does.
+struct MiniBrokerStats {
+  std::atomic<uint32_t> connects{0};
+  std::atomic<uint32_t> published{0}; // PUBLISH packets received from clients
+  std::atomic<uint32_t> delivered{0}; // PUBLISH packets sent to subscribers, the fan-out
+  std::atomic<uint32_t> clients{0};   // Connected right now
+};
+
+class MiniBroker {
+public:
+  ~MiniBroker() { stop(); }
+
+  // port 0 picks a free one, see port()
+  bool start(uint16_t port = 0);
+  void stop();
+  bool running() const { return _running; }
+  uint16_t port() const { return _port; }
+  void setLatency(uint32_t ms) { _latencyMs = ms; }
+  // Drops every client on the broker thread's next pass, wills go out, sessions are kept
+  void kick() { _kick = true; }
+
+  const MiniBrokerStats& stats() const { return _stats; }
+
+private:
+  struct Client {
+    int fd;
+    bool connected = false;
+    bool persistent = false; // Clean session off, filters are kept under id when it goes
+    std::string id;
+    std::string rx;
+    std::vector<std::string> filters;
+    std::string willTopic;
+    std::string willMessage;
+    bool willRetain = false;
+  };
+  struct Pending {
+    uint64_t dueMs;
+    int fd;
+    std::string packet;
+  };
+
+  void run();
+  void readClient(Client& client);
+  void handle(Client& client, const std::string& packet);
+  void publish(const std::string& topic, const std::string& payload, bool retain);
+  void sendPacket(Client& client, uint8_t type, const std::string& body);
+  void drop(int fd, bool sendWill);
+  Client* find(int fd);
+  static bool matches(const std::string& filter, const std::string& topic);
+  static uint64_t nowMs();
+
+  int _listen = -1;
+  uint16_t _port = 0;
+  std::atomic<bool> _running{false};
+  std::atomic<uint32_t> _latencyMs{0};
+  std::atomic<bool> _kick{false};
+  std::thread _thread;
+  std::deque<Client> _clients;
+  std::deque<Pending> _pending;
+  std::vector<std::pair<std::string, std::string>> _retained;
+  std::vector<std::pair<std::string, std::vector<std::string>>> _sessions; // Client id, its filters
+  MiniBrokerStats _stats;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+// Just enough of the ESP32 Arduino core for the modules that hold no hardware state, so they
+// build and run on the host under the native env. Anything touching pins or NVS stays on the
+// device, of WiFi only the UDP multicast the LAN bus needs is here (WiFiUdp.h).
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <native_hal.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+
+#define IRAM_ATTR
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms); // Advances the clock
+void configTzTime(const char* tz, const char* server1, const char* server2 = nullptr, const char* server3 = nullptr);
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+size_t strlcpy(char* dst, const char* src, size_t size); // glibc only has it since 2.38
+#endif
+
+// The parts of Arduino's String the logic uses
+class String {
+public:
+  String() {}
+  String(const char* s) : _s(s ? s : "") {}
+  String(const std::string& s) : _s(s) {}
+  explicit String(int value) : _s(std::to_string(value)) {}
+  explicit String(unsigned value) : _s(std::to_string(value)) {}
+  explicit String(long value) : _s(std::to_string(value)) {}
+  explicit String(unsigned long value) : _s(std::to_string(value)) {}
+
+  const char* c_str() const { return _s.c_str(); }
+  unsigned int length() const { return _s.length(); }
+  bool operator==(const String& other) const { return _s == other._s; }
+  bool operator!=(const String& other) const { return _s != other._s; }
+  bool operator==(const char* other) const { return _s == other; }
+  String& operator+=(const String& other) { _s += other._s; return *this; }
+  String& operator+=(const char* other) { _s += other; return *this; }
+  String& operator+=(char c) { _s += c; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+  friend String operator+(const String& a, const char* b) { return String(a._s + b); }
+  friend String operator+(const String& a, int b) { return String(a._s + std::to_string(b)); }
+  friend String operator+(const String& a, unsigned b) { return String(a._s + std::to_string(b)); }
+  friend String operator+(const String& a, long b) { return String(a._s + std::to_string(b)); }
+  friend String operator+(const String& a, unsigned long b) { return String(a._s + std::to_string(b)); }
+
+private:
+  std::string _s;
+};
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() const { return HAL_FREE_HEAP; }
+};
+
+extern EspClass ESP;
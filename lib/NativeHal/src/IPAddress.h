@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// IPv4 only, what the LAN bus keeps per peer
+class IPAddress {
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _bytes{a, b, c, d} {}
+  uint8_t operator[](int index) const { return _bytes[index]; }
+  bool operator==(const IPAddress& other) const { return (uint32_t)*this == (uint32_t)other; }
+  // Network byte order, as sockaddr_in wants it
+  operator uint32_t() const { uint32_t value; __builtin_memcpy(&value, _bytes, 4); return value; }
+
+private:
+  uint8_t _bytes[4] = {0, 0, 0, 0};
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+// On the host the machine's own network stands in for WiFi, only the UDP parts the LAN bus uses exist
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <WiFiUdp.h>
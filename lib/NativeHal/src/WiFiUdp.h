@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+// WiFiUDP's multicast calls over a POSIX socket, so network.cpp runs unchanged on the host. Several
+// buses in one process share the port (SO_REUSEPORT) and each gets every packet on the group,
+// its own included, as on the device. The group is joined on halLanInterface(), loopback by default.
+class WiFiUDP {
+public:
+  ~WiFiUDP() { stop(); }
+
+  uint8_t beginMulticast(IPAddress group, uint16_t port);
+  void stop();
+
+  // Next datagram, its size or 0 when none is waiting. Never blocks.
+  int parsePacket();
+  int read(uint8_t* buffer, size_t size);
+  IPAddress remoteIP() const { return _remote; }
+
+  int beginMulticastPacket();
+  size_t write(const uint8_t* buffer, size_t size);
+  int endPacket();
+
+private:
+  int _fd = -1;
+  IPAddress _group;
+  uint16_t _port = 0;
+  IPAddress _remote;
+  uint8_t _rx[1500];
+  size_t _rxLength = 0;
+  size_t _rxRead = 0;
+  uint8_t _tx[1500];
+  size_t _txLength = 0;
+};
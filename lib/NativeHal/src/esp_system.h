@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Seeded with halSeedRandom(), not a hardware RNG
+uint32_t esp_random();
@@ -0,0 +1,65 @@
+#include <Arduino.h>
+#include <new>
+#include <esp_sntp.h>
+
+EspClass ESP;
+
+static int64_t halMicros = 0;
+static uint32_t halRandom = 0x9E3779B9;
+static sntp_sync_time_cb_t halSntpCallback = nullptr;
+static thread_local uint64_t halNewCount = 0; // Per thread, the MiniBroker thread allocates freely
+
+void halSetMicros(int64_t micros) { halMicros = micros; }
+void halAdvanceMicros(int64_t micros) { halMicros += micros; }
+uint64_t halAllocations() { return halNewCount; }
+void halSeedRandom(uint32_t seed) { halRandom = seed ? seed : 0x9E3779B9; }
+
+int64_t esp_timer_get_time() { return halMicros; }
+unsigned long millis() { return (unsigned long)(halMicros / 1000); }
+unsigned long micros() { return (unsigned long)halMicros; }
+void delay(uint32_t ms) { halMicros += (int64_t)ms * 1000; }
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) { halSntpCallback = callback; }
+void sntp_set_sync_interval(uint32_t) {}
+void configTzTime(const char* tz, const char*, const char*, const char*) { setenv("TZ", tz, 1); }
+
+void halSntpSync(int64_t epochMicros) {
+  if (halSntpCallback == nullptr) return;
+  struct timeval tv = { (time_t)(epochMicros / 1000000), (suseconds_t)(epochMicros % 1000000) };
+  halSntpCallback(&tv);
+}
+
+uint32_t esp_random() {
+  // xorshift32, plenty for jitter and nonces
+  halRandom ^= halRandom << 13;
+  halRandom ^= halRandom >> 17;
+  halRandom ^= halRandom << 5;
+  return halRandom;
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+size_t strlcpy(char* dst, const char* src, size_t size) {
+  size_t length = strlen(src);
+  if (size > 0) {
+    size_t n = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return length;
+}
+#endif
+
+// Counted global allocations, the soak test and the benchmarks fail on steady state allocations
+static void* halAllocate(size_t size) {
+  halNewCount++;
+  void* ptr = malloc(size ? size : 1);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t size) { return halAllocate(size); }
+void* operator new[](size_t size) { return halAllocate(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
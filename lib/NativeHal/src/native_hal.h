@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Controls for the host build. The clock never moves by itself: tests and the simulator set and
+// advance it, so millis(), micros() and esp_timer_get_time() are exact and repeatable.
+void halSetMicros(int64_t micros);
+void halAdvanceMicros(int64_t micros);
+inline void halAdvanceMillis(int64_t millis) { halAdvanceMicros(millis * 1000); }
+
+// operator new calls made by the calling thread since it started, new[] included. malloc() is not
+// counted, the JSON pool keeps its own count of heap fallbacks.
+uint64_t halAllocations();
+
+// Hands an SNTP result (epoch microseconds) to the registered sync callback, at the current clock
+void halSntpSync(int64_t epochMicros);
+
+// Address of the interface the LAN bus multicasts on, "127.0.0.1" unless set. Set it before
+// LanBus::begin() to reach boards or other hosts on a real network.
+void halLanInterface(const char* ip);
+
+// esp_random() becomes a seeded generator, the same seed gives the same run
+void halSeedRandom(uint32_t seed);
+
+#define HAL_FREE_HEAP 200000 // What ESP.getFreeHeap() reports, the host doesn't track the heap
@@ -0,0 +1,86 @@
+#include <WiFiUdp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static char halLanAddress[16] = "127.0.0.1";
+
+void halLanInterface(const char* ip) { strlcpy(halLanAddress, ip, sizeof(halLanAddress)); }
+
+uint8_t WiFiUDP::beginMulticast(IPAddress group, uint16_t port) {
+  stop();
+  _fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (_fd < 0) return 0;
+  int on = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  ip_mreq membership = {};
+  membership.imr_multiaddr.s_addr = (uint32_t)group;
+  inet_pton(AF_INET, halLanAddress, &membership.imr_interface);
+  if (bind(_fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+      setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0 ||
+      setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_IF, &membership.imr_interface, sizeof(membership.imr_interface)) != 0) {
+    stop();
+    return 0;
+  }
+  setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on));
+  _group = group;
+  _port = port;
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  if (_fd >= 0) close(_fd);
+  _fd = -1;
+  _rxLength = 0;
+  _rxRead = 0;
+}
+
+int WiFiUDP::parsePacket() {
+  if (_fd < 0) return 0;
+  sockaddr_in from = {};
+  socklen_t fromLength = sizeof(from);
+  ssize_t n = recvfrom(_fd, _rx, sizeof(_rx), 0, (sockaddr*)&from, &fromLength);
+  if (n <= 0) return 0;
+  uint32_t ip = ntohl(from.sin_addr.s_addr);
+  _remote = IPAddress(ip >> 24, ip >> 16, ip >> 8, ip);
+  _rxLength = n;
+  _rxRead = 0;
+  return n;
+}
+
+int WiFiUDP::read(uint8_t* buffer, size_t size) {
+  size_t n = min(size, _rxLength - _rxRead);
+  memcpy(buffer, _rx + _rxRead, n);
+  _rxRead += n;
+  return n;
+}
+
+int WiFiUDP::beginMulticastPacket() {
+  _txLength = 0;
+  return _fd >= 0;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+  size_t n = min(size, sizeof(_tx) - _txLength);
+  memcpy(_tx + _txLength, buffer, n);
+  _txLength += n;
+  return n;
+}
+
+int WiFiUDP::endPacket() {
+  if (_fd < 0) return 0;
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(_port);
+  to.sin_addr.s_addr = (uint32_t)_group;
+  return sendto(_fd, _tx, _txLength, 0, (sockaddr*)&to, sizeof(to)) == (ssize_t)_txLength;
+}
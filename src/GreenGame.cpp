@@ -46,6 +46,7 @@ void setup()
 //setup all the LED control pin
 {
   startTime = millis();
+  profiler.begin();
 
   // Initialize the LED pins
   pinMode(REDPIN,   OUTPUT);
@@ -57,15 +58,39 @@ void setup()
   pinMode(WHITEPIN, OUTPUT);
   digitalWrite(WHITEPIN, LOW);
 
-  prefs.begin("display", true);
-  colors.maxBrightness = prefs.getUInt("maxBrightness", 100); // Get max brightness from preferences, default to 255
-  colors.nightBrightness = prefs.getUInt("nightBrightness", 50); // Get max brightness from preferences, default to 255
-  colors.nightEnd = prefs.getUChar("nightEnd", 7); // Get night end hour from preferences, default to 7
-  colors.nightStart = prefs.getUChar("nightStart", 20); // Get night start hour from preferences, default to 20
+  loadConfig();
+  recorder.setClock(epochMillis, &syncEpoch);
+  recorder.record(REC_WINDOW, reorderWindow);
+
+  prefs.begin("game", true);
+  String storedRoom = prefs.getString("room", "");
+  roomStale = prefs.isKey("staleRoom");
+  strlcpy(staleRoom, prefs.getString("staleRoom", "").c_str(), sizeof(staleRoom));
+  prefs.end();
+
+  // Ordered broker list, falls back to the compiled in broker
+  prefs.begin("mqtt", true);
+  String storedBrokers = prefs.getString("brokers", "");
   prefs.end();
+  if (!brokerList.load(storedBrokers.c_str())) {
+    brokerList.load(BROKER);
+  }
+  setRoom(storedRoom.c_str(), false);
+
+  // Touches captured during a previous outage survive a reboot
+  prefs.begin("offline", true);
+  offlineCount = prefs.getBytes("touches", offlineTouches, sizeof(offlineTouches)) / sizeof(OfflineTouch);
+  prefs.end();
+  loadPlayerStats();
   //Configure the interupt for the cap touch sensor
-  pinMode(4, INPUT);
-  attachInterrupt(digitalPinToInterrupt(4), touchEvent, RISING);
+  esp_timer_create_args_t goTimerArgs = {};
+  goTimerArgs.callback = goTimerFired;
+  goTimerArgs.name = "go";
+  esp_timer_create(&goTimerArgs, &goTimer);
+
+  pinMode(TOUCH_PIN, INPUT);
+  gestures.setHandler(onTouchGesture);
+  attachInterrupt(digitalPinToInterrupt(TOUCH_PIN), touchEvent, CHANGE);
 
   Serial.begin(115200);
   //factoryReset(); //TODO #5 remove this in production, this is for testing purposes only, it clears the preferences
@@ -89,35 +114,15 @@ void setup()
   if (ssid.length() > 0 && pass.length() > 0) {
     sendLog("Found saved SSID '" + ssid + "', attempting to connect...", DEBUG);
     
-    //Retrieve and build the MAC string so we can use it later as a MQTT device identifier
-    String tmpMAC = getMacAddress();
-    strcpy(deviceID, tmpMAC.c_str());
-    removeColons(deviceID);
-
-    //Build the MQTT channel for this specific device, used to post status msgs, logs, targeted OTAs, etc.
-    String tmpdeviceChannel = String("funger/device/") + String(deviceID); 
-    strcpy (deviceChannel,tmpdeviceChannel.c_str());
-
-    client = new EspMQTTClient(
-      ssid.c_str(),         // TODO #1 Change to allow user to set wifi password
-      pass.c_str(),
-      BROKER,       // MQTT Broker server ip
-      MQTTu,        // Can be omitted if not needed
-      MQTTp,     // "green1" Client name that uniquely identify your device  #TODO #2 make MQTT login client name dynamic somehow
-      deviceName.c_str(),  // Client name that uniquely identify your device, default to "ESP32Client" if not set
-      1883          // The MQTT port, default to 1883. this line can be omitted
-    );
-
-    // Optional functionalities of EspMQTTClient
-    //client->enableDebuggingMessages(); // Enable debugging messages sent to serial output
-    client->enableLastWillMessage(deviceChannel, "{\"event\":\"Disconnected\"");  // You can activate the retain flag by setting the third parameter to true
-    client->setKeepAlive(15); // Set the keep alive interval in seconds, default is 15 seconds
+    buildDeviceTopics();
+    startTransport();
+    publisher.begin(client);
 
     unsigned long elapsed = millis() - startTime;    
 
     while(!client->isWifiConnected()){
       client->loop(); // Keep the MQTT client loop running to maintain WiFi connection
-      if(client->wifiConnectFailed == true) {
+      if(client->wifiConnectFailed()) {
         //factoryReset(); // Exit if WiFi connection failed
           startProvisioningAP();
 
@@ -140,34 +145,69 @@ void setup()
 
     }
     startTime = 0; // Reset start time after connection
-    sendLog("Connected to WiFi: " + ssid, INFO);
-    syncNTP();
-    calcCurrentTimeMillis(); 
-    printCurrentTimeMillis();
-
-    //Zero out the system time, we will use this time to compute who the winner is on a MQTT touch event
-    syncTime=millis();
-    startMillis = millis();  //initial start time
+    startGame();
     return;
   } else {
     Serial.println("No stored WiFi credentials.");
   }
   // If we get here, provisioning is needed
   auto networks = scanNetworks();
+  size_t used = 0;
   for (const auto& net : networks) {
-    options += "<option value=\"" + net.ssid + "\">" + net.ssid + " (" + String(net.rssi) + " dBm)</option>";
+    int written = snprintf(options + used, sizeof(options) - used, "<option value=\"%s\">%s (%d dBm)</option>",
+                           net.ssid.c_str(), net.ssid.c_str(), (int)net.rssi);
+    if (written < 0 || used + written >= sizeof(options)) {
+      options[used] = '\0'; // Drop the network that didn't fit, the weakest ones come last
+      break;
+    }
+    used += written;
   }
   sendLog(options, VERBOSE);
   startProvisioningAP();
 }
 
+void buildDeviceTopics() {
+  //Retrieve and build the MAC string so we can use it later as a MQTT device identifier
+  getMacAddress(deviceID);
+
+  //Build the MQTT channel for this specific device, used to post status msgs, logs, targeted OTAs, etc.
+  snprintf(deviceChannel, sizeof(deviceChannel), "funger/device/%s", deviceID);
+  snprintf(logChannel, sizeof(logChannel), "%s/logs", deviceChannel);
+  snprintf(summaryTopic, sizeof(summaryTopic), "%s/summary", deviceChannel);
+  snprintf(traceChannel, sizeof(traceChannel), "%s/trace", deviceChannel);
+  snprintf(deviceConfigTopic, sizeof(deviceConfigTopic), "%s/config", deviceChannel);
+  snprintf(mqttClientID, sizeof(mqttClientID), "fungers-%s", deviceID);
+}
+
+void startGame() {
+  // WiFi is up, either from the saved credentials at boot or straight out of the portal
+  sendLog("Connected to WiFi: " + ssid, INFO);
+  epochClock.begin(ntpServer, timeZone);
+  syncNTP();
+  printCurrentTimeMillis();
+
+  //Zero out the system time, we will use this time to compute who the winner is on a MQTT touch event
+  syncTime=millis();
+  syncEpoch = epochMillis();
+  recorder.record(REC_SYNC, 0, "boot");
+  startMillis = millis();  //initial start time
+  roundStats.heapBlocks = heapBlocks();
+  roundStats.jsonHeap = jsonPool.stats().heapAllocations;
+  powerSaver.begin(xTaskGetCurrentTaskHandle(), deviceConfig.idleAfter);
+  startSummaryWindow();
+}
+
 void loop()
 {
+  profiler.loopStart();
 
   // If in provisioning mode, handle incoming HTTP clients
-  if (WiFi.getMode() == WIFI_AP) {
+  if (portalActive) {
+    profiler.setPhase(PHASE_PORTAL);
     dnsServer.processNextRequest();  // handle captive-portal DNS
     server.handleClient();
+    provisionLoop();
+    profiler.setPhase(PHASE_LOOP);
 
     unsigned long elapsed = millis() - startTime;
     // Loop the transition
@@ -191,60 +231,116 @@ void loop()
   // If not in provisioning mode, handle normal operation
   else if (WiFi.getMode() == WIFI_STA || WiFi.getMode() == WIFI_AP_STA) {
     //Serial.println("Normal operation mode");
+    profiler.setPhase(PHASE_FAILOVER);
+    checkFailover();
+    if (transportBenchPending) {
+      transportBenchPending = false;
+      runTransportBench();
+    }
+    profiler.setPhase(PHASE_MQTT);
     client->loop(); //Wifi keep alive
+    profiler.setPhase(PHASE_TOUCH);
+    if (goRound.fired) {
+      goTriggered(); // Before the touches, so presses after the trigger are timed from it
+    }
+    pollTouchGestures();
     
     if (client->isMqttConnected()){
+      profiler.setPhase(PHASE_PUBLISH);
+      publisher.pump();
+
+      if (lanEnabled && !lanBus.active()) {
+        if (!lanBus.begin(deviceID, room, recieveLanEvents)) {
+          lanEnabled = false; // No multicast on this network, MQTT alone carries the game
+          sendLog("LAN multicast unavailable, using MQTT only", WARN);
+        }
+      }
+      profiler.setPhase(PHASE_LAN);
+      lanBus.loop();
+      profiler.setPhase(PHASE_LOOP);
+
+      if (offlineCount > 0) {
+        replayOfflineTouches();
+      }
+
+      if (otaSession.active) {
+        otaSessionLoop();
+      }
+
+      if (sessionDumpNext >= 0) {
+        dumpSessionPart();
+      }
+
+      if (millis() - summaryWindow.startedAt >= SUMMARY_INTERVAL) {
+        publishSummary();
+        if (playerStatsDirty) {
+          publishPlayerStats();
+        }
+      }
       
-      if (touchBtn.pressed) { //TODO #4 add support for press and hold events to trigger clearing of Wifi settings
+      if (touchBtn.pressed) {
+        PhaseScope phase(profiler, PHASE_TOUCH);
+        unsigned long pickupMicros = micros();
         deltaTime = touchBtn.touchTime - syncTime;
-        if (deltaTime >= debouceTime){
-          sendLog(String("touch Event at delta of: " + String(touchBtn.delta)), DEBUG);
+        bool holdoff = currentRound.decided && millis() - currentRound.decidedAt < ROUND_HOLDOFF;
+        bool falseStart = goRound.armed || (goRound.live && (int32_t)(touchBtn.touchMicros - (uint32_t)goRound.triggerMicros) < 0);
+        if (falseStart) {
+          setLEDColors(255, 0, 0, 0); // Red, touched before the go signal
+          sendLogf(INFO, "False start in go round %u", (unsigned)goRound.id);
+        }
+        else if (deltaTime >= debouceTime && !holdoff){
+          TouchTrace trace;
+          trace.id = touchBtn.traceID;
+          strcpy(trace.origin, deviceID);
+          trace.isrToPickup = pickupMicros - touchBtn.touchMicros;
+          trace.isrEpoch = epochMillis() - trace.isrToPickup / 1000;
+          trace.power = touchBtn.power;
+
+          sendLogf(DEBUG, "touch Event at delta of: %lu", touchBtn.delta);
           //set the color to green, this is the color we transition to when a touch event is detected
           //TODO #3 make the color transition to green when a touch event is detected
           setLEDColors(0, 0, 255, 0); 
 
           // Publish the events for other devices to see
-          StaticJsonDocument<200> jsonTxBuffer;
+          PooledJsonDocument jsonTxBuffer;
           jsonTxBuffer["event"] = "touch";
           jsonTxBuffer["device"] = deviceID; 
           jsonTxBuffer["delta"] = touchBtn.delta;
+          if (goRound.live) {
+            // Reaction measured against our own trigger, broker delivery of the go event doesn't enter into it
+            jsonTxBuffer["go"] = goRound.id;
+            jsonTxBuffer["reaction"] = (uint32_t)(touchBtn.touchMicros - (uint32_t)goRound.triggerMicros);
+          }
           time_t now;
           time(&now);
           jsonTxBuffer["time"] = now; //send the timestamp of the touch event
-          sendJSON(jsonTxBuffer, "funger/events/"); 
+
+          // Carry the sender side of the latency trace so the receiver can rebuild the full breakdown
+          trace.pickupToPub = micros() - pickupMicros;
+          trace.pubEpoch = epochMillis();
+          JsonObject jsonTrace = jsonTxBuffer["trace"].to<JsonObject>();
+          jsonTrace["id"] = trace.id;
+          jsonTrace["isr"] = trace.isrEpoch;
+          jsonTrace["pick"] = trace.isrToPickup;
+          jsonTrace["prep"] = trace.pickupToPub;
+          jsonTrace["pub"] = trace.pubEpoch;
+
+          unsigned long publishStart = micros();
+          sendGameEvent(jsonTxBuffer);
+          trace.publishTime = micros() - publishStart;
+          powerSaver.recordTouch(trace.power, trace.isrToPickup + trace.pickupToPub + trace.publishTime);
+          touchLatency.add(trace.isrToPickup + trace.pickupToPub + trace.publishTime);
+          publishTrace(trace);
+
+          queueTouch(deviceID, touchBtn.delta, trace, recorder.record(REC_TOUCH, touchBtn.delta, deviceID, REC_FLAG_LOCAL));
         }
 
         touchBtn.pressed = false;
       }
 
-      if (event.newEvent) {
-        //deltaTime = event.eventTime - syncTime;
-
-        Serial.println(touchBtn.touchTime - syncTime);
-        if (event.eventTime < (touchBtn.touchTime - syncTime)){
-          sendLog(String("they win\n Event occured at: " + String(event.eventTime) + "\n Last touch Event at: " + String(touchBtn.delta)), DEBUG);
-          
-
-          //the event happened sooner than our last touch event, filters out delayed messages?? thats what I am telling myself.
-          //set the color to red and sync the time
-          setLEDColors(0, 0, 0, 255); 
-
-          StaticJsonDocument<200> jsonTxBuffer;
-          jsonTxBuffer["event"] = "sync";
-          jsonTxBuffer["device"] = deviceID; 
-          sendJSON(jsonTxBuffer, "funger/events/");
-        }
-        else if (event.eventTime >= (touchBtn.touchTime - syncTime)){
-          sendLog(String("they lose\n Event occured at: " + String(event.eventTime) + "\n Last touch Event at: " + String(touchBtn.delta)), DEBUG);
-
-          StaticJsonDocument<200> jsonTxBuffer;
-          jsonTxBuffer["event"] = "sync";
-          jsonTxBuffer["device"] = deviceID; 
-          sendJSON(jsonTxBuffer, "funger/events/");
-        }
-
-        display(colors);
-        event.newEvent = false;    
+      // Judge the round once the reorder window after its first touch has passed
+      if (currentRound.count > 0 && millis() - currentRound.windowStart >= reorderWindow) {
+        decideRound();
       }
       
       else{
@@ -254,9 +350,32 @@ void loop()
       //display(colors); //TODO putting this here so we can have a progressive fade/blink/refresh in the future
       //delay(10); // If we are connected to MQTT, just wait a bit
     }
+
+      if (currentRound.count == 0 && !goRound.armed && !otaSession.active && sessionDumpNext < 0) {
+        powerSaver.loop(); // Nothing in flight, the idle mode may take over
+      }
     }
   
     else if(!client->isMqttConnected()){
+      if (!client->isWifiConnected()) {
+        lanBus.end(); // The socket dies with the interface, rejoin the group once we are back
+      }
+      if (mqttWasConnected && disconnectedAt == 0) {
+        // Connection just dropped, remember what the game was showing and start the backoff
+        disconnectedAt = max(millis(), 1UL);
+        savedColors = colors;
+        reconnectAttempts = 0;
+        nextReconnectAt = millis();
+        powerSaver.activity(); // Reconnect at full speed
+      }
+      scheduleReconnect();
+
+      // Keep touches made during the outage so they can be judged once we are back
+      if (touchBtn.pressed) {
+        storeOfflineTouch();
+        touchBtn.pressed = false;
+      }
+
       //Show magenta anytime the MQTT connection has died
       //TODO Change offline indicator to breatheing
       unsigned long elapsed = millis() - startTime;
@@ -283,9 +402,16 @@ void loop()
 }
 
 void IRAM_ATTR touchEvent(){
-  touchBtn.touchTime = millis();
-  touchBtn.delta = touchBtn.touchTime - syncTime;
-  touchBtn.pressed = true;
+  // Only timestamp the edge here, debouncing and gestures happen in pollTouchGestures()
+  uint8_t next = (edgeHead + 1) % EDGE_RING_SIZE;
+  if (next == edgeTail) {
+    gestures.overflows++;
+    return;
+  }
+  touchEdges[edgeHead].micros = micros();
+  touchEdges[edgeHead].level = gpio_ll_get_level(&GPIO, (gpio_num_t)TOUCH_PIN);
+  edgeHead = next;
+  powerSaver.wakeFromISR();
   //Serial.println("touch event detected");
   //Serial.println(touchBtn.touchTime);
   //Serial.println(touchBtn.delta);
@@ -293,26 +419,825 @@ void IRAM_ATTR touchEvent(){
   //Serial.println(millis());
 }
 
+void pollTouchGestures() {
+  // Run the debounce state machine over the edges the ISR buffered, then apply the time based transitions
+  while (edgeTail != edgeHead) {
+    TouchEdge edge = touchEdges[edgeTail];
+    edgeTail = (edgeTail + 1) % EDGE_RING_SIZE;
+    gestures.edge(edge);
+  }
+  gestures.poll(micros());
+}
+
+void onTouchGesture(TouchGesture gesture, uint32_t at, uint32_t duration) {
+  switch (gesture) {
+    case GESTURE_PRESS:
+      // Hand the press to the game with the time of the rising edge, not the time it was confirmed
+      touchBtn.touchMicros = at;
+      touchBtn.traceID++;
+      touchBtn.touchTime = millis() - (micros() - at) / 1000;
+      touchBtn.delta = touchBtn.touchTime - syncTime;
+      touchBtn.power = powerSaver.state();
+      touchBtn.pressed = true;
+      powerSaver.activity(); // Full speed before the press is published
+      break;
+    case GESTURE_RELEASE:
+      sendLogf(DEBUG, "touch released after %ums", (unsigned)(duration / 1000));
+      break;
+    case GESTURE_DOUBLE_TAP:
+      sendGesture("doubleTap", at, duration);
+      break;
+    case GESTURE_LONG_PRESS:
+      sendGesture("longPress", at, duration);
+      sendLog("Long press, clearing WiFi settings", WARN);
+      prefs.begin("wifi", false);
+      prefs.clear();
+      prefs.end();
+      delay(500);
+      ESP.restart();
+      break;
+  }
+}
+
+void sendGesture(const char* gesture, uint32_t at, uint32_t duration) {
+  // Gestures other than the plain press go to the device channel, the game only uses presses
+  if (!client->isMqttConnected()) return;
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "gesture";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["gesture"] = gesture;
+  jsonTxBuffer["at"] = epochMillis() - (micros() - at) / 1000;
+  jsonTxBuffer["duration"] = duration / 1000;
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+}
+
 void synchronize(){
   syncNTP();
   // Set the syncTime to the current millis, this will be used to calculate the delta
   syncTime = millis();
+  syncEpoch = epochMillis();
+  // A sync opens the next round, touches judged before it no longer count
+  currentRound.decided = false;
+  goRound.live = false;
+}
+
+uint64_t epochMicros() {
+  return epochClock.now64();
+}
+
+bool armGo(uint64_t at, uint32_t round) {
+  // Arm a one shot timer for the start instant (epoch ms), the earlier the go event arrives the less it matters when
+  int64_t delay = (int64_t)(at * 1000ULL) - (int64_t)epochMicros();
+  if (delay < GO_MIN_LEAD * 1000LL || delay > GO_MAX_LEAD * 1000LL) {
+    sendLog("go instant " + String(delay / 1000) + "ms away, not armed", WARN);
+    return false;
+  }
+
+  esp_timer_stop(goTimer); // A newer go replaces one that is still pending
+  goRound.id = round;
+  goRound.atMicros = at * 1000ULL;
+  goRound.lead = delay / 1000;
+  goRound.colors = scaledColors(0, 255, 0, 0); // Blue means go
+  goRound.fired = false;
+  goRound.armed = true;
+  setLEDColors(0, 0, 0, 40); // Dim white while the players wait
+  esp_timer_start_once(goTimer, delay);
+  return true;
+}
+
+void goTimerFired(void* arg) {
+  // esp_timer task: flip the pins first, then stamp the time, everything else waits for loop()
+  display(goRound.colors);
+  goRound.triggerMicros = esp_timer_get_time();
+  goRound.triggerEpochMicros = epochMicros();
+  goRound.armed = false;
+  goRound.fired = true;
+}
+
+void goTriggered() {
+  // The go trigger is this round's sync, touch deltas now count from the moment our LEDs changed
+  goRound.fired = false;
+  goRound.live = true;
+  colors = goRound.colors;
+  syncTime = goRound.triggerMicros / 1000; // millis() runs on the esp_timer clock
+  syncEpoch = goRound.triggerEpochMicros / 1000;
+  // Touches queued before our own trigger are left from an earlier round, no reaction beats the LEDs
+  currentRound.count = 0;
+  currentRound.dropped = 0;
+  currentRound.decided = false;
+  recorder.record(REC_SYNC, goRound.id, "go");
+
+  // How late our trigger was against the requested instant on our own clock. Comparing "trigger"
+  // across devices gives the cross-device skew, including each device's NTP error.
+  if (client->isMqttConnected()) {
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "go";
+    jsonTxBuffer["device"] = deviceID;
+    jsonTxBuffer["round"] = goRound.id;
+    jsonTxBuffer["trigger"] = goRound.triggerEpochMicros;
+    jsonTxBuffer["late"] = (int64_t)(goRound.triggerEpochMicros - goRound.atMicros);
+    jsonTxBuffer["lead"] = goRound.lead;
+    sendJSON(jsonTxBuffer, deviceChannel, LANE_TELEMETRY);
+  }
+}
+
+void storeOfflineTouch() {
+  // Capture a touch with its absolute time while the broker is unreachable
+  unsigned long delta = touchBtn.touchTime - syncTime;
+  if (delta < debouceTime) return;
+
+  if (offlineCount >= OFFLINE_QUEUE_SIZE) {
+    memmove(offlineTouches, offlineTouches + 1, sizeof(OfflineTouch) * (OFFLINE_QUEUE_SIZE - 1));
+    offlineCount--;
+  }
+  OfflineTouch& touch = offlineTouches[offlineCount++];
+  touch.at = epochMillis() - (millis() - touchBtn.touchTime);
+  touch.delta = delta;
+  touch.traceID = touchBtn.traceID;
+
+  prefs.begin("offline", false);
+  prefs.putBytes("touches", offlineTouches, sizeof(OfflineTouch) * offlineCount);
+  prefs.end();
+  sendLogf(DEBUG, "Offline touch queued at delta of: %lu", delta);
+}
+
+void replayOfflineTouches() {
+  // Publish the queued touches with their original times, receivers decide if they still fall in the round
+  for (uint8_t i = 0; i < offlineCount; i++) {
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "touch";
+    jsonTxBuffer["device"] = deviceID;
+    jsonTxBuffer["delta"] = offlineTouches[i].delta;
+    jsonTxBuffer["at"] = offlineTouches[i].at;
+    jsonTxBuffer["replay"] = true;
+    JsonObject jsonTrace = jsonTxBuffer["trace"].to<JsonObject>();
+    jsonTrace["id"] = offlineTouches[i].traceID;
+    jsonTrace["isr"] = offlineTouches[i].at;
+    jsonTrace["pub"] = epochMillis();
+    sendGameEvent(jsonTxBuffer); // Same path as a live touch: LAN copy and sequence number for the dedupe
+
+    // Our own copy competes under the same rule as everybody else's
+    if (offlineTouches[i].at >= syncEpoch) {
+      TouchTrace trace;
+      trace.id = offlineTouches[i].traceID;
+      strcpy(trace.origin, deviceID);
+      unsigned long delta = offlineTouches[i].at - syncEpoch;
+      queueTouch(deviceID, delta, trace, recorder.record(REC_TOUCH, delta, deviceID, REC_FLAG_LOCAL));
+    }
+  }
+  sendLog("Replayed " + String(offlineCount) + " offline touches", INFO);
+
+  offlineCount = 0;
+  prefs.begin("offline", false);
+  prefs.remove("touches");
+  prefs.end();
+}
+
+bool queueTouch(const char* device, unsigned long delta, const TouchTrace& trace, unsigned long now) {
+  // Collect a touch for the current round. The first touch opens the reorder window. `now` is the
+  // millis() the session recorder stamped on the touch or its event, a replay runs on the same clock.
+  return roundAddTouch(currentRound, device, delta, trace, now);
+}
+
+void decideRound() {
+  PhaseScope phase(profiler, PHASE_DECIDE);
+  // Rank every touch of the round and assign the FIRST/SECOND/OTHER placements
+  unsigned long decideStart = micros();
+  rankRound(currentRound, deviceID);
+  sendLogf(DEBUG, "Round decided: %u touches, winner %s at delta %lu, our placement %u", currentRound.count,
+           currentRound.touches[0].device, currentRound.touches[0].delta, currentRound.placement);
+  if (currentRound.dropped > 0) {
+    sendLogf(WARN, "Round queue overflowed, dropped %u touches", currentRound.dropped);
+  }
+
+  if (currentRound.placement == FIRST) {
+    setLEDColors(0, 0, 255, 0); // Green, we won
+    // Every device reaches the same ranking, so only the winner announces the end of the round
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "sync";
+    jsonTxBuffer["device"] = deviceID; 
+    sendGameEvent(jsonTxBuffer);
+  } else if (currentRound.placement == SECOND) {
+    setLEDColors(255, 0, 100, 0); // Amber, runner up
+  } else {
+    setLEDColors(0, 0, 0, 255); // White, someone else was faster
+  }
+
+  strcpy(roundStats.winner, currentRound.touches[0].device);
+  roundStats.placement = currentRound.placement;
+  if (currentRound.placement != NOT_PLACED) {
+    // Our best touch of the round, the ranking put it first among ours
+    for (uint8_t i = 0; i < currentRound.count; i++) {
+      if (strcmp(currentRound.touches[i].device, deviceID) == 0) {
+        playerStats.add(currentRound.touches[i].delta, currentRound.placement);
+        playerStatsDirty = true;
+        break;
+      }
+    }
+  }
+  uint32_t decide = micros() - decideStart;
+  for (uint8_t i = 0; i < currentRound.count; i++) {
+    TouchTrace& trace = currentRound.touches[i].trace;
+    if (trace.recvEpoch == 0) continue; // Our own touch, already traced when published
+    trace.recvToDecide = decideStart - trace.recvMicros;
+    trace.decide = decide;
+    roundStats.decideMax = max(roundStats.decideMax, trace.recvToDecide + trace.decide);
+    if (trace.pubEpoch != 0 && trace.recvEpoch >= trace.pubEpoch) {
+      transitLatency.add(trace.recvEpoch - trace.pubEpoch); // Senders without a trace, or a clock ahead of ours, are left out
+    }
+    publishTrace(trace);
+  }
+
+  finishRound(currentRound, recorder.record(REC_DECIDE, currentRound.count, currentRound.touches[0].device, currentRound.placement));
+}
+
+void startSessionDump(bool serial) {
+  if (serial) {
+    // One hex line per dump part, the same bytes the MQTT dump carries, tools/session_replay reads either
+    Serial.printf("SESSION %s %u records, %u overwritten\n", deviceID, (unsigned)recorder.count(), (unsigned)recorder.overwritten());
+    uint8_t part[SESSION_DUMP_BYTES];
+    uint16_t next = 0;
+    while (next < recorder.count()) {
+      uint16_t records = 0;
+      size_t used = recorder.write(next, part, sizeof(part), records);
+      if (records == 0) break;
+      for (size_t b = 0; b < used; b++) Serial.printf("%02x", part[b]);
+      Serial.println();
+      next += records;
+    }
+    return;
+  }
+  recorder.pause(true);
+  sessionDumpNext = 0;
+}
+
+void dumpSessionPart() {
+  // Paced by the telemetry lane, the next part is only handed over once the previous one has left
+  if (publisher.stats(LANE_TELEMETRY).depth > 0) return;
+
+  uint8_t part[SESSION_DUMP_BYTES];
+  uint16_t records = 0;
+  size_t used = recorder.write(sessionDumpNext, part, sizeof(part), records);
+  unsigned char encoded[(SESSION_DUMP_BYTES + 2) / 3 * 4 + 1];
+  size_t encodedLen = 0;
+  mbedtls_base64_encode(encoded, sizeof(encoded), &encodedLen, part, used);
+
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["first"] = sessionDumpNext;
+  jsonTxBuffer["total"] = recorder.count();
+  jsonTxBuffer["d"] = (const char*)encoded;
+  char topic[LANE_TOPIC_LEN];
+  snprintf(topic, sizeof(topic), "%s/session", deviceChannel);
+  sendJSON(jsonTxBuffer, topic, LANE_TELEMETRY);
+
+  sessionDumpNext += records;
+  if (records == 0 || sessionDumpNext >= recorder.count()) {
+    sessionDumpNext = -1;
+    recorder.pause(false);
+  }
+}
+
+void reportSessionReplay() {
+  // One pass of the recording through the parser and the round engine, every recorded decision has
+  // to come out the same. Blocks loop() for a few ms, tools/session_replay repeats it on the host
+  // to measure the engine's throughput.
+  unsigned long start = micros();
+  ReplayResult result = replaySession(recorder, deviceID);
+  unsigned long elapsed = micros() - start;
+
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "session";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["records"] = recorder.count();
+  jsonTxBuffer["overwritten"] = recorder.overwritten();
+  jsonTxBuffer["rounds"] = result.rounds;
+  jsonTxBuffer["mismatched"] = result.mismatched;
+  jsonTxBuffer["firstMismatch"] = result.firstMismatch;
+  jsonTxBuffer["events"] = result.events;
+  jsonTxBuffer["rejected"] = result.rejected;
+  jsonTxBuffer["duplicates"] = result.duplicates;
+  jsonTxBuffer["unreadable"] = result.unreadable;
+  jsonTxBuffer["clockMismatched"] = result.clockMismatched;
+  jsonTxBuffer["micros"] = elapsed;
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+}
+
+// Inputs for the benchmark cases, built once so the cases time the function and not the setup
+static volatile uint32_t benchSink; // Results land here so the compiler can't drop the work
+static const char benchTouch[] = "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":1234,\"seq\":42,"
+                                 "\"trace\":{\"id\":7,\"isr\":1718000000123,\"pub\":1718000000125}}";
+static Round benchRound;
+static std::vector<NetworkInfo> benchNetworks;
+
+static void benchEase(uint32_t i) { benchSink = cubicEaseInOut((i % 1000) / 1000.0f) * 1000; }
+static void benchInterpolate(uint32_t i) { benchSink = interpolate(0, 255, (i % 100) / 100.0f); }
+static void benchScaleColors(uint32_t i) { benchSink = scaledColors(i, 255 - i, i * 3, i * 7).redBrightness; }
+static void benchMac(uint32_t i) {
+  char mac[13];
+  getMacAddress(mac);
+  benchSink = mac[i % 12];
+}
+static void benchParseTouch(uint32_t i) {
+  PooledJsonDocument jsonRxBuffer;
+  GameEvent event;
+  parseEvent(jsonRxBuffer, benchTouch, sizeof(benchTouch) - 1, event);
+  benchSink = event.delta + i;
+}
+static void benchSerializeTouch(uint32_t i) {
+  // The document a touch publishes, written out the way sendJSON() does it
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "touch";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["delta"] = 1000 + i % 500;
+  jsonTxBuffer["time"] = 1718000000 + i;
+  JsonObject jsonTrace = jsonTxBuffer["trace"].to<JsonObject>();
+  jsonTrace["id"] = i;
+  jsonTrace["isr"] = 1718000000123ULL + i;
+  jsonTrace["pick"] = 180;
+  jsonTrace["prep"] = 420;
+  jsonTrace["pub"] = 1718000000125ULL + i;
+  jsonTxBuffer["seq"] = i;
+  jsonTxBuffer["boot"] = 0x5EED;
+  char msg[LANE_PAYLOAD_LEN];
+  benchSink = serializeJson(jsonTxBuffer, msg);
+}
+static void benchRankRound(uint32_t i) {
+  Round r = benchRound;
+  benchSink = rankRound(r, benchRound.touches[i % ROUND_QUEUE_SIZE].device);
+}
+static void benchDedupe(uint32_t i) {
+  std::vector<NetworkInfo> networks = benchNetworks;
+  benchSink = dedupeNetworks(networks).size() + i;
+}
+
+static const BenchCase benchCases[] = {
+  { "ease",           benchEase,           20000, 500 },
+  { "interpolate",    benchInterpolate,    20000, 500 },
+  { "scaleColors",    benchScaleColors,    20000, 1000 },
+  { "mac",            benchMac,            1000,  50000 },
+  { "parseTouch",     benchParseTouch,     500,   100000 },
+  { "serializeTouch", benchSerializeTouch, 500,   100000 },
+  { "rankRound",      benchRankRound,      2000,  20000 },
+  { "dedupeNets",     benchDedupe,         200,   200000 },
+};
+#define BENCH_CASES (sizeof(benchCases) / sizeof(benchCases[0]))
+
+void runBenchmarks(bool saveBaseline) {
+  // Time every case in ns/op and compare with the baseline saved by an earlier run, or the compiled
+  // budget before there is one. Saved baselines survive OTA, so an update can be compared with its
+  // predecessor on the same board. Blocks loop() for a few hundred ms, so it refuses during a round.
+  if (currentRound.count > 0) {
+    sendLog("Benchmark refused, a round is being judged", WARN);
+    return;
+  }
+
+  // Round of full length with one equal delta so the tiebreak is exercised too
+  benchRound = Round();
+  for (uint8_t n = 0; n < ROUND_QUEUE_SIZE; n++) {
+    RoundTouch& touch = benchRound.touches[n];
+    touch.delta = 1000 + (n * 37) % 200;
+    snprintf(touch.device, sizeof(touch.device), "A4CF12F0C0%02X", (unsigned)(0xF0 - n));
+  }
+  benchRound.touches[ROUND_QUEUE_SIZE - 1].delta = benchRound.touches[0].delta;
+  benchRound.count = ROUND_QUEUE_SIZE;
+  // A scan the size of a busy venue: 24 entries, every SSID seen on two access points
+  benchNetworks.clear();
+  for (uint8_t n = 0; n < 24; n++) {
+    benchNetworks.push_back({ String("venue-") + (n % 12), -40 - n * 2 });
+  }
+
+  uint32_t baseline[BENCH_CASES] = {};
+  prefs.begin("bench", true);
+  bool haveBaseline = prefs.getBytes("baseline", baseline, sizeof(baseline)) == sizeof(baseline);
+  prefs.end();
+
+  uint32_t measured[BENCH_CASES];
+  uint8_t regressions = 0;
+  uint32_t mhz = getCpuFrequencyMhz();
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "bench";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["fw"] = FW_Version;
+  jsonTxBuffer["mhz"] = mhz;
+  jsonTxBuffer["baseline"] = haveBaseline ? "saved" : "budget";
+  // One row per case: name, ns/op, reference ns/op, heap blocks kept per 1000 ops, JSON heap fallbacks, ok
+  JsonArray jsonResults = jsonTxBuffer["results"].to<JsonArray>();
+  for (uint8_t c = 0; c < BENCH_CASES; c++) {
+    const BenchCase& bench = benchCases[c];
+    bench.run(0); // Warm the cache and any lazy allocations before timing
+    int32_t blocks = heapBlocks();
+    uint32_t jsonHeap = jsonPool.stats().heapAllocations;
+    uint32_t cycles = ESP.getCycleCount();
+    for (uint32_t i = 0; i < bench.iterations; i++) {
+      bench.run(i);
+    }
+    cycles = ESP.getCycleCount() - cycles;
+    measured[c] = (uint64_t)cycles * 1000 / mhz / bench.iterations;
+
+    uint32_t reference = haveBaseline ? baseline[c] : bench.budgetNs;
+    jsonHeap = jsonPool.stats().heapAllocations - jsonHeap;
+    bool ok = (reference == 0 || measured[c] <= (uint64_t)reference * (100 + BENCH_TOLERANCE_PCT) / 100) && jsonHeap == 0;
+    if (!ok) {
+      regressions++;
+      sendLogf(WARN, "Benchmark %s regressed: %u ns/op, reference %u", bench.name, (unsigned)measured[c], (unsigned)reference);
+    }
+    JsonArray jsonResult = jsonResults.add<JsonArray>();
+    jsonResult.add(bench.name);
+    jsonResult.add(measured[c]);
+    jsonResult.add(reference);
+    jsonResult.add((heapBlocks() - blocks) * 1000 / (int32_t)bench.iterations);
+    jsonResult.add(jsonHeap);
+    jsonResult.add(ok);
+  }
+  jsonTxBuffer["regressions"] = regressions;
+  benchNetworks.clear();
+  benchNetworks.shrink_to_fit();
+
+  if (saveBaseline) {
+    prefs.begin("bench", false);
+    prefs.putBytes("baseline", measured, sizeof(measured));
+    prefs.end();
+    jsonTxBuffer["saved"] = true;
+  }
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
 }
 
-void calcCurrentTimeMillis() {
-  // Calculate the boot time in milliseconds since the epoch
-  time_t now;
-  time(&now);
-  bootTimeMillis = now * 1000UL - millis();
+static uint32_t benchEchoes = 0;
+static void receiveBenchEcho(const char* msg, size_t length) { benchEchoes++; }
+
+void runTransportBench() {
+  // The same burst through whichever MQTT backend this build has, flash each MQTT_TRANSPORT_* env and
+  // compare the replies: publish cost, heap taken, and how fast the burst comes back from the broker
+  char topic[48];
+  snprintf(topic, sizeof(topic), "funger/device/%s/bench", deviceID);
+  if (currentRound.count > 0 || !client->isMqttConnected() || !client->subscribe(topic, receiveBenchEcho)) {
+    sendLog("Transport benchmark refused, a round is being judged or the broker is away", WARN);
+    return;
+  }
+  // The SUBACK has to be back before the burst, publish until one comes through
+  benchEchoes = 0;
+  for (uint8_t i = 0; i < 10 && benchEchoes == 0; i++) {
+    client->publish(topic, "{}");
+    for (unsigned long start = millis(); benchEchoes == 0 && millis() - start < 100;) client->loop();
+  }
+
+  TransportStats before = client->stats();
+  int32_t blocks = heapBlocks();
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t publishMax = 0;
+  uint64_t publishTotal = 0;
+  benchEchoes = 0;
+  unsigned long start = millis();
+  for (uint16_t n = 0; n < TRANSPORT_BENCH_MESSAGES; n++) {
+    uint32_t publishStart = micros();
+    client->publish(topic, benchTouch);
+    uint32_t elapsed = micros() - publishStart;
+    publishTotal += elapsed;
+    publishMax = max(publishMax, elapsed);
+    client->loop(); // Drain the echoes as they come so no buffer fills up
+  }
+  while (benchEchoes < TRANSPORT_BENCH_MESSAGES && millis() - start < TRANSPORT_BENCH_WAIT) {
+    client->loop();
+  }
+  unsigned long elapsed = millis() - start;
+  int32_t heapHeld = (int32_t)freeHeap - (int32_t)ESP.getFreeHeap(); // Still taken once the burst is through
+  client->unsubscribe(topic);
+  const TransportStats& after = client->stats();
+
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "bench";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["fw"] = FW_Version;
+  JsonObject jsonTransport = jsonTxBuffer["transport"].to<JsonObject>();
+  jsonTransport["name"] = client->name();
+  jsonTransport["msgs"] = TRANSPORT_BENCH_MESSAGES;
+  jsonTransport["fails"] = after.failures - before.failures;
+  jsonTransport["pubAvg"] = (uint32_t)(publishTotal / TRANSPORT_BENCH_MESSAGES);
+  jsonTransport["pubMax"] = publishMax;
+  jsonTransport["heapChurn"] = after.heapChurn - before.heapChurn;
+  jsonTransport["heapBlocks"] = heapBlocks() - blocks;
+  jsonTransport["heapHeld"] = heapHeld;
+  jsonTransport["echoes"] = benchEchoes;
+  jsonTransport["ms"] = elapsed;
+  jsonTransport["msgsPerSec"] = elapsed ? benchEchoes * 1000 / elapsed : 0;
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+}
+
+void publishStats() {
+  // Runtime counters, requested with a "stats" event so they cost nothing when nobody is looking
+  const TransportStats& transport = client->stats();
+  // Sent in four parts, all of it together is larger than a lane payload
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "stats";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["part"] = 1;
+  JsonObject jsonTransport = jsonTxBuffer["transport"].to<JsonObject>();
+  jsonTransport["name"] = client->name();
+  jsonTransport["pubs"] = transport.publishes;
+  jsonTransport["fails"] = transport.failures;
+  jsonTransport["pubAvg"] = transport.publishes ? (uint32_t)(transport.publishMicros / transport.publishes) : 0;
+  jsonTransport["pubMax"] = transport.publishMaxMicros;
+  jsonTransport["heapChurn"] = transport.heapChurn;
+  jsonTransport["rx"] = transport.received;
+  jsonTransport["connects"] = transport.connects;
+  jsonTransport["connectMs"] = transport.connectMillis;
+  jsonTransport["connectMax"] = transport.connectMaxMillis;
+  jsonTransport["connectHeap"] = transport.connectHeap;
+#ifdef MQTT_TLS
+  // Full handshake against a resumed TLS session, the last one of each
+  jsonTransport["tlsResumed"] = transport.tlsResumed;
+  jsonTransport["fullMs"] = transport.fullConnectMillis;
+  jsonTransport["fullHeap"] = transport.fullConnectHeap;
+  jsonTransport["resumedMs"] = transport.resumedConnectMillis;
+  jsonTransport["resumedHeap"] = transport.resumedConnectHeap;
+#endif
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+
+  jsonTxBuffer.clear();
+  jsonTxBuffer["event"] = "stats";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["part"] = 2;
+  // One row per broker in list order: host, last probe rtt, healthy
+  jsonTxBuffer["broker"] = brokerList.active();
+  JsonArray jsonBrokers = jsonTxBuffer["brokers"].to<JsonArray>();
+  for (uint8_t i = 0; i < brokerList.count(); i++) {
+    JsonArray jsonBroker = jsonBrokers.add<JsonArray>();
+    jsonBroker.add(brokerList.at(i).host);
+    jsonBroker.add(brokerList.at(i).rtt);
+    jsonBroker.add(brokerList.at(i).healthy);
+  }
+  // LAN bus: peers, sent, received, lost, duplicates, LAN won the race, MQTT won the race
+  const LanStats& lan = lanBus.stats();
+  JsonArray jsonLan = jsonTxBuffer["lan"].to<JsonArray>();
+  jsonLan.add(lanBus.peers());
+  jsonLan.add(lan.sent);
+  jsonLan.add(lan.received);
+  jsonLan.add(lan.lost);
+  jsonLan.add(lan.duplicates);
+  jsonLan.add(lan.lanFirst);
+  jsonLan.add(lan.mqttFirst);
+  // Clock discipline: synced, frequency correction in ppb, last sample error in us, holdover s, samples, steps, rejected
+  const ClockStats& clock = epochClock.stats();
+  JsonArray jsonClock = jsonTxBuffer["clock"].to<JsonArray>();
+  jsonClock.add(epochClock.synced());
+  jsonClock.add(epochClock.frequencyPpb());
+  jsonClock.add(clock.lastError);
+  jsonClock.add(epochClock.holdoverSeconds());
+  jsonClock.add(clock.samples);
+  jsonClock.add(clock.steps);
+  jsonClock.add(clock.rejected);
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+
+  jsonTxBuffer.clear();
+  jsonTxBuffer["event"] = "stats";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["part"] = 3;
+  // JSON memory: arenas in use, most in use, leases, no arena free, arena blocks, heap blocks, peak bytes,
+  // then serialize and deserialize avg/max in us
+  const JsonPoolStats& pool = jsonPool.stats();
+  JsonArray jsonPoolRow = jsonTxBuffer["json"].to<JsonArray>();
+  jsonPoolRow.add(jsonPool.leased());
+  jsonPoolRow.add(pool.peakLeased);
+  jsonPoolRow.add(pool.leases);
+  jsonPoolRow.add(pool.exhausted);
+  jsonPoolRow.add(pool.allocations);
+  jsonPoolRow.add(pool.heapAllocations);
+  jsonPoolRow.add(pool.peakBytes);
+  jsonPoolRow.add(serializeTiming.average());
+  jsonPoolRow.add(serializeTiming.maxMicros);
+  jsonPoolRow.add(deserializeTiming.average());
+  jsonPoolRow.add(deserializeTiming.maxMicros);
+  // Power: state, idle entries, idle s, then touches, avg and max us from ISR to published for active and idle
+  const PowerStats& power = powerSaver.stats();
+  JsonArray jsonPower = jsonTxBuffer["power"].to<JsonArray>();
+  jsonPower.add(powerSaver.state() == POWER_IDLE ? "idle" : "active");
+  jsonPower.add(power.idleEntries);
+  jsonPower.add(powerSaver.idleSeconds());
+  for (uint8_t i = 0; i < POWER_STATES; i++) {
+    const PowerLatency& latency = power.latency[i];
+    jsonPower.add(latency.touches);
+    jsonPower.add(latency.touches ? (uint32_t)(latency.totalMicros / latency.touches) : 0);
+    jsonPower.add(latency.maxMicros);
+  }
+  jsonTxBuffer["configRoom"] = deviceConfig.roomVersion;
+  jsonTxBuffer["configDevice"] = deviceConfig.deviceVersion;
+  jsonTxBuffer["configSkips"] = configSkips;
+  jsonTxBuffer["touchGlitches"] = gestures.glitches;
+  jsonTxBuffer["touchOverflows"] = gestures.overflows;
+  jsonTxBuffer["reconnects"] = reconnects;
+  jsonTxBuffer["reconnectLast"] = lastReconnectMs;
+  jsonTxBuffer["reconnectMax"] = maxReconnectMs;
+  jsonTxBuffer["freeHeap"] = ESP.getFreeHeap();
+  jsonTxBuffer["minFreeHeap"] = ESP.getMinFreeHeap();
+  jsonTxBuffer["maxAllocHeap"] = ESP.getMaxAllocHeap(); // Largest free block, shrinks as the heap fragments
+  jsonTxBuffer["heapBlocks"] = heapBlocks();
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+
+  jsonTxBuffer.clear();
+  jsonTxBuffer["event"] = "stats";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["part"] = 4;
+  jsonTxBuffer["oversized"] = jsonOversized;
+  // One row per lane (game, control, telemetry, summary, log): depth, maxDepth, sent, dropped, coalesced, waitMax, waitAvg
+  JsonArray jsonLanes = jsonTxBuffer["lanes"].to<JsonArray>();
+  for (uint8_t i = 0; i < PUBLISH_LANES; i++) {
+    const LaneStats& lane = publisher.stats(i);
+    JsonArray jsonLane = jsonLanes.add<JsonArray>();
+    jsonLane.add(lane.depth);
+    jsonLane.add(lane.maxDepth);
+    jsonLane.add(lane.sent);
+    jsonLane.add(lane.dropped);
+    jsonLane.add(lane.coalesced);
+    jsonLane.add(lane.maxWaitMs);
+    jsonLane.add(lane.sent ? lane.totalWaitMs / lane.sent : 0);
+  }
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+}
+
+static uint32_t counterDelta(uint32_t now, uint32_t before) {
+  // A recreated transport starts its counters over, count from zero then
+  return now >= before ? now - before : now;
+}
+
+static void addLatency(JsonDocument& json, const char* key, const LatencyHistogram& histogram) {
+  if (histogram.count() == 0) return;
+  JsonObject jsonLatency = json[key].to<JsonObject>();
+  jsonLatency["n"] = histogram.count();
+  jsonLatency["p50"] = histogram.quantile(0.5f);
+  jsonLatency["p99"] = histogram.quantile(0.99f);
+  jsonLatency["max"] = histogram.max();
+  histogram.write(jsonLatency["b"].to<JsonArray>());
+}
+
+void startSummaryWindow() {
+  const TransportStats& transport = client->stats();
+  summaryWindow.startedAt = millis();
+  summaryWindow.publishes = transport.publishes;
+  summaryWindow.failures = transport.failures;
+  summaryWindow.received = transport.received;
+  summaryWindow.dropped = 0;
+  for (uint8_t i = 0; i < PUBLISH_LANES; i++) {
+    summaryWindow.dropped += publisher.stats(i).dropped;
+  }
+  summaryWindow.reconnects = reconnects;
+  summaryWindow.rounds = roundStats.round;
+  touchLatency.clear();
+  transitLatency.clear();
+}
+
+void publishSummary() {
+  // Fleet telemetry: what happened during the last window, as deltas and fixed-edge histograms
+  // that any consumer can add up across windows and devices. The stats event stays for digging in.
+  const TransportStats& transport = client->stats();
+  uint32_t dropped = 0;
+  for (uint8_t i = 0; i < PUBLISH_LANES; i++) {
+    dropped += publisher.stats(i).dropped;
+  }
+
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "summary";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["fw"] = FW_Version;
+  jsonTxBuffer["hw"] = HW_Version;
+  jsonTxBuffer["up"] = millis() / 1000;
+  jsonTxBuffer["window"] = millis() - summaryWindow.startedAt;
+  jsonTxBuffer["pubs"] = counterDelta(transport.publishes, summaryWindow.publishes);
+  jsonTxBuffer["fails"] = counterDelta(transport.failures, summaryWindow.failures);
+  jsonTxBuffer["rx"] = counterDelta(transport.received, summaryWindow.received);
+  jsonTxBuffer["dropped"] = counterDelta(dropped, summaryWindow.dropped);
+  jsonTxBuffer["reconnects"] = (uint16_t)(reconnects - summaryWindow.reconnects);
+  jsonTxBuffer["rounds"] = roundStats.round - summaryWindow.rounds;
+  jsonTxBuffer["rssi"] = WiFi.RSSI();
+  jsonTxBuffer["heapMin"] = ESP.getMinFreeHeap();
+  addLatency(jsonTxBuffer, "touch", touchLatency);
+  addLatency(jsonTxBuffer, "transit", transitLatency);
+  if (measureJson(jsonTxBuffer) >= LANE_PAYLOAD_LEN) {
+    // A window with unusually spread latencies, keep the quantiles rather than lose the whole summary
+    jsonTxBuffer["touch"].remove("b");
+    jsonTxBuffer["transit"].remove("b");
+    jsonTxBuffer["partial"] = true;
+  }
+  sendJSON(jsonTxBuffer, summaryTopic, LANE_SUMMARY);
+  startSummaryWindow();
+}
+
+void loadPlayerStats() {
+  prefs.begin("player", true);
+  bool loaded = prefs.getBytes("stats", &playerStats, sizeof(playerStats)) == sizeof(playerStats);
+  prefs.end();
+  if (!loaded || playerStats.layout != PLAYER_STATS_LAYOUT) {
+    playerStats.clear();
+  }
+  playerStatsSaved = playerStats.count;
+  playerStatsDirty = playerStats.count > 0; // Let the room know about us once we're connected
+}
+
+void publishPlayerStats() {
+  // Cumulative, so the room keeps the latest one per player and never needs the rounds themselves
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "player";
+  jsonTxBuffer["device"] = deviceID;
+  playerStats.write(jsonTxBuffer);
+  sendJSON(jsonTxBuffer, eventTopic, LANE_SUMMARY);
+  leaderboard.set(deviceID, playerStats);
+  playerStatsDirty = false;
+
+  // Written at the summary pace rather than every round, a reboot loses at most one window
+  if (playerStats.count != playerStatsSaved) {
+    prefs.begin("player", false);
+    prefs.putBytes("stats", &playerStats, sizeof(playerStats));
+    prefs.end();
+    playerStatsSaved = playerStats.count;
+  }
+}
+
+void publishLeaderboard() {
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "leaderboard";
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["room"] = room;
+  leaderboard.set(deviceID, playerStats);
+  leaderboard.write(jsonTxBuffer, LANE_PAYLOAD_LEN);
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+}
+
+void publishProfile() {
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "profile";
+  jsonTxBuffer["device"] = deviceID;
+  profiler.report(jsonTxBuffer);
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+}
+
+void closeRound() {
+  // Report what this round cost us and who we think won. Rounds without a winner are still
+  // collecting the trailing syncs of the previous decision, so they stay open.
+  if (roundStats.winner[0] == '\0') return;
+
+  if (client->isMqttConnected()) {
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "round";
+    jsonTxBuffer["device"] = deviceID;
+    jsonTxBuffer["round"] = roundStats.round;
+    jsonTxBuffer["winner"] = roundStats.winner;
+    jsonTxBuffer["place"] = roundStats.placement;
+    jsonTxBuffer["msgs"] = roundStats.messages;
+    jsonTxBuffer["touches"] = roundStats.touches;
+    jsonTxBuffer["syncs"] = roundStats.syncs;
+    jsonTxBuffer["decideMax"] = roundStats.decideMax;
+    jsonTxBuffer["heapBlocks"] = heapBlocks() - roundStats.heapBlocks; // Should stay at 0 round after round
+    jsonTxBuffer["jsonHeap"] = jsonPool.stats().heapAllocations - roundStats.jsonHeap; // Documents that didn't fit the pool
+    jsonTxBuffer["duration"] = millis() - roundStats.startedAt;
+    sendJSON(jsonTxBuffer, deviceChannel, LANE_TELEMETRY);
+  }
+
+  uint32_t nextRound = roundStats.round + 1;
+  roundStats = RoundStats();
+  roundStats.round = nextRound;
+  roundStats.startedAt = millis();
+  roundStats.heapBlocks = heapBlocks();
+  roundStats.jsonHeap = jsonPool.stats().heapAllocations;
 }
 
 void printCurrentTimeMillis() {
-  unsigned long currentMillis = millis();
-  unsigned long currentTimeMillis = (bootTimeMillis + currentMillis);
-  sendLog("Current time in milliseconds since epoch: "+ String(currentTimeMillis), DEBUG);
+  sendLogf(DEBUG, "Current time in milliseconds since epoch: %llu", epochMillis());
+}
+
+uint64_t epochMillis() {
+  // Wall clock time in milliseconds, comparable between devices that share an NTP source
+  return epochClock.now64() / 1000;
 }
 
-void recieveEvents(const String& msg){
+void publishTrace(const TouchTrace& trace) {
+  // Sample the per-stage latency of a touch onto this device's trace channel.
+  // Local touches report the sender stages including the time spent in publish(),
+  // remote touches (recvEpoch set) add the broker transit and the time our loop took to judge the event.
+  if (TRACE_SAMPLE_EVERY == 0 || trace.id == 0) return;
+  if (tracesSeen++ % TRACE_SAMPLE_EVERY != 0) return;
+  if (!client->isMqttConnected()) return;
+
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["id"] = trace.id;
+  jsonTxBuffer["origin"] = trace.origin;
+  jsonTxBuffer["isrToPickup"] = trace.isrToPickup;
+  jsonTxBuffer["pickupToPub"] = trace.pickupToPub;
+  if (trace.recvEpoch == 0) {
+    jsonTxBuffer["publish"] = trace.publishTime;
+    jsonTxBuffer["power"] = trace.power == POWER_IDLE ? "idle" : "active";
+  } else {
+    jsonTxBuffer["receiver"] = deviceID;
+    jsonTxBuffer["path"] = trace.lan ? "lan" : "mqtt";
+    jsonTxBuffer["transit"] = (int64_t)(trace.recvEpoch - trace.pubEpoch); // ms, includes NTP offset between the two devices
+    jsonTxBuffer["recvToDecide"] = trace.recvToDecide;
+    jsonTxBuffer["decide"] = trace.decide;
+    jsonTxBuffer["total"] = (int64_t)(epochMillis() - trace.isrEpoch); // ms from the remote ISR to our decision
+  }
+  sendJSON(jsonTxBuffer, traceChannel, LANE_TELEMETRY);
+}
+
+void recieveEvents(const char* msg, size_t length){
+  PhaseScope phase(profiler, PHASE_EVENT);
   /*event types:
     0: No Event/Unknown
     FF: other event
@@ -322,10 +1247,30 @@ void recieveEvents(const String& msg){
     TODO 5: Disable touch events via MQTT
     TODO 6: factory reset
   */
-  StaticJsonDocument<300> jsonRxBuffer;
-  DeserializationError error = deserializeJson(jsonRxBuffer, msg);
-  if (error){
-    sendLog("event did not contain JSON: " + msg);
+  PooledJsonDocument jsonRxBuffer;
+  GameEvent event;
+  unsigned long parseStart = micros();
+  uint8_t type = parseEvent(jsonRxBuffer, msg, length, event);
+  deserializeTiming.add(micros() - parseStart);
+  // Everything we publish on the device channel or the room topic comes back to us. Only our own
+  // sync is acted on, the winner clears its timer on the echo like every other device.
+  bool own = strcmp(event.device, deviceID) == 0;
+  if (!own) roundStats.messages++;
+  if (own && type != GAME_EVENT_SYNC) {
+    return;
+  }
+  // Game events go into the session as the payload that arrived, commands don't steer rounds
+  bool recorded = type != GAME_EVENT_COMMAND;
+  uint32_t received = recorded ? recorder.recordEvent(event.device, msg, length, lanDelivery ? REC_FLAG_LAN : 0) : millis();
+  if (type == GAME_EVENT_INVALID){
+    sendLogf(INFO, "event rejected, %s: %.*s", event.reason, (int)min(length, (size_t)120), msg);
+  }
+  else if (lanDelivery && type != GAME_EVENT_TOUCH && type != GAME_EVENT_SYNC) {
+    return; //the LAN bus only carries game events, commands must come through the broker
+  }
+  else if (event.sequenced && !lanBus.accept(event.device, event.boot, event.seq, lanDelivery)) {
+    if (recorded) recorder.markLast(REC_FLAG_DUPLICATE);
+    return; //second copy of a game event, the LAN or MQTT copy already got here
   }
   else if(jsonRxBuffer["event"] == "OTA"){
     //Serial.println("got MQTT OTA event");
@@ -345,69 +1290,324 @@ void recieveEvents(const String& msg){
       sendLog("OTA event received but no URL provided.");
     }
   }  
+  else if(jsonRxBuffer["event"] == "otaMqtt"){ //firmware published once as chunks on a shared topic
+    if (!startOtaSession(jsonRxBuffer)) {
+      sendLog("MQTT OTA session rejected", WARN);
+    }
+  }
   else if(jsonRxBuffer["event"] == "connected"){
     return; //ignore connected events, we already know we are connected
   }
-  else if(jsonRxBuffer["event"] == "display"){
-    if (jsonRxBuffer.containsKey("maxBrightness")) {
-      colors.maxBrightness = jsonRxBuffer["maxBrightness"].as<u_int8_t>();
-      prefs.begin("display", false);
-      prefs.putUInt("maxBrightness", colors.maxBrightness);
-      prefs.end();
-      sendLog("Max brightness set to: " + String(colors.maxBrightness), DEBUG);
-    }
-    if (jsonRxBuffer.containsKey("nightBrightness")) {
-      colors.nightBrightness = jsonRxBuffer["nightBrightness"].as<u_int8_t>();
-      prefs.begin("display", false);
-      prefs.putUInt("nightBrightness", colors.nightBrightness);
-      prefs.end();
-      sendLog("Night brightness set to: " + String(colors.nightBrightness), DEBUG);
-    }
-      if (jsonRxBuffer.containsKey("nightStart")) {
-      colors.nightStart = jsonRxBuffer["nightStart"].as<u_int8_t>();
-      prefs.begin("display", false);
-      prefs.putUInt("nightStart", colors.nightStart);
-      prefs.end();
-      sendLog("Night mode start set to: " + String(colors.nightStart), DEBUG);
-    }
-      if (jsonRxBuffer.containsKey("nightEnd")) {
-      colors.nightEnd = jsonRxBuffer["nightEnd"].as<u_int8_t>();
-      prefs.begin("display", false);
-      prefs.putUInt("nightEnd", colors.nightEnd);
-      prefs.end();
-      sendLog("Night mode end hour set to: " + String(colors.nightEnd), DEBUG);
-    }
+  else if(jsonRxBuffer["event"] == "display"){ //single settings, kept for older tools, the retained config document replaces them
+    applyConfig(jsonRxBuffer, CONFIG_LEGACY, 0);
   }
-  else if(jsonRxBuffer["event"] == "touch"){
+  else if(type == GAME_EVENT_TOUCH){
     //Serial.println(msg);
     sendLog("got MQTT touch event");
+    roundStats.touches++;
+    powerSaver.activity();
     serializeJson(jsonRxBuffer, Serial);
-    if (jsonRxBuffer["device"] != deviceID){
-      event.newEvent = true;
-      event.eventTime = jsonRxBuffer["delta"];
-      event.deviceID = jsonRxBuffer["device"];
+
+    // Stamp the receive stage, the sender's stages came with the event
+    TouchTrace& trace = event.trace;
+    trace.recvEpoch = epochMillis();
+    trace.recvMicros = micros();
+    trace.lan = lanDelivery;
+
+    // A replayed offline touch only counts if it happened inside the current round window, its
+    // original delta was measured against a sync the room may have moved past
+    unsigned long delta;
+    if (!touchDelta(event, syncEpoch, delta)) {
+      sendLogf(DEBUG, "replayed touch from %s predates the current round, rejected", trace.origin);
+      return;
     }
-    else{
-      sendLog("this was our event",DEBUG);
+
+    if (!queueTouch(trace.origin, delta, trace, received)) {
+      sendLogf(DEBUG, "touch event from %s ignored, round already decided", trace.origin);
     }
     return;      
   }
-  else if(jsonRxBuffer["event"] == "sync"){ //someone just  processed a wining event - everyone clear thier timers to sync up
+  else if(type == GAME_EVENT_GO){ //reaction round starting at {"at": epoch ms}
+    powerSaver.activity(); // Awake before the go instant, not woken by it
+    armGo(event.at, event.round);
+  }
+  else if(type == GAME_EVENT_SYNC){ //someone just  processed a wining event - everyone clear thier timers to sync up
     sendLog("syncing time",DEBUG);   //will fire off everytime a player processes, this will not scale and will pump traffic
     synchronize();
+    recorder.record(REC_SYNC, 0, event.device);
+    roundStats.syncs++;
+    powerSaver.activity();
+    closeRound();
     //if(jsonRxBuffer["device"] != deviceID){} //no need to sync on our own event only others...wait maybe we do so everyone has round trip latency...test it...
     //  synchronize()
     //}
   } 
+  else if(jsonRxBuffer["event"] == "room"){ //move this device to another game room without a reboot
+    if (!setRoom(jsonRxBuffer["room"] | "")) {
+      sendLog("Invalid room id received", WARN);
+    }
+  }
+  else if(jsonRxBuffer["event"] == "game"){ //tune how rounds are judged: window, glitch, lan
+    applyConfig(jsonRxBuffer, CONFIG_LEGACY, 0);
+  }
+  else if(jsonRxBuffer["event"] == "brokers"){ //ordered broker list for this device/room, "host:port,host:port"
+    const char* list = jsonRxBuffer["list"] | "";
+    BrokerInfo previous = brokerList.current();
+    if (brokerList.load(list)) {
+      if (strcmp(previous.host, brokerList.current().host) != 0 || previous.port != brokerList.current().port) {
+        pendingBroker = brokerList.active(); // Our broker left the list, can't tear the transport down from its own callback
+      }
+      prefs.begin("mqtt", false);
+      prefs.putString("brokers", list);
+      prefs.end();
+      sendLog("Broker list set to: " + String(list), INFO);
+    } else {
+      sendLog("Invalid broker list received", WARN);
+    }
+  }
+  else if(jsonRxBuffer["event"] == "session"){ //dump, replay or clear the session recording
+    const char* action = jsonRxBuffer["action"] | "";
+    if (strcmp(action, "dump") == 0) {
+      startSessionDump(jsonRxBuffer["serial"] | false);
+    } else if (strcmp(action, "replay") == 0) {
+      reportSessionReplay();
+    } else if (strcmp(action, "clear") == 0) {
+      recorder.clear();
+      recorder.record(REC_WINDOW, reorderWindow);
+    }
+  }
+  else if(jsonRxBuffer["event"] == "bench"){ //time the hot functions, "action":"baseline" keeps the result as the new reference
+    const char* action = jsonRxBuffer["action"] | "";
+    if (strcmp(action, "transport") == 0) {
+      transportBenchPending = true; // The MQTT backend instead, run from loop() since it pumps the client
+    } else {
+      runBenchmarks(strcmp(action, "baseline") == 0);
+    }
+  }
+  else if(jsonRxBuffer["event"] == "player"){ //a player's reaction summary, or {"action":"reset"} for ours
+    const char* device = jsonRxBuffer["device"] | "";
+    if (device[0] == '\0') {
+      if (strcmp(jsonRxBuffer["action"] | "", "reset") == 0) {
+        playerStats.clear();
+        sendLog("Player stats reset", INFO);
+      }
+      publishPlayerStats();
+    }
+    else {
+      leaderboard.update(jsonRxBuffer);
+    }
+  }
+  else if(jsonRxBuffer["event"] == "leaderboard"){ //room ranking merged from the players' summaries
+    publishLeaderboard();
+  }
+  else if(jsonRxBuffer["event"] == "profile"){ //stack and CPU per task, loop stalls
+    publishProfile();
+  }
+  else if(jsonRxBuffer["event"] == "stats"){ //report runtime counters on the device channel
+    publishStats();
+  }
   else if(jsonRxBuffer["event"] == "reset"){ //clear all settings in the prefrences space and restart
     factoryReset();
   } 
   else {
-    sendLog("unknown JSON event type"), WARN;
+    sendLog("unknown JSON event type", WARN);
     //Serial.print(jsonRxBuffer);
   }
 }
 
+bool setRoom(const char* newRoom, bool persist) {
+  // Room ids become part of a topic, so only allow short names made of [A-Za-z0-9_-]
+  size_t len = strlen(newRoom);
+  if (len >= sizeof(room)) return false;
+  for (size_t i = 0; i < len; i++) {
+    if (!isalnum(newRoom[i]) && newRoom[i] != '_' && newRoom[i] != '-') return false;
+  }
+
+  char newTopic[sizeof(eventTopic)];
+  char newConfigTopic[sizeof(roomConfigTopic)];
+  roomTopics(newRoom, newTopic, newConfigTopic);
+
+  // Swap subscriptions at runtime so room membership changes without a reboot
+  bool online = client != nullptr && client->isMqttConnected();
+  if (online && strcmp(newTopic, eventTopic) != 0) {
+    client->unsubscribe(eventTopic);
+    client->subscribe(newTopic, recieveEvents, 1);
+    client->unsubscribe(roomConfigTopic);
+    client->subscribe(newConfigTopic, receiveRoomConfig, 1);
+  } else if (!online && !roomStale && eventTopic[0] != '\0' && strcmp(newTopic, eventTopic) != 0) {
+    // The broker keeps the old room in our persistent session, onConnectionEstablished() drops it
+    strcpy(staleRoom, room);
+    roomStale = true;
+  }
+
+  bool changed = strcmp(room, newRoom) != 0;
+  if (changed) {
+    leaderboard.clear(); // Players of the old room
+  }
+  strcpy(room, newRoom);
+  strcpy(eventTopic, newTopic);
+  strcpy(roomConfigTopic, newConfigTopic);
+
+  if (persist) {
+    if (changed) {
+      deviceConfig.roomVersion = 0; // The new room's document starts its own version sequence
+      saveConfig();
+    }
+    prefs.begin("game", false);
+    prefs.putString("room", room);
+    if (roomStale) prefs.putString("staleRoom", staleRoom); // Still to be unsubscribed after a reboot
+    prefs.end();
+    sendLog("Joined room '" + String(room) + "' on " + String(eventTopic), INFO);
+  }
+  return true;
+}
+
+void roomTopics(const char* name, char* events, char* config) {
+  // Both buffers hold sizeof(eventTopic)
+  if (name[0] == '\0') {
+    strcpy(events, "funger/events/");
+    strcpy(config, "funger/config");
+  } else {
+    snprintf(events, sizeof(eventTopic), "funger/rooms/%s/events", name);
+    snprintf(config, sizeof(roomConfigTopic), "funger/rooms/%s/config", name);
+  }
+}
+
+void loadConfig() {
+  // One blob holds the whole config, devices from before it existed start from their old per field settings
+  prefs.begin("config", true);
+  size_t length = prefs.getBytes("config", &deviceConfig, sizeof(deviceConfig));
+  prefs.end();
+  bool stored = length > 0 && deviceConfig.layout >= 1 && deviceConfig.layout <= CONFIG_LAYOUT;
+  if (stored && deviceConfig.layout < 2) {
+    deviceConfig.idleAfter = DeviceConfig().idleAfter; // Layout 1 ended before it, the bytes read there were padding
+  }
+  deviceConfig.layout = CONFIG_LAYOUT;
+
+  if (!stored) {
+    deviceConfig = DeviceConfig();
+    prefs.begin("display", true);
+    deviceConfig.maxBrightness = prefs.getUInt("maxBrightness", 100);
+    deviceConfig.nightBrightness = prefs.getUInt("nightBrightness", 50);
+    deviceConfig.nightEnd = prefs.getUChar("nightEnd", 7);
+    deviceConfig.nightStart = prefs.getUChar("nightStart", 20);
+    prefs.end();
+    prefs.begin("game", true);
+    deviceConfig.reorderWindow = prefs.getUShort("window", 150);
+    deviceConfig.glitchMicros = prefs.getUShort("glitch", 3000);
+    deviceConfig.lan = prefs.getBool("lan", true);
+    prefs.end();
+  }
+  useConfig();
+}
+
+void useConfig() {
+  // Push the config into the globals the rest of the firmware reads
+  colors.maxBrightness = deviceConfig.maxBrightness;
+  colors.nightBrightness = deviceConfig.nightBrightness;
+  colors.nightStart = deviceConfig.nightStart;
+  colors.nightEnd = deviceConfig.nightEnd;
+  if (reorderWindow != deviceConfig.reorderWindow) {
+    reorderWindow = deviceConfig.reorderWindow;
+    recorder.record(REC_WINDOW, reorderWindow);
+  }
+  gestures.glitchMicros = deviceConfig.glitchMicros;
+  lanEnabled = deviceConfig.lan;
+  if (!lanEnabled) lanBus.end();
+  powerSaver.setIdleAfter(deviceConfig.idleAfter);
+}
+
+void saveConfig() {
+  prefs.begin("config", false);
+  prefs.putBytes("config", &deviceConfig, sizeof(deviceConfig));
+  prefs.end();
+}
+
+int8_t configField(JsonDocument& json, const char* key, uint16_t bit, uint8_t scope, uint16_t& fields, long low, long high, long& value) {
+  // 1 when the field should be taken, 0 when absent or owned by the device document, -1 when out of range
+  if (!json.containsKey(key)) return 0;
+  fields |= bit;
+  if (scope == CONFIG_ROOM && (deviceConfig.deviceFields & bit)) return 0;
+  value = json[key].as<long>();
+  return (value >= low && value <= high) ? 1 : -1;
+}
+
+bool applyConfig(JsonDocument& json, uint8_t scope, uint32_t version) {
+  // Build the new config on a copy, one bad field rejects the whole document
+  DeviceConfig next = deviceConfig;
+  uint16_t fields = 0;
+  long value;
+  int8_t result;
+  bool valid = true;
+
+  if ((result = configField(json, "maxBrightness", CFG_MAX_BRIGHTNESS, scope, fields, 0, 100, value)) == 1) next.maxBrightness = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "nightBrightness", CFG_NIGHT_BRIGHTNESS, scope, fields, 0, 100, value)) == 1) next.nightBrightness = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "nightStart", CFG_NIGHT_START, scope, fields, 0, 23, value)) == 1) next.nightStart = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "nightEnd", CFG_NIGHT_END, scope, fields, 0, 23, value)) == 1) next.nightEnd = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "window", CFG_WINDOW, scope, fields, 0, 5000, value)) == 1) next.reorderWindow = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "glitch", CFG_GLITCH, scope, fields, 0, 50000, value)) == 1) next.glitchMicros = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "lan", CFG_LAN, scope, fields, 0, 1, value)) == 1) next.lan = value;
+  valid &= result >= 0;
+  if ((result = configField(json, "idle", CFG_IDLE, scope, fields, 0, 3600, value)) == 1) next.idleAfter = value;
+  valid &= result >= 0;
+
+  if (!valid) {
+    sendLog("Config rejected, a field is out of range", WARN);
+    return false;
+  }
+  if (scope == CONFIG_ROOM) {
+    next.roomVersion = version;
+  } else if (scope == CONFIG_DEVICE) {
+    next.deviceVersion = version;
+    next.deviceFields = fields;
+  }
+
+  deviceConfig = next;
+  saveConfig();
+  useConfig();
+  sendLog("Config applied: " + String(scope == CONFIG_ROOM ? "room" : scope == CONFIG_DEVICE ? "device" : "event") +
+          (version ? " v" + String(version) : String("")), INFO);
+  return true;
+}
+
+void receiveConfig(const char* msg, size_t length, uint8_t scope) {
+  PhaseScope phase(profiler, PHASE_EVENT);
+  if (length == 0) return; // Retained document deleted, keep what we have
+
+  // Look at the version alone first, an unchanged document costs one filtered parse and nothing else
+  PooledJsonDocument filter;
+  filter["version"] = true;
+  PooledJsonDocument peek;
+  if (deserializeJson(peek, msg, length, DeserializationOption::Filter(filter))) {
+    sendLog("Config document is not JSON", WARN);
+    return;
+  }
+  uint32_t version = peek["version"] | 0;
+  uint32_t current = (scope == CONFIG_ROOM) ? deviceConfig.roomVersion : deviceConfig.deviceVersion;
+  if (version <= current) {
+    configSkips++;
+    return;
+  }
+
+  PooledJsonDocument jsonRxBuffer;
+  if (deserializeJson(jsonRxBuffer, msg, length)) return;
+  applyConfig(jsonRxBuffer, scope, version);
+}
+
+void receiveRoomConfig(const char* msg, size_t length) {
+  receiveConfig(msg, length, CONFIG_ROOM);
+}
+
+void receiveDeviceConfig(const char* msg, size_t length) {
+  receiveConfig(msg, length, CONFIG_DEVICE);
+}
+
 void factoryReset() {
   // Reset the device to factory settings
   sendLog("Factory reset initiated.",WARN);
@@ -420,6 +1620,26 @@ void factoryReset() {
   prefs.begin("display", false);
   prefs.clear();
   prefs.end();
+
+  // Clear the broker list
+  prefs.begin("mqtt", false);
+  prefs.clear();
+  prefs.end();
+
+  // Clear room membership
+  prefs.begin("game", false);
+  prefs.clear();
+  prefs.end();
+
+  // Clear the applied config document
+  prefs.begin("config", false);
+  prefs.clear();
+  prefs.end();
+
+  // Drop touches queued while offline
+  prefs.begin("offline", false);
+  prefs.clear();
+  prefs.end();
   // Optionally, reset other settings or configurations here
 
   // Restart the device
@@ -428,42 +1648,189 @@ void factoryReset() {
 }
 
 
-String getMacAddress(){
+void getMacAddress(char* mac){
+  // WiFi station MAC as 12 hex digits without separators, mac must hold 13 chars
   uint8_t baseMac[6];
-  // Get MAC address for WiFi station
   esp_read_mac(baseMac, ESP_MAC_WIFI_STA);
+  formatMac(baseMac, mac);
+  sendLogf(DEBUG, "MAC Address :: %s", mac);
+}
 
-  char baseMacChr[18] = {0};
-  sprintf(baseMacChr, "%02X:%02X:%02X:%02X:%02X:%02X", baseMac[0], baseMac[1], baseMac[2], baseMac[3], baseMac[4], baseMac[5]);
-  String macAddress = String(baseMacChr);
+bool sendJSON(const JsonDocument& json, const char* channel, uint8_t lane){
+  char msg[LANE_PAYLOAD_LEN];
+  unsigned long serializeStart = micros();
+  size_t msgLen = serializeJson(json, msg);
+  serializeTiming.add(micros() - serializeStart);
+  if (measureJson(json) >= sizeof(msg)) {
+    // A cut off document is invalid JSON, receivers would drop it or lose its end. Not logged over
+    // MQTT, the log entry goes through here too.
+    jsonOversized++;
+    Serial.printf("sendJSON: %u byte document too large for %s, not published\n", (unsigned)measureJson(json), channel);
+    return false;
+  }
+  sendLogf(VERBOSE, "message length = %u", (unsigned)msgLen);
+  return publisher.publish(lane, channel, msg); // Goes out now unless more important traffic is waiting or the lane is over its rate
+}
+
+void sendGameEvent(JsonDocument& json) {
+  // Touch and sync go to LAN peers directly and through the broker, receivers keep whichever copy lands first
+  if (lanBus.active()) {
+    uint32_t seq = lanBus.nextSeq();
+    json["seq"] = seq;
+    json["boot"] = lanBus.boot();
+    char msg[LAN_PACKET_MAX];
+    serializeJson(json, msg);
+    lanBus.send(seq, msg);
+  }
+  sendJSON(json, eventTopic, LANE_GAME);
+}
+
+void recieveLanEvents(const char* msg, size_t length) {
+  lanDelivery = true;
+  recieveEvents(msg, length);
+  lanDelivery = false;
+}
+
+void startTransport() {
+  // Connect to the active entry of the broker list
+  client = createMqttTransport(
+    ssid.c_str(),         // TODO #1 Change to allow user to set wifi password
+    pass.c_str(),
+    brokerList.current().host,       // MQTT Broker server ip
+    MQTTu,        // Can be omitted if not needed
+    MQTTp,     // "green1" Client name that uniquely identify your device  #TODO #2 make MQTT login client name dynamic somehow
+    mqttClientID,  // Derived from the MAC, not the user name, so the broker can resume our session
+    brokerList.current().port
+  );
+
+  // Optional functionalities of the MQTT transport
+  client->enableLastWillMessage(deviceChannel, "{\"event\":\"Disconnected\"");  // You can activate the retain flag by setting the third parameter to true
+  client->setKeepAlive(15); // Set the keep alive interval in seconds, default is 15 seconds
+  client->enablePersistentSession(); // Subscriptions and QoS 1 messages survive a broker blip
+  client->setReconnectDelay(RECONNECT_MIN_DELAY);
+  client->setBufferSize(MQTT_BUFFER_SIZE);
+#ifdef MQTT_TLS
+  client->enableTls(MQTT_CA_CERT); // CA lives in flash via secrets.h, nothing else is trusted
+#endif
+}
+
+void probeBrokers() {
+  // Time a TCP connect to one broker per interval, bounded so a dead broker can't stall the game
+  if (brokerList.count() < 2 || millis() - lastProbe < BROKER_PROBE_INTERVAL) return;
+  if (currentRound.count > 0 || !client->isWifiConnected()) return; // Never while a round is being collected
+  lastProbe = millis();
+
+  uint8_t index = brokerList.nextProbe();
+  const BrokerInfo& broker = brokerList.at(index);
+  WiFiClient probe;
+  unsigned long start = millis();
+  bool reachable = probe.connect(broker.host, broker.port, BROKER_PROBE_TIMEOUT);
+  brokerList.recordProbe(index, reachable, millis() - start);
+  probe.stop();
+  sendLogf(VERBOSE, "Broker %s rtt %ums%s", broker.host, (unsigned)broker.rtt, broker.healthy ? "" : " unhealthy");
+}
+
+void checkFailover() {
+  if (pendingBroker >= 0) {
+    uint8_t index = pendingBroker;
+    pendingBroker = -1;
+    switchBroker(index);
+    return;
+  }
+  probeBrokers();
+  int8_t preferred = brokerList.select(client->isMqttConnected(), millis());
+  if (preferred >= 0) switchBroker(preferred);
+}
 
-  sendLog("MAC Address :: " + macAddress, DEBUG); // Log the MAC address with level 1
-  return String(baseMacChr);
+void switchBroker(uint8_t index) {
+  sendLogf(WARN, "Switching broker from %s to %s", brokerList.current().host, brokerList.at(index).host);
+  if (client->isMqttConnected() && disconnectedAt == 0) {
+    // Leaving a working broker (fail back), treat it like an outage so the LEDs come back afterwards
+    disconnectedAt = max(millis(), 1UL);
+    savedColors = colors;
+  }
+  delete client;
+  brokerList.setActive(index, millis());
+  startTransport();
+  publisher.setTransport(client);
 }
 
-void sendJSON(const JsonDocument& json, const char* channel){
-  char msg[255];
-  int msgLen =serializeJson(json, msg);
-  sendLog("message length = " + String(msgLen, DEC), VERBOSE);
-  client->publish(String(channel), msg); // You can activate the retain flag by setting the third parameter to true  
+void scheduleReconnect() {
+  // Exponential backoff with +-25% jitter so a fleet that lost the broker together doesn't return in lockstep.
+  // The transport retries on its own timer, we only retune the delay each time an attempt is due.
+  if ((long)(millis() - nextReconnectAt) < 0) return;
+
+  uint32_t delayMs = RECONNECT_MIN_DELAY << min(reconnectAttempts, (uint8_t)8);
+  delayMs = min(delayMs, (uint32_t)RECONNECT_MAX_DELAY);
+  delayMs = delayMs * 3 / 4 + esp_random() % (delayMs / 2 + 1);
+  if (reconnectAttempts < 255) reconnectAttempts++;
+
+  client->setReconnectDelay(delayMs);
+  nextReconnectAt = millis() + delayMs;
 }
 
 void onConnectionEstablished(){
   // This function is called once everything is connected (Wifi and MQTT), is used to register callbacks for MQTT messages recieved
-  // Subscribe to "mytopic/test" and display received message to Serial
-  client->subscribe("funger/events/", recieveEvents);
-  client->subscribe("funger/device/"+ String(deviceID), recieveEvents);
+  if (roomStale) {
+    // Room changed while we were offline, its old subscriptions would keep delivering to us
+    char staleTopic[sizeof(eventTopic)];
+    char staleConfigTopic[sizeof(roomConfigTopic)];
+    roomTopics(staleRoom, staleTopic, staleConfigTopic);
+    if (strcmp(staleTopic, eventTopic) != 0) {
+      client->unsubscribe(staleTopic);
+      client->unsubscribe(staleConfigTopic);
+    }
+    roomStale = false;
+    prefs.begin("game", false);
+    prefs.remove("staleRoom");
+    prefs.end();
+  }
+  // QoS 1 so the persistent session keeps them, and events sent while we were away are delivered on resume
+  client->subscribe(eventTopic, recieveEvents, 1);
+  client->subscribe(deviceChannel, recieveEvents, 1);
+  client->subscribe(roomConfigTopic, receiveRoomConfig, 1);   // Retained, so the current document arrives right away
+  client->subscribe(deviceConfigTopic, receiveDeviceConfig, 1);
   //client->subscribe(String("funger/OTA/" + String(deviceID)), fetchOTA);
+  client->setReconnectDelay(RECONNECT_MIN_DELAY);
+
+  if (mqttWasConnected) {
+    // Reconnect: skip the full announcement and put the game back exactly as it was
+    lastReconnectMs = disconnectedAt ? millis() - disconnectedAt : 0;
+    maxReconnectMs = max(maxReconnectMs, lastReconnectMs);
+    reconnects++;
+    disconnectedAt = 0;
+    colors = savedColors;
+    display(colors);
+
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "reconnected";
+    jsonTxBuffer["device"] = deviceID;
+    jsonTxBuffer["downtime"] = lastReconnectMs;
+    jsonTxBuffer["attempts"] = reconnectAttempts;
+    sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL);
+    return;
+  }
+  mqttWasConnected = true;
+
+  // What the previous boot was doing when it ended, if it ended badly or hung
+  PooledJsonDocument jsonBootReport;
+  jsonBootReport["event"] = "lastBoot";
+  jsonBootReport["device"] = deviceID;
+  if (profiler.takeBootReport(jsonBootReport)) {
+    sendJSON(jsonBootReport, deviceChannel, LANE_CONTROL);
+  }
 
   // Publish a message 
-  StaticJsonDocument<200> jsonTxBuffer;
+  PooledJsonDocument jsonTxBuffer;
   jsonTxBuffer["event"] = "connected";
   jsonTxBuffer["device"] = deviceID; 
   jsonTxBuffer["userName"] = deviceName;
   jsonTxBuffer["ipaddr"] = WiFi.localIP();
   jsonTxBuffer["FW_Ver"] = FW_Version;
   jsonTxBuffer["HW_Ver"] = HW_Version;
-  sendJSON(jsonTxBuffer, deviceChannel); 
+  jsonTxBuffer["room"] = room;
+  jsonTxBuffer["transport"] = client->name();
+  sendJSON(jsonTxBuffer, deviceChannel, LANE_CONTROL); 
 
   // Publish a message to "mytopic/test"
   // client->publish(deviceChannel, "Connected"); // You can activate the retain flag by setting the third parameter to true
@@ -491,6 +1858,7 @@ void updateFirmware(uint8_t *data, size_t len){
 }
 
 bool fetchOTA(const String& url, bool persist) { //#TODO #3 add status reporting over MQTT
+  PhaseScope phase(profiler, PHASE_OTA);
   bool status = false;
   String log;
 
@@ -564,52 +1932,249 @@ bool fetchOTA(const String& url, bool persist) { //#TODO #3 add status reporting
   return status;
 }
 
+//================================ MQTT OTA ==================================
+// The image is published once on funger/ota/<id>/chunks as {"n":index,"d":"<base64>"} and every device in
+// the room writes it straight into Update. Devices report progress on funger/ota/<id>/ack with a
+// cumulative {"next":n} every window and re-request only the chunks they missed with {"missing":[...]}.
+
+bool startOtaSession(JsonDocument& json) {
+  const char* id = json["session"] | "";
+  uint32_t size = json["size"] | 0;
+  uint16_t chunkSize = json["chunkSize"] | 0;
+  const char* md5 = json["md5"] | "";
+  if (otaSession.active || id[0] == '\0' || strlen(id) >= sizeof(otaSession.id) || strchr(id, '/') ||
+      size == 0 || chunkSize == 0 || chunkSize > OTA_CHUNK_MAX) {
+    return false;
+  }
+  // Without the MD5 nothing stops Update.end() from committing an image that was corrupted on the way
+  if (strlen(md5) != 32 || strspn(md5, "0123456789abcdefABCDEF") != 32) {
+    sendLog("MQTT OTA rejected, the start event needs the image MD5", WARN);
+    return false;
+  }
+  if (!Update.begin(size)) {
+    sendLog("Update.begin() failed!", WARN);
+    return false;
+  }
+  Update.setMD5(md5);
+
+  otaSession.active = true;
+  strcpy(otaSession.id, id);
+  snprintf(otaSession.chunkTopic, sizeof(otaSession.chunkTopic), "funger/ota/%s/chunks", id);
+  snprintf(otaSession.ackTopic, sizeof(otaSession.ackTopic), "funger/ota/%s/ack", id);
+  otaSession.size = size;
+  otaSession.chunkSize = chunkSize;
+  otaSession.chunks = (size + chunkSize - 1) / chunkSize;
+  otaSession.next = 0;
+  otaSession.lastAcked = 0;
+  otaSession.ahead = 0;
+  otaSession.duplicates = 0;
+  memset(otaSession.windowChunk, 0xFF, sizeof(otaSession.windowChunk));
+  otaSession.lastChunk = millis();
+  otaSession.gapSince = 0;
+  otaSession.lastRequest = millis();
+
+  client->subscribe(otaSession.chunkTopic, receiveOtaChunk);
+  sendLog("MQTT OTA " + String(id) + ": " + String(size) + " bytes in " + String(otaSession.chunks) + " chunks", INFO);
+  requestOtaChunks(false); // Tell the publisher we're listening
+  return true;
+}
+
+void receiveOtaChunk(const char* msg, size_t length) {
+  PhaseScope phase(profiler, PHASE_OTA);
+  PooledJsonDocument jsonRxBuffer;
+  if (!otaSession.active || deserializeJson(jsonRxBuffer, msg, length)) return;
+
+  uint16_t n = jsonRxBuffer["n"] | 0xFFFF;
+  const char* data = jsonRxBuffer["d"] | "";
+  if (n >= otaSession.chunks || n < otaSession.next) {
+    otaSession.duplicates++; // Resent for someone else
+    return;
+  }
+  if (n >= otaSession.next + OTA_WINDOW) {
+    // Further than the publisher should go, we must be missing chunk `next`. Start the gap timer
+    // so the hole is re-requested after OTA_NACK_MS instead of the stall timeout.
+    otaSession.duplicates++;
+    if (n > otaSession.ahead) otaSession.ahead = n;
+    if (otaSession.gapSince == 0) otaSession.gapSince = millis();
+    return;
+  }
+
+  uint8_t slot = n % OTA_WINDOW;
+  if (otaSession.windowChunk[slot] == n) {
+    otaSession.duplicates++;
+    return;
+  }
+  size_t decodedLen = 0;
+  if (mbedtls_base64_decode(otaSession.window[slot], OTA_CHUNK_MAX, &decodedLen, (const unsigned char*)data, strlen(data)) != 0 ||
+      decodedLen != otaChunkLength(n)) {
+    sendLog("MQTT OTA chunk " + String(n) + " is corrupt", WARN);
+    return;
+  }
+  otaSession.lastChunk = millis();
+  otaSession.windowLength[slot] = decodedLen;
+  otaSession.windowChunk[slot] = n;
+
+  // Write everything that is contiguous now, the window slides along with `next`
+  while (otaSession.active && otaSession.windowChunk[otaSession.next % OTA_WINDOW] == otaSession.next) {
+    uint8_t ready = otaSession.next % OTA_WINDOW;
+    otaSession.windowChunk[ready] = 0xFFFF;
+    otaSession.next++;
+    writeOtaChunk(otaSession.window[ready], otaSession.windowLength[ready]);
+  }
+
+  // Chunks parked behind a hole start the re-request timer
+  bool parked = otaSession.ahead > otaSession.next;
+  for (uint8_t i = 0; i < OTA_WINDOW; i++) {
+    if (otaSession.windowChunk[i] != 0xFFFF) parked = true;
+  }
+  if (!parked) {
+    otaSession.gapSince = 0;
+  } else if (otaSession.gapSince == 0) {
+    otaSession.gapSince = millis();
+  }
+}
+
+size_t otaChunkLength(uint16_t n) {
+  // Every chunk is exactly chunkSize, except the last one which holds what is left
+  if (n + 1 < otaSession.chunks) return otaSession.chunkSize;
+  return otaSession.size - (uint32_t)n * otaSession.chunkSize;
+}
+
+void writeOtaChunk(const uint8_t* data, size_t len) {
+  setLEDColors(255, 0, 0, 0); // Same red as the HTTP update
+  if (Update.write((uint8_t*)data, len) != len) {
+    sendLog("Update.write() failed: " + String(Update.errorString()), ERROR);
+    endOtaSession(false);
+    return;
+  }
+  if (otaSession.next == otaSession.chunks) {
+    endOtaSession(true);
+  } else if (otaSession.next - otaSession.lastAcked >= OTA_ACK_EVERY) {
+    requestOtaChunks(false);
+  }
+}
+
+void otaSessionLoop() {
+  PhaseScope phase(profiler, PHASE_OTA);
+  // Selective re-requests for holes in the window, a resend request when the stream stalls
+  unsigned long now = millis();
+  if (now - otaSession.lastChunk >= OTA_ABORT_MS) {
+    sendLog("MQTT OTA " + String(otaSession.id) + " timed out", ERROR);
+    endOtaSession(false);
+  } else if (otaSession.gapSince != 0 && now - otaSession.gapSince >= OTA_NACK_MS && now - otaSession.lastRequest >= OTA_NACK_MS) {
+    requestOtaChunks(false);
+  } else if (now - otaSession.lastChunk >= OTA_STALL_MS && now - otaSession.lastRequest >= OTA_STALL_MS) {
+    requestOtaChunks(true);
+  }
+}
+
+void requestOtaChunks(bool stalled) {
+  // Cumulative ack plus the holes inside our window, the publisher resends only those on the shared topic
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["next"] = otaSession.next;
+  if (stalled) jsonTxBuffer["stalled"] = true;
+
+  uint16_t highest = otaSession.next;
+  for (uint8_t i = 0; i < OTA_WINDOW; i++) {
+    if (otaSession.windowChunk[i] != 0xFFFF && otaSession.windowChunk[i] > highest) highest = otaSession.windowChunk[i];
+  }
+  if (otaSession.ahead > highest) highest = min((uint16_t)(otaSession.next + OTA_WINDOW), otaSession.ahead);
+  if (highest > otaSession.next) {
+    JsonArray missing = jsonTxBuffer["missing"].to<JsonArray>();
+    for (uint16_t n = otaSession.next; n < highest; n++) {
+      if (otaSession.windowChunk[n % OTA_WINDOW] != n) missing.add(n);
+    }
+  }
+  sendJSON(jsonTxBuffer, otaSession.ackTopic, LANE_CONTROL);
+  otaSession.lastAcked = otaSession.next;
+  otaSession.lastRequest = millis();
+}
+
+void endOtaSession(bool success) {
+  otaSession.active = false;
+  client->unsubscribe(otaSession.chunkTopic);
+
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["device"] = deviceID;
+  jsonTxBuffer["next"] = otaSession.next;
+  jsonTxBuffer["done"] = success;
+  jsonTxBuffer["duplicates"] = otaSession.duplicates;
+  sendJSON(jsonTxBuffer, otaSession.ackTopic, LANE_CONTROL);
+
+  if (!success || !Update.end(true)) {
+    sendLog("MQTT OTA failed: " + String(Update.errorString()), ERROR);
+    Update.abort();
+    display(colors);
+    return;
+  }
+  sendLog("\nUpdate Success, Total Size: " + String(otaSession.size) + "\nRebooting...\n", INFO);
+  publisher.pump(); // Let the final ack out before restarting
+  ESP.restart();
+}
+
 void sendLog(const String& log, int msgLevel) {
-  
+  writeLog(log.c_str(), msgLevel);
+}
+
+void sendLog(const char* log, int msgLevel) {
+  writeLog(log, msgLevel);
+}
+
+void sendLogf(int msgLevel, const char* format, ...) {
+  // printf style logging into a stack buffer, entries nobody would see are not even formatted
+  if (msgLevel > logLevelSerial && msgLevel > logLevelMQTT) return;
+  char entry[LOG_ENTRY_LEN];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(entry, sizeof(entry), format, args);
+  va_end(args);
+  writeLog(entry, msgLevel);
+}
+
+void writeLog(const char* entry, int msgLevel) {
   if (msgLevel <= logLevelSerial){
     // Log to Serial if the log level is less than or equal to the set log level
-    Serial.println(log);
+    Serial.println(entry);
   }
-    if (msgLevel <= logLevelMQTT && client->isMqttConnected()) {
+  if (msgLevel <= logLevelMQTT && client != nullptr && client->isMqttConnected()) {
     // Publish a message 
-    StaticJsonDocument<200> jsonTxBuffer;
+    PooledJsonDocument jsonTxBuffer;
     jsonTxBuffer["level"] = msgLevel;
-    jsonTxBuffer["entry"] = log; 
+    jsonTxBuffer["entry"] = entry; 
     time_t now;
     time(&now);
     jsonTxBuffer["time"] = now; //send the time of the log entry
-    sendJSON(jsonTxBuffer, ("funger/device/" + String(deviceID) + "/logs").c_str()); 
+    sendJSON(jsonTxBuffer, logChannel, LANE_LOG); 
   }
 }
 
+int32_t heapBlocks() {
+  // Blocks currently allocated, unlike free heap this moves with every allocation that isn't given back
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  return info.allocated_blocks;
+}
+
 void syncNTP() {
-  // Initialize and get the time
-  // Set up NTP with timezone support
-  configTzTime(timeZone, ntpServer); // timezone is a TZ string, e.g., "PST8PDT,M3.2.0,M11.1.0"
+  PhaseScope phase(profiler, PHASE_NTP);
+  // Refresh the local calendar time used by night mode. SNTP itself runs in the background since
+  // epochClock.begin() and feeds the disciplined clock, restarting it here would step the time.
   if (!getLocalTime(&timeinfo)) {
     sendLog("Failed to obtain time");
     return;
   }else{
     // timeinfo.tm_hour, timeinfo.tm_min, etc. now reflect local time (with offset applied)
-    sendLog("NTP Sync completed - " + String(timeinfo.tm_hour) + ":" + String(timeinfo.tm_min) + ":" + String(timeinfo.tm_sec), VERBOSE); // Adjust for your timezone if needed
+    sendLogf(VERBOSE, "NTP Sync completed - %d:%d:%d", timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec); // Adjust for your timezone if needed
   }
 
 }
 
-void removeColons(char* str) {
-  int length = strlen(str);
-  int j = 0; 
-  for (int i = 0; i < length; ++i) {
-    if (str[i] != ':') {
-      str[j++] = str[i];
-    }
-  }
-  str[j] = '\0'; // Null-terminate the modified string
-}
 
 
 //================================= Wifi Fucntions ===================================
 std::vector<NetworkInfo> scanNetworks() {
+  PhaseScope phase(profiler, PHASE_SCAN);
   WiFi.mode(WIFI_STA); // Ensure we're in station mode
   delay(100);          // Allow mode switch to settle
   std::vector<NetworkInfo> networks;
@@ -617,46 +2182,32 @@ std::vector<NetworkInfo> scanNetworks() {
   for (int i = 0; i < n; ++i) {
     networks.push_back({WiFi.SSID(i), WiFi.RSSI(i)});
   }
-  // Sort by RSSI (signal strength), descending
-  std::sort(networks.begin(), networks.end(), [](const NetworkInfo& a, const NetworkInfo& b) {
-    return a.rssi > b.rssi;
-  });
-  // Remove duplicates (same SSID)
-  std::vector<NetworkInfo> uniqueNetworks;
-  for (const auto& net : networks) {
-    bool exists = false;
-    for (const auto& u : uniqueNetworks) {
-      if (u.ssid == net.ssid) {
-        exists = true;
-        break;
-      }
-    }
-    if (!exists && net.ssid.length() > 0) uniqueNetworks.push_back(net);
-    if (uniqueNetworks.size() >= 10) break;
-  }
-  return uniqueNetworks;
+  return dedupeNetworks(networks);
 }
 
 void startProvisioningAP() {
+    if (portalActive) return;
+    portalActive = true;
     WiFi.mode(WIFI_AP); // Set WiFi mode to Access Point
     // Get device ID (MAC address without colons)
-    String mac = getMacAddress();
-    mac.replace(":", "");
-    String suffix = mac.substring(mac.length() - 4); // last 4 characters
-    String apName = "fungers-" + suffix;
+    char mac[13];
+    getMacAddress(mac);
+    char apName[16];
+    snprintf(apName, sizeof(apName), "fungers-%s", mac + 8); // last 4 characters
 
     WiFi.softAPConfig(apIP, gateway, subnet);
 
     // AP SSID will be "fungers-xxxx"
-    WiFi.softAP(apName.c_str());
+    WiFi.softAP(apName);
     //ip = WiFi.softAPIP();
-    Serial.printf("Provisioning AP started. Connect to http://%s (SSID: %s)\n", apIP.toString().c_str(), apName.c_str());
+    Serial.printf("Provisioning AP started. Connect to http://%s (SSID: %s)\n", apIP.toString().c_str(), apName);
 
     dnsServer.start(53, "*", apIP); // Start DNS server to redirect all requests to the AP IP
 
     // Setup HTTP routes required to host the captive portal
     server.on("/", HTTP_GET, handleRoot);
     server.on("/save", HTTP_POST, handleSave);
+    server.on("/status", HTTP_GET, handleStatus);
     // Handle common captive portal URLs
     server.on("/generate_204", HTTP_GET, handleRoot); // Android
     server.on("/fwlink", HTTP_GET, handleRoot);       // Windows
@@ -666,6 +2217,7 @@ void startProvisioningAP() {
     server.onNotFound(handleNotFound);
 
     server.begin();
+    provisionEvent = WiFi.onEvent(onProvisionWifiEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
 }
 
 // Handle root path: serve the form
@@ -797,7 +2349,7 @@ String page = String(R"rawliteral(
         <input id="deviceName" name="deviceName" type="text" class="p-1" />
       </div>
       <div class="text-center mt-1">
-        <button type="submit" class="button">Save &amp; Reboot</button>
+        <button type="submit" class="button">Connect</button>
       </div>
     </form>
   </div>
@@ -815,24 +2367,131 @@ String page = String(R"rawliteral(
   //server.send(200, "text/html", provisioningPage);
 }
 
-// Handle form submission: save credentials then reboot
+// Handle form submission: try the credentials live, they are only saved once the game can connect
 void handleSave() {
   String ssid = server.arg("ssid");
   String pass = server.arg("pass");
   String deviceName = server.arg("deviceName");
-  if (ssid.length() > 0 && pass.length() > 0 && deviceName.length() > 0 ) {
-    prefs.begin("wifi", false);
-    prefs.putString("ssid", ssid);
-    prefs.putString("pass", pass);
-    prefs.putString("deviceName", deviceName);
-    prefs.end();
-
-    server.send(200, psavePage);
-    delay(2000);
-    ESP.restart();
-  } else {
+  if (ssid.length() == 0 || pass.length() == 0 || deviceName.length() == 0) {
     server.send(400, "text/plain", "All field are required!");
+    return;
+  }
+  if (ssid.length() >= sizeof(provision.ssid) || pass.length() >= sizeof(provision.pass) ||
+      deviceName.length() >= sizeof(provision.deviceName)) {
+    server.send(400, "text/plain", "Network name, password or user name is too long");
+    return;
+  }
+  if (provision.state == PROVISION_JOINING || provision.state == PROVISION_MQTT) {
+    server.send(409, "text/plain", "Already testing a network");
+    return;
   }
+
+  strlcpy(provision.ssid, ssid.c_str(), sizeof(provision.ssid));
+  strlcpy(provision.pass, pass.c_str(), sizeof(provision.pass));
+  strlcpy(provision.deviceName, deviceName.c_str(), sizeof(provision.deviceName));
+  strlcpy(provision.message, "Joining the network", sizeof(provision.message));
+  provision.reason = 0;
+  provision.state = PROVISION_JOINING;
+  provision.startedAt = millis();
+
+  // The AP stays up next to the station, it follows the station to the network's channel
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.begin(provision.ssid, provision.pass);
+  sendLogf(INFO, "Testing WiFi credentials for %s", provision.ssid);
+  server.send(200, "text/html", psavePage);
+}
+
+// Progress of the credential test, polled by the page handleSave() served
+void handleStatus() {
+  static const char* const states[] = { "idle", "joining", "mqtt", "done", "failed" };
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["state"] = states[provision.state];
+  jsonTxBuffer["message"] = provision.message;
+  jsonTxBuffer["elapsed"] = millis() - provision.startedAt;
+  char body[160];
+  serializeJson(jsonTxBuffer, body);
+  server.send(200, "application/json", body);
+}
+
+void onProvisionWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  // WiFi event task: keep why the join failed, provisionLoop() turns it into a message
+  provision.reason = info.wifi_sta_disconnected.reason;
+}
+
+void provisionLoop() {
+  // Walk the credentials from the portal through association, DHCP and the broker without dropping the AP
+  unsigned long elapsed = millis() - provision.startedAt;
+  switch (provision.state) {
+    case PROVISION_JOINING: {
+      uint8_t reason = provision.reason;
+      if (WiFi.status() == WL_CONNECTED && (uint32_t)WiFi.localIP() != 0) {
+        ssid = provision.ssid;
+        pass = provision.pass;
+        deviceName = provision.deviceName;
+        buildDeviceTopics();
+        if (client != nullptr) delete client; // Left over from a saved network that failed at boot
+        startTransport();
+        publisher.begin(client);
+        snprintf(provision.message, sizeof(provision.message), "Joined with address %s, connecting to the game",
+                 WiFi.localIP().toString().c_str());
+        provision.state = PROVISION_MQTT;
+        provision.startedAt = millis();
+      } else if (reason == WIFI_REASON_NO_AP_FOUND) {
+        failProvisioning("Network not found, check the name and that it is in range");
+      } else if (reason == WIFI_REASON_AUTH_FAIL || reason == WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT ||
+                 reason == WIFI_REASON_HANDSHAKE_TIMEOUT) {
+        failProvisioning("Wrong password");
+      } else if (elapsed > PROVISION_JOIN_TIMEOUT) {
+        failProvisioning(WiFi.status() == WL_CONNECTED ? "Joined, but the network gave us no address"
+                                                       : "Timed out joining the network");
+      }
+      break;
+    }
+    case PROVISION_MQTT:
+      client->loop();
+      if (client->isMqttConnected()) {
+        prefs.begin("wifi", false);
+        prefs.putString("ssid", ssid);
+        prefs.putString("pass", pass);
+        prefs.putString("deviceName", deviceName);
+        prefs.end();
+        strlcpy(provision.message, "Connected, this device is ready to play", sizeof(provision.message));
+        provision.state = PROVISION_DONE;
+        provision.startedAt = millis();
+        sendLogf(INFO, "Provisioned on %s", provision.ssid);
+      } else if (elapsed > PROVISION_MQTT_TIMEOUT) {
+        delete client;
+        client = nullptr;
+        failProvisioning("The network works, but the game server did not answer");
+      }
+      break;
+    case PROVISION_DONE:
+      client->loop();
+      if (elapsed > PROVISION_HANDOFF) {
+        finishProvisioning();
+      }
+      break;
+  }
+}
+
+void failProvisioning(const char* reason) {
+  // Nothing was saved, drop the station and keep serving the portal
+  strlcpy(provision.message, reason, sizeof(provision.message));
+  provision.state = PROVISION_FAILED;
+  WiFi.disconnect();
+  WiFi.mode(WIFI_AP);
+  sendLogf(WARN, "WiFi test failed: %s", reason);
+}
+
+void finishProvisioning() {
+  // Straight into game mode, the station connection and the broker session carry over
+  WiFi.removeEvent(provisionEvent);
+  dnsServer.stop();
+  server.stop();
+  WiFi.softAPdisconnect(true);
+  portalActive = false;
+  provision.state = PROVISION_IDLE;
+  startGame();
 }
 
 void handleNotFound() {
@@ -847,20 +2506,6 @@ void handleNotFound() {
 }
 
 //================================ Display Functions ==================================
-int interpolate(int start, int end, float t) {
-  return start + (end - start) * t;
-}
-
-// Cubic easing in/out: accelerating then decelerating
-float cubicEaseInOut(float t) {
-  if (t < 0.5) {
-    return 4 * t * t * t;
-  } else {
-    float f = (2 * t) - 2;
-    return 0.5 * f * f * f + 1;
-  }
-}
-
 void display(const struct LEDstruct led) {
   analogWrite(REDPIN, led.redBrightness);
   analogWrite(BLUEPIN, led.blueBrightness);
@@ -869,30 +2514,14 @@ void display(const struct LEDstruct led) {
 }
 
 void setLEDColors(uint8_t red, uint8_t blue, uint8_t green, uint8_t white) {
-  sendLog(String(timeinfo.tm_hour) + ":" + String(timeinfo.tm_min) + ":" + String(timeinfo.tm_sec), VERBOSE); // Adjust for your timezone if needed
-  int hour = timeinfo.tm_hour;
-
-  if (hour >= colors.nightEnd && hour < colors.nightStart ) {
-    // Daytime: Set colors to bright
-    colors.redBrightness = constrain(red, 0 , (255*colors.maxBrightness)/100);
-    colors.blueBrightness = constrain(blue, 0 , (255*colors.maxBrightness)/100);
-    colors.greenBrightness = constrain(green, 0 , (255*colors.maxBrightness)/100);
-    colors.whiteBrightness = constrain(white, 0 , (255*colors.maxBrightness)/100);
-    sendLog("Setting daytime LED colors: R=" + String(colors.redBrightness) + 
-            ", G=" + String(colors.greenBrightness) + 
-            ", B=" + String(colors.blueBrightness) + 
-            ", W=" + String(colors.whiteBrightness), VERBOSE);
-  } else {
-    // Nighttime: Dim the colors
-    colors.redBrightness = constrain((red * colors.nightBrightness) / 100, 0, (255*colors.maxBrightness)/100);
-    colors.blueBrightness = constrain((blue * colors.nightBrightness) / 100, 0, (255*colors.maxBrightness)/100);
-    colors.greenBrightness = constrain((green * colors.nightBrightness) / 100, 0, (255*colors.maxBrightness)/100);
-    colors.whiteBrightness = constrain((white * colors.nightBrightness) / 100, 0, (255*colors.maxBrightness)/100);
-    sendLog("Setting Nighttime LED colors: R=" + String(colors.redBrightness) + 
-          ", G=" + String(colors.greenBrightness) + 
-          ", B=" + String(colors.blueBrightness) + 
-          ", W=" + String(colors.whiteBrightness), VERBOSE);
-  }
-  
+  // Called for every animation frame, so the logging must cost nothing when VERBOSE is off
+  colors = scaledColors(red, blue, green, white);
+  sendLogf(VERBOSE, "%d:%d:%d Setting LED colors: R=%u, G=%u, B=%u, W=%u", timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+           colors.redBrightness, colors.greenBrightness, colors.blueBrightness, colors.whiteBrightness);
   display(colors);
   }
+
+LEDstruct scaledColors(uint8_t red, uint8_t blue, uint8_t green, uint8_t white) {
+  // Apply the day/night brightness limits without touching the LEDs, so a color can be prepared ahead of time
+  return scaleColors(colors, red, blue, green, white, timeinfo.tm_hour);
+}
@@ -0,0 +1,84 @@
+#include <broker_list.h>
+
+bool BrokerList::load(const char* list) {
+  BrokerInfo parsed[MAX_BROKERS];
+  uint8_t count = 0;
+  const char* entry = list;
+  while (*entry != '\0' && count < MAX_BROKERS) {
+    const char* end = strchr(entry, ',');
+    size_t len = end ? (size_t)(end - entry) : strlen(entry);
+    const char* colon = (const char*)memchr(entry, ':', len);
+    size_t hostLen = colon ? (size_t)(colon - entry) : len;
+    if (hostLen > 0 && hostLen < sizeof(parsed[count].host)) {
+      memcpy(parsed[count].host, entry, hostLen);
+      parsed[count].host[hostLen] = '\0';
+      parsed[count].port = colon ? atoi(colon + 1) : MQTT_PORT;
+      if (parsed[count].port != 0) count++;
+    }
+    if (end == nullptr) break;
+    entry = end + 1;
+  }
+  if (count == 0) return false;
+
+  uint8_t active = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (_count > 0 && strcmp(parsed[i].host, _brokers[_active].host) == 0 && parsed[i].port == _brokers[_active].port) {
+      active = i;
+    }
+  }
+  memcpy(_brokers, parsed, sizeof(parsed));
+  _count = count;
+  _active = active;
+  _probeIndex = 0;
+  return true;
+}
+
+uint8_t BrokerList::nextProbe() {
+  uint8_t index = _probeIndex;
+  _probeIndex = (_probeIndex + 1) % _count;
+  return index;
+}
+
+void BrokerList::recordProbe(uint8_t index, bool reachable, uint16_t rtt) {
+  BrokerInfo& broker = _brokers[index];
+  broker.rtt = rtt;
+  if (reachable && rtt <= BROKER_MAX_RTT) {
+    if (broker.streak < 255) broker.streak++;
+  } else {
+    broker.streak = 0;
+  }
+  broker.healthy = broker.streak >= BROKER_HEALTHY_STREAK;
+}
+
+int8_t BrokerList::select(bool connected, unsigned long now) {
+  if (connected) {
+    _offlineSince = 0;
+  } else if (_offlineSince == 0) {
+    _offlineSince = max(now, 1UL);
+  }
+  if (_count < 2) return -1;
+
+  bool failOver = _offlineSince != 0 && now - _offlineSince >= BROKER_FAILOVER_MS;
+  if (failOver) {
+    // The active broker is not giving us a session, whatever its TCP probe says
+    _brokers[_active].streak = 0;
+    _brokers[_active].healthy = false;
+  }
+
+  uint8_t preferred = _active;
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_brokers[i].healthy) {
+      preferred = i;
+      break;
+    }
+  }
+  // Move up the list as soon as a better broker is healthy, but only leave a broker that still
+  // gives us a session because of a slow probe once it has actually dropped us
+  if (preferred < _active || (preferred != _active && failOver)) return preferred;
+  return -1;
+}
+
+void BrokerList::setActive(uint8_t index, unsigned long now) {
+  _active = index;
+  _offlineSince = max(now, 1UL);
+}
@@ -0,0 +1,99 @@
+#include <epoch_clock.h>
+#include "esp_sntp.h"
+#include <sys/time.h>
+
+EpochClock* EpochClock::_instance = nullptr;
+
+void EpochClock::begin(const char* server, const char* timeZone) {
+  // Run on the system time until SNTP answers, so now64() is never undefined
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  Model model;
+  model.baseLocal = esp_timer_get_time();
+  model.baseEpoch = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+  publish(model);
+
+  _instance = this;
+  sntp_set_time_sync_notification_cb(onSntpSync);
+  sntp_set_sync_interval(CLOCK_SNTP_INTERVAL);
+  configTzTime(timeZone, server); // Also keeps localtime() right for the night mode hours
+}
+
+void EpochClock::onSntpSync(struct timeval* tv) {
+  // SNTP task: SNTP has just set the system time from a server response
+  int64_t local = esp_timer_get_time();
+  if (_instance != nullptr) {
+    _instance->addSample(local, (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec);
+  }
+}
+
+void EpochClock::addSample(int64_t local, int64_t epoch) {
+  int64_t predicted = predict(local);
+  int64_t error = epoch - predicted;
+  _stats.samples++;
+  _stats.lastError = constrain(error, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+
+  Model model = _models[_active];
+  if (!_synced || llabs(error) > CLOCK_STEP_US) {
+    // First sample or a clock that is hopelessly off: step, and start the frequency estimate over
+    model.baseLocal = local;
+    model.baseEpoch = epoch;
+    model.slew = 0;
+    model.slewLength = 0;
+    publish(model);
+    _synced = true;
+    _historyCount = 0;
+    _history[_historyCount++] = { local, epoch };
+    _stats.steps++;
+    _stats.lastSample = local;
+    return;
+  }
+
+  if (llabs(error) > CLOCK_OUTLIER_US && _outliers < 2) {
+    _outliers++; // A single bad response, unless the next ones agree with it
+    _stats.rejected++;
+    return;
+  }
+  _outliers = 0;
+  _stats.lastSample = local;
+
+  if (_historyCount == CLOCK_HISTORY) {
+    memmove(_history, _history + 1, sizeof(Sample) * (CLOCK_HISTORY - 1));
+    _historyCount--;
+  }
+  _history[_historyCount++] = { local, epoch };
+
+  // Frequency from the oldest to the newest sample, the longer the baseline the less NTP jitter matters
+  const Sample& oldest = _history[0];
+  int64_t baseline = local - oldest.local;
+  if (baseline >= CLOCK_MIN_BASELINE) {
+    int64_t drift = (epoch - oldest.epoch) - baseline;
+    int64_t freq = drift * (1LL << 32) / baseline;
+    int64_t limit = ((int64_t)CLOCK_MAX_PPM << 32) / 1000000;
+    model.freq = constrain(freq, -limit, limit);
+  }
+
+  // Continue from where the clock is now and slew the offset out instead of jumping
+  model.baseLocal = local;
+  model.baseEpoch = predicted;
+  int64_t rate = ((int64_t)CLOCK_SLEW_PPM << 32) / 1000000;
+  model.slew = error < 0 ? -rate : rate;
+  model.slewLength = llabs(error) * 1000000 / CLOCK_SLEW_PPM;
+  publish(model);
+}
+
+void EpochClock::publish(const Model& model) {
+  // Fill the model readers are not using, then switch them over in one store
+  uint8_t next = _active ^ 1;
+  _models[next] = model;
+  _active = next;
+}
+
+int32_t EpochClock::frequencyPpb() const {
+  return (int32_t)((_models[_active].freq * 1000000000LL) >> 32);
+}
+
+uint32_t EpochClock::holdoverSeconds() const {
+  if (_stats.lastSample == 0) return 0;
+  return (esp_timer_get_time() - _stats.lastSample) / 1000000;
+}
@@ -0,0 +1,67 @@
+#include <event_parser.h>
+
+static uint8_t reject(GameEvent& event, const char* reason) {
+  event.type = GAME_EVENT_INVALID;
+  event.reason = reason;
+  return GAME_EVENT_INVALID;
+}
+
+uint8_t parseEvent(JsonDocument& json, const char* msg, size_t length, GameEvent& event) {
+  event = GameEvent();
+  if (length > EVENT_MAX_PAYLOAD) return reject(event, "too long");
+  DeserializationError error = deserializeJson(json, msg, length);
+  if (error) return reject(event, error.c_str());
+  if (!json.is<JsonObject>()) return reject(event, "not an object");
+
+  const char* device = json["device"] | "";
+  if (strlen(device) >= sizeof(event.device)) return reject(event, "device id too long");
+  strlcpy(event.device, device, sizeof(event.device));
+  if (json.containsKey("seq")) {
+    if (!json["seq"].is<uint32_t>()) return reject(event, "bad seq");
+    event.sequenced = true;
+    event.seq = json["seq"];
+    event.boot = json["boot"] | 0u;
+  }
+
+  if (json["event"] == "touch") {
+    // A touch without a usable delta would otherwise compete as 0 and win every round
+    if (event.device[0] == '\0') return reject(event, "touch without device");
+    if (!json["delta"].is<uint32_t>()) return reject(event, "touch without delta");
+    event.delta = json["delta"];
+    event.replay = json["replay"] | false;
+    if (event.replay) {
+      if (!json["at"].is<uint64_t>()) return reject(event, "replayed touch without at");
+      event.at = json["at"];
+    }
+    strlcpy(event.trace.origin, event.device, sizeof(event.trace.origin));
+    JsonObject jsonTrace = json["trace"];
+    if (!jsonTrace.isNull()) {
+      event.trace.id = jsonTrace["id"] | 0u;
+      event.trace.isrEpoch = jsonTrace["isr"] | 0ULL;
+      event.trace.isrToPickup = jsonTrace["pick"] | 0u;
+      event.trace.pickupToPub = jsonTrace["prep"] | 0u;
+      event.trace.pubEpoch = jsonTrace["pub"] | 0ULL;
+    }
+    event.type = GAME_EVENT_TOUCH;
+  } else if (json["event"] == "sync") {
+    event.type = GAME_EVENT_SYNC;
+  } else if (json["event"] == "go") {
+    if (!json["at"].is<uint64_t>()) return reject(event, "go without at");
+    event.at = json["at"];
+    event.round = json["round"] | 0u;
+    event.type = GAME_EVENT_GO;
+  } else {
+    event.type = GAME_EVENT_COMMAND;
+  }
+  return event.type;
+}
+
+bool touchDelta(const GameEvent& event, uint64_t syncEpoch, unsigned long& delta) {
+  if (!event.replay) {
+    delta = event.delta;
+    return true;
+  }
+  if (event.at < syncEpoch) return false;
+  delta = event.at - syncEpoch;
+  return true;
+}
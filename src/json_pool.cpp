@@ -0,0 +1,102 @@
+#include <json_pool.h>
+
+JsonPool jsonPool;
+
+void* JsonHeapAllocator::allocate(size_t size) {
+  _stats->heapAllocations++;
+  return malloc(size);
+}
+
+void JsonHeapAllocator::deallocate(void* ptr) {
+  free(ptr);
+}
+
+void* JsonHeapAllocator::reallocate(void* ptr, size_t size) {
+  if (ptr == nullptr) _stats->heapAllocations++;
+  return realloc(ptr, size);
+}
+
+void* JsonArena::allocate(size_t size) {
+  size_t start = (_used + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+  if (start + size > JSON_ARENA_SIZE) {
+    return _heap->allocate(size); // Document larger than its arena, works but shows up in the stats
+  }
+  _last = start;
+  _used = start + size;
+  _stats->allocations++;
+  return _memory + start;
+}
+
+void JsonArena::deallocate(void* ptr) {
+  if (ptr == nullptr) return;
+  if (!owns(ptr)) {
+    _heap->deallocate(ptr);
+    return;
+  }
+  size_t offset = (uint8_t*)ptr - _memory;
+  if (offset == _last) {
+    _used = offset; // Newest block, the space can be reused right away
+    _last = SIZE_MAX;
+  }
+}
+
+void* JsonArena::reallocate(void* ptr, size_t size) {
+  if (ptr == nullptr) return allocate(size);
+  if (!owns(ptr)) return _heap->reallocate(ptr, size);
+
+  size_t offset = (uint8_t*)ptr - _memory;
+  if (offset == _last && offset + size <= JSON_ARENA_SIZE) {
+    _used = offset + size; // Growing a string while parsing, or shrinkToFit() after it
+    return ptr;
+  }
+  // Blocks are contiguous, the old one can't be larger than what follows it
+  size_t keep = min(size, _used - offset);
+  void* moved = allocate(size);
+  if (moved != nullptr) memcpy(moved, ptr, keep);
+  return moved;
+}
+
+void JsonArena::reset() {
+  if (_used > _stats->peakBytes) _stats->peakBytes = _used;
+  _used = 0;
+  _last = SIZE_MAX;
+  _leased = false;
+}
+
+JsonPool::JsonPool() {
+  _heap._stats = &_stats;
+  for (JsonArena& arena : _arenas) {
+    arena._heap = &_heap;
+    arena._stats = &_stats;
+  }
+}
+
+ArduinoJson::Allocator* JsonPool::acquire() {
+  for (JsonArena& arena : _arenas) {
+    if (arena._leased) continue;
+    arena._leased = true;
+    _stats.leases++;
+    uint8_t count = leased();
+    if (count > _stats.peakLeased) _stats.peakLeased = count;
+    return &arena;
+  }
+  _stats.exhausted++;
+  return &_heap;
+}
+
+void JsonPool::release(ArduinoJson::Allocator* allocator) {
+  for (JsonArena& arena : _arenas) {
+    if (&arena == allocator) {
+      arena.reset();
+      return;
+    }
+  }
+}
+
+uint8_t JsonPool::leased() const {
+  uint8_t count = 0;
+  for (const JsonArena& arena : _arenas) {
+    if (arena._leased) count++;
+  }
+  return count;
+}
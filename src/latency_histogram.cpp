@@ -0,0 +1,51 @@
+#include <latency_histogram.h>
+
+uint8_t LatencyHistogram::bucketOf(uint32_t value) {
+  if (value < 4) return value;
+  uint8_t e = 31 - __builtin_clz(value);
+  return 4 * e + ((value >> (e - 2)) & 3) - 4;
+}
+
+uint32_t LatencyHistogram::bucketLow(uint8_t index) {
+  if (index < 4) return index;
+  uint8_t e = (index + 4) / 4;
+  uint8_t sub = (index + 4) % 4;
+  return (uint32_t)(4 + sub) << (e - 2);
+}
+
+void LatencyHistogram::add(uint32_t value) {
+  uint16_t& bucket = _buckets[bucketOf(value)];
+  if (bucket != UINT16_MAX) bucket++; // Saturate, the summary window keeps counts far below this
+  _count++;
+  if (value > _max) _max = value;
+}
+
+void LatencyHistogram::clear() {
+  memset(_buckets, 0, sizeof(_buckets));
+  _count = 0;
+  _max = 0;
+}
+
+uint32_t LatencyHistogram::quantile(float q) const {
+  if (_count == 0) return 0;
+  uint32_t rank = q * (_count - 1);
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += _buckets[i];
+    if (seen > rank) {
+      uint32_t low = bucketLow(i);
+      uint32_t high = (i + 1 < HISTOGRAM_BUCKETS) ? bucketLow(i + 1) : UINT32_MAX;
+      return min(low + (high - low) / 2, _max);
+    }
+  }
+  return _max;
+}
+
+void LatencyHistogram::write(JsonArray buckets) const {
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (_buckets[i] == 0) continue;
+    JsonArray bucket = buckets.add<JsonArray>();
+    bucket.add(i);
+    bucket.add(_buckets[i]);
+  }
+}
@@ -0,0 +1,33 @@
+#include <led_math.h>
+
+int interpolate(int start, int end, float t) {
+  return start + (end - start) * t;
+}
+
+float cubicEaseInOut(float t) {
+  if (t < 0.5) {
+    return 4 * t * t * t;
+  } else {
+    float f = (2 * t) - 2;
+    return 0.5 * f * f * f + 1;
+  }
+}
+
+LEDstruct scaleColors(const LEDstruct& base, uint8_t red, uint8_t blue, uint8_t green, uint8_t white, int hour) {
+  LEDstruct led = base;
+
+  if (hour >= base.nightEnd && hour < base.nightStart ) {
+    // Daytime: Set colors to bright
+    led.redBrightness = constrain(red, 0 , (255*base.maxBrightness)/100);
+    led.blueBrightness = constrain(blue, 0 , (255*base.maxBrightness)/100);
+    led.greenBrightness = constrain(green, 0 , (255*base.maxBrightness)/100);
+    led.whiteBrightness = constrain(white, 0 , (255*base.maxBrightness)/100);
+  } else {
+    // Nighttime: Dim the colors
+    led.redBrightness = constrain((red * base.nightBrightness) / 100, 0, (255*base.maxBrightness)/100);
+    led.blueBrightness = constrain((blue * base.nightBrightness) / 100, 0, (255*base.maxBrightness)/100);
+    led.greenBrightness = constrain((green * base.nightBrightness) / 100, 0, (255*base.maxBrightness)/100);
+    led.whiteBrightness = constrain((white * base.nightBrightness) / 100, 0, (255*base.maxBrightness)/100);
+  }
+  return led;
+}
@@ -0,0 +1,795 @@
+#include <mqtt_transport.h>
+
+//================================ Common ==================================
+bool MqttTransport::publish(const char* topic, const char* payload, bool retain) {
+  // Time every publish and watch the heap so the backends can be compared against the same broker
+  uint32_t heapBefore = ESP.getFreeHeap();
+  unsigned long start = micros();
+  bool ok = doPublish(topic, payload, retain);
+  uint32_t elapsed = micros() - start;
+  uint32_t heapAfter = ESP.getFreeHeap();
+
+  if (ok) {
+    _stats.publishes++;
+    _stats.publishMicros += elapsed;
+    if (elapsed > _stats.publishMaxMicros) _stats.publishMaxMicros = elapsed;
+  } else {
+    _stats.failures++;
+  }
+  if (heapAfter < heapBefore) _stats.heapChurn += heapBefore - heapAfter;
+  return ok;
+}
+
+//============================= EspMQTTClient ===============================
+#ifdef MQTT_TRANSPORT_ESPMQTTCLIENT
+#include "EspMQTTClient.h"
+
+// Thin wrapper, EspMQTTClient already owns the WiFi connection and calls onConnectionEstablished() itself
+class EspMqttClientTransport : public MqttTransport {
+public:
+  EspMqttClientTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                         const char* user, const char* password, const char* clientName, uint16_t port)
+    : _client(wifiSsid, wifiPassword, broker, user, password, clientName, port) {}
+
+  const char* name() const override { return "EspMQTTClient"; }
+  void enableLastWillMessage(const char* topic, const char* message, bool retain) override {
+    _client.enableLastWillMessage(topic, message, retain);
+  }
+  void setKeepAlive(uint16_t seconds) override { _client.setKeepAlive(seconds); }
+  void enablePersistentSession() override { _client.enableMQTTPersistence(); }
+  void setReconnectDelay(uint32_t milliseconds) override { _client.setMqttReconnectionAttemptDelay(milliseconds); }
+  void setBufferSize(uint16_t bytes) override { _client.setMaxPacketSize(bytes); }
+
+  void loop() override { _client.loop(); }
+  bool isWifiConnected() override { return _client.isWifiConnected(); }
+  bool wifiConnectFailed() override { return _client.wifiConnectFailed; }
+  bool isMqttConnected() override { return _client.isMqttConnected(); }
+
+  bool subscribe(const char* topic, MqttMessageHandler handler, uint8_t qos) override {
+    return _client.subscribe(topic, [this, handler](const String& message) {
+      _stats.received++;
+      handler(message.c_str(), message.length());
+    }, qos);
+  }
+  bool unsubscribe(const char* topic) override { return _client.unsubscribe(topic); }
+
+protected:
+  bool doPublish(const char* topic, const char* payload, bool retain) override {
+    return _client.publish(topic, payload, retain);
+  }
+
+private:
+  EspMQTTClient _client;
+};
+
+MqttTransport* createMqttTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                                   const char* user, const char* password, const char* clientName, uint16_t port) {
+  return new EspMqttClientTransport(wifiSsid, wifiPassword, broker, user, password, clientName, port);
+}
+#endif
+
+//================================ esp-mqtt =================================
+#ifdef MQTT_TRANSPORT_ESP_IDF
+#include <WiFi.h>
+#include "esp_idf_version.h"
+#include "mqtt_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#define IDF_MQTT_MAX_SUBSCRIPTIONS 8
+#define IDF_MQTT_TOPIC_LEN 64
+#define IDF_MQTT_PAYLOAD_LEN 1024
+#define IDF_MQTT_INBOX_DEPTH 6
+
+void onConnectionEstablished();
+
+// Message copied off the esp-mqtt task, handed to loop() through a FreeRTOS queue
+struct IdfInboundMessage {
+  char topic[IDF_MQTT_TOPIC_LEN];
+  char payload[IDF_MQTT_PAYLOAD_LEN + 1];
+  size_t length;
+};
+
+struct IdfSubscription {
+  char topic[IDF_MQTT_TOPIC_LEN] = "";
+  MqttMessageHandler handler = nullptr;
+};
+
+// Event driven client: the network work happens on the esp-mqtt task, loop() only drains the inbox.
+// WiFi is joined here directly since there is no EspMQTTClient to do it.
+class EspIdfMqttTransport : public MqttTransport {
+public:
+  EspIdfMqttTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                      const char* user, const char* password, const char* clientName, uint16_t port)
+    : _broker(broker), _user(user), _password(password), _clientName(clientName), _port(port) {
+    _inbox = xQueueCreate(IDF_MQTT_INBOX_DEPTH, sizeof(IdfInboundMessage));
+    // A transport recreated for another broker keeps the existing WiFi association
+    if (WiFi.status() != WL_CONNECTED) {
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(wifiSsid, wifiPassword);
+    }
+  }
+
+  ~EspIdfMqttTransport() override {
+    if (_client != nullptr) {
+      esp_mqtt_client_stop(_client);
+      esp_mqtt_client_destroy(_client);
+    }
+    vQueueDelete(_inbox);
+  }
+
+  const char* name() const override { return "esp-mqtt"; }
+  void enableLastWillMessage(const char* topic, const char* message, bool retain) override {
+    _willTopic = topic;
+    _willMessage = message;
+    _willRetain = retain;
+  }
+  void setKeepAlive(uint16_t seconds) override { _keepAlive = seconds; }
+  void enablePersistentSession() override { _persistent = true; }
+  void setReconnectDelay(uint32_t milliseconds) override { _reconnectDelay = milliseconds; }
+  void setBufferSize(uint16_t bytes) override {} // Inbox slots are sized for IDF_MQTT_PAYLOAD_LEN
+  bool enableTls(const char* caCertPem) override {
+    _caCert = caCertPem;
+    return true;
+  }
+
+  void loop() override {
+    // The client is created once WiFi is up. Reconnects are paced from here rather than by
+    // esp-mqtt's fixed timeout so the caller's backoff applies.
+    if (_client == nullptr && WiFi.status() == WL_CONNECTED) {
+      markAttempt();
+      start();
+    } else if (_client != nullptr && !_connected && WiFi.status() == WL_CONNECTED &&
+               millis() - _lastAttempt >= _reconnectDelay) {
+      markAttempt();
+      esp_mqtt_client_reconnect(_client);
+    }
+    if (_connectedEvent) {
+      // Cost of the connection that just came up: every reconnect pays a full TLS handshake
+      _connectedEvent = false;
+      _stats.connects++;
+      _stats.connectMillis = _connectedAt - _lastAttempt;
+      if (_stats.connectMillis > _stats.connectMaxMillis) _stats.connectMaxMillis = _stats.connectMillis;
+      _stats.connectHeap = (int32_t)_heapAtAttempt - (int32_t)ESP.getFreeHeap();
+      onConnectionEstablished();
+    }
+
+    IdfInboundMessage* msg = &_scratch;
+    while (xQueueReceive(_inbox, msg, 0) == pdTRUE) {
+      for (auto& sub : _subscriptions) {
+        if (sub.handler != nullptr && strcmp(sub.topic, msg->topic) == 0) {
+          _stats.received++;
+          sub.handler(msg->payload, msg->length);
+        }
+      }
+    }
+  }
+  bool isWifiConnected() override { return WiFi.status() == WL_CONNECTED; }
+  bool wifiConnectFailed() override { return WiFi.status() == WL_CONNECT_FAILED; }
+  bool isMqttConnected() override { return _connected; }
+
+  bool subscribe(const char* topic, MqttMessageHandler handler, uint8_t qos) override {
+    if (!_connected || strlen(topic) >= IDF_MQTT_TOPIC_LEN) return false;
+    IdfSubscription* slot = nullptr;
+    for (auto& sub : _subscriptions) {
+      if (strcmp(sub.topic, topic) == 0) { slot = &sub; break; }
+      if (slot == nullptr && sub.handler == nullptr) slot = &sub;
+    }
+    if (slot == nullptr) return false;
+    if (esp_mqtt_client_subscribe(_client, topic, qos) < 0) return false;
+    strcpy(slot->topic, topic);
+    slot->handler = handler;
+    return true;
+  }
+  bool unsubscribe(const char* topic) override {
+    for (auto& sub : _subscriptions) {
+      if (strcmp(sub.topic, topic) == 0) {
+        sub = IdfSubscription();
+      }
+    }
+    return _connected && esp_mqtt_client_unsubscribe(_client, topic) >= 0;
+  }
+
+protected:
+  bool doPublish(const char* topic, const char* payload, bool retain) override {
+    if (!_connected) return false;
+    return esp_mqtt_client_publish(_client, topic, payload, 0, 0, retain) >= 0;
+  }
+
+private:
+  void markAttempt() {
+    _lastAttempt = millis();
+    _heapAtAttempt = ESP.getFreeHeap();
+  }
+
+  void start() {
+    esp_mqtt_client_config_t config = {};
+#if ESP_IDF_VERSION_MAJOR >= 5
+    config.broker.address.hostname = _broker;
+    config.broker.address.port = _port;
+    config.broker.address.transport = _caCert ? MQTT_TRANSPORT_OVER_SSL : MQTT_TRANSPORT_OVER_TCP;
+    config.broker.verification.certificate = _caCert;
+    config.credentials.client_id = _clientName;
+    config.credentials.username = _user;
+    config.credentials.authentication.password = _password;
+    config.session.keepalive = _keepAlive;
+    config.session.last_will.topic = _willTopic;
+    config.session.last_will.msg = _willMessage;
+    config.session.last_will.retain = _willRetain;
+    config.session.disable_clean_session = _persistent;
+    config.network.disable_auto_reconnect = true;
+    config.buffer.size = IDF_MQTT_PAYLOAD_LEN;
+#else
+    config.host = _broker;
+    config.port = _port;
+    config.transport = _caCert ? MQTT_TRANSPORT_OVER_SSL : MQTT_TRANSPORT_OVER_TCP;
+    config.cert_pem = _caCert;
+    config.client_id = _clientName;
+    config.username = _user;
+    config.password = _password;
+    config.keepalive = _keepAlive;
+    config.lwt_topic = _willTopic;
+    config.lwt_msg = _willMessage;
+    config.lwt_retain = _willRetain;
+    config.disable_clean_session = _persistent;
+    config.disable_auto_reconnect = true;
+    config.buffer_size = IDF_MQTT_PAYLOAD_LEN;
+#endif
+    _client = esp_mqtt_client_init(&config);
+    esp_mqtt_client_register_event(_client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, onEvent, this);
+    esp_mqtt_client_start(_client);
+  }
+
+  // Runs on the esp-mqtt task, only copies data out for loop()
+  static void onEvent(void* arg, esp_event_base_t base, int32_t eventId, void* eventData) {
+    EspIdfMqttTransport* self = static_cast<EspIdfMqttTransport*>(arg);
+    esp_mqtt_event_handle_t event = static_cast<esp_mqtt_event_handle_t>(eventData);
+    switch ((esp_mqtt_event_id_t)eventId) {
+      case MQTT_EVENT_CONNECTED:
+        self->_connectedAt = millis();
+        self->_connected = true;
+        self->_connectedEvent = true;
+        break;
+      case MQTT_EVENT_DISCONNECTED:
+        self->_connected = false;
+        break;
+      case MQTT_EVENT_DATA:
+        // Fragmented or oversized messages are not used by the game protocol
+        if (event->data_len != event->total_data_len || event->data_len > IDF_MQTT_PAYLOAD_LEN ||
+            event->topic_len >= IDF_MQTT_TOPIC_LEN) break;
+        memcpy(self->_incoming.topic, event->topic, event->topic_len);
+        self->_incoming.topic[event->topic_len] = '\0';
+        memcpy(self->_incoming.payload, event->data, event->data_len);
+        self->_incoming.payload[event->data_len] = '\0';
+        self->_incoming.length = event->data_len;
+        xQueueSend(self->_inbox, &self->_incoming, 0);
+        break;
+      default:
+        break;
+    }
+  }
+
+  esp_mqtt_client_handle_t _client = nullptr;
+  QueueHandle_t _inbox = nullptr;
+  IdfInboundMessage _incoming; // Only touched by the esp-mqtt task
+  IdfInboundMessage _scratch;  // Only touched by loop()
+  IdfSubscription _subscriptions[IDF_MQTT_MAX_SUBSCRIPTIONS];
+  volatile bool _connected = false;
+  volatile bool _connectedEvent = false;
+
+  const char* _broker;
+  const char* _user;
+  const char* _password;
+  const char* _clientName;
+  uint16_t _port;
+  uint16_t _keepAlive = 15;
+  bool _persistent = false;
+  uint32_t _reconnectDelay = 1000;
+  unsigned long _lastAttempt = 0;
+  uint32_t _heapAtAttempt = 0;
+  volatile unsigned long _connectedAt = 0;
+  const char* _caCert = nullptr;
+  const char* _willTopic = nullptr;
+  const char* _willMessage = nullptr;
+  bool _willRetain = false;
+};
+
+MqttTransport* createMqttTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                                   const char* user, const char* password, const char* clientName, uint16_t port) {
+  return new EspIdfMqttTransport(wifiSsid, wifiPassword, broker, user, password, clientName, port);
+}
+#endif
+
+//============================== PubSubClient ===============================
+#ifdef MQTT_TRANSPORT_PUBSUBCLIENT
+#include <WiFi.h>
+#include <PubSubClient.h>
+#ifdef MQTT_TLS
+#include <tls_session_client.h>
+#endif
+
+#define PUBSUB_MAX_SUBSCRIPTIONS 8
+#define PUBSUB_TOPIC_LEN 64
+#define PUBSUB_PAYLOAD_LEN 1024
+#define PUBSUB_SOCKET_TIMEOUT 2 // s PubSubClient waits for CONNACK and the rest of a packet
+
+void onConnectionEstablished();
+
+struct PubSubSubscription {
+  char topic[PUBSUB_TOPIC_LEN] = "";
+  MqttMessageHandler handler = nullptr;
+};
+
+// The client EspMQTTClient wraps, used directly: loop() driven and blocking on connect like it, but
+// messages are copied once out of PubSubClient's buffer instead of going through Arduino Strings.
+// WiFi is joined here directly since there is no EspMQTTClient to do it.
+class PubSubClientTransport : public MqttTransport {
+public:
+  PubSubClientTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                        const char* user, const char* password, const char* clientName, uint16_t port)
+    : _client(_net), _user(user), _password(password), _clientName(clientName) {
+    _client.setServer(broker, port);
+    _client.setSocketTimeout(PUBSUB_SOCKET_TIMEOUT);
+    _client.setCallback([this](char* topic, uint8_t* payload, unsigned int length) { dispatch(topic, payload, length); });
+    // A transport recreated for another broker keeps the existing WiFi association
+    if (WiFi.status() != WL_CONNECTED) {
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(wifiSsid, wifiPassword);
+    }
+  }
+
+  ~PubSubClientTransport() override { _client.disconnect(); }
+
+  const char* name() const override { return "PubSubClient"; }
+  void enableLastWillMessage(const char* topic, const char* message, bool retain) override {
+    _willTopic = topic;
+    _willMessage = message;
+    _willRetain = retain;
+  }
+  void setKeepAlive(uint16_t seconds) override { _client.setKeepAlive(seconds); }
+  void enablePersistentSession() override { _persistent = true; }
+  void setReconnectDelay(uint32_t milliseconds) override { _reconnectDelay = milliseconds; }
+  void setBufferSize(uint16_t bytes) override { _client.setBufferSize(bytes); }
+#ifdef MQTT_TLS
+  bool enableTls(const char* caCertPem) override {
+    _net.setCACert(caCertPem);
+    return true;
+  }
+#endif
+
+  void loop() override {
+    if (_client.connected()) {
+      _client.loop();
+      return;
+    }
+    if (WiFi.status() != WL_CONNECTED) return;
+    if (_attempted && millis() - _lastAttempt < _reconnectDelay) return;
+    _attempted = true;
+    _lastAttempt = millis();
+    uint32_t heapBefore = ESP.getFreeHeap();
+    bool anonymous = _user == nullptr || _user[0] == '\0';
+    if (!_client.connect(_clientName, anonymous ? nullptr : _user, anonymous ? nullptr : _password,
+                         _willTopic, 0, _willRetain, _willMessage, !_persistent)) {
+      return;
+    }
+    _stats.connects++;
+    _stats.connectMillis = millis() - _lastAttempt;
+    if (_stats.connectMillis > _stats.connectMaxMillis) _stats.connectMaxMillis = _stats.connectMillis;
+    _stats.connectHeap = (int32_t)heapBefore - (int32_t)ESP.getFreeHeap();
+#ifdef MQTT_TLS
+    if (_net.resumed()) {
+      _stats.tlsResumed++;
+      _stats.resumedConnectMillis = _stats.connectMillis;
+      _stats.resumedConnectHeap = _stats.connectHeap;
+    } else {
+      _stats.fullConnectMillis = _stats.connectMillis;
+      _stats.fullConnectHeap = _stats.connectHeap;
+    }
+#endif
+    onConnectionEstablished();
+  }
+  bool isWifiConnected() override { return WiFi.status() == WL_CONNECTED; }
+  bool wifiConnectFailed() override { return WiFi.status() == WL_CONNECT_FAILED; }
+  bool isMqttConnected() override { return _client.connected(); }
+
+  bool subscribe(const char* topic, MqttMessageHandler handler, uint8_t qos) override {
+    if (!_client.connected() || strlen(topic) >= PUBSUB_TOPIC_LEN) return false;
+    PubSubSubscription* slot = nullptr;
+    for (auto& sub : _subscriptions) {
+      if (strcmp(sub.topic, topic) == 0) { slot = &sub; break; }
+      if (slot == nullptr && sub.handler == nullptr) slot = &sub;
+    }
+    if (slot == nullptr) return false;
+    if (!_client.subscribe(topic, qos > 1 ? 1 : qos)) return false;
+    strcpy(slot->topic, topic);
+    slot->handler = handler;
+    return true;
+  }
+  bool unsubscribe(const char* topic) override {
+    for (auto& sub : _subscriptions) {
+      if (strcmp(sub.topic, topic) == 0) {
+        sub = PubSubSubscription();
+      }
+    }
+    return _client.connected() && _client.unsubscribe(topic);
+  }
+
+protected:
+  bool doPublish(const char* topic, const char* payload, bool retain) override {
+    return _client.publish(topic, payload, retain);
+  }
+
+private:
+  // Runs inside _client.loop(), the payload points into PubSubClient's buffer and is not terminated
+  void dispatch(const char* topic, const uint8_t* payload, unsigned int length) {
+    if (length > PUBSUB_PAYLOAD_LEN) return;
+    memcpy(_payload, payload, length);
+    _payload[length] = '\0';
+    for (auto& sub : _subscriptions) {
+      if (sub.handler != nullptr && strcmp(sub.topic, topic) == 0) {
+        _stats.received++;
+        sub.handler(_payload, length);
+      }
+    }
+  }
+
+#ifdef MQTT_TLS
+  TlsSessionClient _net;
+#else
+  WiFiClient _net;
+#endif
+  PubSubClient _client;
+  PubSubSubscription _subscriptions[PUBSUB_MAX_SUBSCRIPTIONS];
+  char _payload[PUBSUB_PAYLOAD_LEN + 1];
+
+  const char* _user;
+  const char* _password;
+  const char* _clientName;
+  bool _persistent = false;
+  uint32_t _reconnectDelay = 1000;
+  bool _attempted = false;
+  unsigned long _lastAttempt = 0;
+  const char* _willTopic = nullptr;
+  const char* _willMessage = nullptr;
+  bool _willRetain = false;
+};
+
+MqttTransport* createMqttTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                                   const char* user, const char* password, const char* clientName, uint16_t port) {
+  return new PubSubClientTransport(wifiSsid, wifiPassword, broker, user, password, clientName, port);
+}
+#endif
+
+//============================== POSIX socket ===============================
+#ifdef MQTT_TRANSPORT_SOCKET
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#define SOCKET_MQTT_MAX_SUBSCRIPTIONS 8
+#define SOCKET_MQTT_TOPIC_LEN 64
+#define SOCKET_MQTT_BUFFER 2048          // Largest packet either way, twice the device's MQTT_BUFFER_SIZE
+#define SOCKET_MQTT_CONNECT_TIMEOUT 2000 // ms for TCP and CONNACK together
+
+// The firmware defines it, host programs that don't care about connections can leave it out
+void onConnectionEstablished() __attribute__((weak));
+
+struct SocketSubscription {
+  char topic[SOCKET_MQTT_TOPIC_LEN] = "";
+  MqttMessageHandler handler = nullptr;
+};
+
+// Host backend for the native env: QoS 0 publishes, exact topic subscriptions, keepalive pings and
+// paced reconnects, all driven from loop() like EspMQTTClient. There is no WiFi to join. Connection
+// times are taken from the monotonic clock since millis() only moves when the host program says so.
+class SocketMqttTransport : public MqttTransport {
+public:
+  SocketMqttTransport(const char* broker, const char* user, const char* password, const char* clientName, uint16_t port)
+    : _broker(broker), _user(user), _password(password), _clientName(clientName), _port(port) {}
+
+  ~SocketMqttTransport() override { disconnect(); }
+
+  const char* name() const override { return "socket"; }
+  void enableLastWillMessage(const char* topic, const char* message, bool retain) override {
+    _willTopic = topic;
+    _willMessage = message;
+    _willRetain = retain;
+  }
+  void setKeepAlive(uint16_t seconds) override { _keepAlive = seconds; }
+  void enablePersistentSession() override { _persistent = true; }
+  void setReconnectDelay(uint32_t milliseconds) override { _reconnectDelay = milliseconds; }
+  void setBufferSize(uint16_t bytes) override {} // Fixed at SOCKET_MQTT_BUFFER
+
+  void loop() override {
+    if (_fd < 0) {
+      if (_attempted && millis() - _lastAttempt < _reconnectDelay) return;
+      _attempted = true;
+      _lastAttempt = millis();
+      if (connectBroker() && onConnectionEstablished) onConnectionEstablished();
+      return;
+    }
+    receive();
+    if (_fd >= 0 && _keepAlive > 0 && millis() - _lastSent >= _keepAlive * 1000UL / 2) {
+      const uint8_t ping[] = { 0xC0, 0x00 };
+      send(ping, sizeof(ping));
+    }
+  }
+  bool isWifiConnected() override { return true; }
+  bool wifiConnectFailed() override { return false; }
+  bool isMqttConnected() override { return _fd >= 0; }
+
+  bool subscribe(const char* topic, MqttMessageHandler handler, uint8_t qos) override {
+    size_t topicLen = strlen(topic);
+    if (_fd < 0 || topicLen >= SOCKET_MQTT_TOPIC_LEN) return false;
+    SocketSubscription* slot = nullptr;
+    for (auto& sub : _subscriptions) {
+      if (strcmp(sub.topic, topic) == 0) { slot = &sub; break; }
+      if (slot == nullptr && sub.handler == nullptr) slot = &sub;
+    }
+    if (slot == nullptr) return false;
+    uint8_t* p = _tx;
+    *p++ = 0x82;
+    p = putLength(p, 2 + 2 + topicLen + 1);
+    p = putShort(p, nextPacketId());
+    p = putString(p, topic, topicLen);
+    *p++ = qos > 1 ? 1 : qos;
+    if (!send(_tx, p - _tx)) return false;
+    strcpy(slot->topic, topic);
+    slot->handler = handler;
+    return true;
+  }
+  bool unsubscribe(const char* topic) override {
+    for (auto& sub : _subscriptions) {
+      if (strcmp(sub.topic, topic) == 0) {
+        sub = SocketSubscription();
+      }
+    }
+    size_t topicLen = strlen(topic);
+    if (_fd < 0 || topicLen >= SOCKET_MQTT_TOPIC_LEN) return false;
+    uint8_t* p = _tx;
+    *p++ = 0xA2;
+    p = putLength(p, 2 + 2 + topicLen);
+    p = putShort(p, nextPacketId());
+    p = putString(p, topic, topicLen);
+    return send(_tx, p - _tx);
+  }
+
+protected:
+  bool doPublish(const char* topic, const char* payload, bool retain) override {
+    if (_fd < 0) return false;
+    size_t topicLen = strlen(topic);
+    size_t payloadLen = strlen(payload);
+    size_t remaining = 2 + topicLen + payloadLen;
+    if (remaining + 5 > SOCKET_MQTT_BUFFER) return false;
+    uint8_t* p = _tx;
+    *p++ = 0x30 | (retain ? 0x01 : 0x00);
+    p = putLength(p, remaining);
+    p = putString(p, topic, topicLen);
+    memcpy(p, payload, payloadLen);
+    return send(_tx, p - _tx + payloadLen);
+  }
+
+private:
+  static uint32_t monotonicMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+  }
+  static uint8_t* putLength(uint8_t* p, size_t length) {
+    do {
+      uint8_t digit = length % 128;
+      length /= 128;
+      *p++ = length > 0 ? digit | 0x80 : digit;
+    } while (length > 0);
+    return p;
+  }
+  static uint8_t* putShort(uint8_t* p, uint16_t value) {
+    *p++ = value >> 8;
+    *p++ = value & 0xFF;
+    return p;
+  }
+  static uint8_t* putString(uint8_t* p, const char* s, size_t length) {
+    p = putShort(p, length);
+    memcpy(p, s, length);
+    return p + length;
+  }
+  uint16_t nextPacketId() {
+    if (++_packetId == 0) _packetId = 1;
+    return _packetId;
+  }
+
+  bool connectBroker() {
+    uint32_t start = monotonicMillis();
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addr = nullptr;
+    char port[6];
+    snprintf(port, sizeof(port), "%u", (unsigned)_port);
+    if (getaddrinfo(_broker, port, &hints, &addr) != 0) return false;
+    _fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    struct timeval timeout = { SOCKET_MQTT_CONNECT_TIMEOUT / 1000, (SOCKET_MQTT_CONNECT_TIMEOUT % 1000) * 1000 };
+    setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int on = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    bool ok = ::connect(_fd, addr->ai_addr, addr->ai_addrlen) == 0;
+    freeaddrinfo(addr);
+    if (!ok) {
+      disconnect();
+      return false;
+    }
+
+    size_t userLen = _user ? strlen(_user) : 0;
+    size_t passwordLen = _password ? strlen(_password) : 0;
+    size_t clientLen = strlen(_clientName);
+    uint8_t flags = _persistent ? 0x00 : 0x02;
+    size_t remaining = 10 + 2 + clientLen;
+    if (_willTopic != nullptr) {
+      flags |= 0x04 | (_willRetain ? 0x20 : 0x00);
+      remaining += 2 + strlen(_willTopic) + 2 + strlen(_willMessage);
+    }
+    if (userLen > 0) {
+      flags |= 0x80;
+      remaining += 2 + userLen;
+      if (_password != nullptr) {
+        flags |= 0x40;
+        remaining += 2 + passwordLen;
+      }
+    }
+    if (remaining + 5 > SOCKET_MQTT_BUFFER) {
+      disconnect();
+      return false;
+    }
+    uint8_t* p = _tx;
+    *p++ = 0x10;
+    p = putLength(p, remaining);
+    p = putString(p, "MQTT", 4);
+    *p++ = 4; // 3.1.1
+    *p++ = flags;
+    p = putShort(p, _keepAlive);
+    p = putString(p, _clientName, clientLen);
+    if (_willTopic != nullptr) {
+      p = putString(p, _willTopic, strlen(_willTopic));
+      p = putString(p, _willMessage, strlen(_willMessage));
+    }
+    if (flags & 0x80) p = putString(p, _user, userLen);
+    if (flags & 0x40) p = putString(p, _password, passwordLen);
+    uint8_t connack[4];
+    if (!send(_tx, p - _tx) || ::recv(_fd, connack, sizeof(connack), MSG_WAITALL) != sizeof(connack) ||
+        connack[0] != 0x20 || connack[3] != 0) {
+      disconnect();
+      return false;
+    }
+
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+    _rxLen = 0;
+    _stats.connects++;
+    _stats.connectMillis = monotonicMillis() - start;
+    if (_stats.connectMillis > _stats.connectMaxMillis) _stats.connectMaxMillis = _stats.connectMillis;
+    return true;
+  }
+
+  void disconnect() {
+    if (_fd >= 0) ::close(_fd);
+    _fd = -1;
+  }
+
+  bool send(const uint8_t* data, size_t length) {
+    while (length > 0) {
+      ssize_t n = ::send(_fd, data, length, MSG_NOSIGNAL);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        struct pollfd pfd = { _fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, SOCKET_MQTT_CONNECT_TIMEOUT) > 0) continue;
+      }
+      if (n <= 0) {
+        disconnect();
+        return false;
+      }
+      data += n;
+      length -= n;
+    }
+    _lastSent = millis();
+    return true;
+  }
+
+  void receive() {
+    while (true) {
+      ssize_t n = ::recv(_fd, _rx + _rxLen, sizeof(_rx) - _rxLen, 0);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        disconnect(); // Broker closed the connection, loop() reconnects after the delay
+        return;
+      }
+      if (n < 0) return;
+      _rxLen += n;
+
+      // Hand every complete packet on, keep a partial one for the next read
+      size_t used = 0;
+      while (true) {
+        size_t remaining = 0;
+        size_t header = 1;
+        uint32_t multiplier = 1;
+        bool complete = false;
+        while (used + header < _rxLen && header <= 4) {
+          uint8_t digit = _rx[used + header++];
+          remaining += (digit & 0x7F) * multiplier;
+          multiplier *= 128;
+          if (!(digit & 0x80)) {
+            complete = true;
+            break;
+          }
+        }
+        if (!complete || used + header + remaining > _rxLen) break;
+        handlePacket(_rx[used], _rx + used + header, remaining);
+        if (_fd < 0) return;
+        used += header + remaining;
+      }
+      if (used == 0 && _rxLen == sizeof(_rx)) {
+        disconnect(); // A packet larger than the buffer, the stream can't be resynchronised
+        return;
+      }
+      memmove(_rx, _rx + used, _rxLen - used);
+      _rxLen -= used;
+    }
+  }
+
+  void handlePacket(uint8_t type, const uint8_t* body, size_t length) {
+    if ((type >> 4) != 3 || length < 2) return; // Only PUBLISH needs anything, acks and PINGRESP are dropped
+    uint8_t qos = (type >> 1) & 0x03;
+    size_t topicLen = (body[0] << 8) | body[1];
+    size_t offset = 2 + topicLen + (qos > 0 ? 2 : 0);
+    if (offset > length) return;
+    if (qos > 0) {
+      uint8_t puback[] = { 0x40, 0x02, body[2 + topicLen], body[3 + topicLen] };
+      send(puback, sizeof(puback));
+    }
+    if (topicLen >= SOCKET_MQTT_TOPIC_LEN) return;
+    memcpy(_topic, body + 2, topicLen);
+    _topic[topicLen] = '\0';
+    size_t payloadLen = length - offset;
+    memcpy(_payload, body + offset, payloadLen);
+    _payload[payloadLen] = '\0';
+    for (auto& sub : _subscriptions) {
+      if (sub.handler != nullptr && strcmp(sub.topic, _topic) == 0) {
+        _stats.received++;
+        sub.handler(_payload, payloadLen);
+      }
+    }
+  }
+
+  int _fd = -1;
+  uint8_t _tx[SOCKET_MQTT_BUFFER];
+  uint8_t _rx[SOCKET_MQTT_BUFFER];
+  size_t _rxLen = 0;
+  char _topic[SOCKET_MQTT_TOPIC_LEN];
+  char _payload[SOCKET_MQTT_BUFFER + 1];
+  SocketSubscription _subscriptions[SOCKET_MQTT_MAX_SUBSCRIPTIONS];
+  uint16_t _packetId = 0;
+
+  const char* _broker;
+  const char* _user;
+  const char* _password;
+  const char* _clientName;
+  uint16_t _port;
+  uint16_t _keepAlive = 15;
+  bool _persistent = false;
+  uint32_t _reconnectDelay = 1000;
+  bool _attempted = false;
+  unsigned long _lastAttempt = 0;
+  unsigned long _lastSent = 0;
+  const char* _willTopic = nullptr;
+  const char* _willMessage = nullptr;
+  bool _willRetain = false;
+};
+
+MqttTransport* createMqttTransport(const char* wifiSsid, const char* wifiPassword, const char* broker,
+                                   const char* user, const char* password, const char* clientName, uint16_t port) {
+  return new SocketMqttTransport(broker, user, password, clientName, port);
+}
+#endif
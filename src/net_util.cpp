@@ -0,0 +1,32 @@
+#include <net_util.h>
+#include <algorithm>
+
+std::vector<NetworkInfo> dedupeNetworks(std::vector<NetworkInfo>& networks) {
+  // Sort by RSSI (signal strength), descending
+  std::sort(networks.begin(), networks.end(), [](const NetworkInfo& a, const NetworkInfo& b) {
+    return a.rssi > b.rssi;
+  });
+  // Remove duplicates (same SSID)
+  std::vector<NetworkInfo> uniqueNetworks;
+  for (const auto& net : networks) {
+    bool exists = false;
+    for (const auto& u : uniqueNetworks) {
+      if (u.ssid == net.ssid) {
+        exists = true;
+        break;
+      }
+    }
+    if (!exists && net.ssid.length() > 0) uniqueNetworks.push_back(net);
+    if (uniqueNetworks.size() >= NETWORKS_MAX) break;
+  }
+  return uniqueNetworks;
+}
+
+void formatMac(const uint8_t mac[6], char* out) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (uint8_t i = 0; i < 6; i++) {
+    out[i * 2] = hex[mac[i] >> 4];
+    out[i * 2 + 1] = hex[mac[i] & 0x0F];
+  }
+  out[12] = '\0';
+}
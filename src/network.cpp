@@ -0,0 +1,161 @@
+#include <network.h>
+
+static const IPAddress lanGroup(LAN_GROUP_IP);
+
+bool LanBus::begin(const char* device, const char* room, MqttMessageHandler handler) {
+  _device = device;
+  _room = room;
+  _handler = handler;
+  if (_boot == 0) _boot = esp_random() | 1; // Once per boot, a restarted bus keeps counting where it was
+  _active = _udp.beginMulticast(lanGroup, LAN_PORT);
+  if (_active) {
+    sendPacket(LAN_PACKET_BEACON, 0, nullptr); // Announce ourselves right away instead of waiting a beacon interval
+    _lastBeacon = millis();
+  }
+  return _active;
+}
+
+void LanBus::end() {
+  if (!_active) return;
+  _udp.stop();
+  _active = false;
+}
+
+void LanBus::loop() {
+  if (!_active) return;
+
+  if (millis() - _lastBeacon >= LAN_BEACON_INTERVAL) {
+    sendPacket(LAN_PACKET_BEACON, 0, nullptr);
+    _lastBeacon = millis();
+  }
+
+  int size;
+  while ((size = _udp.parsePacket()) > 0) {
+    int length = _udp.read((uint8_t*)_packet, LAN_PACKET_MAX);
+    if (length < (int)sizeof(LanHeader) || size > LAN_PACKET_MAX) {
+      _stats.foreign++;
+      continue;
+    }
+    LanHeader header;
+    memcpy(&header, _packet, sizeof(header));
+    header.device[sizeof(header.device) - 1] = '\0';
+    header.room[sizeof(header.room) - 1] = '\0';
+    if (header.magic[0] != 'F' || header.magic[1] != 'G' || header.version != LAN_VERSION || strcmp(header.room, _room) != 0) {
+      _stats.foreign++;
+      continue;
+    }
+    if (strcmp(header.device, _device) == 0) continue; // Our own packet looped back
+
+    LanPeer* peer = findPeer(header.device, true);
+    peer->ip = _udp.remoteIP();
+    peer->lastSeen = millis();
+    peer->lastActive = peer->lastSeen;
+    if (header.type != LAN_PACKET_EVENT) continue;
+    syncBoot(peer, header.boot);
+
+    _stats.received++;
+    if (peer->lanHighest != 0 && header.seq > peer->lanHighest + 1 && header.seq - peer->lanHighest <= LAN_SEQ_WINDOW) {
+      _stats.lost += header.seq - peer->lanHighest - 1;
+    }
+    if (header.seq > peer->lanHighest || peer->lanHighest - header.seq > LAN_SEQ_WINDOW) {
+      peer->lanHighest = header.seq;
+    }
+
+    _packet[length] = '\0';
+    if (_handler != nullptr) {
+      _handler(_packet + sizeof(LanHeader), length - sizeof(LanHeader));
+    }
+  }
+}
+
+bool LanBus::send(uint32_t seq, const char* payload) {
+  if (!_active || peers() == 0) return false; // Nobody listening, MQTT carries it
+  return sendPacket(LAN_PACKET_EVENT, seq, payload);
+}
+
+bool LanBus::sendPacket(uint8_t type, uint32_t seq, const char* payload) {
+  LanHeader header = {};
+  header.magic[0] = 'F';
+  header.magic[1] = 'G';
+  header.version = LAN_VERSION;
+  header.type = type;
+  header.seq = seq;
+  header.boot = _boot;
+  strlcpy(header.device, _device, sizeof(header.device));
+  strlcpy(header.room, _room, sizeof(header.room));
+
+  size_t length = payload ? strlen(payload) : 0;
+  if (sizeof(header) + length > LAN_PACKET_MAX) {
+    _stats.sendFailures++;
+    return false;
+  }
+  bool ok = _udp.beginMulticastPacket() &&
+            _udp.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+            _udp.write((const uint8_t*)payload, length) == length &&
+            _udp.endPacket();
+  if (type == LAN_PACKET_EVENT) {
+    if (ok) _stats.sent++;
+    else _stats.sendFailures++;
+  }
+  return ok;
+}
+
+void LanBus::syncBoot(LanPeer* peer, uint32_t boot) {
+  // The peer restarted, its counter starts over and the old window says nothing about the new values
+  if (peer->boot == boot) return;
+  peer->boot = boot;
+  peer->highest = 0;
+  peer->seen = 0;
+  peer->lanHighest = 0;
+}
+
+bool LanBus::accept(const char* device, uint32_t boot, uint32_t seq, bool viaLan) {
+  if (strcmp(device, _device) == 0) return true; // Our own MQTT echo, never sent to ourselves over the LAN
+
+  LanPeer* peer = findPeer(device, true);
+  peer->lastActive = millis();
+  syncBoot(peer, boot);
+  if (seq > peer->highest || peer->highest - seq >= LAN_SEQ_WINDOW) {
+    // Newer than anything seen, or far outside the window
+    uint32_t shift = seq - peer->highest;
+    peer->seen = (seq > peer->highest && shift < LAN_SEQ_WINDOW) ? (peer->seen << shift) | 1 : 1;
+    peer->highest = seq;
+  } else {
+    uint32_t bit = 1UL << (peer->highest - seq);
+    if (peer->seen & bit) {
+      _stats.duplicates++;
+      return false;
+    }
+    peer->seen |= bit;
+  }
+
+  if (viaLan) {
+    _stats.lanFirst++;
+  } else if (peer->lastSeen != 0) {
+    _stats.mqttFirst++;
+  }
+  return true;
+}
+
+uint8_t LanBus::peers() const {
+  uint8_t count = 0;
+  for (const LanPeer& peer : _peers) {
+    if (peer.lastSeen != 0 && millis() - peer.lastSeen < LAN_PEER_TIMEOUT) count++;
+  }
+  return count;
+}
+
+LanPeer* LanBus::findPeer(const char* device, bool create) {
+  LanPeer* oldest = &_peers[0];
+  for (LanPeer& peer : _peers) {
+    if (strcmp(peer.device, device) == 0) return &peer;
+    if (oldest->device[0] == '\0') continue;
+    if (peer.device[0] == '\0' || millis() - peer.lastActive > millis() - oldest->lastActive) oldest = &peer;
+  }
+  if (!create) return nullptr;
+  // Reuse an empty slot or the peer we heard from least recently on either path
+  *oldest = LanPeer();
+  strlcpy(oldest->device, device, sizeof(oldest->device));
+  oldest->lastActive = millis();
+  return oldest;
+}
@@ -0,0 +1,130 @@
+#include <player_stats.h>
+#include <algorithm>
+
+void PlayerStats::add(uint32_t delta, uint8_t placement) {
+  // Welford: the mean and the squared differences move by one sample, no history needed
+  count++;
+  double diff = delta - mean;
+  mean += diff / count;
+  m2 += diff * (delta - mean);
+  if (delta < min) min = delta;
+  if (delta > max) max = delta;
+  deltas.add(delta);
+  if (placement >= 1 && placement <= PLAYER_PLACES) places[placement - 1]++;
+}
+
+void PlayerStats::write(JsonDocument& json) const {
+  json["n"] = count;
+  json["mean"] = (float)mean;
+  json["var"] = variance();
+  json["min"] = count ? min : 0;
+  json["p50"] = deltas.quantile(0.5f);
+  json["p90"] = deltas.quantile(0.9f);
+  JsonArray jsonPlaces = json["place"].to<JsonArray>();
+  for (uint8_t i = 0; i < PLAYER_PLACES; i++) {
+    jsonPlaces.add(places[i]);
+  }
+}
+
+PlayerEntry* Leaderboard::find(const char* device) {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (strcmp(_players[i].device, device) == 0) return &_players[i];
+  }
+  if (_count < ROOM_PLAYERS) {
+    PlayerEntry* entry = &_players[_count++];
+    *entry = PlayerEntry();
+    strlcpy(entry->device, device, sizeof(entry->device));
+    return entry;
+  }
+  // Full, the player heard from longest ago goes
+  PlayerEntry* oldest = &_players[0];
+  for (uint8_t i = 1; i < _count; i++) {
+    if (millis() - _players[i].seenAt > millis() - oldest->seenAt) oldest = &_players[i];
+  }
+  *oldest = PlayerEntry();
+  strlcpy(oldest->device, device, sizeof(oldest->device));
+  return oldest;
+}
+
+bool Leaderboard::update(const JsonDocument& json) {
+  const char* device = json["device"] | "";
+  if (device[0] == '\0' || !json["n"].is<uint32_t>()) return false;
+  PlayerEntry* entry = find(device);
+  entry->count = json["n"];
+  entry->mean = json["mean"] | 0.0f;
+  entry->variance = json["var"] | 0.0f;
+  entry->min = json["min"] | 0;
+  entry->p50 = json["p50"] | 0;
+  entry->p90 = json["p90"] | 0;
+  for (uint8_t i = 0; i < PLAYER_PLACES; i++) {
+    entry->places[i] = json["place"][i] | 0;
+  }
+  entry->seenAt = millis();
+  return true;
+}
+
+void Leaderboard::set(const char* device, const PlayerStats& stats) {
+  PlayerEntry* entry = find(device);
+  entry->count = stats.count;
+  entry->mean = stats.mean;
+  entry->variance = stats.variance();
+  entry->min = stats.count ? stats.min : 0;
+  entry->p50 = stats.deltas.quantile(0.5f);
+  entry->p90 = stats.deltas.quantile(0.9f);
+  memcpy(entry->places, stats.places, sizeof(entry->places));
+  entry->seenAt = millis();
+}
+
+void Leaderboard::write(JsonDocument& json, size_t maxBytes) const {
+  uint8_t order[ROOM_PLAYERS];
+  uint8_t ranked = 0;
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_players[i].count > 0) order[ranked++] = i;
+  }
+  std::sort(order, order + ranked, [this](uint8_t a, uint8_t b) {
+    if (_players[a].p50 != _players[b].p50) return _players[a].p50 < _players[b].p50;
+    return _players[a].mean < _players[b].mean;
+  });
+
+  // The room as one player: the parallel form of Welford merges count, mean and variance exactly
+  uint32_t count = 0;
+  double mean = 0;
+  uint32_t min = UINT32_MAX;
+  for (uint8_t i = 0; i < ranked; i++) {
+    const PlayerEntry& p = _players[order[i]];
+    count += p.count;
+    mean += (double)p.mean * p.count;
+    if (p.min < min) min = p.min;
+  }
+  if (count > 0) mean /= count;
+  double m2 = 0;
+  for (uint8_t i = 0; i < ranked; i++) {
+    const PlayerEntry& p = _players[order[i]];
+    double diff = p.mean - mean;
+    m2 += (double)p.variance * p.count + diff * diff * p.count;
+  }
+  JsonObject jsonRoom = json["room"].to<JsonObject>();
+  jsonRoom["players"] = ranked;
+  jsonRoom["n"] = count;
+  jsonRoom["mean"] = (float)mean;
+  jsonRoom["sd"] = count > 0 ? (float)sqrt(m2 / count) : 0.0f;
+  jsonRoom["min"] = count > 0 ? min : 0;
+
+  JsonArray jsonPlayers = json["players"].to<JsonArray>();
+  for (uint8_t i = 0; i < ranked; i++) {
+    const PlayerEntry& p = _players[order[i]];
+    JsonArray row = jsonPlayers.add<JsonArray>();
+    row.add(p.device);
+    row.add(p.count);
+    row.add(p.p50);
+    row.add(p.p90);
+    row.add((uint32_t)(p.mean + 0.5f));
+    for (uint8_t j = 0; j < PLAYER_PLACES; j++) {
+      row.add(p.places[j]);
+    }
+  }
+  while (jsonPlayers.size() > 0 && measureJson(json) >= maxBytes) {
+    jsonPlayers.remove(jsonPlayers.size() - 1);
+    json["partial"] = true;
+  }
+}
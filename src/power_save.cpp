@@ -0,0 +1,60 @@
+#include <power_save.h>
+#include <WiFi.h>
+
+void PowerSaver::begin(TaskHandle_t loopTask, uint16_t idleAfter) {
+  _loopTask = loopTask;
+  _idleAfter = idleAfter;
+  _lastActivity = millis();
+  leaveIdle();
+}
+
+void PowerSaver::activity() {
+  _lastActivity = millis();
+  if (_state == POWER_IDLE) leaveIdle();
+}
+
+void PowerSaver::loop() {
+  if (_state == POWER_ACTIVE) {
+    if (_idleAfter != 0 && millis() - _lastActivity >= _idleAfter * 1000UL) enterIdle();
+    return;
+  }
+  // Give the CPU to the idle task until a touch or the timeout, MQTT keeps up at this pace
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POWER_IDLE_WAIT_MS));
+}
+
+void IRAM_ATTR PowerSaver::wakeFromISR() {
+  if (_state != POWER_IDLE || _loopTask == nullptr) return;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(_loopTask, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void PowerSaver::enterIdle() {
+  _state = POWER_IDLE;
+  _idleSince = millis();
+  _stats.idleEntries++;
+  // Modem sleep wakes for every DTIM beacon, the first message of a round can wait one beacon interval
+  WiFi.setSleep(WIFI_PS_MIN_MODEM);
+  setCpuFrequencyMhz(POWER_IDLE_CPU_MHZ);
+}
+
+void PowerSaver::leaveIdle() {
+  // Clock first, the rest of the touch path runs right after this
+  setCpuFrequencyMhz(POWER_ACTIVE_CPU_MHZ);
+  WiFi.setSleep(WIFI_PS_NONE);
+  if (_state == POWER_IDLE) _stats.idleMillis += millis() - _idleSince;
+  _state = POWER_ACTIVE;
+}
+
+uint32_t PowerSaver::idleSeconds() const {
+  uint64_t total = _stats.idleMillis;
+  if (_state == POWER_IDLE) total += millis() - _idleSince;
+  return total / 1000;
+}
+
+void PowerSaver::recordTouch(uint8_t state, uint32_t micros) {
+  PowerLatency& latency = _stats.latency[state];
+  latency.touches++;
+  latency.totalMicros += micros;
+  if (micros > latency.maxMicros) latency.maxMicros = micros;
+}
@@ -0,0 +1,176 @@
+#include <profiler.h>
+#include <algorithm>
+
+#define PROFILE_MAGIC 0x50524F46 // "PROF"
+
+// Not cleared by a reset other than power on, begin() checks the magic before trusting it
+struct ProfileRtc {
+  uint32_t magic;
+  uint8_t phase; // Mirror of the current phase
+  uint8_t head;  // Next slot to write
+  uint8_t count;
+  StallRecord stalls[PROFILE_RING];
+};
+RTC_NOINIT_ATTR static ProfileRtc profileRtc;
+
+static const char* const phaseNames[PHASE_COUNT] = {
+  "setup", "loop", "portal", "mqtt", "event", "touch", "decide", "publish", "lan", "ota", "ntp", "scan", "failover"
+};
+
+static const char* const resetNames[] = {
+  "unknown", "powerOn", "external", "software", "panic", "intWdt", "taskWdt", "wdt", "deepSleep", "brownout", "sdio"
+};
+
+const char* Profiler::phaseName(uint8_t phase) {
+  return phase < PHASE_COUNT ? phaseNames[phase] : "?";
+}
+
+void Profiler::begin() {
+  _resetReason = esp_reset_reason();
+  bool valid = profileRtc.magic == PROFILE_MAGIC && _resetReason != ESP_RST_POWERON &&
+               profileRtc.count <= PROFILE_RING && profileRtc.head < PROFILE_RING;
+  if (valid) {
+    _resetPhase = profileRtc.phase;
+    _previousCount = profileRtc.count;
+    for (uint8_t i = 0; i < _previousCount; i++) {
+      _previous[i] = profileRtc.stalls[(profileRtc.head + PROFILE_RING - _previousCount + i) % PROFILE_RING];
+    }
+  }
+  memset(&profileRtc, 0, sizeof(profileRtc));
+  profileRtc.magic = PROFILE_MAGIC;
+  setPhase(PHASE_SETUP);
+}
+
+void Profiler::setPhase(uint8_t phase) {
+  _phase = phase;
+  profileRtc.phase = phase;
+}
+
+void Profiler::loopStart() {
+  uint32_t now = micros();
+  if (_passStartMicros != 0 && now - _passStartMicros > _maxPassMicros) {
+    _maxPassMicros = now - _passStartMicros;
+  }
+  _passStartMicros = now;
+  _passStart = millis();
+  _stalled = false; // After the new start, so the detector never pairs the old start with a cleared flag
+  setPhase(PHASE_LOOP);
+
+  if (_timer == nullptr) {
+    // Armed on the first pass, setup() is allowed to take its time
+    esp_timer_create_args_t args = {};
+    args.callback = check;
+    args.arg = this;
+    args.name = "profiler";
+    if (esp_timer_create(&args, &_timer) == ESP_OK) {
+      esp_timer_start_periodic(_timer, PROFILE_CHECK_MS * 1000);
+    }
+  }
+}
+
+void Profiler::check(void* arg) {
+  // esp_timer task: look at the loop heartbeat from outside
+  Profiler* self = (Profiler*)arg;
+  uint32_t running = millis() - self->_passStart;
+  if (running < LOOP_STALL_MS) return;
+  self->noteStall(running);
+  if (running >= LOOP_STALL_RESTART_MS && self->_phase != PHASE_OTA) {
+    esp_restart(); // Hung for good, the next boot reports where
+  }
+}
+
+void Profiler::noteStall(uint32_t duration) {
+  uint8_t slot;
+  if (!_stalled) {
+    _stalled = true;
+    _stalls++;
+    slot = profileRtc.head;
+    profileRtc.head = (profileRtc.head + 1) % PROFILE_RING;
+    if (profileRtc.count < PROFILE_RING) profileRtc.count++;
+    profileRtc.stalls[slot].at = _passStart;
+    profileRtc.stalls[slot].phase = _phase;
+  } else {
+    slot = (profileRtc.head + PROFILE_RING - 1) % PROFILE_RING;
+  }
+  profileRtc.stalls[slot].duration = duration; // Kept current, a reset can cut the stall short at any time
+}
+
+bool Profiler::takeBootReport(JsonDocument& json) {
+  if (_reported) return false;
+  _reported = true;
+  bool abnormal = _resetReason == ESP_RST_PANIC || _resetReason == ESP_RST_INT_WDT || _resetReason == ESP_RST_TASK_WDT ||
+                  _resetReason == ESP_RST_WDT || _resetReason == ESP_RST_BROWNOUT;
+  if (!abnormal && _previousCount == 0) return false;
+
+  json["reset"] = _resetReason < sizeof(resetNames) / sizeof(resetNames[0]) ? resetNames[_resetReason] : "?";
+  json["phase"] = phaseName(_resetPhase);
+  // One row per stall of the previous boot, oldest first: phase, ms into the boot, ms stalled
+  JsonArray jsonStalls = json["stalls"].to<JsonArray>();
+  for (uint8_t i = 0; i < _previousCount; i++) {
+    JsonArray jsonStall = jsonStalls.add<JsonArray>();
+    jsonStall.add(phaseName(_previous[i].phase));
+    jsonStall.add(_previous[i].at);
+    jsonStall.add(_previous[i].duration);
+  }
+  return true;
+}
+
+void Profiler::report(JsonDocument& json) {
+  json["loopMax"] = _maxPassMicros;
+  json["stalls"] = _stalls;
+  _maxPassMicros = 0;
+
+#if configUSE_TRACE_FACILITY
+  TaskStatus_t tasks[PROFILE_TASKS];
+  uint32_t total = 0;
+  UBaseType_t count = uxTaskGetSystemState(tasks, PROFILE_TASKS, &total);
+  json["tasks"] = count;
+
+  // CPU share since the last report in permille of all cores, 0 without run time stats
+  uint16_t share[PROFILE_TASKS] = {};
+#if configGENERATE_RUN_TIME_STATS
+  uint32_t elapsed = (total - _lastTotal) * portNUM_PROCESSORS;
+  for (UBaseType_t i = 0; i < count; i++) {
+    uint32_t last = 0;
+    for (uint8_t j = 0; j < PROFILE_TASKS; j++) {
+      if (_lastTaskNumber[j] == tasks[i].xTaskNumber) {
+        last = _lastTaskTime[j];
+        break;
+      }
+    }
+    if (elapsed > 0) share[i] = (uint64_t)(tasks[i].ulRunTimeCounter - last) * 1000 / elapsed;
+  }
+  _lastTotal = total;
+  for (UBaseType_t i = 0; i < PROFILE_TASKS; i++) {
+    _lastTaskNumber[i] = i < count ? tasks[i].xTaskNumber : 0;
+    _lastTaskTime[i] = i < count ? tasks[i].ulRunTimeCounter : 0;
+  }
+#endif
+
+  // Tasks close to overflowing their stack first, then the busiest
+  uint8_t order[PROFILE_TASKS];
+  for (uint8_t i = 0; i < count; i++) order[i] = i;
+  std::sort(order, order + count, [&](uint8_t a, uint8_t b) {
+    bool lowA = tasks[a].usStackHighWaterMark < PROFILE_STACK_LOW;
+    bool lowB = tasks[b].usStackHighWaterMark < PROFILE_STACK_LOW;
+    if (lowA != lowB) return lowA;
+    if (lowA) return tasks[a].usStackHighWaterMark < tasks[b].usStackHighWaterMark;
+    return share[a] > share[b];
+  });
+  // One row per task: name, stack bytes never used, CPU permille
+  JsonArray jsonTasks = json["cpu"].to<JsonArray>();
+  for (uint8_t i = 0; i < count && i < PROFILE_REPORT_TASKS; i++) {
+    const TaskStatus_t& task = tasks[order[i]];
+    JsonArray jsonTask = jsonTasks.add<JsonArray>();
+    jsonTask.add(task.pcTaskName);
+    jsonTask.add(task.usStackHighWaterMark);
+    jsonTask.add(share[order[i]]);
+  }
+#else
+  // No task list in this build, the loop task is the one we can always see
+  JsonArray jsonTask = json["cpu"].to<JsonArray>().add<JsonArray>();
+  jsonTask.add(pcTaskGetTaskName(nullptr));
+  jsonTask.add(uxTaskGetStackHighWaterMark(nullptr));
+  jsonTask.add(0);
+#endif
+}
@@ -0,0 +1,117 @@
+#include <publish_scheduler.h>
+
+// Rate, burst, depth and overflow policy of each lane, indexed by LANE_*
+static const LaneConfig laneConfigs[PUBLISH_LANES] = {
+  { 0,  0,  4, DROP_OLDEST }, // LANE_GAME: unlimited, only queues while publish() fails
+  { 20, 10, 4, DROP_OLDEST }, // LANE_CONTROL
+  { 5,  5,  4, DROP_OLDEST }, // LANE_TELEMETRY
+  { 1,  2,  2, COALESCE },    // LANE_SUMMARY: one summary topic and one player topic
+  { 2,  5,  6, DROP_OLDEST }, // LANE_LOG
+};
+
+void PublishScheduler::begin(MqttTransport* transport) {
+  _transport = transport;
+  for (uint8_t i = 0; i < PUBLISH_LANES; i++) {
+    _lanes[i].config = laneConfigs[i];
+    _lanes[i].tokens = laneConfigs[i].burst;
+  }
+  _lastRefill = millis();
+}
+
+bool PublishScheduler::publish(uint8_t lane, const char* topic, const char* payload, bool retain) {
+  if (lane >= PUBLISH_LANES) lane = LANE_LOG;
+  Lane& l = _lanes[lane];
+  refill();
+
+  // Fast path keeps ordering within the lane and never overtakes a more important message
+  if (l.stats.depth == 0 && !higherPriorityWaiting(lane) && takeToken(l)) {
+    if (_transport->publish(topic, payload, retain)) {
+      l.stats.sent++;
+      return true;
+    }
+  }
+  return enqueue(l, topic, payload, retain);
+}
+
+void PublishScheduler::pump() {
+  refill();
+  for (uint8_t i = 0; i < PUBLISH_LANES; i++) {
+    Lane& l = _lanes[i];
+    while (l.stats.depth > 0) {
+      if (!takeToken(l)) return; // Lower lanes wait until this one has drained
+      QueuedMessage& msg = at(l, 0);
+      if (!_transport->publish(msg.topic, msg.payload, msg.retain)) {
+        if (l.config.ratePerSec > 0) l.tokens += 1; // Give the token back, nothing went out
+        return;
+      }
+      uint32_t waited = millis() - msg.queuedAt;
+      l.stats.sent++;
+      l.stats.totalWaitMs += waited;
+      if (waited > l.stats.maxWaitMs) l.stats.maxWaitMs = waited;
+      l.head = (l.head + 1) % l.config.depth;
+      l.stats.depth--;
+    }
+  }
+}
+
+void PublishScheduler::refill() {
+  unsigned long now = millis();
+  float elapsed = (now - _lastRefill) / 1000.0f;
+  _lastRefill = now;
+  for (auto& l : _lanes) {
+    if (l.config.ratePerSec == 0) continue;
+    l.tokens = min(l.tokens + elapsed * l.config.ratePerSec, (float)l.config.burst);
+  }
+}
+
+bool PublishScheduler::takeToken(Lane& lane) {
+  if (lane.config.ratePerSec == 0) return true;
+  if (lane.tokens < 1) return false;
+  lane.tokens -= 1;
+  return true;
+}
+
+bool PublishScheduler::higherPriorityWaiting(uint8_t lane) const {
+  for (uint8_t i = 0; i < lane; i++) {
+    if (_lanes[i].stats.depth > 0) return true;
+  }
+  return false;
+}
+
+bool PublishScheduler::enqueue(Lane& lane, const char* topic, const char* payload, bool retain) {
+  if (strlen(topic) >= LANE_TOPIC_LEN || strlen(payload) >= LANE_PAYLOAD_LEN) {
+    lane.stats.dropped++;
+    return false;
+  }
+
+  QueuedMessage* slot = nullptr;
+  if (lane.config.policy == COALESCE) {
+    // Only the latest summary per topic matters
+    for (uint8_t i = 0; i < lane.stats.depth; i++) {
+      if (strcmp(at(lane, i).topic, topic) == 0) {
+        slot = &at(lane, i);
+        lane.stats.coalesced++;
+        break;
+      }
+    }
+    if (slot == nullptr && lane.stats.depth >= lane.config.depth) {
+      lane.stats.dropped++;
+      return false;
+    }
+  } else if (lane.stats.depth >= lane.config.depth) {
+    lane.head = (lane.head + 1) % lane.config.depth;
+    lane.stats.depth--;
+    lane.stats.dropped++;
+  }
+
+  if (slot == nullptr) {
+    slot = &at(lane, lane.stats.depth);
+    slot->queuedAt = millis();
+    lane.stats.depth++;
+    if (lane.stats.depth > lane.stats.maxDepth) lane.stats.maxDepth = lane.stats.depth;
+  }
+  strcpy(slot->topic, topic);
+  strcpy(slot->payload, payload);
+  slot->retain = retain;
+  return true;
+}
@@ -0,0 +1,63 @@
+#include <round_engine.h>
+
+bool roundAddTouch(Round& r, const char* device, unsigned long delta, const TouchTrace& trace, unsigned long now) {
+  if (r.decided) {
+    if (now - r.decidedAt < ROUND_HOLDOFF) return false; // Late arrival for a round already judged
+    r.decided = false; // The winner's sync never showed up, don't stall the game
+  }
+
+  // A device competes once per round with its earliest touch
+  for (uint8_t i = 0; i < r.count; i++) {
+    if (strcmp(r.touches[i].device, device) == 0) {
+      if (delta < r.touches[i].delta) {
+        r.touches[i].delta = delta;
+        r.touches[i].trace = trace; // The trace belongs to the touch that competes
+      }
+      return true;
+    }
+  }
+
+  RoundTouch candidate;
+  candidate.delta = delta;
+  strlcpy(candidate.device, device, sizeof(candidate.device));
+  candidate.trace = trace;
+  if (r.count >= ROUND_QUEUE_SIZE) {
+    // Keep the best ROUND_QUEUE_SIZE whatever the arrival order, so every device judges the same
+    // touches: the worst one queued makes room if the new touch ranks before it
+    uint8_t worst = 0;
+    for (uint8_t i = 1; i < r.count; i++) {
+      if (touchBefore(r.touches[worst], r.touches[i])) worst = i;
+    }
+    r.dropped++;
+    if (!touchBefore(candidate, r.touches[worst])) return true;
+    r.touches[worst] = candidate;
+    return true;
+  }
+  if (r.count == 0) r.windowStart = now;
+
+  r.touches[r.count++] = candidate;
+  return true;
+}
+
+bool touchBefore(const RoundTouch& a, const RoundTouch& b) {
+  if (a.delta != b.delta) return a.delta < b.delta;
+  return strcmp(a.device, b.device) < 0;
+}
+
+uint8_t rankRound(Round& r, const char* self) {
+  std::sort(r.touches, r.touches + r.count, touchBefore);
+  r.placement = NOT_PLACED;
+  for (uint8_t i = 0; i < r.count; i++) {
+    if (strcmp(r.touches[i].device, self) == 0) {
+      r.placement = (i == 0) ? FIRST : (i == 1) ? SECOND : OTHER;
+    }
+  }
+  return r.placement;
+}
+
+void finishRound(Round& r, unsigned long now) {
+  r.count = 0;
+  r.dropped = 0;
+  r.decided = true;
+  r.decidedAt = now;
+}
@@ -0,0 +1,165 @@
+#include <session_recorder.h>
+#include <event_parser.h>
+#include <json_pool.h>
+
+uint32_t SessionRecorder::record(uint8_t type, uint32_t value, const char* device, uint8_t flags) {
+  uint32_t now = millis();
+  if (_paused) return now;
+  SessionRecord& rec = append();
+  rec.at = now;
+  rec.value = value;
+  rec.type = type;
+  rec.flags = flags;
+  strlcpy(rec.device, device, sizeof(rec.device));
+  rec.epoch = _epochMillis ? _epochMillis() : 0;
+  rec.syncEpoch = _syncEpoch ? *_syncEpoch : 0;
+  rec.payload = 0;
+  return now;
+}
+
+uint32_t SessionRecorder::recordEvent(const char* device, const char* payload, size_t length, uint8_t flags) {
+  size_t kept = min(length, (size_t)SESSION_EVENT_MAX);
+  if (kept < length) flags |= REC_FLAG_CUT;
+  uint32_t now = record(REC_EVENT, kept, device, flags);
+  if (_paused) return now;
+  storePayload(last(), payload, kept);
+  return now;
+}
+
+void SessionRecorder::markLast(uint8_t flags) {
+  if (_paused || _count == 0) return;
+  last().flags |= flags;
+}
+
+bool SessionRecorder::payload(const SessionRecord& rec, char* out, size_t size) const {
+  if (rec.type != REC_EVENT || (rec.flags & REC_FLAG_LOST) || rec.value > size) return false;
+  if (_payloadHead - rec.payload > SESSION_PAYLOAD_BYTES) return false; // Newer payloads wrote over it
+  size_t offset = rec.payload % SESSION_PAYLOAD_BYTES;
+  size_t first = min((size_t)rec.value, (size_t)SESSION_PAYLOAD_BYTES - offset);
+  memcpy(out, _payloads + offset, first);
+  memcpy(out + first, _payloads, rec.value - first);
+  return true;
+}
+
+size_t SessionRecorder::write(uint16_t first, uint8_t* out, size_t size, uint16_t& records) const {
+  size_t used = 0;
+  records = 0;
+  for (uint16_t i = first; i < _count; i++) {
+    SessionRecord rec = at(i);
+    size_t payloadBytes = 0;
+    if (rec.type == REC_EVENT && !(rec.flags & REC_FLAG_LOST)) {
+      if (_payloadHead - rec.payload > SESSION_PAYLOAD_BYTES) {
+        rec.flags |= REC_FLAG_LOST;
+      } else {
+        payloadBytes = rec.value;
+      }
+    }
+    if (used + sizeof(rec) + payloadBytes > size) break;
+    memcpy(out + used, &rec, sizeof(rec));
+    used += sizeof(rec);
+    if (payloadBytes > 0) {
+      payload(rec, (char*)out + used, payloadBytes);
+      used += payloadBytes;
+    }
+    records++;
+  }
+  return used;
+}
+
+bool SessionRecorder::load(const uint8_t* data, size_t length) {
+  size_t pos = 0;
+  while (pos < length) {
+    SessionRecord rec;
+    if (length - pos < sizeof(rec)) return false;
+    memcpy(&rec, data + pos, sizeof(rec));
+    pos += sizeof(rec);
+    size_t payloadBytes = (rec.type == REC_EVENT && !(rec.flags & REC_FLAG_LOST)) ? rec.value : 0;
+    if (payloadBytes > SESSION_EVENT_MAX || length - pos < payloadBytes) return false;
+    SessionRecord& stored = append();
+    stored = rec;
+    if (payloadBytes > 0) storePayload(stored, (const char*)data + pos, payloadBytes);
+    pos += payloadBytes;
+  }
+  return true;
+}
+
+SessionRecord& SessionRecorder::append() {
+  SessionRecord& rec = _records[_head];
+  _head = (_head + 1) % SESSION_RECORDS;
+  if (_count < SESSION_RECORDS) {
+    _count++;
+  } else {
+    _overwritten++;
+  }
+  return rec;
+}
+
+void SessionRecorder::storePayload(SessionRecord& rec, const char* payload, size_t length) {
+  rec.payload = _payloadHead;
+  size_t offset = _payloadHead % SESSION_PAYLOAD_BYTES;
+  size_t first = min(length, (size_t)SESSION_PAYLOAD_BYTES - offset);
+  memcpy(_payloads + offset, payload, first);
+  memcpy(_payloads, payload + first, length - first);
+  _payloadHead += length;
+}
+
+ReplayResult replaySession(const SessionRecorder& recorder, const char* self) {
+  // The same steps recieveEvents(), queueTouch() and decideRound() took live. The sync clock is
+  // rebuilt from the REC_SYNC records, every other record has to agree with it.
+  ReplayResult result;
+  Round r;
+  bool started = false; // The ring can start halfway through a round, judge from the first boundary on
+  uint64_t syncEpoch = recorder.count() > 0 ? recorder.at(0).syncEpoch : 0;
+  char msg[SESSION_EVENT_MAX];
+  for (uint16_t i = 0; i < recorder.count(); i++) {
+    const SessionRecord& rec = recorder.at(i);
+    if (rec.type == REC_SYNC) {
+      syncEpoch = rec.syncEpoch;
+      r.decided = false;
+      if (strcmp(rec.device, "go") == 0) {
+        r.count = 0; // goTriggered() drops what was queued before the trigger
+        r.dropped = 0;
+      }
+      started = true;
+      continue;
+    }
+    if (rec.syncEpoch != syncEpoch) result.clockMismatched++;
+
+    if (rec.type == REC_TOUCH && started) {
+      roundAddTouch(r, rec.device, rec.value, TouchTrace(), rec.at);
+    } else if (rec.type == REC_EVENT) {
+      if (rec.flags & REC_FLAG_DUPLICATE) {
+        result.duplicates++;
+        continue;
+      }
+      if ((rec.flags & REC_FLAG_CUT) || !recorder.payload(rec, msg, sizeof(msg))) {
+        result.unreadable++;
+        started = false; // Can't tell what it did to the round
+        continue;
+      }
+      PooledJsonDocument json;
+      GameEvent event;
+      uint8_t type = parseEvent(json, msg, rec.value, event);
+      result.events++;
+      unsigned long delta;
+      if (type == GAME_EVENT_INVALID) {
+        result.rejected++;
+      } else if (type == GAME_EVENT_TOUCH && started && touchDelta(event, syncEpoch, delta)) {
+        roundAddTouch(r, event.trace.origin, delta, TouchTrace(), rec.at);
+      }
+    } else if (rec.type == REC_DECIDE) {
+      if (started) {
+        result.rounds++;
+        uint8_t count = r.count;
+        uint8_t placement = rankRound(r, self);
+        if (count == 0 || count != rec.value || placement != rec.flags || strcmp(r.touches[0].device, rec.device) != 0) {
+          result.mismatched++;
+          if (result.firstMismatch < 0) result.firstMismatch = i;
+        }
+      }
+      finishRound(r, rec.at);
+      started = true;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,228 @@
+#ifdef MQTT_TLS
+#include <tls_session_client.h>
+#include <Preferences.h>
+#include "mbedtls/net_sockets.h"
+
+// Sessions by broker, kept across connections and transports so a failover back finds its session
+struct TlsSession {
+  char broker[56] = ""; // host:port
+  uint16_t length = 0;  // Serialized bytes in data, 0 when there is none
+  unsigned long usedAt = 0;
+  uint8_t data[TLS_SESSION_BYTES];
+};
+
+static TlsSession sessions[TLS_SESSION_SLOTS];
+static bool sessionsLoaded = false;
+static uint8_t scratch[TLS_SESSION_BYTES];
+
+static TlsSession* findSession(const char* broker, bool create) {
+  if (!sessionsLoaded) {
+    // The last broker's session from before the reboot
+    sessionsLoaded = true;
+    Preferences prefs;
+    prefs.begin("tls", true);
+    prefs.getString("broker", sessions[0].broker, sizeof(sessions[0].broker));
+    sessions[0].length = prefs.getBytes("session", sessions[0].data, sizeof(sessions[0].data));
+    prefs.end();
+  }
+  TlsSession* oldest = &sessions[0];
+  for (TlsSession& session : sessions) {
+    if (strcmp(session.broker, broker) == 0) return &session;
+    // An empty slot, or else the one resumed longest ago
+    if (session.length == 0 ? oldest->length != 0 : oldest->length != 0 && session.usedAt < oldest->usedAt) oldest = &session;
+  }
+  if (!create) return nullptr;
+  strlcpy(oldest->broker, broker, sizeof(oldest->broker));
+  oldest->length = 0;
+  return oldest;
+}
+
+static bool offerSession(const char* broker, mbedtls_ssl_context* ssl) {
+  TlsSession* cached = findSession(broker, false);
+  if (cached == nullptr || cached->length == 0) return false;
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  bool offered = mbedtls_ssl_session_load(&session, cached->data, cached->length) == 0 &&
+                 mbedtls_ssl_set_session(ssl, &session) == 0;
+  mbedtls_ssl_session_free(&session);
+  cached->usedAt = millis();
+  return offered;
+}
+
+static void keepSession(const char* broker, const mbedtls_ssl_context* ssl) {
+  // A new ticket comes with every full handshake and may with a resumed one, NVS is only written
+  // when the bytes changed
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  size_t length = 0;
+  bool saved = mbedtls_ssl_get_session(ssl, &session) == 0 &&
+               mbedtls_ssl_session_save(&session, scratch, sizeof(scratch), &length) == 0;
+  mbedtls_ssl_session_free(&session);
+  if (!saved) return; // Larger than TLS_SESSION_BYTES, the next connect is a full handshake
+
+  TlsSession* cached = findSession(broker, true);
+  cached->usedAt = millis();
+  if (cached->length == length && memcmp(cached->data, scratch, length) == 0) return;
+  memcpy(cached->data, scratch, length);
+  cached->length = length;
+  Preferences prefs;
+  prefs.begin("tls", false);
+  prefs.putString("broker", broker);
+  prefs.putBytes("session", scratch, length);
+  prefs.end();
+}
+
+static void forgetSession(const char* broker) {
+  TlsSession* cached = findSession(broker, false);
+  if (cached != nullptr) cached->length = 0;
+  Preferences prefs;
+  prefs.begin("tls", false);
+  if (prefs.getString("broker", "") == broker) prefs.remove("session");
+  prefs.end();
+}
+
+TlsSessionClient::~TlsSessionClient() {
+  stop();
+  if (_configured) {
+    mbedtls_ssl_config_free(&_conf);
+    mbedtls_x509_crt_free(&_ca);
+    mbedtls_ctr_drbg_free(&_drbg);
+    mbedtls_entropy_free(&_entropy);
+  }
+}
+
+bool TlsSessionClient::configure() {
+  if (_configured) return true;
+  if (_caCert == nullptr) return false;
+  mbedtls_ssl_config_init(&_conf);
+  mbedtls_x509_crt_init(&_ca);
+  mbedtls_ctr_drbg_init(&_drbg);
+  mbedtls_entropy_init(&_entropy);
+  _configured = true; // From here on the destructor frees them
+  if (mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, nullptr, 0) != 0 ||
+      mbedtls_x509_crt_parse(&_ca, (const unsigned char*)_caCert, strlen(_caCert) + 1) != 0 ||
+      mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                  MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    return false;
+  }
+  mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&_conf, &_ca, nullptr);
+  mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+  mbedtls_ssl_conf_verify(&_conf, onVerify, this);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+  mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED); // Without it, session ids only
+#endif
+#if MBEDTLS_VERSION_MAJOR >= 3
+  // TLS 1.3 tickets arrive after the handshake, 1.2 hands over the session with it
+  mbedtls_ssl_conf_max_tls_version(&_conf, MBEDTLS_SSL_VERSION_TLS1_2);
+#endif
+  return true;
+}
+
+int TlsSessionClient::connect(IPAddress ip, uint16_t port) {
+  return connect(ip.toString().c_str(), port);
+}
+
+int TlsSessionClient::connect(const char* host, uint16_t port) {
+  stop();
+  unsigned long start = millis();
+  if (!configure() || !_net.connect(host, port, TLS_HANDSHAKE_TIMEOUT)) return 0;
+  mbedtls_ssl_init(&_ssl);
+  _open = true;
+  if (mbedtls_ssl_setup(&_ssl, &_conf) != 0 || mbedtls_ssl_set_hostname(&_ssl, host) != 0) {
+    stop();
+    return 0;
+  }
+  mbedtls_ssl_set_bio(&_ssl, this, netSend, netRecv, nullptr);
+
+  char broker[sizeof(TlsSession::broker)];
+  snprintf(broker, sizeof(broker), "%s:%u", host, (unsigned)port);
+  bool offered = offerSession(broker, &_ssl);
+  _verified = false;
+  int ret;
+  while ((ret = mbedtls_ssl_handshake(&_ssl)) != 0) {
+    if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+        millis() - start > TLS_HANDSHAKE_TIMEOUT) {
+      if (offered) forgetSession(broker); // In case the session is what the broker choked on
+      stop();
+      return 0;
+    }
+    delay(1);
+  }
+  // A resumed handshake skips the Certificate message, so the verify callback never ran
+  _resumed = offered && !_verified;
+  keepSession(broker, &_ssl);
+  return 1;
+}
+
+size_t TlsSessionClient::write(const uint8_t* buf, size_t size) {
+  if (!_open) return 0;
+  size_t sent = 0;
+  unsigned long start = millis();
+  while (sent < size) {
+    int n = mbedtls_ssl_write(&_ssl, buf + sent, size - sent);
+    if (n > 0) {
+      sent += n;
+    } else if ((n != MBEDTLS_ERR_SSL_WANT_WRITE && n != MBEDTLS_ERR_SSL_WANT_READ) || millis() - start > TLS_IO_TIMEOUT) {
+      stop();
+      break;
+    }
+  }
+  return sent;
+}
+
+int TlsSessionClient::available() {
+  if (!_open) return 0;
+  if (mbedtls_ssl_get_bytes_avail(&_ssl) == 0) {
+    int ret = mbedtls_ssl_read(&_ssl, nullptr, 0); // Decrypts the next record if one has arrived
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      stop();
+      return 0;
+    }
+  }
+  return mbedtls_ssl_get_bytes_avail(&_ssl);
+}
+
+int TlsSessionClient::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsSessionClient::read(uint8_t* buf, size_t size) {
+  if (available() == 0) return -1;
+  int n = mbedtls_ssl_read(&_ssl, buf, size);
+  return n > 0 ? n : -1;
+}
+
+void TlsSessionClient::stop() {
+  if (_open) {
+    mbedtls_ssl_close_notify(&_ssl);
+    mbedtls_ssl_free(&_ssl);
+    _open = false;
+  }
+  _net.stop();
+}
+
+uint8_t TlsSessionClient::connected() {
+  return _open && (_net.connected() || mbedtls_ssl_get_bytes_avail(&_ssl) > 0);
+}
+
+int TlsSessionClient::netSend(void* ctx, const unsigned char* buf, size_t length) {
+  WiFiClient& net = static_cast<TlsSessionClient*>(ctx)->_net;
+  if (!net.connected()) return MBEDTLS_ERR_NET_CONN_RESET;
+  size_t n = net.write(buf, length);
+  return n > 0 ? (int)n : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int TlsSessionClient::netRecv(void* ctx, unsigned char* buf, size_t length) {
+  WiFiClient& net = static_cast<TlsSessionClient*>(ctx)->_net;
+  int n = net.available() ? net.read(buf, length) : 0;
+  if (n > 0) return n;
+  return net.connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+}
+
+int TlsSessionClient::onVerify(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+  static_cast<TlsSessionClient*>(ctx)->_verified = true;
+  return 0; // mbedtls still fails the handshake on *flags, this only notes that a chain was checked
+}
+#endif
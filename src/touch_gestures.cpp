@@ -0,0 +1,70 @@
+#include <touch_gestures.h>
+
+void TouchGestures::edge(const TouchEdge& edge) {
+  settle(edge.micros);
+  switch (_state) {
+    case TOUCH_IDLE:
+      if (edge.level) {
+        _state = TOUCH_PRESS_PENDING;
+        _edgeMicros = edge.micros;
+      }
+      break;
+    case TOUCH_PRESS_PENDING:
+      if (!edge.level) {
+        glitches++;
+        _state = TOUCH_IDLE;
+      }
+      break;
+    case TOUCH_PRESSED:
+      if (!edge.level) {
+        _state = TOUCH_RELEASE_PENDING;
+        _edgeMicros = edge.micros;
+      }
+      break;
+    case TOUCH_RELEASE_PENDING:
+      if (edge.level) {
+        glitches++;
+        _state = TOUCH_PRESSED;
+      }
+      break;
+  }
+}
+
+void TouchGestures::poll(uint32_t now) {
+  settle(now);
+  if (_state == TOUCH_PRESSED && !_longSent && now - _pressMicros >= LONG_PRESS_MS * 1000UL) {
+    _longSent = true;
+    emit(GESTURE_LONG_PRESS, _pressMicros, now - _pressMicros);
+  }
+  if (_tapPending && _state == TOUCH_IDLE && now - _releaseMicros >= DOUBLE_TAP_MS * 1000UL) {
+    _tapPending = false; // No second tap came
+  }
+}
+
+void TouchGestures::settle(uint32_t now) {
+  // A pending edge that survived the glitch window becomes a real press or release, timed at the edge itself
+  if (now - _edgeMicros < glitchMicros) return;
+  if (_state == TOUCH_PRESS_PENDING) {
+    _state = TOUCH_PRESSED;
+    press(_edgeMicros);
+  } else if (_state == TOUCH_RELEASE_PENDING) {
+    _state = TOUCH_IDLE;
+    release(_edgeMicros);
+  }
+}
+
+void TouchGestures::press(uint32_t at) {
+  _pressMicros = at;
+  _longSent = false;
+  emit(GESTURE_PRESS, at, 0);
+
+  _secondTap = _tapPending && at - _releaseMicros < DOUBLE_TAP_MS * 1000UL;
+  _tapPending = false;
+  if (_secondTap) emit(GESTURE_DOUBLE_TAP, at, at - _releaseMicros);
+}
+
+void TouchGestures::release(uint32_t at) {
+  _releaseMicros = at;
+  _tapPending = !_secondTap && !_longSent;
+  emit(GESTURE_RELEASE, at, at - _pressMicros);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Reference for test_benchmarks, written by the test itself. ns/op on the machine it was
+// generated on, allocations are operator new calls and JSON heap fallbacks per 1000 ops and
+// only move with the code or the C++ library.
+struct BenchReference {
+  const char* name;
+  uint32_t ns;
+  uint32_t allocs;
+};
+
+static const BenchReference benchBaseline[] = {
+  { "ease", 3, 0 },
+  { "interpolate", 2, 0 },
+  { "scaleColors", 5, 0 },
+  { "mac", 7, 0 },
+  { "parseTouch", 1013, 0 },
+  { "serializeTouch", 1865, 0 },
+  { "rankRound", 117, 0 },
+  { "dedupeNets", 1451, 6000 },
+};
@@ -0,0 +1,184 @@
+#include <unity.h>
+#include <chrono>
+#include <round_engine.h>
+#include <led_math.h>
+#include <net_util.h>
+#include <json_pool.h>
+#include <event_parser.h>
+#include <publish_scheduler.h>
+#include "baseline.h"
+
+// Host twin of the on-device benchmark (runBenchmarks()): the same cases, timed in ns/op with the
+// fastest of BENCH_RUNS runs, plus operator new calls and JSON pool heap fallbacks per 1000 ops.
+// Allocations must not go up at all, so a document that outgrows its arena fails the suite. Time may grow by BENCH_HOST_TOLERANCE_PCT, host timings move with the machine and its
+// load, the device baseline is the one to trust for small regressions.
+//
+// After an intended change, regenerate the reference and commit it with the change:
+//   BENCH_BASELINE_OUT=test/test_benchmarks/baseline.h pio test -e native -f test_benchmarks
+#define BENCH_RUNS 5
+#define BENCH_HOST_TOLERANCE_PCT 100
+#define BENCH_SLACK_NS 20 // Absolute allowance, the cheapest cases are a few ns and all jitter
+
+struct HostBench {
+  const char* name;
+  void (*run)(uint32_t i);
+  uint32_t iterations;
+};
+
+static volatile uint32_t benchSink;
+static const char benchTouch[] = "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":1234,\"seq\":42,"
+                                 "\"trace\":{\"id\":7,\"isr\":1718000000123,\"pub\":1718000000125}}";
+static Round benchRound;
+static std::vector<NetworkInfo> benchNetworks;
+
+static void benchEase(uint32_t i) { benchSink = cubicEaseInOut((i % 1000) / 1000.0f) * 1000; }
+static void benchInterpolate(uint32_t i) { benchSink = interpolate(0, 255, (i % 100) / 100.0f); }
+static void benchScaleColors(uint32_t i) {
+  LEDstruct base;
+  base.maxBrightness = 80;
+  base.nightBrightness = 40;
+  benchSink = scaleColors(base, i, 255 - i, i * 3, i * 7, i % 24).redBrightness;
+}
+static void benchMac(uint32_t i) {
+  const uint8_t mac[6] = { 0xA4, 0xCF, 0x12, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i };
+  char out[13];
+  formatMac(mac, out);
+  benchSink = out[i % 12];
+}
+static void benchParseTouch(uint32_t i) {
+  PooledJsonDocument jsonRxBuffer;
+  GameEvent event;
+  parseEvent(jsonRxBuffer, benchTouch, sizeof(benchTouch) - 1, event);
+  benchSink = event.delta + i;
+}
+static void benchSerializeTouch(uint32_t i) {
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "touch";
+  jsonTxBuffer["device"] = "A4CF12F0C0DE";
+  jsonTxBuffer["delta"] = 1000 + i % 500;
+  jsonTxBuffer["time"] = 1718000000 + i;
+  JsonObject jsonTrace = jsonTxBuffer["trace"].to<JsonObject>();
+  jsonTrace["id"] = i;
+  jsonTrace["isr"] = 1718000000123ULL + i;
+  jsonTrace["pick"] = 180;
+  jsonTrace["prep"] = 420;
+  jsonTrace["pub"] = 1718000000125ULL + i;
+  jsonTxBuffer["seq"] = i;
+  jsonTxBuffer["boot"] = 0x5EED;
+  char msg[LANE_PAYLOAD_LEN];
+  benchSink = serializeJson(jsonTxBuffer, msg);
+}
+static void benchRankRound(uint32_t i) {
+  Round r = benchRound;
+  benchSink = rankRound(r, benchRound.touches[i % ROUND_QUEUE_SIZE].device);
+}
+static void benchDedupe(uint32_t i) {
+  std::vector<NetworkInfo> networks = benchNetworks;
+  benchSink = dedupeNetworks(networks).size() + i;
+}
+
+static const HostBench hostBenches[] = {
+  { "ease",           benchEase,           1000000 },
+  { "interpolate",    benchInterpolate,    1000000 },
+  { "scaleColors",    benchScaleColors,    1000000 },
+  { "mac",            benchMac,            1000000 },
+  { "parseTouch",     benchParseTouch,     200000 },
+  { "serializeTouch", benchSerializeTouch, 200000 },
+  { "rankRound",      benchRankRound,      200000 },
+  { "dedupeNets",     benchDedupe,         20000 },
+};
+#define HOST_BENCHES (sizeof(hostBenches) / sizeof(hostBenches[0]))
+
+struct BenchResult {
+  uint32_t ns;
+  uint32_t allocs; // operator new calls and JSON heap fallbacks per 1000 ops
+};
+
+static BenchResult measure(const HostBench& bench) {
+  bench.run(0);
+  BenchResult result = { UINT32_MAX, 0 };
+  for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+    uint64_t allocations = halAllocations() + jsonPool.stats().heapAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < bench.iterations; i++) {
+      bench.run(i);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    uint32_t ns = elapsed / bench.iterations;
+    if (ns < result.ns) result.ns = ns;
+    result.allocs = (halAllocations() + jsonPool.stats().heapAllocations - allocations) * 1000 / bench.iterations;
+  }
+  return result;
+}
+
+static const BenchReference* reference(const char* name) {
+  for (const BenchReference& ref : benchBaseline) {
+    if (strcmp(ref.name, name) == 0) return &ref;
+  }
+  return nullptr;
+}
+
+static void writeBaseline(const char* path, const BenchResult* results) {
+  FILE* file = fopen(path, "w");
+  TEST_ASSERT_NOT_NULL_MESSAGE(file, "Can't write BENCH_BASELINE_OUT");
+  fprintf(file, "#pragma once\n\n#include <stdint.h>\n\n");
+  fprintf(file, "// Reference for test_benchmarks, written by the test itself. ns/op on the machine it was\n");
+  fprintf(file, "// generated on, allocations are operator new calls and JSON heap fallbacks per 1000 ops and\n");
+  fprintf(file, "// only move with the code or the C++ library.\n");
+  fprintf(file, "struct BenchReference {\n  const char* name;\n  uint32_t ns;\n  uint32_t allocs;\n};\n\n");
+  fprintf(file, "static const BenchReference benchBaseline[] = {\n");
+  for (uint8_t c = 0; c < HOST_BENCHES; c++) {
+    fprintf(file, "  { \"%s\", %u, %u },\n", hostBenches[c].name, (unsigned)results[c].ns, (unsigned)results[c].allocs);
+  }
+  fprintf(file, "};\n");
+  fclose(file);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_benchmarks_against_baseline() {
+  // Round of full length with one equal delta so the tiebreak is exercised too, as on the device
+  for (uint8_t n = 0; n < ROUND_QUEUE_SIZE; n++) {
+    RoundTouch& touch = benchRound.touches[n];
+    touch.delta = 1000 + (n * 37) % 200;
+    snprintf(touch.device, sizeof(touch.device), "A4CF12F0C0%02X", (unsigned)(0xF0 - n));
+  }
+  benchRound.touches[ROUND_QUEUE_SIZE - 1].delta = benchRound.touches[0].delta;
+  benchRound.count = ROUND_QUEUE_SIZE;
+  // A scan the size of a busy venue: 24 entries, every SSID seen on two access points
+  for (uint8_t n = 0; n < 24; n++) {
+    benchNetworks.push_back({ String("venue-") + (n % 12), -40 - n * 2 });
+  }
+
+  BenchResult results[HOST_BENCHES];
+  uint8_t regressions = 0;
+  char line[160];
+  for (uint8_t c = 0; c < HOST_BENCHES; c++) {
+    results[c] = measure(hostBenches[c]);
+    const BenchReference* ref = reference(hostBenches[c].name);
+    bool ok = true;
+    if (ref != nullptr) {
+      uint64_t limit = (uint64_t)ref->ns * (100 + BENCH_HOST_TOLERANCE_PCT) / 100 + BENCH_SLACK_NS;
+      ok = results[c].ns <= limit && results[c].allocs <= ref->allocs;
+    }
+    if (!ok) regressions++;
+    snprintf(line, sizeof(line), "%-14s %6u ns/op (ref %u)  %5u allocs/1000 ops (ref %u)  %s", hostBenches[c].name,
+             (unsigned)results[c].ns, ref ? (unsigned)ref->ns : 0, (unsigned)results[c].allocs,
+             ref ? (unsigned)ref->allocs : 0, ref == nullptr ? "NEW" : ok ? "ok" : "REGRESSED");
+    TEST_MESSAGE(line);
+  }
+
+  const char* out = getenv("BENCH_BASELINE_OUT");
+  if (out != nullptr) {
+    writeBaseline(out, results);
+    return;
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(0, regressions, "Benchmarks regressed against baseline.h");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmarks_against_baseline);
+  return UNITY_END();
+}
@@ -0,0 +1,285 @@
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <broker_list.h>
+#include <mqtt_transport.h>
+#include <mini_broker.h>
+
+// A room of devices on two local brokers with injected latency. Probes are MQTT CONNECT/CONNACK
+// round trips, on the device it is a TCP connect, which MiniBroker's latency doesn't reach. Devices
+// connect with a persistent session and subscribe at QoS 1, as onConnectionEstablished() does.
+#define ROOM_DEVICES 3
+#define WAIT_MS 3000
+#define RECONNECT_DELAY 250
+
+struct Device {
+  char id[18];
+  BrokerList brokers;
+  MqttTransport* transport = nullptr;
+};
+
+static MiniBroker primary;
+static MiniBroker backup;
+static uint16_t primaryPort;
+static Device devices[ROOM_DEVICES];
+static uint32_t delivered = 0;
+
+static int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t heardAt[ROOM_DEVICES]; // First event each device got since the test reset it
+
+template <uint8_t I> static void onEvent(const char* payload, size_t length) {
+  delivered++;
+  if (heardAt[I] == 0) heardAt[I] = nowMs();
+}
+static const MqttMessageHandler roomHandlers[ROOM_DEVICES] = { onEvent<0>, onEvent<1>, onEvent<2> };
+
+void onConnectionEstablished() {} // Subscriptions are made by the test once it sees the connection
+
+static int32_t probe(const BrokerInfo& broker) {
+  // -1 when the broker doesn't answer within BROKER_PROBE_TIMEOUT
+  int64_t start = nowMs();
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(broker.port);
+  inet_pton(AF_INET, broker.host, &addr.sin_addr);
+  int32_t rtt = -1;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+    const uint8_t connect[] = { 0x10, 0x11, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x0F,
+                                0x00, 0x05, 'p', 'r', 'o', 'b', 'e' };
+    uint8_t connack[4];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (send(fd, connect, sizeof(connect), MSG_NOSIGNAL) == sizeof(connect) &&
+        poll(&pfd, 1, BROKER_PROBE_TIMEOUT) > 0 && recv(fd, connack, sizeof(connack), MSG_WAITALL) == sizeof(connack)) {
+      rtt = nowMs() - start;
+    }
+  }
+  close(fd);
+  return rtt;
+}
+
+static void probeAll(Device& device) {
+  for (uint8_t n = 0; n < device.brokers.count(); n++) {
+    uint8_t index = device.brokers.nextProbe();
+    int32_t rtt = probe(device.brokers.at(index));
+    device.brokers.recordProbe(index, rtt >= 0, rtt >= 0 ? rtt : BROKER_PROBE_TIMEOUT);
+  }
+}
+
+static void connectDevice(Device& device) {
+  delete device.transport;
+  const BrokerInfo& broker = device.brokers.current();
+  device.transport = createMqttTransport(nullptr, nullptr, broker.host, "", "", device.id, broker.port);
+  device.transport->enablePersistentSession();
+  device.transport->setReconnectDelay(RECONNECT_DELAY);
+}
+
+static bool settle(bool (*done)(), uint32_t waitMs = WAIT_MS) {
+  int64_t deadline = nowMs() + waitMs;
+  bool subscribed[ROOM_DEVICES] = {};
+  while (nowMs() < deadline) {
+    for (uint8_t i = 0; i < ROOM_DEVICES; i++) {
+      devices[i].transport->loop();
+      bool connected = devices[i].transport->isMqttConnected();
+      if (connected && !subscribed[i]) subscribed[i] = devices[i].transport->subscribe("room/events", roomHandlers[i], 1);
+    }
+    if (done()) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+static bool allConnected() {
+  for (const Device& device : devices) {
+    if (!device.transport->isMqttConnected()) return false;
+  }
+  return true;
+}
+
+static bool allDisconnected() {
+  for (const Device& device : devices) {
+    if (device.transport->isMqttConnected()) return false;
+  }
+  return true;
+}
+
+static bool never() { return false; }
+
+static uint32_t expectedEvents = 0;
+static bool eventsArrived() { return delivered >= expectedEvents; }
+
+// One pass of checkFailover() on every device, with the virtual clock where the test put it
+static void failoverPass() {
+  for (Device& device : devices) {
+    int8_t preferred = device.brokers.select(device.transport->isMqttConnected(), millis());
+    if (preferred >= 0) {
+      device.brokers.setActive(preferred, millis());
+      connectDevice(device);
+    }
+  }
+}
+
+static void assertRoomOn(uint16_t port) {
+  for (const Device& device : devices) {
+    TEST_ASSERT_EQUAL_UINT16(port, device.brokers.current().port);
+  }
+  // Everyone on the same broker, so an event reaches the whole room
+  TEST_ASSERT_TRUE(settle(allConnected));
+  settle(never, 100); // Let the SUBACKs come back before publishing
+  delivered = 0;
+  expectedEvents = ROOM_DEVICES;
+  TEST_ASSERT_TRUE(devices[0].transport->publish("room/events", "{\"event\":\"touch\"}"));
+  TEST_ASSERT_TRUE_MESSAGE(settle(eventsArrived), "The room is split across brokers");
+}
+
+void setUp() {
+  halSetMicros(1000000);
+  TEST_ASSERT_TRUE(primary.start());
+  TEST_ASSERT_TRUE(backup.start());
+  primaryPort = primary.port();
+  char list[64];
+  snprintf(list, sizeof(list), "127.0.0.1:%u,127.0.0.1:%u", (unsigned)primary.port(), (unsigned)backup.port());
+  for (uint8_t i = 0; i < ROOM_DEVICES; i++) {
+    snprintf(devices[i].id, sizeof(devices[i].id), "A4CF12F0C0%02X", i);
+    devices[i].brokers = BrokerList();
+    TEST_ASSERT_TRUE(devices[i].brokers.load(list));
+    connectDevice(devices[i]);
+  }
+}
+
+void tearDown() {
+  for (Device& device : devices) {
+    delete device.transport;
+    device.transport = nullptr;
+  }
+  primary.stop();
+  backup.stop();
+}
+
+static void test_parse_broker_list() {
+  BrokerList list;
+  TEST_ASSERT_FALSE(list.load(""));
+  TEST_ASSERT_FALSE(list.load(",:1883,"));
+  TEST_ASSERT_TRUE(list.load("a.example:1884,b.example,c.example:0,d.example:1885,e.example,f.example"));
+  TEST_ASSERT_EQUAL_UINT8(MAX_BROKERS, list.count());
+  TEST_ASSERT_EQUAL_STRING("a.example", list.at(0).host);
+  TEST_ASSERT_EQUAL_UINT16(1884, list.at(0).port);
+  TEST_ASSERT_EQUAL_UINT16(MQTT_PORT, list.at(1).port);
+  TEST_ASSERT_EQUAL_STRING("d.example", list.at(2).host); // Port 0 is skipped
+
+  // The active broker survives a reordered list
+  list.setActive(2, 1);
+  TEST_ASSERT_TRUE(list.load("x.example,d.example:1885"));
+  TEST_ASSERT_EQUAL_UINT8(1, list.active());
+  TEST_ASSERT_TRUE(list.load("y.example"));
+  TEST_ASSERT_EQUAL_UINT8(0, list.active());
+}
+
+static void test_slow_primary_keeps_a_connected_room() {
+  TEST_ASSERT_TRUE(settle(allConnected));
+  primary.setLatency(BROKER_MAX_RTT + 100);
+  for (Device& device : devices) probeAll(device);
+  TEST_ASSERT_FALSE(devices[0].brokers.at(0).healthy);
+  TEST_ASSERT_TRUE(devices[0].brokers.at(1).healthy);
+
+  // Faster broker further down the list, but the session still works: nobody moves
+  halAdvanceMillis(BROKER_FAILOVER_MS * 2);
+  failoverPass();
+  primary.setLatency(0);
+  assertRoomOn(primaryPort);
+}
+
+static void test_room_fails_over_and_back() {
+  TEST_ASSERT_TRUE(settle(allConnected));
+  primary.stop();
+  TEST_ASSERT_TRUE(settle(allDisconnected));
+
+  // Not before BROKER_FAILOVER_MS without a session
+  failoverPass();
+  halAdvanceMillis(BROKER_FAILOVER_MS - 1);
+  failoverPass();
+  for (const Device& device : devices) TEST_ASSERT_EQUAL_UINT8(0, device.brokers.active());
+  halAdvanceMillis(1);
+  failoverPass();
+  assertRoomOn(backup.port());
+
+  // The primary comes back: two good probes and the whole room moves up the list again
+  TEST_ASSERT_TRUE(primary.start(primaryPort));
+  for (uint8_t round = 0; round < BROKER_HEALTHY_STREAK; round++) {
+    for (Device& device : devices) probeAll(device);
+    if (round + 1 < BROKER_HEALTHY_STREAK) {
+      failoverPass();
+      for (const Device& device : devices) TEST_ASSERT_EQUAL_UINT8(1, device.brokers.active());
+    }
+  }
+  failoverPass();
+  assertRoomOn(primaryPort);
+}
+
+static void test_disconnect_to_playable() {
+  // Connection lost to the whole room hearing events again: reconnect delay, CONNECT, resubscribe,
+  // first event through. Real time, with the virtual clock following it so the delay runs out.
+  TEST_ASSERT_TRUE(settle(allConnected));
+  settle(never, 100);
+  int64_t connectedAt[ROOM_DEVICES] = {};
+  bool dropped[ROOM_DEVICES] = {};
+  for (int64_t& at : heardAt) at = 0;
+  uint64_t virtualStart = micros();
+  int64_t start = nowMs();
+  int64_t lastEvent = 0;
+  primary.kick();
+
+  bool playable = false;
+  while (!playable && nowMs() - start < WAIT_MS) {
+    halSetMicros(virtualStart + (nowMs() - start) * 1000);
+    playable = true;
+    for (uint8_t i = 0; i < ROOM_DEVICES; i++) {
+      MqttTransport* transport = devices[i].transport;
+      transport->loop();
+      if (!transport->isMqttConnected()) {
+        dropped[i] = true;
+      } else if (dropped[i] && connectedAt[i] == 0) {
+        connectedAt[i] = nowMs();
+        transport->subscribe("room/events", roomHandlers[i], 1);
+      }
+      playable = playable && heardAt[i] != 0;
+    }
+    // The first device back keeps touching until everyone has heard one
+    if (connectedAt[0] != 0 && nowMs() - lastEvent >= 10) {
+      devices[0].transport->publish("room/events", "{\"event\":\"touch\"}");
+      lastEvent = nowMs();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  TEST_ASSERT_TRUE_MESSAGE(playable, "The room never came back");
+
+  int64_t connectedMax = 0;
+  int64_t playableMax = 0;
+  for (uint8_t i = 0; i < ROOM_DEVICES; i++) {
+    connectedMax = std::max(connectedMax, connectedAt[i] - start);
+    playableMax = std::max(playableMax, heardAt[i] - start);
+  }
+  char line[160];
+  snprintf(line, sizeof(line), "disconnect to connected %lld ms, to playable %lld ms (reconnect delay %u ms, %u devices)",
+           (long long)connectedMax, (long long)playableMax, RECONNECT_DELAY, ROOM_DEVICES);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(connectedMax >= RECONNECT_DELAY);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_broker_list);
+  RUN_TEST(test_slow_primary_keeps_a_connected_room);
+  RUN_TEST(test_room_fails_over_and_back);
+  RUN_TEST(test_disconnect_to_playable);
+  return UNITY_END();
+}
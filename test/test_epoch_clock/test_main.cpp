@@ -0,0 +1,156 @@
+#include <unity.h>
+#include <epoch_clock.h>
+#include <random>
+
+// The clock against a simulated world: true time runs at the real rate, the esp_timer crystal
+// runs DRIFT_PPM fast, and every SNTP answer is true time plus network jitter.
+#define EPOCH_START 1700000000000000LL // True epoch us at the start of every test
+#define LOCAL_START 5000000LL          // esp_timer us at the start, the device booted 5s ago
+#define DRIFT_PPM 50
+#define JITTER_US 5000                 // SNTP answers are off by up to this much either way
+#define SAMPLE_US (CLOCK_SNTP_INTERVAL * 1000LL)
+
+static EpochClock* clock_;
+static std::mt19937 rng;
+static int64_t trueElapsed; // us since the start of the test
+
+void setUp() {
+  static EpochClock storage;
+  storage = EpochClock();
+  clock_ = &storage;
+  rng.seed(42);
+  trueElapsed = 0;
+  halSetMicros(LOCAL_START);
+}
+void tearDown() {}
+
+static int64_t trueEpoch() { return EPOCH_START + trueElapsed; }
+
+// Moves true time forward, the crystal follows DRIFT_PPM fast
+static void advance(int64_t us) {
+  trueElapsed += us;
+  halSetMicros(LOCAL_START + trueElapsed + trueElapsed * DRIFT_PPM / 1000000);
+}
+
+static void sample(int64_t offset = 0) {
+  std::uniform_int_distribution<int> jitter(-JITTER_US, JITTER_US);
+  clock_->addSample(esp_timer_get_time(), trueEpoch() + jitter(rng) + offset);
+}
+
+// Samples every SNTP interval for the given time, checking the clock never runs backwards
+static void run(int64_t us) {
+  int64_t last = clock_->now64();
+  for (int64_t t = 0; t < us; t += SAMPLE_US) {
+    for (int i = 0; i < 10; i++) {
+      advance(SAMPLE_US / 10);
+      int64_t now = clock_->now64();
+      TEST_ASSERT_TRUE(now > last);
+      last = now;
+    }
+    sample();
+    TEST_ASSERT_TRUE(clock_->now64() >= last); // Samples never step a synced clock back
+  }
+}
+
+static int64_t clockError() { return clock_->now64() - trueEpoch(); }
+
+static void test_first_sample_steps() {
+  TEST_ASSERT_FALSE(clock_->synced());
+  clock_->addSample(esp_timer_get_time(), EPOCH_START);
+  TEST_ASSERT_TRUE(clock_->synced());
+  TEST_ASSERT_EQUAL_INT64(EPOCH_START, clock_->now64());
+  TEST_ASSERT_EQUAL_UINT32(1, clock_->stats().steps);
+}
+
+static void test_sntp_callback_feeds_the_clock() {
+  clock_->begin("pool.ntp.org", "UTC0");
+  halSntpSync(EPOCH_START);
+  TEST_ASSERT_TRUE(clock_->synced());
+  TEST_ASSERT_EQUAL_INT64(EPOCH_START, clock_->now64());
+}
+
+static void test_estimates_crystal_drift() {
+  sample();
+  run(3 * 3600 * 1000000LL);
+  // The crystal is 50 ppm fast, so the correction is -50 ppm. 8 samples 5 minutes apart with
+  // +-5ms of jitter each leave a few ppm of noise.
+  TEST_ASSERT_INT32_WITHIN(5000, -DRIFT_PPM * 1000, clock_->frequencyPpb());
+  TEST_ASSERT_INT64_WITHIN(JITTER_US * 2, 0, clockError());
+  TEST_ASSERT_EQUAL_UINT32(1, clock_->stats().steps);
+  TEST_ASSERT_EQUAL_UINT32(0, clock_->stats().rejected);
+}
+
+static void test_holds_over_through_an_outage() {
+  sample();
+  run(3 * 3600 * 1000000LL);
+  int64_t lastSample = esp_timer_get_time();
+  advance(3600 * 1000000LL); // An hour without SNTP
+  TEST_ASSERT_EQUAL_UINT32((esp_timer_get_time() - lastSample) / 1000000, clock_->holdoverSeconds());
+  // Free running the crystal would be 180ms off by now
+  TEST_ASSERT_INT64_WITHIN(30000, 0, clockError());
+}
+
+static void test_offsets_are_slewed_not_stepped() {
+  sample();
+  run(3 * 3600 * 1000000LL);
+  advance(60 * 1000000LL); // Let the last sample's slew finish
+  int64_t before = clock_->now64();
+  clock_->addSample(esp_timer_get_time(), before + 10000); // 10ms behind
+  TEST_ASSERT_EQUAL_INT64(before, clock_->now64());
+  // 500 ppm: half of it is gone after 10s, all of it after 20s
+  int64_t start = clockError();
+  advance(10 * 1000000LL);
+  TEST_ASSERT_INT64_WITHIN(1000, start + 5000, clockError());
+  advance(10 * 1000000LL);
+  TEST_ASSERT_INT64_WITHIN(1000, start + 10000, clockError());
+  advance(10 * 1000000LL);
+  TEST_ASSERT_INT64_WITHIN(1000, start + 10000, clockError());
+  TEST_ASSERT_EQUAL_UINT32(1, clock_->stats().steps);
+}
+
+static void test_large_offset_steps() {
+  sample();
+  run(3600 * 1000000LL);
+  clock_->addSample(esp_timer_get_time(), trueEpoch() + 5000000);
+  TEST_ASSERT_EQUAL_INT64(trueEpoch() + 5000000, clock_->now64());
+  TEST_ASSERT_EQUAL_UINT32(2, clock_->stats().steps);
+}
+
+static void test_single_outlier_is_rejected() {
+  sample();
+  run(3 * 3600 * 1000000LL);
+  int32_t ppb = clock_->frequencyPpb();
+  advance(SAMPLE_US);
+  sample(200000); // One answer 200ms off
+  TEST_ASSERT_EQUAL_UINT32(1, clock_->stats().rejected);
+  TEST_ASSERT_EQUAL_INT32(ppb, clock_->frequencyPpb());
+  run(SAMPLE_US);
+  TEST_ASSERT_INT64_WITHIN(JITTER_US * 2, 0, clockError());
+}
+
+static void test_persistent_offset_is_accepted() {
+  sample();
+  run(3 * 3600 * 1000000LL);
+  for (int i = 0; i < 3; i++) {
+    advance(SAMPLE_US);
+    sample(200000);
+  }
+  // The first two are taken for bad answers, the third agrees with them and is slewed in
+  TEST_ASSERT_EQUAL_UINT32(2, clock_->stats().rejected);
+  TEST_ASSERT_EQUAL_UINT32(1, clock_->stats().steps);
+  advance(500 * 1000000LL);
+  TEST_ASSERT_INT64_WITHIN(50000, 200000, clockError());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_sample_steps);
+  RUN_TEST(test_sntp_callback_feeds_the_clock);
+  RUN_TEST(test_estimates_crystal_drift);
+  RUN_TEST(test_holds_over_through_an_outage);
+  RUN_TEST(test_offsets_are_slewed_not_stepped);
+  RUN_TEST(test_large_offset_steps);
+  RUN_TEST(test_single_outlier_is_rejected);
+  RUN_TEST(test_persistent_offset_is_accepted);
+  return UNITY_END();
+}
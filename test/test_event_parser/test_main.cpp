@@ -0,0 +1,154 @@
+#include <unity.h>
+#include <event_parser.h>
+#include <json_pool.h>
+
+void setUp() {}
+void tearDown() {}
+
+static GameEvent event;
+
+static uint8_t parse(const char* msg) {
+  PooledJsonDocument json;
+  return parseEvent(json, msg, strlen(msg), event);
+}
+
+static void test_touch_with_trace() {
+  // The payload the device's parseTouch benchmark times
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse("{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":1234,\"seq\":42,"
+                                             "\"trace\":{\"id\":7,\"isr\":1718000000123,\"pub\":1718000000125}}"));
+  TEST_ASSERT_EQUAL_STRING("A4CF12F0C0DE", event.device);
+  TEST_ASSERT_EQUAL_UINT32(1234, event.delta);
+  TEST_ASSERT_TRUE(event.sequenced);
+  TEST_ASSERT_EQUAL_UINT32(42, event.seq);
+  TEST_ASSERT_EQUAL_UINT32(0, event.boot);
+  TEST_ASSERT_FALSE(event.replay);
+  TEST_ASSERT_EQUAL_STRING("A4CF12F0C0DE", event.trace.origin);
+  TEST_ASSERT_EQUAL_UINT32(7, event.trace.id);
+  TEST_ASSERT_TRUE(event.trace.isrEpoch == 1718000000123ULL);
+  TEST_ASSERT_TRUE(event.trace.pubEpoch == 1718000000125ULL);
+  TEST_ASSERT_EQUAL_UINT32(0, event.trace.isrToPickup);
+}
+
+static void test_touch_without_trace_or_seq() {
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse("{\"event\":\"touch\",\"device\":\"B4CF12F0C0DE\",\"delta\":0}"));
+  TEST_ASSERT_EQUAL_UINT32(0, event.delta);
+  TEST_ASSERT_FALSE(event.sequenced);
+  TEST_ASSERT_EQUAL_UINT32(0, event.trace.id);
+  TEST_ASSERT_EQUAL_STRING("B4CF12F0C0DE", event.trace.origin);
+}
+
+static void test_lan_copy_carries_boot() {
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse("{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":5,\"seq\":9,\"boot\":3735928559}"));
+  TEST_ASSERT_EQUAL_UINT32(9, event.seq);
+  TEST_ASSERT_EQUAL_UINT32(3735928559u, event.boot);
+}
+
+static void test_replayed_touch_counts_from_current_sync() {
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse("{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":80,"
+                                             "\"at\":1718000005000,\"replay\":true}"));
+  TEST_ASSERT_TRUE(event.replay);
+  unsigned long delta = 0;
+  TEST_ASSERT_TRUE(touchDelta(event, 1718000004700ULL, delta));
+  TEST_ASSERT_EQUAL_UINT32(300, delta); // Not the 80 it was pressed with
+  TEST_ASSERT_FALSE(touchDelta(event, 1718000005001ULL, delta)); // Pressed before the round began
+
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse("{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":80}"));
+  TEST_ASSERT_TRUE(touchDelta(event, 1718000005001ULL, delta));
+  TEST_ASSERT_EQUAL_UINT32(80, delta);
+}
+
+static void test_sync_and_go() {
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_SYNC, parse("{\"event\":\"sync\",\"device\":\"A4CF12F0C0DE\"}"));
+  TEST_ASSERT_EQUAL_STRING("A4CF12F0C0DE", event.device);
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_SYNC, parse("{\"event\":\"sync\"}")); // From a tool, no sender
+  TEST_ASSERT_EQUAL_STRING("", event.device);
+
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_GO, parse("{\"event\":\"go\",\"at\":1718000009000,\"round\":12}"));
+  TEST_ASSERT_TRUE(event.at == 1718000009000ULL);
+  TEST_ASSERT_EQUAL_UINT32(12, event.round);
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_INVALID, parse("{\"event\":\"go\",\"round\":12}"));
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_INVALID, parse("{\"event\":\"go\",\"at\":\"soon\"}"));
+}
+
+static void test_commands_stay_in_the_document() {
+  PooledJsonDocument json;
+  const char msg[] = "{\"event\":\"room\",\"room\":\"arena\"}";
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_COMMAND, parseEvent(json, msg, sizeof(msg) - 1, event));
+  TEST_ASSERT_EQUAL_STRING("arena", json["room"] | "");
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_COMMAND, parse("{\"event\":\"no-such-event\"}"));
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_COMMAND, parse("{\"level\":3}"));
+}
+
+static void test_malformed_payloads() {
+  const char* bad[] = {
+    "",
+    "   ",
+    "touch",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":12",  // Cut off
+    "{\"event\":\"touch\" \"device\":\"A4CF12F0C0DE\"}",              // Missing comma
+    "[1,2,3]",
+    "42",
+    "\"touch\"",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\"}",              // No delta, would win at 0
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":-5}",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":\"12\"}",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":1.5}",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":99999999999}",
+    "{\"event\":\"touch\",\"delta\":12}",
+    "{\"event\":\"touch\",\"device\":\"\",\"delta\":12}",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE-A4CF12F0C0DE\",\"delta\":12}",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":12,\"replay\":true}",
+    "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":12,\"seq\":\"x\"}",
+    "{\"event\":\"sync\",\"device\":\"A4CF12F0C0DE\",\"seq\":-1}",
+  };
+  for (const char* msg : bad) {
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(GAME_EVENT_INVALID, parse(msg), msg);
+    TEST_ASSERT_TRUE_MESSAGE(event.reason[0] != '\0', msg);
+  }
+}
+
+static void test_length_bounds_the_parse() {
+  // MQTT payloads are not terminated, only `length` bytes belong to the event
+  const char buffer[] = "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":12}{\"event\":\"sync\"}";
+  PooledJsonDocument json;
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parseEvent(json, buffer, strchr(buffer, '}') - buffer + 1, event));
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_INVALID, parseEvent(json, buffer, 30, event));
+}
+
+static void test_oversized_payloads() {
+  static char msg[EVENT_MAX_PAYLOAD + 2];
+  const char head[] = "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":12,\"pad\":\"";
+  size_t fill = EVENT_MAX_PAYLOAD - (sizeof(head) - 1) - 2;
+  memcpy(msg, head, sizeof(head) - 1);
+  memset(msg + sizeof(head) - 1, 'x', fill);
+  memcpy(msg + sizeof(head) - 1 + fill, "\"}", 3);
+  TEST_ASSERT_EQUAL_UINT32(EVENT_MAX_PAYLOAD, strlen(msg));
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse(msg)); // Right at the limit still parses
+
+  memcpy(msg + sizeof(head) - 1 + fill, "x\"}", 4);
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_INVALID, parse(msg));
+  TEST_ASSERT_EQUAL_STRING("too long", event.reason);
+}
+
+static void test_rejected_event_keeps_no_state() {
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_TOUCH, parse("{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":12,\"seq\":4}"));
+  TEST_ASSERT_EQUAL_UINT8(GAME_EVENT_INVALID, parse("not json"));
+  TEST_ASSERT_EQUAL_STRING("", event.device);
+  TEST_ASSERT_FALSE(event.sequenced);
+  TEST_ASSERT_EQUAL_UINT32(0, event.delta);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_touch_with_trace);
+  RUN_TEST(test_touch_without_trace_or_seq);
+  RUN_TEST(test_lan_copy_carries_boot);
+  RUN_TEST(test_replayed_touch_counts_from_current_sync);
+  RUN_TEST(test_sync_and_go);
+  RUN_TEST(test_commands_stay_in_the_document);
+  RUN_TEST(test_malformed_payloads);
+  RUN_TEST(test_length_bounds_the_parse);
+  RUN_TEST(test_oversized_payloads);
+  RUN_TEST(test_rejected_event_keeps_no_state);
+  return UNITY_END();
+}
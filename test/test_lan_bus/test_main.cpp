@@ -0,0 +1,231 @@
+#include <unity.h>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <network.h>
+#include <event_parser.h>
+#include <json_pool.h>
+#include <mini_broker.h>
+
+// Two LAN buses on the loopback multicast group next to two socket transports on a broker, the
+// way sendGameEvent() and recieveEvents() use them: every event goes out over both paths with the
+// same (boot, seq), the receiver keeps the first copy. Reports the latency of each path, and
+// checks LAN loss counting, duplicate detection and a sender that reboots. MQTT_BENCH_BROKER=host:port
+// runs the MQTT side against a real broker instead of MiniBroker, MQTT_BENCH_LATENCY=ms makes
+// MiniBroker a broker that far away. The pump reads MQTT before the LAN, in the order loop() does.
+#define LAN_EVENTS 200
+#define LAN_DROP_EVERY 10 // The LAN copy of every 10th event is not sent, as if the packet was lost
+#define WAIT_MS 3000
+
+static const char* deviceA = "A4CF12F0C0DE";
+static const char* deviceB = "B4CF12F0C0DE";
+static const char* room = "lab";
+static const char* topic = "funger/rooms/lab/events";
+
+static MiniBroker broker;
+static char brokerHost[64] = "127.0.0.1";
+static uint16_t brokerPort = 0;
+static MqttTransport* mqttA = nullptr;
+static MqttTransport* mqttB = nullptr;
+static LanBus* lanA = nullptr;
+static LanBus lanB;
+
+// What B saw of the current event
+static int64_t sentAt = 0;
+static int64_t lanArrival = 0;
+static int64_t mqttArrival = 0;
+static uint32_t accepted = 0;
+static uint32_t rejected = 0;
+static bool pinged = false;
+static std::vector<int64_t> lanNs;
+static std::vector<int64_t> mqttNs;
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void deliver(const char* payload, size_t length, bool viaLan) {
+  // recieveEvents() on B: parse, then the dedupe on the (device, boot, seq) the event carries
+  PooledJsonDocument json;
+  GameEvent event;
+  uint8_t type = parseEvent(json, payload, length, event);
+  if (type == GAME_EVENT_COMMAND) {
+    pinged = true;
+    return;
+  }
+  if (type != GAME_EVENT_TOUCH || !event.sequenced) return;
+  int64_t now = nowNs();
+  (viaLan ? lanArrival : mqttArrival) = now;
+  (viaLan ? lanNs : mqttNs).push_back(now - sentAt);
+  if (lanB.accept(event.device, event.boot, event.seq, viaLan)) {
+    accepted++;
+  } else {
+    rejected++;
+  }
+}
+
+static void onLan(const char* payload, size_t length) { deliver(payload, length, true); }
+static void onMqtt(const char* payload, size_t length) { deliver(payload, length, false); }
+
+static void pump() {
+  mqttA->loop();
+  mqttB->loop();
+  lanA->loop();
+  lanB.loop();
+}
+
+static bool waitFor(bool (*done)(), uint32_t ms = WAIT_MS) {
+  int64_t deadline = nowNs() + (int64_t)ms * 1000000;
+  while (!done()) {
+    if (nowNs() > deadline) return false;
+    pump();
+  }
+  return true;
+}
+
+static bool connected() { return mqttA->isMqttConnected() && mqttB->isMqttConnected(); }
+static bool discovered() { return lanA->peers() > 0 && lanB.peers() > 0; }
+static bool wasPinged() { return pinged; }
+static bool mqttOnly = false;
+static bool bothArrived() { return mqttArrival != 0 && (mqttOnly || lanArrival != 0); }
+
+static void startBus(LanBus& bus, const char* device, MqttMessageHandler handler) {
+  TEST_ASSERT_TRUE_MESSAGE(bus.begin(device, room, handler), "No multicast on this host");
+}
+
+void setUp() {
+  const char* env = getenv("MQTT_BENCH_BROKER");
+  if (env != nullptr) {
+    const char* colon = strchr(env, ':');
+    size_t hostLen = colon ? (size_t)(colon - env) : strlen(env);
+    snprintf(brokerHost, sizeof(brokerHost), "%.*s", (int)hostLen, env);
+    brokerPort = colon ? atoi(colon + 1) : 1883;
+  } else if (!broker.running()) {
+    TEST_ASSERT_TRUE(broker.start());
+    brokerPort = broker.port();
+    broker.setLatency(getenv("MQTT_BENCH_LATENCY") ? atoi(getenv("MQTT_BENCH_LATENCY")) : 0);
+  }
+  halSetMicros(1000000);
+  lanA = new LanBus();
+  lanB = LanBus();
+  mqttA = createMqttTransport(nullptr, nullptr, brokerHost, "", "", "lan-a", brokerPort);
+  mqttB = createMqttTransport(nullptr, nullptr, brokerHost, "", "", "lan-b", brokerPort);
+  TEST_ASSERT_TRUE_MESSAGE(waitFor(connected), "No broker connection");
+  TEST_ASSERT_TRUE(mqttB->subscribe(topic, onMqtt));
+  // SUBACK has to be back before the first event, ping until B hears one
+  pinged = false;
+  for (int i = 0; i < 10 && !pinged; i++) {
+    mqttA->publish(topic, "{\"event\":\"ping\"}");
+    waitFor(wasPinged, 100);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(pinged, "Subscription never became active");
+
+  startBus(*lanA, deviceA, nullptr);
+  startBus(lanB, deviceB, onLan);
+  halAdvanceMillis(LAN_BEACON_INTERVAL); // Both beacon on the next loop() and find each other
+  TEST_ASSERT_TRUE_MESSAGE(waitFor(discovered), "Buses never heard each other's beacons");
+  accepted = 0;
+  rejected = 0;
+  lanNs.clear();
+  mqttNs.clear();
+}
+
+void tearDown() {
+  lanA->end();
+  delete lanA;
+  lanB.end();
+  delete mqttA;
+  delete mqttB;
+}
+
+// sendGameEvent() on A. Returns false if B did not get every copy that was sent.
+static bool sendEvent(LanBus& bus, uint32_t seq, bool overLan, uint32_t delta = 100) {
+  char payload[160];
+  snprintf(payload, sizeof(payload), "{\"event\":\"touch\",\"device\":\"%s\",\"delta\":%u,\"seq\":%u,\"boot\":%u}",
+           deviceA, delta, seq, bus.boot());
+  sentAt = nowNs();
+  lanArrival = 0;
+  mqttArrival = 0;
+  mqttOnly = !overLan;
+  if (overLan) TEST_ASSERT_TRUE(bus.send(seq, payload));
+  TEST_ASSERT_TRUE(mqttA->publish(topic, payload));
+  return waitFor(bothArrived);
+}
+
+static int64_t percentile(std::vector<int64_t>& ns, int pct) {
+  std::sort(ns.begin(), ns.end());
+  return ns[ns.size() * pct / 100] / 1000;
+}
+
+static void test_first_copy_wins_and_the_second_is_dropped() {
+  uint32_t dropped = 0;
+  for (uint32_t i = 0; i < LAN_EVENTS; i++) {
+    bool overLan = i % LAN_DROP_EVERY != LAN_DROP_EVERY / 2;
+    if (!overLan) dropped++;
+    TEST_ASSERT_TRUE_MESSAGE(sendEvent(*lanA, lanA->nextSeq(), overLan), "Event copy never arrived");
+  }
+
+  const LanStats& stats = lanB.stats();
+  const char* target = getenv("MQTT_BENCH_BROKER") ? getenv("MQTT_BENCH_BROKER") : "MiniBroker";
+  char line[200];
+  snprintf(line, sizeof(line), "%u events, LAN p50 %lld us p99 %lld us, MQTT via %s p50 %lld us p99 %lld us",
+           LAN_EVENTS, (long long)percentile(lanNs, 50), (long long)percentile(lanNs, 99), target,
+           (long long)percentile(mqttNs, 50), (long long)percentile(mqttNs, 99));
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "LAN first %u, MQTT first %u, duplicates %u, LAN lost %u",
+           (unsigned)stats.lanFirst, (unsigned)stats.mqttFirst, (unsigned)stats.duplicates, (unsigned)stats.lost);
+  TEST_MESSAGE(line);
+
+  TEST_ASSERT_EQUAL_UINT32(LAN_EVENTS, accepted); // Every event exactly once
+  TEST_ASSERT_EQUAL_UINT32(LAN_EVENTS - dropped, rejected);
+  TEST_ASSERT_EQUAL_UINT32(LAN_EVENTS - dropped, stats.duplicates);
+  TEST_ASSERT_EQUAL_UINT32(LAN_EVENTS - dropped, stats.received);
+  TEST_ASSERT_EQUAL_UINT32(dropped, stats.lost);
+  TEST_ASSERT_EQUAL_UINT32(LAN_EVENTS, stats.lanFirst + stats.mqttFirst);
+  TEST_ASSERT_TRUE(stats.mqttFirst >= dropped);
+  TEST_ASSERT_EQUAL_UINT32(LAN_EVENTS - dropped, lanA->stats().sent);
+}
+
+static void test_rebooted_peer_starts_counting_again() {
+  for (uint32_t i = 0; i < 5; i++) TEST_ASSERT_TRUE(sendEvent(*lanA, lanA->nextSeq(), true));
+  uint32_t oldBoot = lanA->boot();
+
+  // A restarts: new bus, new boot nonce, sequence numbers from 1 again
+  lanA->end();
+  delete lanA;
+  lanA = new LanBus();
+  startBus(*lanA, deviceA, nullptr);
+  TEST_ASSERT_TRUE(lanA->boot() != oldBoot);
+  halAdvanceMillis(LAN_BEACON_INTERVAL);
+  TEST_ASSERT_TRUE(waitFor(discovered));
+  for (uint32_t i = 0; i < 5; i++) TEST_ASSERT_TRUE(sendEvent(*lanA, lanA->nextSeq(), true));
+  TEST_ASSERT_EQUAL_UINT32(10, accepted); // Same seqs as before the reboot, none taken for duplicates
+  TEST_ASSERT_EQUAL_UINT32(10, rejected);
+  TEST_ASSERT_EQUAL_UINT32(0, lanB.stats().lost);
+
+  // A late copy of an event already taken under the new boot is still a duplicate
+  TEST_ASSERT_TRUE(sendEvent(*lanA, 3, false));
+  TEST_ASSERT_EQUAL_UINT32(10, accepted);
+}
+
+static void test_other_rooms_are_ignored() {
+  LanBus other;
+  TEST_ASSERT_TRUE(other.begin("C4CF12F0C0DE", "elsewhere", nullptr));
+  halAdvanceMillis(LAN_BEACON_INTERVAL);
+  uint32_t foreign = lanB.stats().foreign;
+  for (int i = 0; i < 50 && lanB.stats().foreign == foreign; i++) {
+    other.loop();
+    pump();
+  }
+  TEST_ASSERT_TRUE(lanB.stats().foreign > foreign);
+  TEST_ASSERT_EQUAL_UINT8(1, lanB.peers()); // Only A
+  other.end();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_copy_wins_and_the_second_is_dropped);
+  RUN_TEST(test_rebooted_peer_starts_counting_again);
+  RUN_TEST(test_other_rooms_are_ignored);
+  return UNITY_END();
+}
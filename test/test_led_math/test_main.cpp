@@ -0,0 +1,77 @@
+#include <unity.h>
+#include <led_math.h>
+
+void setUp() {}
+void tearDown() {}
+
+static void test_ease_endpoints() {
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.0f, cubicEaseInOut(0.0f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.5f, cubicEaseInOut(0.5f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, cubicEaseInOut(1.0f));
+}
+
+static void test_ease_monotonic_and_symmetric() {
+  float last = -1;
+  for (int i = 0; i <= 1000; i++) {
+    float t = i / 1000.0f;
+    float eased = cubicEaseInOut(t);
+    TEST_ASSERT_TRUE(eased >= last);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.0f - eased, cubicEaseInOut(1.0f - t));
+    last = eased;
+  }
+  // Slow at the ends, fast through the middle
+  TEST_ASSERT_TRUE(cubicEaseInOut(0.1f) < 0.1f);
+  TEST_ASSERT_TRUE(cubicEaseInOut(0.9f) > 0.9f);
+}
+
+static void test_interpolate() {
+  TEST_ASSERT_EQUAL_INT(0, interpolate(0, 255, 0.0f));
+  TEST_ASSERT_EQUAL_INT(255, interpolate(0, 255, 1.0f));
+  TEST_ASSERT_EQUAL_INT(127, interpolate(0, 255, 0.5f));  // Truncates, the animations rely on integer steps
+  TEST_ASSERT_EQUAL_INT(159, interpolate(255, 64, 0.5f)); // 159.5, falling ranges truncate too
+  TEST_ASSERT_EQUAL_INT(64, interpolate(255, 64, 1.0f));
+}
+
+static void test_scale_daytime_caps_at_max_brightness() {
+  LEDstruct base;
+  base.maxBrightness = 50; // 127 of 255
+  LEDstruct led = scaleColors(base, 255, 100, 0, 200, 12);
+  TEST_ASSERT_EQUAL_UINT8(127, led.redBrightness);
+  TEST_ASSERT_EQUAL_UINT8(100, led.blueBrightness);
+  TEST_ASSERT_EQUAL_UINT8(0, led.greenBrightness);
+  TEST_ASSERT_EQUAL_UINT8(127, led.whiteBrightness);
+  TEST_ASSERT_EQUAL_UINT8(50, led.maxBrightness); // The limits travel with the color
+}
+
+static void test_scale_night_dims() {
+  LEDstruct base;
+  base.nightBrightness = 50;
+  LEDstruct led = scaleColors(base, 255, 100, 0, 201, 22);
+  TEST_ASSERT_EQUAL_UINT8(127, led.redBrightness);
+  TEST_ASSERT_EQUAL_UINT8(50, led.blueBrightness);
+  TEST_ASSERT_EQUAL_UINT8(0, led.greenBrightness);
+  TEST_ASSERT_EQUAL_UINT8(100, led.whiteBrightness);
+}
+
+static void test_scale_night_boundaries() {
+  LEDstruct base;
+  base.nightBrightness = 10;
+  base.nightEnd = 7;
+  base.nightStart = 20;
+  TEST_ASSERT_EQUAL_UINT8(25, scaleColors(base, 255, 0, 0, 0, 6).redBrightness);
+  TEST_ASSERT_EQUAL_UINT8(255, scaleColors(base, 255, 0, 0, 0, 7).redBrightness);   // nightEnd is day
+  TEST_ASSERT_EQUAL_UINT8(255, scaleColors(base, 255, 0, 0, 0, 19).redBrightness);
+  TEST_ASSERT_EQUAL_UINT8(25, scaleColors(base, 255, 0, 0, 0, 20).redBrightness);   // nightStart is night
+  TEST_ASSERT_EQUAL_UINT8(25, scaleColors(base, 255, 0, 0, 0, 0).redBrightness);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ease_endpoints);
+  RUN_TEST(test_ease_monotonic_and_symmetric);
+  RUN_TEST(test_interpolate);
+  RUN_TEST(test_scale_daytime_caps_at_max_brightness);
+  RUN_TEST(test_scale_night_dims);
+  RUN_TEST(test_scale_night_boundaries);
+  return UNITY_END();
+}
@@ -0,0 +1,64 @@
+#include <unity.h>
+#include <net_util.h>
+
+void setUp() {}
+void tearDown() {}
+
+static void test_dedupe_keeps_strongest_per_ssid() {
+  std::vector<NetworkInfo> networks = {
+    { "venue", -70 }, { "home", -50 }, { "venue", -40 }, { "home", -80 }, { "guest", -60 },
+  };
+  std::vector<NetworkInfo> unique = dedupeNetworks(networks);
+  TEST_ASSERT_EQUAL(3, unique.size());
+  TEST_ASSERT_EQUAL_STRING("venue", unique[0].ssid.c_str());
+  TEST_ASSERT_EQUAL_INT32(-40, unique[0].rssi);
+  TEST_ASSERT_EQUAL_STRING("home", unique[1].ssid.c_str());
+  TEST_ASSERT_EQUAL_INT32(-50, unique[1].rssi);
+  TEST_ASSERT_EQUAL_STRING("guest", unique[2].ssid.c_str());
+}
+
+static void test_dedupe_drops_hidden_networks() {
+  std::vector<NetworkInfo> networks = { { "", -30 }, { "visible", -90 }, { "", -35 } };
+  std::vector<NetworkInfo> unique = dedupeNetworks(networks);
+  TEST_ASSERT_EQUAL(1, unique.size());
+  TEST_ASSERT_EQUAL_STRING("visible", unique[0].ssid.c_str());
+}
+
+static void test_dedupe_caps_the_list() {
+  std::vector<NetworkInfo> networks;
+  for (int n = 0; n < 30; n++) {
+    networks.push_back({ String("net-") + n, -30 - n });
+  }
+  std::vector<NetworkInfo> unique = dedupeNetworks(networks);
+  TEST_ASSERT_EQUAL(NETWORKS_MAX, unique.size());
+  TEST_ASSERT_EQUAL_STRING("net-0", unique[0].ssid.c_str());
+  TEST_ASSERT_EQUAL_INT32(-30 - (NETWORKS_MAX - 1), unique[NETWORKS_MAX - 1].rssi);
+}
+
+static void test_dedupe_empty_scan() {
+  std::vector<NetworkInfo> networks;
+  TEST_ASSERT_EQUAL(0, dedupeNetworks(networks).size());
+}
+
+static void test_format_mac() {
+  // Replaces removeColons(WiFi.macAddress()): same digits, no separators, upper case
+  const uint8_t mac[6] = { 0xA4, 0xCF, 0x12, 0x0F, 0x00, 0xDE };
+  char out[13];
+  memset(out, 'x', sizeof(out));
+  formatMac(mac, out);
+  TEST_ASSERT_EQUAL_STRING("A4CF120F00DE", out);
+
+  const uint8_t ones[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  formatMac(ones, out);
+  TEST_ASSERT_EQUAL_STRING("FFFFFFFFFFFF", out);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_dedupe_keeps_strongest_per_ssid);
+  RUN_TEST(test_dedupe_drops_hidden_networks);
+  RUN_TEST(test_dedupe_caps_the_list);
+  RUN_TEST(test_dedupe_empty_scan);
+  RUN_TEST(test_format_mac);
+  return UNITY_END();
+}
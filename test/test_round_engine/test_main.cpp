@@ -0,0 +1,174 @@
+#include <unity.h>
+#include <round_engine.h>
+#include <random>
+#include <vector>
+
+static Round r;
+
+void setUp() { r = Round(); }
+void tearDown() {}
+
+static void add(const char* device, unsigned long delta, unsigned long now = 1000) {
+  TEST_ASSERT_TRUE(roundAddTouch(r, device, delta, TouchTrace(), now));
+}
+
+static void test_earliest_delta_wins() {
+  add("CCCC", 300);
+  add("AAAA", 500);
+  add("BBBB", 200);
+  TEST_ASSERT_EQUAL_UINT8(FIRST, rankRound(r, "BBBB"));
+  TEST_ASSERT_EQUAL_STRING("BBBB", r.touches[0].device);
+  TEST_ASSERT_EQUAL_STRING("CCCC", r.touches[1].device);
+  TEST_ASSERT_EQUAL_STRING("AAAA", r.touches[2].device);
+  TEST_ASSERT_EQUAL_UINT8(SECOND, rankRound(r, "CCCC"));
+  TEST_ASSERT_EQUAL_UINT8(OTHER, rankRound(r, "AAAA"));
+  TEST_ASSERT_EQUAL_UINT8(NOT_PLACED, rankRound(r, "DDDD"));
+}
+
+static void test_equal_deltas_go_to_lowest_device() {
+  add("B4CF12F0C0DE", 250);
+  add("A4CF12F0C0DE", 250);
+  TEST_ASSERT_EQUAL_UINT8(FIRST, rankRound(r, "A4CF12F0C0DE"));
+  TEST_ASSERT_EQUAL_UINT8(SECOND, rankRound(r, "B4CF12F0C0DE"));
+}
+
+static void test_device_competes_with_earliest_touch() {
+  add("AAAA", 400);
+  add("BBBB", 300);
+  add("AAAA", 100); // Same device again, an earlier delta replaces its entry
+  add("AAAA", 900); // A later one doesn't
+  TEST_ASSERT_EQUAL_UINT8(2, r.count);
+  TEST_ASSERT_EQUAL_UINT8(FIRST, rankRound(r, "AAAA"));
+  TEST_ASSERT_EQUAL_UINT32(100, r.touches[0].delta);
+}
+
+static void test_device_keeps_trace_of_earliest_touch() {
+  TouchTrace first, retry;
+  first.id = 1;
+  retry.id = 2;
+  TEST_ASSERT_TRUE(roundAddTouch(r, "AAAA", 400, first, 1000));
+  TEST_ASSERT_TRUE(roundAddTouch(r, "AAAA", 100, retry, 1000));
+  TEST_ASSERT_EQUAL_UINT32(2, r.touches[0].trace.id);
+  TEST_ASSERT_TRUE(roundAddTouch(r, "AAAA", 900, first, 1000));
+  TEST_ASSERT_EQUAL_UINT32(2, r.touches[0].trace.id);
+}
+
+static void test_full_queue_keeps_the_best() {
+  char device[18];
+  // Slowest first, so every later arrival beats something already queued
+  for (uint8_t n = 0; n < ROUND_QUEUE_SIZE + 3; n++) {
+    snprintf(device, sizeof(device), "DEV%02u", n);
+    add(device, 500 - n);
+  }
+  add("LATE", 900); // Worse than everything queued, turned away
+  TEST_ASSERT_EQUAL_UINT8(ROUND_QUEUE_SIZE, r.count);
+  TEST_ASSERT_EQUAL_UINT8(4, r.dropped);
+  rankRound(r, "");
+  for (uint8_t i = 0; i < r.count; i++) {
+    snprintf(device, sizeof(device), "DEV%02u", ROUND_QUEUE_SIZE + 2 - i);
+    TEST_ASSERT_EQUAL_STRING(device, r.touches[i].device);
+  }
+  TEST_ASSERT_EQUAL_UINT8(NOT_PLACED, rankRound(r, "DEV00"));
+  TEST_ASSERT_EQUAL_UINT8(NOT_PLACED, rankRound(r, "LATE"));
+}
+
+static void test_window_starts_with_first_touch() {
+  add("AAAA", 100, 5000);
+  add("BBBB", 100, 5100);
+  TEST_ASSERT_EQUAL_UINT32(5000, r.windowStart);
+}
+
+static void test_holdoff_after_decision() {
+  add("AAAA", 100, 1000);
+  rankRound(r, "AAAA");
+  finishRound(r, 2000);
+  TEST_ASSERT_EQUAL_UINT8(0, r.count);
+  TEST_ASSERT_TRUE(r.decided);
+
+  TEST_ASSERT_FALSE(roundAddTouch(r, "BBBB", 50, TouchTrace(), 2000 + ROUND_HOLDOFF - 1)); // Late for the judged round
+  TEST_ASSERT_EQUAL_UINT8(0, r.count);
+  TEST_ASSERT_TRUE(roundAddTouch(r, "BBBB", 50, TouchTrace(), 2000 + ROUND_HOLDOFF)); // No sync came, next round
+  TEST_ASSERT_FALSE(r.decided);
+  TEST_ASSERT_EQUAL_UINT8(1, r.count);
+  TEST_ASSERT_EQUAL_UINT32(2000 + ROUND_HOLDOFF, r.windowStart);
+}
+
+// Property: every device hears the round's touches in its own order, and all of them must still
+// agree on the ranking. Random rounds of up to twice ROUND_QUEUE_SIZE players, so the queue
+// overflows, with repeat touches and equal deltas, ranked from many shuffled arrival orders.
+struct Arrival {
+  char device[18];
+  unsigned long delta;
+};
+
+static void rankArrivals(const std::vector<Arrival>& arrivals, Round& out) {
+  out = Round();
+  for (const Arrival& a : arrivals) {
+    TEST_ASSERT_TRUE(roundAddTouch(out, a.device, a.delta, TouchTrace(), 1000));
+  }
+  rankRound(out, "");
+}
+
+static void test_shuffled_arrivals_rank_the_same() {
+  std::mt19937 rng(29);
+  for (uint16_t trial = 0; trial < 500; trial++) {
+    uint8_t players = 1 + rng() % (2 * ROUND_QUEUE_SIZE);
+    std::vector<Arrival> arrivals;
+    for (uint8_t p = 0; p < players; p++) {
+      Arrival a;
+      snprintf(a.device, sizeof(a.device), "A4CF12F0%02X%02X", (unsigned)(rng() % 256), (unsigned)p);
+      uint8_t touches = 1 + rng() % 3; // Retries and LAN + broker copies of the same touch
+      for (uint8_t t = 0; t < touches; t++) {
+        a.delta = 200 + rng() % 40; // Narrow range, so equal deltas and the tiebreak come up often
+        arrivals.push_back(a);
+      }
+    }
+
+    Round reference;
+    rankArrivals(arrivals, reference);
+    TEST_ASSERT_EQUAL_UINT8(min(players, (uint8_t)ROUND_QUEUE_SIZE), reference.count);
+    for (uint8_t order = 0; order < 20; order++) {
+      std::shuffle(arrivals.begin(), arrivals.end(), rng);
+      Round shuffled;
+      rankArrivals(arrivals, shuffled);
+      TEST_ASSERT_EQUAL_UINT8(reference.count, shuffled.count);
+      for (uint8_t i = 0; i < reference.count; i++) {
+        TEST_ASSERT_EQUAL_STRING(reference.touches[i].device, shuffled.touches[i].device);
+        TEST_ASSERT_EQUAL_UINT32(reference.touches[i].delta, shuffled.touches[i].delta);
+      }
+      // And every player works out the same placement for itself
+      for (uint8_t i = 0; i < reference.count; i++) {
+        uint8_t expected = (i == 0) ? FIRST : (i == 1) ? SECOND : OTHER;
+        TEST_ASSERT_EQUAL_UINT8(expected, rankRound(shuffled, reference.touches[i].device));
+      }
+    }
+  }
+}
+
+static void test_ranking_is_a_strict_order() {
+  // touchBefore must be irreflexive and asymmetric or std::sort may give devices different orders
+  std::mt19937 rng(2);
+  for (uint16_t trial = 0; trial < 2000; trial++) {
+    RoundTouch a, b;
+    a.delta = rng() % 4;
+    b.delta = rng() % 4;
+    snprintf(a.device, sizeof(a.device), "D%u", (unsigned)(rng() % 3));
+    snprintf(b.device, sizeof(b.device), "D%u", (unsigned)(rng() % 3));
+    TEST_ASSERT_FALSE(touchBefore(a, a));
+    TEST_ASSERT_FALSE(touchBefore(a, b) && touchBefore(b, a));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_earliest_delta_wins);
+  RUN_TEST(test_equal_deltas_go_to_lowest_device);
+  RUN_TEST(test_device_competes_with_earliest_touch);
+  RUN_TEST(test_device_keeps_trace_of_earliest_touch);
+  RUN_TEST(test_full_queue_keeps_the_best);
+  RUN_TEST(test_window_starts_with_first_touch);
+  RUN_TEST(test_holdoff_after_decision);
+  RUN_TEST(test_shuffled_arrivals_rank_the_same);
+  RUN_TEST(test_ranking_is_a_strict_order);
+  return UNITY_END();
+}
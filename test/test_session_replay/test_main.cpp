@@ -0,0 +1,328 @@
+#include <unity.h>
+#include <native_hal.h>
+#include <event_parser.h>
+#include <json_pool.h>
+#include <round_engine.h>
+#include <session_recorder.h>
+
+// A session is played the way recieveEvents(), queueTouch() and decideRound() handle it on the
+// device, recorded, dumped in MQTT sized parts, loaded back and replayed. Everything the replay
+// judges has to come out as it did live, and tampering with a payload or the clock has to show.
+#define SELF "A4CF12F0C0DE"
+#define EPOCH_START 1718000000000ULL
+#define DUMP_PART 320 // SESSION_DUMP_BYTES on the device
+
+static SessionRecorder recorder;
+static SessionRecorder loaded;
+static Round live;
+static uint64_t syncEpoch;
+static uint8_t dump[SESSION_RECORDS * sizeof(SessionRecord) + SESSION_PAYLOAD_BYTES];
+static size_t dumpLength;
+static uint16_t liveRounds;
+
+static uint64_t epochNow() { return EPOCH_START + millis(); }
+
+void setUp() {
+  halSetMicros(0);
+  recorder.clear();
+  recorder.setClock(epochNow, &syncEpoch);
+  loaded.clear();
+  live = Round();
+  syncEpoch = epochNow();
+  liveRounds = 0;
+}
+void tearDown() {}
+
+static void receive(const char* msg, bool lan = false, bool duplicate = false) {
+  PooledJsonDocument json;
+  GameEvent event;
+  uint8_t type = parseEvent(json, msg, strlen(msg), event);
+  if (strcmp(event.device, SELF) == 0 && type != GAME_EVENT_SYNC) return;
+  if (type == GAME_EVENT_COMMAND) return;
+  uint32_t received = recorder.recordEvent(event.device, msg, strlen(msg), lan ? REC_FLAG_LAN : 0);
+  if (duplicate) {
+    recorder.markLast(REC_FLAG_DUPLICATE); // lanBus.accept() said no
+    return;
+  }
+  unsigned long delta;
+  if (type == GAME_EVENT_TOUCH && touchDelta(event, syncEpoch, delta)) {
+    roundAddTouch(live, event.trace.origin, delta, event.trace, received);
+  } else if (type == GAME_EVENT_SYNC) {
+    syncEpoch = epochNow(); // synchronize()
+    live.decided = false;
+    recorder.record(REC_SYNC, 0, event.device);
+  }
+}
+
+static void touch(const char* device, unsigned long delta, bool lan = false, bool duplicate = false) {
+  char msg[160];
+  snprintf(msg, sizeof(msg), "{\"event\":\"touch\",\"device\":\"%s\",\"delta\":%lu,\"seq\":%u,\"trace\":{\"id\":%u,\"isr\":%llu}}",
+           device, delta, liveRounds, liveRounds, (unsigned long long)(syncEpoch + delta));
+  receive(msg, lan, duplicate);
+}
+
+static void localTouch(unsigned long delta) {
+  roundAddTouch(live, SELF, delta, TouchTrace(), recorder.record(REC_TOUCH, delta, SELF, REC_FLAG_LOCAL));
+}
+
+static void decide() {
+  rankRound(live, SELF);
+  finishRound(live, recorder.record(REC_DECIDE, live.count, live.touches[0].device, live.placement));
+  liveRounds++;
+}
+
+static void sync(const char* device) {
+  char msg[80];
+  snprintf(msg, sizeof(msg), "{\"event\":\"sync\",\"device\":\"%s\"}", device);
+  receive(msg);
+}
+
+static void goTrigger(uint32_t round) {
+  // goTriggered(): the trigger is the sync, whatever was queued before it is dropped
+  syncEpoch = epochNow();
+  live.count = 0;
+  live.dropped = 0;
+  live.decided = false;
+  recorder.record(REC_SYNC, round, "go");
+}
+
+static void playSession() {
+  // Round 1: a plain race, the remote touch wins
+  sync("B4CF12F0C0DE");
+  halAdvanceMillis(400);
+  touch("B4CF12F0C0DE", 100);
+  halAdvanceMillis(20);
+  localTouch(180);
+  touch("C4CF12F0C0DE", 150, true);
+  touch("C4CF12F0C0DE", 150, false, true); // The MQTT copy of the LAN touch
+  halAdvanceMillis(150);
+  decide();
+  halAdvanceMillis(300);
+  touch("D4CF12F0C0DE", 90); // Late, inside the hold-off of the decided round
+
+  // Round 2: a device retries with a better touch and beats us, someone sends garbage
+  sync("B4CF12F0C0DE");
+  halAdvanceMillis(250);
+  localTouch(120);
+  touch("B4CF12F0C0DE", 200);
+  receive("{\"event\":\"touch\",\"device\":\"C4CF12F0C0DE\",\"delta\":\"soon\"}");
+  touch("B4CF12F0C0DE", 110);
+  halAdvanceMillis(150);
+  decide();
+  sync(SELF); // Our own sync comes back
+
+  // Round 3: a replayed offline touch, measured from this round's sync
+  halAdvanceMillis(500);
+  char replay[160];
+  snprintf(replay, sizeof(replay), "{\"event\":\"touch\",\"device\":\"D4CF12F0C0DE\",\"delta\":9,\"at\":%llu,\"replay\":true}",
+           (unsigned long long)(syncEpoch + 130));
+  receive(replay);
+  localTouch(140);
+  touch("E4CF12F0C0DE", 135);
+  halAdvanceMillis(150);
+  decide();
+
+  // Round 4: the winner's sync never comes, the hold-off runs out
+  halAdvanceMillis(ROUND_HOLDOFF + 10);
+  touch("C4CF12F0C0DE", 3000);
+  localTouch(3100);
+  halAdvanceMillis(150);
+  decide();
+}
+
+static void dumpAndLoad() {
+  dumpLength = 0;
+  uint16_t next = 0;
+  while (next < recorder.count()) {
+    uint16_t records = 0;
+    size_t used = recorder.write(next, dump + dumpLength, DUMP_PART, records);
+    TEST_ASSERT_TRUE(records > 0);
+    TEST_ASSERT_TRUE(used <= DUMP_PART);
+    dumpLength += used;
+    next += records;
+  }
+  loaded.clear();
+  TEST_ASSERT_TRUE(loaded.load(dump, dumpLength));
+}
+
+// Walks the dump format to the i-th record, nullptr past the end
+static SessionRecord* dumpRecord(uint16_t index) {
+  size_t pos = 0;
+  for (uint16_t i = 0; pos < dumpLength; i++) {
+    SessionRecord* rec = (SessionRecord*)(dump + pos);
+    if (i == index) return rec;
+    pos += sizeof(SessionRecord);
+    if (rec->type == REC_EVENT && !(rec->flags & REC_FLAG_LOST)) pos += rec->value;
+  }
+  return nullptr;
+}
+
+static void test_replay_makes_the_live_decisions() {
+  playSession();
+  dumpAndLoad();
+  TEST_ASSERT_EQUAL_UINT16(recorder.count(), loaded.count());
+
+  ReplayResult result = replaySession(loaded, SELF);
+  TEST_ASSERT_EQUAL_UINT16(liveRounds, result.rounds);
+  TEST_ASSERT_EQUAL_UINT16(0, result.mismatched);
+  TEST_ASSERT_EQUAL_INT16(-1, result.firstMismatch);
+  TEST_ASSERT_EQUAL_UINT16(1, result.duplicates);
+  TEST_ASSERT_EQUAL_UINT16(1, result.rejected);
+  TEST_ASSERT_EQUAL_UINT16(0, result.unreadable);
+  TEST_ASSERT_EQUAL_UINT16(0, result.clockMismatched);
+
+  // The recording on the device replays the same as the dump of it
+  ReplayResult direct = replaySession(recorder, SELF);
+  TEST_ASSERT_EQUAL_UINT16(result.rounds, direct.rounds);
+  TEST_ASSERT_EQUAL_UINT16(0, direct.mismatched);
+}
+
+static void test_records_keep_the_clock_state() {
+  playSession();
+  dumpAndLoad();
+  for (uint16_t i = 0; i < loaded.count(); i++) {
+    const SessionRecord& rec = loaded.at(i);
+    TEST_ASSERT_TRUE(rec.epoch == EPOCH_START + rec.at);
+  }
+  const SessionRecord& first = loaded.at(0);
+  TEST_ASSERT_EQUAL_UINT8(REC_EVENT, first.type);
+  TEST_ASSERT_EQUAL_STRING("B4CF12F0C0DE", first.device);
+  char msg[SESSION_EVENT_MAX];
+  TEST_ASSERT_TRUE(loaded.payload(first, msg, sizeof(msg)));
+  TEST_ASSERT_EQUAL_STRING_LEN("{\"event\":\"sync\"", msg, 15);
+  TEST_ASSERT_EQUAL_UINT8(REC_SYNC, loaded.at(1).type);
+  TEST_ASSERT_TRUE(loaded.at(1).syncEpoch == first.epoch); // synchronize() ran at the same millis()
+}
+
+static void test_changed_payload_is_caught() {
+  playSession();
+  dumpAndLoad();
+  // Round 1 was won by B at 100, make it 900 and C wins instead
+  uint8_t* found = nullptr;
+  const char needle[] = "\"device\":\"B4CF12F0C0DE\",\"delta\":100,";
+  for (size_t i = 0; i + sizeof(needle) - 1 <= dumpLength && !found; i++) {
+    if (memcmp(dump + i, needle, sizeof(needle) - 1) == 0) found = dump + i;
+  }
+  TEST_ASSERT_NOT_NULL(found);
+  found[sizeof(needle) - 1 - 4] = '9';
+  loaded.clear();
+  TEST_ASSERT_TRUE(loaded.load(dump, dumpLength));
+
+  ReplayResult result = replaySession(loaded, SELF);
+  TEST_ASSERT_EQUAL_UINT16(1, result.mismatched);
+  TEST_ASSERT_EQUAL_UINT8(REC_DECIDE, loaded.at(result.firstMismatch).type);
+}
+
+static void test_changed_sync_clock_is_caught() {
+  playSession();
+  dumpAndLoad();
+  // The sync that opened round 3 was our own echo, move it and the replayed touch measures differently
+  uint16_t index = 0;
+  uint16_t syncs = 0;
+  for (SessionRecord* rec = dumpRecord(0); rec; rec = dumpRecord(++index)) {
+    if (rec->type == REC_SYNC && ++syncs == 3) {
+      rec->syncEpoch -= 40;
+      break;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT16(3, syncs);
+  loaded.clear();
+  TEST_ASSERT_TRUE(loaded.load(dump, dumpLength));
+
+  ReplayResult result = replaySession(loaded, SELF);
+  TEST_ASSERT_TRUE(result.clockMismatched > 0);
+  TEST_ASSERT_EQUAL_UINT16(1, result.mismatched); // D's replayed touch now beats E
+}
+
+static void test_lost_payloads_are_skipped() {
+  // More payload bytes than the ring holds: the oldest events are still in the record ring but
+  // their bytes are gone, their round can't be judged and must not count as a mismatch
+  char msg[SESSION_EVENT_MAX];
+  memset(msg, ' ', sizeof(msg) - 1);
+  msg[sizeof(msg) - 1] = '\0';
+  const char head[] = "{\"event\":\"touch\",\"device\":\"B4CF12F0C0DE\",\"delta\":100}";
+  memcpy(msg, head, sizeof(head) - 1);
+  for (uint16_t i = 0; i < SESSION_PAYLOAD_BYTES / SESSION_EVENT_MAX + 4; i++) {
+    receive(msg);
+    halAdvanceMillis(1);
+  }
+  decide();
+  playSession();
+  dumpAndLoad();
+
+  TEST_ASSERT_TRUE(loaded.at(0).flags & REC_FLAG_LOST);
+  char out[SESSION_EVENT_MAX];
+  TEST_ASSERT_FALSE(loaded.payload(loaded.at(0), out, sizeof(out)));
+  ReplayResult result = replaySession(loaded, SELF);
+  TEST_ASSERT_TRUE(result.unreadable > 0);
+  TEST_ASSERT_EQUAL_UINT16(0, result.mismatched);
+  TEST_ASSERT_EQUAL_UINT16(liveRounds - 1, result.rounds); // The round that lost its touches is left out
+}
+
+static void test_long_payloads_are_cut() {
+  static char msg[SESSION_EVENT_MAX + 50];
+  memset(msg, 'x', sizeof(msg));
+  recorder.recordEvent("B4CF12F0C0DE", msg, sizeof(msg));
+  TEST_ASSERT_EQUAL_UINT32(SESSION_EVENT_MAX, recorder.at(0).value);
+  TEST_ASSERT_TRUE(recorder.at(0).flags & REC_FLAG_CUT);
+  ReplayResult result = replaySession(recorder, SELF);
+  TEST_ASSERT_EQUAL_UINT16(1, result.unreadable);
+}
+
+static void test_truncated_dump_is_refused() {
+  playSession();
+  dumpAndLoad();
+  loaded.clear();
+  TEST_ASSERT_FALSE(loaded.load(dump, dumpLength - 3));
+  loaded.clear();
+  TEST_ASSERT_FALSE(loaded.load(dump, sizeof(SessionRecord) - 1));
+}
+
+static void test_go_trigger_drops_stale_touches() {
+  sync("B4CF12F0C0DE");
+  halAdvanceMillis(200);
+  touch("B4CF12F0C0DE", 150);
+  halAdvanceMillis(150);
+  decide();
+  halAdvanceMillis(ROUND_HOLDOFF + 10);
+  touch("C4CF12F0C0DE", 40); // Late for round 1, queued when the go arrives
+  halAdvanceMillis(50);
+  goTrigger(7);
+  halAdvanceMillis(200);
+  localTouch(200);
+  touch("B4CF12F0C0DE", 230);
+  halAdvanceMillis(150);
+  decide();
+  TEST_ASSERT_EQUAL_STRING(SELF, live.touches[0].device); // Not the stale 40
+
+  dumpAndLoad();
+  ReplayResult result = replaySession(loaded, SELF);
+  TEST_ASSERT_EQUAL_UINT16(2, result.rounds);
+  TEST_ASSERT_EQUAL_UINT16(0, result.mismatched);
+}
+
+static void test_paused_recorder_keeps_still() {
+  recorder.record(REC_WINDOW, 150);
+  recorder.pause(true);
+  halAdvanceMillis(5);
+  TEST_ASSERT_EQUAL_UINT32(5, recorder.record(REC_TOUCH, 10, SELF)); // The clock still comes back
+  recorder.recordEvent("B4CF12F0C0DE", "{}", 2);
+  recorder.markLast(REC_FLAG_DUPLICATE);
+  recorder.pause(false);
+  TEST_ASSERT_EQUAL_UINT16(1, recorder.count());
+  TEST_ASSERT_EQUAL_UINT8(0, recorder.at(0).flags);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_makes_the_live_decisions);
+  RUN_TEST(test_records_keep_the_clock_state);
+  RUN_TEST(test_changed_payload_is_caught);
+  RUN_TEST(test_changed_sync_clock_is_caught);
+  RUN_TEST(test_lost_payloads_are_skipped);
+  RUN_TEST(test_long_payloads_are_cut);
+  RUN_TEST(test_truncated_dump_is_refused);
+  RUN_TEST(test_go_trigger_drops_stale_touches);
+  RUN_TEST(test_paused_recorder_keeps_still);
+  return UNITY_END();
+}
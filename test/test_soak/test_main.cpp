@@ -0,0 +1,295 @@
+#include <unity.h>
+#include <stdarg.h>
+#include <chrono>
+#include <json_pool.h>
+#include <latency_histogram.h>
+#include <led_math.h>
+#include <net_util.h>
+#include <round_engine.h>
+#include <touch_gestures.h>
+#include <epoch_clock.h>
+#include <mqtt_transport.h>
+#include <publish_scheduler.h>
+#include <mini_broker.h>
+
+// 72 hours of gameplay in virtual time: a few devices on the MiniBroker play a round every
+// SOAK_ROUND_MS through the same modules the firmware uses, bouncy touch edges, pooled JSON,
+// the publish lanes, the socket transport, ranking, LED easing and log lines. Once the warm-up
+// rounds are over nothing on the game path may allocate: no operator new on this thread and no
+// JSON document falling back to the heap.
+#define SOAK_HOURS 72
+#define SOAK_ROUND_MS 10000       // Virtual time between round starts
+#define SOAK_DEVICES 3
+#define SOAK_WARMUP_ROUNDS 20     // Connections, subscriptions and first-use buffers settle here
+#define SOAK_WINDOW_MS 1000       // Touches land in the first part of this, the rest is the reorder window
+#define SOAK_LOOP_MS 10           // Virtual loop() period while the round is open
+#define SOAK_LED_FRAMES 30        // Animation frames computed per round
+#define SOAK_WAIT_MS 3000         // Real time allowed for the broker to deliver a round
+#define SOAK_ROUNDS ((uint32_t)SOAK_HOURS * 3600 * 1000 / SOAK_ROUND_MS)
+#define SOAK_EPOCH_START 1718000000000000LL
+
+struct VirtualDevice {
+  char id[18];
+  char logTopic[40];
+  MqttTransport* client;
+  PublishScheduler scheduler;
+  TouchGestures gestures;
+  EpochClock clock;
+  Round round;
+  uint32_t seq;
+  uint32_t syncMicros;    // micros() of the last sync, deltas count from here
+  TouchEdge edges[4];     // This round's touch: a bounce, the press, the release
+  uint8_t edgeCount;
+  uint8_t nextEdge;
+  uint8_t syncs;          // Syncs heard this round
+  LatencyHistogram transit;
+};
+
+static MiniBroker broker;
+static VirtualDevice devices[SOAK_DEVICES];
+static VirtualDevice* receiving = nullptr; // The device whose client->loop() is dispatching
+static const char* roomTopic = "greengame/soak/room";
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t epochMillis(const VirtualDevice& d) { return d.clock.now64() / 1000; }
+
+static void publishJson(VirtualDevice& d, const JsonDocument& json, const char* topic, uint8_t lane) {
+  char payload[LANE_PAYLOAD_LEN];
+  serializeJson(json, payload, sizeof(payload));
+  d.scheduler.publish(lane, topic, payload);
+}
+
+static void logf(VirtualDevice& d, const char* format, ...) {
+  // What sendLogf() and writeLog() do: a stack buffer, a pooled document, the logs channel built once
+  char entry[192];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(entry, sizeof(entry), format, args);
+  va_end(args);
+  PooledJsonDocument json;
+  json["level"] = 3;
+  json["entry"] = entry;
+  json["time"] = d.clock.now64() / 1000000;
+  publishJson(d, json, d.logTopic, LANE_LOG);
+}
+
+static void onTouchGesture(VirtualDevice& d, TouchGesture gesture, uint32_t at) {
+  if (gesture != GESTURE_PRESS) return;
+  // Our own touch goes straight into the round, like queueTouch() does for a local press
+  unsigned long delta = (at - d.syncMicros) / 1000;
+  roundAddTouch(d.round, d.id, delta, TouchTrace(), millis());
+  PooledJsonDocument json;
+  json["event"] = "touch";
+  json["device"] = d.id;
+  json["delta"] = delta;
+  json["seq"] = ++d.seq;
+  json["pub"] = epochMillis(d);
+  publishJson(d, json, roomTopic, LANE_GAME);
+}
+
+// TouchGestureHandler carries no context, one trampoline per device
+template <uint8_t I>
+static void gestureHandler(TouchGesture gesture, uint32_t at, uint32_t) { onTouchGesture(devices[I], gesture, at); }
+static const TouchGestureHandler gestureHandlers[] = { gestureHandler<0>, gestureHandler<1>, gestureHandler<2> };
+
+static void onMessage(const char* payload, size_t length) {
+  VirtualDevice& d = *receiving;
+  PooledJsonDocument json;
+  DeserializationError error = deserializeJson(json, payload, length);
+  TEST_ASSERT_FALSE_MESSAGE((bool)error, payload);
+  const char* device = json["device"] | "";
+  bool own = strcmp(device, d.id) == 0;
+  if (json["event"] == "sync") {
+    d.syncs++;
+    d.round.decided = false;
+    d.syncMicros = micros();
+  } else if (json["event"] == "touch" && !own) {
+    TouchTrace trace;
+    trace.recvEpoch = epochMillis(d);
+    trace.pubEpoch = json["pub"] | 0ULL;
+    strlcpy(trace.origin, device, sizeof(trace.origin));
+    if (trace.recvEpoch >= trace.pubEpoch) d.transit.add(trace.recvEpoch - trace.pubEpoch);
+    roundAddTouch(d.round, device, json["delta"] | 0UL, trace, millis());
+  }
+}
+
+static void loopAll() {
+  for (VirtualDevice& d : devices) {
+    receiving = &d;
+    d.client->loop();
+    d.scheduler.pump();
+  }
+}
+
+// Loops every client until done() holds, in real time since the broker runs on its own thread
+template <typename Done>
+static bool waitFor(Done done) {
+  int64_t deadline = nowNs() + (int64_t)SOAK_WAIT_MS * 1000000;
+  while (!done()) {
+    if (nowNs() > deadline) return false;
+    loopAll();
+  }
+  return true;
+}
+
+void setUp() {
+  halSetMicros(0);
+  halSeedRandom(43);
+  TEST_ASSERT_TRUE(broker.start());
+  for (uint8_t i = 0; i < SOAK_DEVICES; i++) {
+    VirtualDevice& d = devices[i];
+    uint8_t mac[6] = { 0xA4, 0xCF, 0x12, 0xF0, 0xC0, (uint8_t)i };
+    formatMac(mac, d.id);
+    snprintf(d.logTopic, sizeof(d.logTopic), "greengame/soak/%.17s/logs", d.id);
+    d.client = createMqttTransport(nullptr, nullptr, "127.0.0.1", "", "", d.id, broker.port());
+    d.scheduler.begin(d.client);
+    d.gestures.setHandler(gestureHandlers[i]);
+    d.clock.addSample(esp_timer_get_time(), SOAK_EPOCH_START);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(waitFor([] {
+    for (VirtualDevice& d : devices) if (!d.client->isMqttConnected()) return false;
+    return true;
+  }), "No broker connection");
+  for (VirtualDevice& d : devices) {
+    TEST_ASSERT_TRUE(d.client->subscribe(roomTopic, onMessage));
+  }
+}
+
+void tearDown() {
+  for (VirtualDevice& d : devices) delete d.client;
+  broker.stop();
+}
+
+static bool everyoneHeard(uint8_t touches) {
+  for (VirtualDevice& d : devices) {
+    if (d.round.count < touches) return false;
+  }
+  return true;
+}
+
+// One round from the sync to the winner's sync coming back. Returns false if the devices
+// disagreed on the winner.
+static bool playRound(int64_t roundStart) {
+  halSetMicros(roundStart);
+  uint32_t deltas[SOAK_DEVICES];
+  for (uint8_t i = 0; i < SOAK_DEVICES; i++) {
+    VirtualDevice& d = devices[i];
+    // A finger lands 150-650ms after the sync, bounces once and lifts 80ms later
+    uint32_t at = (uint32_t)roundStart + (150 + esp_random() % 500) * 1000;
+    d.edges[0] = { at, 1 };
+    d.edges[1] = { at + 400, 0 };
+    d.edges[2] = { at + 900, 1 };
+    d.edges[3] = { at + 80900, 0 };
+    d.edgeCount = 4;
+    d.nextEdge = 0;
+    d.syncs = 0;
+    deltas[i] = (at + 900 - d.syncMicros) / 1000; // The press settles on the last rising edge
+  }
+
+  for (uint32_t t = 0; t <= SOAK_WINDOW_MS; t += SOAK_LOOP_MS) {
+    halSetMicros(roundStart + (int64_t)t * 1000);
+    for (VirtualDevice& d : devices) {
+      while (d.nextEdge < d.edgeCount && (int32_t)(micros() - d.edges[d.nextEdge].micros) >= 0) {
+        d.gestures.edge(d.edges[d.nextEdge++]);
+      }
+      d.gestures.poll(micros());
+    }
+    loopAll();
+  }
+  TEST_ASSERT_TRUE_MESSAGE(waitFor([] { return everyoneHeard(SOAK_DEVICES); }), "Touches lost");
+
+  // Every device ranks on its own and must come to the same winner
+  uint8_t expected = 0;
+  for (uint8_t i = 1; i < SOAK_DEVICES; i++) {
+    if (deltas[i] < deltas[expected] || (deltas[i] == deltas[expected] && strcmp(devices[i].id, devices[expected].id) < 0)) {
+      expected = i;
+    }
+  }
+  bool agreed = true;
+  for (VirtualDevice& d : devices) {
+    uint8_t placement = rankRound(d.round, d.id);
+    agreed = agreed && strcmp(d.round.touches[0].device, devices[expected].id) == 0;
+    logf(d, "Round decided: %u touches, winner %s at delta %lu, our placement %u", d.round.count,
+         d.round.touches[0].device, d.round.touches[0].delta, placement);
+    if (placement == FIRST) {
+      PooledJsonDocument json;
+      json["event"] = "sync";
+      json["device"] = d.id;
+      publishJson(d, json, roomTopic, LANE_GAME);
+    }
+
+    PooledJsonDocument report;
+    report["event"] = "round";
+    report["device"] = d.id;
+    report["winner"] = d.round.touches[0].device;
+    report["place"] = placement;
+    report["transitP90"] = d.transit.quantile(0.9f);
+    publishJson(d, report, d.logTopic, LANE_TELEMETRY);
+
+    // The placement color fading in over the next frames
+    LEDstruct base;
+    for (uint8_t frame = 0; frame < SOAK_LED_FRAMES; frame++) {
+      float eased = cubicEaseInOut(frame / (float)(SOAK_LED_FRAMES - 1));
+      LEDstruct color = scaleColors(base, placement == FIRST ? 0 : 255, 0, interpolate(0, 255, eased), 0, 12);
+      (void)color;
+    }
+    finishRound(d.round, millis());
+  }
+  TEST_ASSERT_TRUE_MESSAGE(waitFor([] {
+    for (VirtualDevice& d : devices) if (d.syncs == 0) return false;
+    return true;
+  }), "Sync lost");
+
+  // SNTP every 5 minutes, answers jittered by a few ms
+  for (VirtualDevice& d : devices) {
+    int64_t local = esp_timer_get_time();
+    if (local - d.clock.stats().lastSample >= CLOCK_SNTP_INTERVAL * 1000LL) {
+      d.clock.addSample(local, SOAK_EPOCH_START + local + (int32_t)(esp_random() % 10000) - 5000);
+    }
+  }
+  return agreed;
+}
+
+static void test_soak_steady_state_does_not_allocate() {
+  uint64_t allocations = 0;
+  uint32_t jsonHeap = 0, jsonExhausted = 0;
+  uint32_t disagreements = 0;
+  int64_t start = nowNs();
+
+  for (uint32_t round = 0; round < SOAK_ROUNDS; round++) {
+    if (round == SOAK_WARMUP_ROUNDS) {
+      allocations = halAllocations();
+      jsonHeap = jsonPool.stats().heapAllocations;
+      jsonExhausted = jsonPool.stats().exhausted;
+    }
+    if (!playRound((int64_t)round * SOAK_ROUND_MS * 1000)) disagreements++;
+  }
+  uint64_t steadyAllocations = halAllocations() - allocations;
+  uint32_t steadyJsonHeap = jsonPool.stats().heapAllocations - jsonHeap;
+
+  double seconds = (nowNs() - start) / 1e9;
+  printf("soak: %u rounds (%u virtual hours) in %.1fs, broker %u published %u delivered, "
+         "%llu allocations, %u JSON heap blocks, JSON pool peak %u bytes / %u arenas, log lane dropped %u\n",
+         (unsigned)SOAK_ROUNDS, (unsigned)SOAK_HOURS, seconds, (unsigned)broker.stats().published,
+         (unsigned)broker.stats().delivered, (unsigned long long)steadyAllocations, (unsigned)steadyJsonHeap,
+         jsonPool.stats().peakBytes, jsonPool.stats().peakLeased, (unsigned)devices[0].scheduler.stats(LANE_LOG).dropped);
+
+  TEST_ASSERT_EQUAL_UINT32(0, disagreements);
+  TEST_ASSERT_EQUAL_UINT64(0, steadyAllocations);
+  TEST_ASSERT_EQUAL_UINT32(0, steadyJsonHeap);
+  TEST_ASSERT_EQUAL_UINT32(0, jsonPool.stats().exhausted - jsonExhausted);
+  for (VirtualDevice& d : devices) {
+    TEST_ASSERT_EQUAL_UINT32(0, d.scheduler.stats(LANE_GAME).dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, d.client->stats().failures);
+    TEST_ASSERT_EQUAL_UINT32(1, d.clock.stats().steps);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_soak_steady_state_does_not_allocate);
+  return UNITY_END();
+}
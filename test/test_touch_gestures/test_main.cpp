@@ -0,0 +1,184 @@
+#include <unity.h>
+#include <touch_gestures.h>
+
+// Synthetic edge traces through the debounce state machine. A trace is replayed the way loop()
+// sees it: every LOOP_US the edges the ISR buffered since the last pass, then a poll.
+#define LOOP_US 1000
+#define MAX_EVENTS 16
+
+struct Event {
+  TouchGesture gesture;
+  uint32_t at;
+  uint32_t duration;
+};
+
+static TouchGestures gestures;
+static Event events[MAX_EVENTS];
+static uint8_t eventCount;
+
+static void record(TouchGesture gesture, uint32_t at, uint32_t duration) {
+  TEST_ASSERT_LESS_THAN(MAX_EVENTS, eventCount);
+  events[eventCount++] = { gesture, at, duration };
+}
+
+void setUp() {
+  gestures = TouchGestures();
+  gestures.setHandler(record);
+  eventCount = 0;
+}
+void tearDown() {}
+
+// Replays edges from start until `until`, loop passes every `loopUs`
+static void replay(const TouchEdge* trace, size_t count, uint32_t start, uint32_t until, uint32_t loopUs = LOOP_US) {
+  size_t next = 0;
+  for (uint32_t now = start; now - start <= until - start; now += loopUs) {
+    while (next < count && trace[next].micros - start <= now - start) {
+      gestures.edge(trace[next++]);
+    }
+    gestures.poll(now);
+  }
+  TEST_ASSERT_EQUAL(count, next);
+}
+
+static void assertEvent(uint8_t index, TouchGesture gesture, uint32_t at, uint32_t duration) {
+  TEST_ASSERT_LESS_THAN(eventCount, index);
+  TEST_ASSERT_EQUAL_UINT8(gesture, events[index].gesture);
+  TEST_ASSERT_EQUAL_UINT32(at, events[index].at);
+  TEST_ASSERT_EQUAL_UINT32(duration, events[index].duration);
+}
+
+static void test_clean_press_and_release() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 80000, 0 } };
+  replay(trace, 2, 0, 200000);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, 10000, 0);
+  assertEvent(1, GESTURE_RELEASE, 80000, 70000);
+  TEST_ASSERT_EQUAL_UINT32(0, gestures.glitches);
+  TEST_ASSERT_EQUAL_UINT8(TOUCH_IDLE, gestures.state());
+}
+
+static void test_bouncy_press_is_one_press_timed_at_the_stable_edge() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 10400, 0 }, { 10900, 1 }, { 11200, 0 }, { 11500, 1 }, { 90000, 0 } };
+  replay(trace, 6, 0, 200000);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, 11500, 0);
+  assertEvent(1, GESTURE_RELEASE, 90000, 78500);
+  TEST_ASSERT_EQUAL_UINT32(2, gestures.glitches);
+}
+
+static void test_glitch_shorter_than_the_window_is_ignored() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 12999, 0 } };
+  replay(trace, 2, 0, 100000);
+  TEST_ASSERT_EQUAL_UINT8(0, eventCount);
+  TEST_ASSERT_EQUAL_UINT32(1, gestures.glitches);
+}
+
+static void test_pulse_of_exactly_the_window_is_a_press() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 13000, 0 } };
+  replay(trace, 2, 0, 100000);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, 10000, 0);
+  assertEvent(1, GESTURE_RELEASE, 13000, 3000);
+}
+
+static void test_release_bounce_keeps_the_press() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 50000, 0 }, { 50500, 1 }, { 51000, 0 } };
+  replay(trace, 4, 0, 100000);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, 10000, 0);
+  assertEvent(1, GESTURE_RELEASE, 51000, 41000);
+  TEST_ASSERT_EQUAL_UINT32(1, gestures.glitches);
+}
+
+static void test_configurable_glitch_window() {
+  gestures.glitchMicros = 500;
+  const TouchEdge trace[] = { { 10000, 1 }, { 11000, 0 } };
+  replay(trace, 2, 0, 100000);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, 10000, 0);
+}
+
+static void test_long_press_fires_once() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 10000 + LONG_PRESS_MS * 1000UL + 500000, 0 } };
+  replay(trace, 2, 0, LONG_PRESS_MS * 1000UL + 1000000);
+  TEST_ASSERT_EQUAL_UINT8(3, eventCount);
+  assertEvent(0, GESTURE_PRESS, 10000, 0);
+  assertEvent(1, GESTURE_LONG_PRESS, 10000, LONG_PRESS_MS * 1000UL); // On the first poll past the hold time
+  assertEvent(2, GESTURE_RELEASE, 10000 + LONG_PRESS_MS * 1000UL + 500000, LONG_PRESS_MS * 1000UL + 500000);
+}
+
+static void test_no_double_tap_after_a_long_press() {
+  uint32_t release = 10000 + LONG_PRESS_MS * 1000UL + 1000;
+  const TouchEdge trace[] = { { 10000, 1 }, { release, 0 }, { release + 100000, 1 }, { release + 150000, 0 } };
+  replay(trace, 4, 0, release + 500000);
+  for (uint8_t i = 0; i < eventCount; i++) {
+    TEST_ASSERT_TRUE(events[i].gesture != GESTURE_DOUBLE_TAP);
+  }
+}
+
+static void test_double_tap() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 60000, 0 }, { 260000, 1 }, { 300000, 0 } };
+  replay(trace, 4, 0, 600000);
+  TEST_ASSERT_EQUAL_UINT8(5, eventCount);
+  assertEvent(0, GESTURE_PRESS, 10000, 0);
+  assertEvent(1, GESTURE_RELEASE, 60000, 50000);
+  assertEvent(2, GESTURE_PRESS, 260000, 0); // The second tap is still a press for the game
+  assertEvent(3, GESTURE_DOUBLE_TAP, 260000, 200000);
+  assertEvent(4, GESTURE_RELEASE, 300000, 40000);
+}
+
+static void test_third_tap_starts_over() {
+  const TouchEdge trace[] = { { 10000, 1 }, { 60000, 0 }, { 160000, 1 }, { 200000, 0 }, { 300000, 1 }, { 340000, 0 } };
+  replay(trace, 6, 0, 800000);
+  uint8_t doubleTaps = 0;
+  for (uint8_t i = 0; i < eventCount; i++) {
+    if (events[i].gesture == GESTURE_DOUBLE_TAP) doubleTaps++;
+  }
+  TEST_ASSERT_EQUAL_UINT8(1, doubleTaps);
+}
+
+static void test_slow_second_tap_is_two_presses() {
+  uint32_t second = 60000 + DOUBLE_TAP_MS * 1000UL;
+  const TouchEdge trace[] = { { 10000, 1 }, { 60000, 0 }, { second, 1 }, { second + 40000, 0 } };
+  replay(trace, 4, 0, second + 200000);
+  TEST_ASSERT_EQUAL_UINT8(4, eventCount);
+  TEST_ASSERT_EQUAL_UINT8(GESTURE_PRESS, events[2].gesture);
+  TEST_ASSERT_EQUAL_UINT8(GESTURE_RELEASE, events[3].gesture);
+}
+
+static void test_edges_batched_by_a_slow_loop() {
+  // loop() stalled for 50ms: the bounces arrive together and still settle at their own times
+  const TouchEdge trace[] = { { 10000, 1 }, { 10400, 0 }, { 10900, 1 }, { 11200, 0 }, { 11500, 1 }, { 40000, 0 } };
+  replay(trace, 6, 0, 200000, 50000);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, 11500, 0);
+  assertEvent(1, GESTURE_RELEASE, 40000, 28500);
+  TEST_ASSERT_EQUAL_UINT32(2, gestures.glitches);
+}
+
+static void test_micros_rollover() {
+  const uint32_t start = 0xFFFF0000UL;
+  const TouchEdge trace[] = { { start + 0x8000, 1 }, { start + 0x8400, 0 }, { start + 0x9000, 1 }, { 0x00020000UL, 0 } };
+  replay(trace, 4, start, 0x00040000UL);
+  TEST_ASSERT_EQUAL_UINT8(2, eventCount);
+  assertEvent(0, GESTURE_PRESS, start + 0x9000, 0);
+  assertEvent(1, GESTURE_RELEASE, 0x00020000UL, (uint32_t)(0x00020000UL - (start + 0x9000)));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_press_and_release);
+  RUN_TEST(test_bouncy_press_is_one_press_timed_at_the_stable_edge);
+  RUN_TEST(test_glitch_shorter_than_the_window_is_ignored);
+  RUN_TEST(test_pulse_of_exactly_the_window_is_a_press);
+  RUN_TEST(test_release_bounce_keeps_the_press);
+  RUN_TEST(test_configurable_glitch_window);
+  RUN_TEST(test_long_press_fires_once);
+  RUN_TEST(test_no_double_tap_after_a_long_press);
+  RUN_TEST(test_double_tap);
+  RUN_TEST(test_third_tap_starts_over);
+  RUN_TEST(test_slow_second_tap_is_two_presses);
+  RUN_TEST(test_edges_batched_by_a_slow_loop);
+  RUN_TEST(test_micros_rollover);
+  return UNITY_END();
+}
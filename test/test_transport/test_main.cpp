@@ -0,0 +1,243 @@
+#include <unity.h>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <mqtt_transport.h>
+#include <publish_scheduler.h>
+#include <mini_broker.h>
+
+// Scheduler and socket transport against a broker on this machine: the in-process MiniBroker, or a
+// real one with MQTT_BENCH_BROKER=host:port (mosquitto -p 1883). The benchmark prints publish
+// cost, end to end throughput and latency, and fails if publishing allocates.
+#define BENCH_MESSAGES 20000
+#define BENCH_DRAIN_EVERY 50 // Publishes between subscriber reads, keeps the socket buffers from filling
+#define WAIT_MS 3000
+
+static MiniBroker broker;
+static char brokerHost[64] = "127.0.0.1";
+static uint16_t brokerPort = 0;
+static MqttTransport* publisher = nullptr;
+static MqttTransport* subscriber = nullptr;
+
+static std::vector<std::string> received;
+static uint32_t receivedCount = 0;
+static bool keepPayloads = true;
+static std::vector<int64_t> sentAt;
+static std::vector<int64_t> latencyNs;
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void onMessage(const char* payload, size_t length) {
+  receivedCount++;
+  if (keepPayloads) received.push_back(std::string(payload, length));
+  const char* seq = strstr(payload, "\"seq\":");
+  if (seq != nullptr && !sentAt.empty()) {
+    uint32_t n = strtoul(seq + 6, nullptr, 10);
+    if (n < sentAt.size()) latencyNs.push_back(nowNs() - sentAt[n]);
+  }
+}
+
+static MqttTransport* roomDevice = nullptr; // Pumped along with the other two when a test makes one
+
+static bool waitFor(bool (*done)(), uint32_t ms = WAIT_MS) {
+  int64_t deadline = nowNs() + (int64_t)ms * 1000000;
+  while (!done()) {
+    if (nowNs() > deadline) return false;
+    publisher->loop();
+    subscriber->loop();
+    if (roomDevice) roomDevice->loop();
+  }
+  return true;
+}
+
+static bool bothConnected() { return publisher->isMqttConnected() && subscriber->isMqttConnected(); }
+static bool allDisconnected() { return !publisher->isMqttConnected() && !roomDevice->isMqttConnected(); }
+static bool allConnected() { return publisher->isMqttConnected() && roomDevice->isMqttConnected(); }
+static uint32_t expected = 0;
+static uint32_t pingsSent = 0; // Publishes setUp() needed before the subscription was active
+static bool allReceived() { return receivedCount >= expected; }
+
+// SUBACK has to be back before publishing, or the first messages have nobody to go to. Pings until
+// one comes through, then counting starts from zero.
+static bool subscriptionActive(const char* topic) {
+  receivedCount = 0;
+  for (int i = 0; i < 10 && receivedCount == 0; i++) {
+    publisher->publish(topic, "{\"event\":\"ping\"}");
+    expected = 1;
+    waitFor(allReceived, 100);
+  }
+  bool active = receivedCount > 0;
+  received.clear();
+  receivedCount = 0;
+  return active;
+}
+
+void setUp() {
+  const char* env = getenv("MQTT_BENCH_BROKER");
+  if (env != nullptr) {
+    const char* colon = strchr(env, ':');
+    size_t hostLen = colon ? (size_t)(colon - env) : strlen(env);
+    snprintf(brokerHost, sizeof(brokerHost), "%.*s", (int)hostLen, env);
+    brokerPort = colon ? atoi(colon + 1) : 1883;
+  } else {
+    TEST_ASSERT_TRUE(broker.start());
+    brokerPort = broker.port();
+  }
+  publisher = createMqttTransport(nullptr, nullptr, brokerHost, "", "", "bench-pub", brokerPort);
+  subscriber = createMqttTransport(nullptr, nullptr, brokerHost, "", "", "bench-sub", brokerPort);
+  TEST_ASSERT_TRUE_MESSAGE(waitFor(bothConnected), "No broker connection");
+  TEST_ASSERT_TRUE(subscriber->subscribe("bench/game", onMessage));
+  TEST_ASSERT_TRUE(subscriber->subscribe("bench/log", onMessage));
+  TEST_ASSERT_TRUE_MESSAGE(subscriptionActive("bench/game"), "Subscription never became active");
+  pingsSent = publisher->stats().publishes;
+  keepPayloads = true;
+  sentAt.clear();
+  latencyNs.clear();
+  halSetMicros(0);
+}
+
+void tearDown() {
+  delete publisher;
+  delete subscriber;
+  delete roomDevice;
+  roomDevice = nullptr;
+  broker.stop();
+}
+
+static void test_transport_round_trip() {
+  TEST_ASSERT_TRUE(publisher->publish("bench/game", "{\"event\":\"touch\",\"delta\":321}"));
+  expected = 1;
+  TEST_ASSERT_TRUE(waitFor(allReceived));
+  TEST_ASSERT_EQUAL_STRING("{\"event\":\"touch\",\"delta\":321}", received[0].c_str());
+  TEST_ASSERT_EQUAL_UINT32(2, subscriber->stats().received); // And the ping from setUp() that came through
+  TEST_ASSERT_EQUAL_UINT32(pingsSent + 1, publisher->stats().publishes);
+}
+
+static void test_game_lane_overtakes_a_log_flood() {
+  PublishScheduler scheduler;
+  scheduler.begin(publisher);
+  char payload[32];
+  for (uint8_t i = 0; i < 20; i++) {
+    snprintf(payload, sizeof(payload), "log %u", i);
+    scheduler.publish(LANE_LOG, "bench/log", payload);
+  }
+  TEST_ASSERT_TRUE(scheduler.publish(LANE_GAME, "bench/game", "touch"));
+
+  const LaneStats& log = scheduler.stats(LANE_LOG);
+  TEST_ASSERT_EQUAL_UINT32(5, log.sent);      // The burst
+  TEST_ASSERT_EQUAL_UINT8(6, log.depth);      // A full queue
+  TEST_ASSERT_EQUAL_UINT32(9, log.dropped);   // Oldest made room for newer ones
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler.stats(LANE_GAME).sent);
+
+  expected = 6;
+  TEST_ASSERT_TRUE(waitFor(allReceived));
+  TEST_ASSERT_EQUAL_STRING("touch", received[5].c_str()); // Straight behind the burst, not behind the queue
+
+  // The queued logs drain at 2/s
+  for (uint8_t s = 0; s < 3; s++) {
+    halAdvanceMillis(1000);
+    scheduler.pump();
+  }
+  TEST_ASSERT_EQUAL_UINT8(0, log.depth);
+  expected = 12;
+  TEST_ASSERT_TRUE(waitFor(allReceived));
+  TEST_ASSERT_EQUAL_STRING("log 14", received[6].c_str());
+  TEST_ASSERT_EQUAL_STRING("log 19", received[11].c_str());
+  TEST_ASSERT_EQUAL_UINT32(3000, log.maxWaitMs);
+}
+
+static void test_benchmark_scheduler_and_transport() {
+  PublishScheduler scheduler;
+  scheduler.begin(publisher);
+  keepPayloads = false;
+  sentAt.assign(BENCH_MESSAGES, 0);
+  latencyNs.reserve(BENCH_MESSAGES);
+  char payload[LANE_PAYLOAD_LEN];
+
+  int64_t publishNs = 0;
+  uint64_t allocations = halAllocations();
+  int64_t start = nowNs();
+  for (uint32_t n = 0; n < BENCH_MESSAGES; n++) {
+    // A touch event the size the firmware sends, trace included
+    snprintf(payload, sizeof(payload),
+             "{\"event\":\"touch\",\"device\":\"A4CF12F0C0DE\",\"delta\":%u,\"seq\":%u,\"boot\":305419896,"
+             "\"trace\":{\"id\":%u,\"isr\":1718000000123,\"pub\":1718000000125}}", (unsigned)(n % 2000), (unsigned)n, (unsigned)n);
+    int64_t before = nowNs();
+    sentAt[n] = before;
+    TEST_ASSERT_TRUE(scheduler.publish(LANE_GAME, "bench/game", payload));
+    publishNs += nowNs() - before;
+    if (n % BENCH_DRAIN_EVERY == 0) subscriber->loop();
+  }
+  allocations = halAllocations() - allocations;
+  expected = BENCH_MESSAGES;
+  TEST_ASSERT_TRUE_MESSAGE(waitFor(allReceived), "Messages lost between the transports");
+  int64_t elapsed = nowNs() - start;
+
+  std::sort(latencyNs.begin(), latencyNs.end());
+  const char* target = getenv("MQTT_BENCH_BROKER") ? getenv("MQTT_BENCH_BROKER") : "MiniBroker";
+  char line[160];
+  snprintf(line, sizeof(line), "%s via %s: %u msgs, publish %lld ns/msg, %.0f msgs/s end to end",
+           publisher->name(), target, (unsigned)BENCH_MESSAGES,
+           (long long)(publishNs / BENCH_MESSAGES), BENCH_MESSAGES * 1e9 / elapsed);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "publish to handler under full load: p50 %lld us, p99 %lld us, max %lld us, %llu allocations while publishing",
+           (long long)latencyNs[latencyNs.size() / 2] / 1000, (long long)latencyNs[latencyNs.size() * 99 / 100] / 1000,
+           (long long)latencyNs.back() / 1000, (unsigned long long)allocations);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(BENCH_MESSAGES + pingsSent, publisher->stats().publishes);
+  TEST_ASSERT_EQUAL_UINT32(0, publisher->stats().failures);
+  TEST_ASSERT_EQUAL_MESSAGE(0, allocations, "Publishing allocated");
+}
+
+static void test_room_change_while_offline_drops_the_old_room() {
+  // What setRoom() and onConnectionEstablished() do around an outage, against a broker that keeps
+  // the persistent session of a device's stable client id
+  if (getenv("MQTT_BENCH_BROKER")) TEST_IGNORE_MESSAGE("Needs MiniBroker to cut the connection");
+  roomDevice = createMqttTransport(nullptr, nullptr, brokerHost, "", "", "fungers-room", brokerPort);
+  roomDevice->enablePersistentSession();
+  TEST_ASSERT_TRUE(waitFor(allConnected));
+  TEST_ASSERT_TRUE(roomDevice->subscribe("funger/rooms/a/events", onMessage, 1));
+  TEST_ASSERT_TRUE(subscriptionActive("funger/rooms/a/events"));
+
+  // Outage, the room changes to b meanwhile
+  broker.kick();
+  TEST_ASSERT_TRUE(waitFor(allDisconnected));
+  halAdvanceMillis(1000); // Reconnect delay
+  TEST_ASSERT_TRUE(waitFor(allConnected));
+
+  // Nothing was subscribed since, the broker resumed the session and still delivers the old room
+  publisher->publish("funger/rooms/a/events", "a");
+  expected = 1;
+  TEST_ASSERT_TRUE(waitFor(allReceived));
+
+  roomDevice->unsubscribe("funger/rooms/a/events");
+  TEST_ASSERT_TRUE(roomDevice->subscribe("funger/rooms/b/events", onMessage, 1));
+  TEST_ASSERT_TRUE(subscriptionActive("funger/rooms/b/events")); // The UNSUBSCRIBE went before it
+  publisher->publish("funger/rooms/a/events", "a");
+  publisher->publish("funger/rooms/b/events", "b");
+  expected = 1;
+  TEST_ASSERT_TRUE(waitFor(allReceived));
+  TEST_ASSERT_EQUAL_STRING("b", received[0].c_str()); // The "a" would have come first
+
+  // And the next resume no longer has the old room in it
+  broker.kick();
+  TEST_ASSERT_TRUE(waitFor(allDisconnected));
+  halAdvanceMillis(1000);
+  TEST_ASSERT_TRUE(waitFor(allConnected));
+  publisher->publish("funger/rooms/a/events", "a");
+  publisher->publish("funger/rooms/b/events", "b");
+  expected = 2;
+  TEST_ASSERT_TRUE(waitFor(allReceived));
+  TEST_ASSERT_EQUAL_STRING("b", received[1].c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_transport_round_trip);
+  RUN_TEST(test_game_lane_overtakes_a_log_flood);
+  RUN_TEST(test_benchmark_scheduler_and_transport);
+  RUN_TEST(test_room_change_while_offline_drops_the_old_room);
+  return UNITY_END();
+}
@@ -0,0 +1,580 @@
+// Fleet simulator: N virtual devices in one process, all on one broker, playing scripted touch
+// storms with the game modules the firmware runs (touch debounce, round engine, publish lanes,
+// pooled JSON, the socket MQTT transport). Every device subscribes to the room's event topic and
+// its own device channel the way onConnectionEstablished() does, so the all-to-all cost shows up
+// as it would in a venue.
+//
+//   pio run -e fleet_sim && .pio/build/fleet_sim/program --devices 200 --rounds 20
+//
+//   --devices N     virtual devices (default 50)
+//   --rounds R      rounds to play (default 10)
+//   --touchers K    devices touching in each round, picked at random (default all)
+//   --storm MS      touches are spread over this much time (default 100). Storms longer than the
+//                   reorder window leave touches for after the sync, which roll into the next round
+//   --window MS     reorder window, reorderWindow on the device (default 150)
+//   --latency MS    delay the in-process broker adds to every packet (default 0)
+//   --broker H:P    use a real broker (mosquitto -p 1883) instead of the in-process one
+//   --seed S        touch script seed (default 27)
+//   --go LEAD       reaction rounds: the coordinator publishes {"event":"go","at":..} LEAD ms ahead
+//                   (default 0, rounds open with a sync). Every device arms a virtual one shot timer
+//                   on its own epoch clock, the touchers react 150ms plus up to --storm after their
+//                   own trigger.
+//   --clock-error US  go rounds: each device's epoch clock is off by up to this much (default 1000),
+//                   what NTP leaves on a venue network
+//
+// Per round it prints the messages each device received, the broker fan-out (deliveries per
+// publish), how long devices took from the first press to judging the round (p50/p90/p99) and
+// how many devices picked the winner the delta ordering says they should have. Late touches
+// reached a device after it had judged the round, carried ones were pressed after the sync.
+// All devices run on one thread: when the slowest pass nears the reorder window, the host is the
+// bottleneck rather than the broker, and late touches say more about this machine than the room.
+// Go rounds also print the cross-device trigger skew: the spread of the instants the devices
+// fired at on the true clock, the part of it their clock offsets explain, and how late the
+// timers were dispatched, which is the pass time of this host rather than an esp_timer's.
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <sys/resource.h>
+#include <json_pool.h>
+#include <net_util.h>
+#include <epoch_clock.h>
+#include <event_parser.h>
+#include <round_engine.h>
+#include <touch_gestures.h>
+#include <mqtt_transport.h>
+#include <publish_scheduler.h>
+#include <mini_broker.h>
+
+#define SIM_ROUND_TIMEOUT 10000 // ms a round may take before it is reported as stuck
+#define SIM_LEAD_MS 200         // Time between the round start and the earliest touch
+#define SIM_GAP_MS ROUND_HOLDOFF // Time after every device has the sync before the next round starts. A device
+                                // that hears the sync before its own window closes still judges the round
+                                // afterwards and holds off its button for this long.
+#define SIM_CONNECT_TIMEOUT 30000
+#define SIM_EPOCH 1700000000000000LL // us, the true epoch at micros() 0
+#define SIM_REACTION 150        // ms, a go round's touchers press this long after their own trigger, plus the storm
+
+struct SimDevice {
+  char id[18];
+  char deviceChannel[48];
+  MqttTransport* client = nullptr;
+  PublishScheduler publisher;
+  TouchGestures gestures;
+  Round round;
+  unsigned long syncTime = 0; // millis() of the last sync, deltas count from here
+  EpochClock clock;           // Off from the true epoch by clockOffset, as if NTP had set it
+  int32_t clockOffset = 0;    // us
+
+  // The go timer, armGo() and goTimerFired()
+  bool goArmed = false;
+  int64_t goDue = 0;          // micros() the timer is set for
+  int64_t goTrigger = 0;      // micros() it fired at, 0 before
+  int64_t goLate = 0;         // us between the trigger on our own clock and the requested instant
+  uint32_t reaction = 0;      // ms, the scripted press after our trigger, 0 when not touching
+
+  // This round
+  TouchEdge edges[4];
+  uint8_t edgeCount = 0;
+  uint8_t nextEdge = 0;
+  bool touched = false;
+  unsigned long sentDelta = 0;
+  uint32_t messages = 0;      // Received from others, what roundStats.messages counts
+  uint32_t touches = 0;
+  uint32_t syncs = 0;
+  uint32_t late = 0;          // Touches that arrived after this device had judged the round
+  bool carried = false;       // Pressed after the round's sync, the firmware counts it for the next round
+  bool decided = false;
+  bool synced = false;        // The winner's sync came back
+  int64_t decidedAt = 0;      // Real us
+  char winner[18] = "";
+  uint8_t heard = 0;          // Touches in the round when it was judged
+  uint8_t dropped = 0;
+};
+
+static const char* eventTopic = "funger/rooms/sim/events";
+static std::unique_ptr<SimDevice[]> devices;
+static uint32_t deviceCount = 50;
+static uint16_t reorderWindow = 150;
+static SimDevice* current = nullptr; // Device whose transport or gestures are calling back
+static int64_t startNs = 0;
+static int64_t slowestPass = 0;      // us, every device shares this thread so a slow pass delays them all
+static uint32_t goLead = 0;
+static uint64_t goAt = 0;            // Epoch ms of the current go round's start instant
+
+static int64_t monotonicNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The virtual clock follows the real one, the broker and the sockets run in real time
+static int64_t tick() {
+  int64_t now = (monotonicNs() - startNs) / 1000;
+  halSetMicros(now);
+  return now;
+}
+
+static bool sendJSON(SimDevice& d, const JsonDocument& json, const char* channel, uint8_t lane) {
+  char msg[LANE_PAYLOAD_LEN];
+  if (serializeJson(json, msg, sizeof(msg)) >= sizeof(msg)) return false;
+  return d.publisher.publish(lane, channel, msg);
+}
+
+static void onTouchGesture(TouchGesture gesture, uint32_t at, uint32_t duration) {
+  // loop()'s touch path: publish the touch for the room, then queue it locally
+  SimDevice& d = *current;
+  if (gesture != GESTURE_PRESS) return;
+  bool holdoff = d.round.decided && millis() - d.round.decidedAt < ROUND_HOLDOFF;
+  if (holdoff) return;
+  unsigned long touchTime = millis() - (micros() - at) / 1000;
+  unsigned long delta = touchTime - d.syncTime;
+  PooledJsonDocument jsonTxBuffer;
+  jsonTxBuffer["event"] = "touch";
+  jsonTxBuffer["device"] = d.id;
+  jsonTxBuffer["delta"] = delta;
+  jsonTxBuffer["time"] = (uint32_t)(millis() / 1000);
+  JsonObject jsonTrace = jsonTxBuffer["trace"].to<JsonObject>();
+  jsonTrace["id"] = esp_random();
+  jsonTrace["isr"] = (uint64_t)at / 1000;
+  jsonTrace["pick"] = micros() - at;
+  jsonTrace["prep"] = 0;
+  jsonTrace["pub"] = (uint64_t)millis();
+  sendJSON(d, jsonTxBuffer, eventTopic, LANE_GAME);
+  if (d.synced) {
+    d.carried = true;
+  } else {
+    d.touched = true;
+    d.sentDelta = delta;
+  }
+  roundAddTouch(d.round, d.id, delta, TouchTrace(), millis());
+}
+
+static void synchronize(SimDevice& d) {
+  d.syncTime = millis();
+  d.round.decided = false;
+  d.synced = true;
+}
+
+static void onGo(SimDevice& d, const char* msg, size_t length) {
+  // armGo(): the timer runs on micros(), the delay comes from our own epoch clock
+  PooledJsonDocument json;
+  GameEvent event;
+  if (parseEvent(json, msg, length, event) != GAME_EVENT_GO) return;
+  int64_t delay = (int64_t)(event.at * 1000ULL) - d.clock.now64();
+  if (delay < GO_MIN_LEAD * 1000LL || delay > GO_MAX_LEAD * 1000LL) return;
+  d.goDue = micros() + delay;
+  d.goArmed = true;
+}
+
+static void goTriggered(SimDevice& d, uint64_t at) {
+  // goTimerFired() and goTriggered(): the trigger is the round's sync, the player sees the LEDs now
+  d.goArmed = false;
+  d.goTrigger = micros();
+  d.goLate = d.clock.now64() - (int64_t)(at * 1000ULL);
+  d.syncTime = d.goTrigger / 1000;
+  d.round.count = 0; // Left from an earlier round, no reaction beats the LEDs
+  d.round.dropped = 0;
+  d.round.decided = false;
+  d.decided = d.synced = false;
+  if (d.reaction == 0) return;
+  // A bouncy contact, as in the touch rounds, settling on the second rising edge
+  uint32_t press = (uint32_t)(d.goTrigger + d.reaction * 1000 - 900);
+  d.edges[0] = { press, 1 };
+  d.edges[1] = { press + 400, 0 };
+  d.edges[2] = { press + 900, 1 };
+  d.edges[3] = { press + 80900, 0 };
+  d.edgeCount = 4;
+  d.nextEdge = 0;
+}
+
+static void recieveEvents(const char* msg, size_t length) {
+  SimDevice& d = *current;
+  PooledJsonDocument jsonRxBuffer;
+  if (deserializeJson(jsonRxBuffer, msg, length)) return;
+  if (jsonRxBuffer["event"] == "go") {
+    onGo(d, msg, length);
+    return;
+  }
+  // Our own publishes come back on both topics, only our own sync is acted on
+  if (strcmp(jsonRxBuffer["device"] | "", d.id) == 0) {
+    if (jsonRxBuffer["event"] == "sync") synchronize(d);
+    return;
+  }
+  d.messages++;
+  if (jsonRxBuffer["event"] == "touch") {
+    d.touches++;
+    TouchTrace trace;
+    trace.recvEpoch = millis();
+    strlcpy(trace.origin, jsonRxBuffer["device"] | "", sizeof(trace.origin));
+    if (!roundAddTouch(d.round, trace.origin, jsonRxBuffer["delta"] | 0UL, trace, millis()) || d.decided) d.late++;
+  } else if (jsonRxBuffer["event"] == "sync") {
+    d.syncs++;
+    synchronize(d);
+  }
+}
+
+static void decideRound(SimDevice& d, int64_t now) {
+  d.heard = d.round.count;
+  d.dropped = d.round.dropped;
+  uint8_t placement = rankRound(d.round, d.id);
+  strlcpy(d.winner, d.round.touches[0].device, sizeof(d.winner));
+  d.decided = true;
+  d.decidedAt = now;
+  if (placement == FIRST) {
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "sync";
+    jsonTxBuffer["device"] = d.id;
+    sendJSON(d, jsonTxBuffer, eventTopic, LANE_GAME);
+  }
+  finishRound(d.round, millis());
+
+  // closeRound()'s report, one per device per round on its own channel
+  PooledJsonDocument jsonReport;
+  jsonReport["event"] = "round";
+  jsonReport["device"] = d.id;
+  jsonReport["winner"] = d.winner;
+  jsonReport["place"] = placement;
+  jsonReport["msgs"] = d.messages;
+  jsonReport["touches"] = d.touches;
+  jsonReport["syncs"] = d.syncs;
+  sendJSON(d, jsonReport, d.deviceChannel, LANE_TELEMETRY);
+}
+
+// One pass of every device's loop()
+static void loopAll() {
+  int64_t now = tick();
+  // The go timers first, an esp_timer would preempt loop()
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    SimDevice& d = devices[i];
+    if (d.goArmed && tick() >= d.goDue) goTriggered(d, goAt);
+  }
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    SimDevice& d = devices[i];
+    current = &d;
+    while (d.nextEdge < d.edgeCount && (int32_t)(micros() - d.edges[d.nextEdge].micros) >= 0) {
+      d.gestures.edge(d.edges[d.nextEdge++]);
+    }
+    d.gestures.poll(micros());
+    d.client->loop();
+    d.publisher.pump();
+    if (!d.decided && d.round.count > 0 && millis() - d.round.windowStart >= reorderWindow) {
+      decideRound(d, now);
+    }
+  }
+  slowestPass = std::max(slowestPass, tick() - now);
+}
+
+template <typename Done>
+static bool runUntil(Done done, uint32_t timeoutMs) {
+  int64_t deadline = tick() + (int64_t)timeoutMs * 1000;
+  while (!done()) {
+    if (tick() > deadline) return false;
+    loopAll();
+  }
+  return true;
+}
+
+template <typename T>
+static T percentile(std::vector<T>& values, float q) {
+  if (values.empty()) return 0;
+  size_t k = std::min(values.size() - 1, (size_t)(q * values.size()));
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  return values[k];
+}
+
+struct Totals {
+  uint64_t transportPublishes = 0;
+  uint64_t transportReceived = 0;
+};
+
+static Totals transportTotals() {
+  Totals totals;
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    totals.transportPublishes += devices[i].client->stats().publishes;
+    totals.transportReceived += devices[i].client->stats().received;
+  }
+  return totals;
+}
+
+int main(int argc, char** argv) {
+  uint32_t rounds = 10;
+  uint32_t touchers = 0;
+  uint32_t stormMs = 100;
+  uint32_t latencyMs = 0;
+  uint32_t seed = 27;
+  uint32_t clockError = 1000;
+  char brokerHost[64] = "127.0.0.1";
+  uint16_t brokerPort = 0;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char* value = argv[i + 1];
+    if (strcmp(argv[i], "--devices") == 0) deviceCount = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--rounds") == 0) rounds = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--touchers") == 0) touchers = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--storm") == 0) stormMs = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--window") == 0) reorderWindow = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--latency") == 0) latencyMs = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--seed") == 0) seed = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--go") == 0) goLead = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--clock-error") == 0) clockError = strtoul(value, nullptr, 10);
+    else if (strcmp(argv[i], "--broker") == 0) {
+      const char* colon = strchr(value, ':');
+      size_t hostLen = colon ? (size_t)(colon - value) : strlen(value);
+      snprintf(brokerHost, sizeof(brokerHost), "%.*s", (int)hostLen, value);
+      brokerPort = colon ? atoi(colon + 1) : 1883;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (deviceCount == 0) return 2;
+  if (touchers == 0 || touchers > deviceCount) touchers = deviceCount;
+  if (goLead != 0 && (goLead < GO_MIN_LEAD || goLead > GO_MAX_LEAD)) {
+    fprintf(stderr, "--go needs %u..%u ms\n", (unsigned)GO_MIN_LEAD, (unsigned)GO_MAX_LEAD);
+    return 2;
+  }
+
+  // Two descriptors per device with the in-process broker, well past the usual 1024
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < deviceCount * 2 + 16) {
+      fprintf(stderr, "open file limit %lu is too low for %u devices, raise it with ulimit -n\n",
+              (unsigned long)limit.rlim_cur, (unsigned)deviceCount);
+      return 1;
+    }
+  }
+
+  startNs = monotonicNs();
+  tick();
+  halSeedRandom(seed);
+  MiniBroker broker;
+  if (brokerPort == 0) {
+    if (!broker.start()) {
+      fprintf(stderr, "in-process broker failed to start\n");
+      return 1;
+    }
+    broker.setLatency(latencyMs);
+    brokerPort = broker.port();
+  }
+
+  devices.reset(new SimDevice[deviceCount]);
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    SimDevice& d = devices[i];
+    uint8_t mac[6] = { 0xA4, 0xCF, 0x12, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i };
+    formatMac(mac, d.id);
+    snprintf(d.deviceChannel, sizeof(d.deviceChannel), "funger/device/%.17s", d.id);
+    d.client = createMqttTransport(nullptr, nullptr, brokerHost, "", "", d.id, brokerPort);
+    d.publisher.begin(d.client);
+    d.gestures.setHandler(onTouchGesture);
+    // One SNTP answer, off by what NTP over WiFi leaves
+    d.clockOffset = clockError ? (int32_t)(esp_random() % (2 * clockError + 1)) - (int32_t)clockError : 0;
+    d.clock.addSample(micros(), SIM_EPOCH + micros() + d.clockOffset);
+  }
+
+  // Connect, subscribe and announce like onConnectionEstablished()
+  if (!runUntil([] {
+        for (uint32_t i = 0; i < deviceCount; i++) if (!devices[i].client->isMqttConnected()) return false;
+        return true;
+      }, SIM_CONNECT_TIMEOUT)) {
+    fprintf(stderr, "not every device could connect to %s:%u\n", brokerHost, (unsigned)brokerPort);
+    return 1;
+  }
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    SimDevice& d = devices[i];
+    d.client->subscribe(eventTopic, recieveEvents, 1);
+    d.client->subscribe(d.deviceChannel, recieveEvents, 1);
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "connected";
+    jsonTxBuffer["device"] = d.id;
+    jsonTxBuffer["FW_Ver"] = "sim";
+    jsonTxBuffer["room"] = "sim";
+    jsonTxBuffer["transport"] = d.client->name();
+    sendJSON(d, jsonTxBuffer, d.deviceChannel, LANE_CONTROL);
+  }
+  // The first sync opens round one, once every subscription is in place
+  runUntil([] { return false; }, 1000);
+  {
+    current = &devices[0];
+    PooledJsonDocument jsonTxBuffer;
+    jsonTxBuffer["event"] = "sync";
+    jsonTxBuffer["device"] = devices[0].id;
+    sendJSON(devices[0], jsonTxBuffer, eventTopic, LANE_GAME);
+    for (uint32_t i = 0; i < deviceCount; i++) devices[i].synced = false;
+    if (!runUntil([] {
+          for (uint32_t i = 0; i < deviceCount; i++) if (!devices[i].synced) return false;
+          return true;
+        }, SIM_ROUND_TIMEOUT)) {
+      fprintf(stderr, "the opening sync did not reach every device\n");
+      return 1;
+    }
+  }
+
+  printf("%u devices, %u touching per round over %ums, reorder window %ums, broker %s:%u%s\n",
+         (unsigned)deviceCount, (unsigned)touchers, (unsigned)stormMs, (unsigned)reorderWindow, brokerHost,
+         (unsigned)brokerPort, latencyMs ? " with injected latency" : "");
+  if (goLead) {
+    printf("go rounds: start instant %ums ahead, device clocks off by up to %uus\n", (unsigned)goLead,
+           (unsigned)clockError);
+  }
+
+  std::mt19937 rng(seed);
+  std::vector<uint32_t> order(deviceCount);
+  for (uint32_t i = 0; i < deviceCount; i++) order[i] = i;
+  std::vector<uint32_t> decideMs, allDecideMs;
+  uint64_t totalMessages = 0, totalPublishes = 0, totalDeliveries = 0;
+  uint32_t agreedRounds = 0, agreeingDevices = 0, stuckRounds = 0, totalLate = 0, totalCarried = 0;
+  std::vector<int64_t> goSpreads;
+  int64_t goDispatchMax = 0;
+  uint32_t goMissed = 0;
+
+  for (uint32_t r = 1; r <= rounds; r++) {
+    // The storm script: who touches and when
+    std::shuffle(order.begin(), order.end(), rng);
+    int64_t roundStart = tick();
+    int64_t firstPress = INT64_MAX;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+      SimDevice& d = devices[i];
+      d.edgeCount = d.nextEdge = 0;
+      d.touched = d.carried = false;
+      d.messages = d.touches = d.syncs = d.late = 0;
+      d.decided = d.synced = false;
+      d.winner[0] = '\0';
+      d.goArmed = false;
+      d.goTrigger = 0;
+      d.reaction = 0;
+    }
+    for (uint32_t k = 0; goLead && k < touchers; k++) {
+      // Each toucher reacts to its own LEDs, the press is scripted when its timer fires
+      devices[order[k]].reaction = SIM_REACTION + rng() % (stormMs + 1);
+    }
+    if (goLead) {
+      // The coordinator is on the true clock and names no device, every device acts on it
+      goAt = (uint64_t)(SIM_EPOCH + tick()) / 1000 + goLead;
+      PooledJsonDocument jsonTxBuffer;
+      jsonTxBuffer["event"] = "go";
+      jsonTxBuffer["at"] = goAt;
+      jsonTxBuffer["round"] = r;
+      sendJSON(devices[0], jsonTxBuffer, eventTopic, LANE_GAME);
+    }
+    for (uint32_t k = 0; !goLead && k < touchers; k++) {
+      SimDevice& d = devices[order[k]];
+      // A bouncy contact: the press settles on the second rising edge, 900us after the first
+      uint32_t at = (uint32_t)(roundStart + (SIM_LEAD_MS + rng() % (stormMs + 1)) * 1000);
+      d.edges[0] = { at, 1 };
+      d.edges[1] = { at + 400, 0 };
+      d.edges[2] = { at + 900, 1 };
+      d.edges[3] = { at + 80900, 0 };
+      d.edgeCount = 4;
+      firstPress = std::min(firstPress, (int64_t)(uint32_t)(at + 900));
+    }
+    Totals before = transportTotals();
+    slowestPass = 0;
+
+    bool done = runUntil([] {
+      for (uint32_t i = 0; i < deviceCount; i++) if (!devices[i].decided || !devices[i].synced) return false;
+      return true;
+    }, SIM_ROUND_TIMEOUT);
+    runUntil([] { return false; }, SIM_GAP_MS); // Trailing reports and echoes land in this round
+    Totals after = transportTotals();
+    if (goLead) {
+      for (uint32_t i = 0; i < deviceCount; i++) {
+        const SimDevice& d = devices[i];
+        if (d.reaction && d.goTrigger) firstPress = std::min(firstPress, d.goTrigger + d.reaction * 1000);
+      }
+    }
+
+    // The winner every device should have found: the lowest delta that was sent, then the lowest ID
+    const SimDevice* expected = nullptr;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+      const SimDevice& d = devices[i];
+      if (!d.touched) continue;
+      if (expected == nullptr || d.sentDelta < expected->sentDelta ||
+          (d.sentDelta == expected->sentDelta && strcmp(d.id, expected->id) < 0)) {
+        expected = &d;
+      }
+    }
+    uint32_t agree = 0, undecided = 0, late = 0, dropped = 0, carried = 0;
+    uint64_t messages = 0;
+    decideMs.clear();
+    for (uint32_t i = 0; i < deviceCount; i++) {
+      const SimDevice& d = devices[i];
+      messages += d.messages;
+      late += d.late;
+      carried += d.carried;
+      dropped += d.dropped;
+      if (!d.decided) {
+        undecided++;
+        continue;
+      }
+      if (expected != nullptr && strcmp(d.winner, expected->id) == 0) agree++;
+      uint32_t ms = d.decidedAt > firstPress ? (uint32_t)((d.decidedAt - firstPress) / 1000) : 0;
+      decideMs.push_back(ms);
+      allDecideMs.push_back(ms);
+    }
+    uint64_t publishes = after.transportPublishes - before.transportPublishes;
+    uint64_t deliveries = after.transportReceived - before.transportReceived;
+    totalMessages += messages;
+    totalPublishes += publishes;
+    totalDeliveries += deliveries;
+    totalLate += late;
+    totalCarried += carried;
+    agreeingDevices += agree;
+    if (agree == deviceCount) agreedRounds++;
+    if (!done) stuckRounds++;
+
+    uint32_t p50 = percentile(decideMs, 0.50f), p90 = percentile(decideMs, 0.90f), p99 = percentile(decideMs, 0.99f);
+    printf("round %u: %.1f msgs/device, %llu published, %llu delivered, fan-out %.1f, decide p50 %ums p90 %ums p99 %ums, "
+           "winner %s agreed by %u/%u, late %u, carried %u, dropped %u, slowest pass %ums%s\n",
+           (unsigned)r, (double)messages / deviceCount, (unsigned long long)publishes, (unsigned long long)deliveries,
+           publishes ? (double)deliveries / publishes : 0.0, (unsigned)p50, (unsigned)p90, (unsigned)p99,
+           expected ? expected->id : "-", (unsigned)agree, (unsigned)deviceCount, (unsigned)late, (unsigned)carried, (unsigned)dropped, (unsigned)(slowestPass / 1000),
+           done ? "" : undecided ? ", STUCK: devices never decided" : ", STUCK: sync missing");
+
+    if (goLead) {
+      // Skew on the true clock, against what the clock offsets alone would have caused
+      int64_t first = INT64_MAX, last = INT64_MIN, dispatch = 0, lateMax = 0;
+      int32_t lowOffset = INT32_MAX, highOffset = INT32_MIN;
+      uint32_t triggered = 0, reactionError = 0;
+      for (uint32_t i = 0; i < deviceCount; i++) {
+        const SimDevice& d = devices[i];
+        if (d.goTrigger == 0) continue;
+        triggered++;
+        first = std::min(first, d.goTrigger);
+        last = std::max(last, d.goTrigger);
+        lowOffset = std::min(lowOffset, d.clockOffset);
+        highOffset = std::max(highOffset, d.clockOffset);
+        dispatch = std::max(dispatch, d.goTrigger - d.goDue);
+        lateMax = std::max(lateMax, (int64_t)llabs(d.goLate));
+        // The delta the device published against the reaction it was scripted with
+        if (d.touched) reactionError = std::max(reactionError, (uint32_t)labs((long)d.sentDelta - (long)d.reaction));
+      }
+      goMissed += deviceCount - triggered;
+      goDispatchMax = std::max(goDispatchMax, dispatch);
+      if (triggered) goSpreads.push_back(last - first);
+      printf("  go %u: triggered %u/%u, spread %lldus (clock offsets %dus), timer dispatch max %lldus, "
+             "late on own clock max %lldus, reaction error max %ums\n",
+             (unsigned)r, (unsigned)triggered, (unsigned)deviceCount, triggered ? (long long)(last - first) : 0LL,
+             triggered ? highOffset - lowOffset : 0, (long long)dispatch, (long long)lateMax, (unsigned)reactionError);
+    }
+  }
+
+  uint32_t p50 = percentile(allDecideMs, 0.50f), p90 = percentile(allDecideMs, 0.90f), p99 = percentile(allDecideMs, 0.99f);
+  printf("total: %u rounds, %.1f msgs/device/round, fan-out %.1f, decide p50 %ums p90 %ums p99 %ums, "
+         "%u/%u rounds agreed (%.1f%% of decisions), %u late and %u carried touches, %u stuck rounds, JSON heap blocks %u\n",
+         (unsigned)rounds, rounds ? (double)totalMessages / deviceCount / rounds : 0.0,
+         totalPublishes ? (double)totalDeliveries / totalPublishes : 0.0, (unsigned)p50, (unsigned)p90, (unsigned)p99,
+         (unsigned)agreedRounds, (unsigned)rounds, rounds ? 100.0 * agreeingDevices / ((double)deviceCount * rounds) : 0.0,
+         (unsigned)totalLate, (unsigned)totalCarried, (unsigned)stuckRounds, (unsigned)jsonPool.stats().heapAllocations);
+
+  if (goLead) {
+    printf("go: trigger spread p50 %lldus p99 %lldus max %lldus, timer dispatch max %lldus, %u triggers missed\n",
+           (long long)percentile(goSpreads, 0.50f), (long long)percentile(goSpreads, 0.99f),
+           (long long)percentile(goSpreads, 1.0f), (long long)goDispatchMax, (unsigned)goMissed);
+  }
+
+  for (uint32_t i = 0; i < deviceCount; i++) delete devices[i].client;
+  broker.stop();
+  return stuckRounds == 0 && goMissed == 0 ? 0 : 1;
+}
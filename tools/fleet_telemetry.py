@@ -0,0 +1,671 @@
+#!/usr/bin/env python3
+"""Fleet telemetry aggregator: subscribes to every device channel and keeps per-device and
+fleet-wide statistics, printing a summary every --interval seconds.
+
+What it reads, all published by GreenGame.cpp:
+  funger/device/<id>/summary   every SUMMARY_INTERVAL: window deltas (pubs, fails, rx, dropped,
+                               reconnects, rounds), heap and RSSI, and the touch (us) and transit
+                               (ms) latency histograms as [bucket, count] pairs
+  funger/device/<id>/logs      sendLog() entries, counted by level
+  funger/device/<id>           device events: "connected" carries FW_Ver, "reconnected" the downtime
+  funger/device/<id>/trace     sampled touch traces, the sender's stages from the touching device and
+                               the network and decision stages from every device that judged it
+
+Traces are joined on (origin, id): the sender's report brings the time inside publish(), each
+receiver's the transit and its own decision, and both carry the ISR and loop pickup stages. Every
+stage goes into its own histogram in us, "other" is what the receiver's ISR-to-decision total
+doesn't account for (ms rounding and NTP offset between the two clocks). The slowest joined
+touches are listed with their full breakdown, which is the answer to "I hit first and lost".
+
+The latency histograms have fixed log-scale bucket edges (latency_histogram.h), so merging
+windows and devices is adding counts: the fleet quantiles are exactly the ones a single device
+would report had it seen every sample, with the same 19% bucket resolution. Memory is bounded:
+a fixed record per device and 124 counters per fleet histogram, however many summaries arrive.
+
+  fleet_telemetry.py --broker 10.0.0.2 --interval 60
+  fleet_telemetry.py --simulate 2000 --minutes 30
+  fleet_telemetry.py --load 500 --broker localhost --speedup 60
+
+--load is the synthetic load generator: N devices publishing connected events, logs,
+reconnects and summaries to the broker, --speedup times faster than real devices would.
+--simulate runs the generator straight into the aggregator without a broker, in simulated time,
+and checks the merged histograms against ones built from every generated sample.
+"""
+
+import argparse
+import json
+import math
+import random
+import sys
+import time
+import tracemalloc
+
+# Must match latency_histogram.h
+HISTOGRAM_BUCKETS = 124
+UINT32_MAX = 0xFFFFFFFF
+
+# Must match GreenGame.h
+SUMMARY_INTERVAL = 60  # s
+LOG_LEVELS = {1: "error", 2: "warn", 3: "info", 4: "debug", 5: "verbose"}
+
+TRACE_STAGES = ("isrToPickup", "pickupToPub", "publish", "transit", "recvToDecide", "decide", "other", "total")
+TRACE_JOIN_WINDOW = 30   # s a trace waits for the rest of its reports
+TRACE_PENDING_MAX = 5000 # Traces waiting at most, the oldest is dropped
+
+DEVICE_EVENTS = ("connected", "reconnected", "round", "stats", "lastBoot", "gesture", "profile", "leaderboard")
+OFFLINE_AFTER = 3 * SUMMARY_INTERVAL  # s without a message before a device counts as offline
+WORST = 3                             # Devices listed per "worst" category
+
+
+def bucket_of(value):
+    # Same as LatencyHistogram::bucketOf()
+    if value < 4:
+        return value
+    e = value.bit_length() - 1
+    return 4 * e + ((value >> (e - 2)) & 3) - 4
+
+
+def bucket_low(index):
+    # Same as LatencyHistogram::bucketLow()
+    if index < 4:
+        return index
+    e = (index + 4) // 4
+    sub = (index + 4) % 4
+    return (4 + sub) << (e - 2)
+
+
+class Histogram:
+    """Fleet side of LatencyHistogram: the same buckets, merged by adding counts."""
+
+    __slots__ = ("counts", "n", "max")
+
+    def __init__(self):
+        self.counts = [0] * HISTOGRAM_BUCKETS
+        self.n = 0
+        self.max = 0
+
+    def add(self, value):
+        self.counts[bucket_of(value)] += 1
+        self.n += 1
+        self.max = max(self.max, value)
+
+    def add_buckets(self, pairs, maximum):
+        for index, count in pairs:
+            if 0 <= index < HISTOGRAM_BUCKETS and count > 0:
+                self.counts[index] += count
+                self.n += count
+        self.max = max(self.max, maximum)
+
+    def merge(self, other):
+        for i, count in enumerate(other.counts):
+            self.counts[i] += count
+        self.n += other.n
+        self.max = max(self.max, other.max)
+
+    def quantile(self, q):
+        # Same as LatencyHistogram::quantile(): midpoint of the bucket holding the rank
+        if self.n == 0:
+            return 0
+        rank = int(q * (self.n - 1))
+        seen = 0
+        for i, count in enumerate(self.counts):
+            seen += count
+            if seen > rank:
+                low = bucket_low(i)
+                high = bucket_low(i + 1) if i + 1 < HISTOGRAM_BUCKETS else UINT32_MAX
+                return min(low + (high - low) // 2, self.max)
+        return self.max
+
+    def describe(self):
+        if self.n == 0:
+            return "none"
+        return "n %d p50 %d p90 %d p99 %d max %d" % (self.n, self.quantile(0.5), self.quantile(0.9),
+                                                    self.quantile(0.99), self.max)
+
+
+class Device:
+    """What the aggregator remembers of one device, a fixed set of fields."""
+
+    __slots__ = ("fw", "hw", "transport", "last_seen", "summaries", "pubs", "fails", "dropped", "reconnects",
+                 "rounds", "rate", "heap_min", "rssi", "transit_p99", "touch_p99", "errors")
+
+    def __init__(self):
+        self.fw = "?"
+        self.hw = "?"
+        self.transport = "?"
+        self.last_seen = 0.0
+        self.summaries = 0
+        self.pubs = 0         # Totals over every summary received
+        self.fails = 0
+        self.dropped = 0
+        self.reconnects = 0
+        self.rounds = 0
+        self.rate = 0.0       # Publishes per second in the last window
+        self.heap_min = 0
+        self.rssi = 0
+        self.transit_p99 = 0  # From the last summary that had transit samples
+        self.touch_p99 = 0
+        self.errors = 0
+
+
+class Window:
+    """Fleet counters for one reporting interval, or for the whole run."""
+
+    def __init__(self):
+        self.messages = 0
+        self.summaries = 0
+        self.partial = 0
+        self.pubs = 0
+        self.fails = 0
+        self.rx = 0
+        self.dropped = 0
+        self.reconnects = 0
+        self.rounds = 0
+        self.logs = dict.fromkeys(LOG_LEVELS.values(), 0)
+        self.events = dict.fromkeys(DEVICE_EVENTS + ("other",), 0)
+        self.malformed = 0
+        self.touch = Histogram()    # us, local touch to published
+        self.transit = Histogram()  # ms, remote touch publish to receive
+        self.stages = {stage: Histogram() for stage in TRACE_STAGES}  # us, from the trace channel
+        self.traces = 0             # Touches seen on the trace channel
+        self.joined = 0             # Receiver reports joined with their sender's
+        self.negative_transit = 0   # Receiver clock behind the sender's by more than the transit
+        self.slowest = []           # (total us, breakdown) of the slowest joined touches
+
+
+class TraceJoiner:
+    """Matches the reports of one sampled touch by (origin, id). Bounded: a trace is forgotten
+    TRACE_JOIN_WINDOW after its first report, or sooner when TRACE_PENDING_MAX are waiting."""
+
+    def __init__(self):
+        self.pending = {}  # (origin, id) -> [first seen, sender report or None, receiver reports]
+
+    def add(self, message, now, windows):
+        key = (message.get("origin"), message.get("id"))
+        entry = self.pending.get(key)
+        if entry is None:
+            if len(self.pending) >= TRACE_PENDING_MAX:
+                del self.pending[min(self.pending, key=lambda k: self.pending[k][0])]
+            entry = self.pending[key] = [now, None, []]
+            # The sender stages travel in every report of the touch, count them once
+            for w in windows:
+                w.traces += 1
+                for stage in ("isrToPickup", "pickupToPub"):
+                    w.stages[stage].add(max(int(message.get(stage, 0)), 0))
+
+        if "receiver" in message:
+            transit = int(message.get("transit", 0)) * 1000
+            stages = {"transit": max(transit, 0), "recvToDecide": int(message.get("recvToDecide", 0)),
+                      "decide": int(message.get("decide", 0)), "total": max(int(message.get("total", 0)) * 1000, 0)}
+            stages["other"] = max(stages["total"] - int(message.get("isrToPickup", 0)) -
+                                  int(message.get("pickupToPub", 0)) - transit - stages["recvToDecide"] -
+                                  stages["decide"], 0)
+            for w in windows:
+                w.negative_transit += 1 if transit < 0 else 0
+                for stage, value in stages.items():
+                    w.stages[stage].add(value)
+            entry[2].append(message)
+            receivers = [message] if entry[1] is not None else []
+        elif entry[1] is None:
+            entry[1] = message
+            for w in windows:
+                w.stages["publish"].add(max(int(message.get("publish", 0)), 0))
+            receivers = entry[2]
+        else:
+            return  # The sender's report twice
+        for receiver in receivers:
+            self.join(entry[1], receiver, windows)
+
+    @staticmethod
+    def join(sender, receiver, windows):
+        breakdown = {stage: receiver.get(stage, 0) for stage in ("isrToPickup", "pickupToPub")}
+        breakdown["publish"] = sender.get("publish", 0)
+        breakdown["transit"] = receiver.get("transit", 0) * 1000
+        for stage in ("recvToDecide", "decide"):
+            breakdown[stage] = receiver.get(stage, 0)
+        total = receiver.get("total", 0) * 1000
+        line = "%s#%s -> %s over %s, %s" % (sender.get("origin"), sender.get("id"), receiver.get("receiver"),
+                                             receiver.get("path", "mqtt"), sender.get("power", "active"))
+        for w in windows:
+            w.joined += 1
+            w.slowest.append((total, line, breakdown))
+            w.slowest.sort(key=lambda t: -t[0])
+            del w.slowest[WORST:]
+
+    def expire(self, now):
+        for key in [k for k, entry in self.pending.items() if now - entry[0] > TRACE_JOIN_WINDOW]:
+            del self.pending[key]
+
+
+class Aggregator:
+    def __init__(self, max_devices):
+        self.max_devices = max_devices
+        self.devices = {}
+        self.traces = TraceJoiner()
+        self.interval = Window()
+        self.total = Window()
+        self.started = None
+        self.interval_started = None
+
+    def device(self, device_id, now):
+        device = self.devices.get(device_id)
+        if device is None:
+            if len(self.devices) >= self.max_devices:
+                # Bounded memory: the device heard from longest ago makes room
+                oldest = min(self.devices, key=lambda d: self.devices[d].last_seen)
+                del self.devices[oldest]
+            device = self.devices[device_id] = Device()
+        device.last_seen = now
+        return device
+
+    def on_message(self, topic, payload, now):
+        if self.started is None:
+            self.started = self.interval_started = now
+        parts = topic.split("/")
+        if len(parts) < 3 or parts[0] != "funger" or parts[1] != "device":
+            return
+        windows = (self.interval, self.total)
+        for w in windows:
+            w.messages += 1
+        device = self.device(parts[2], now)
+        channel = parts[3] if len(parts) > 3 else ""
+        try:
+            message = json.loads(payload)
+        except ValueError:
+            message = None
+        if not isinstance(message, dict):
+            for w in windows:
+                w.malformed += 1
+            return
+
+        if channel == "summary":
+            self.on_summary(device, message, windows)
+        elif channel == "trace":
+            self.traces.add(message, now, windows)
+        elif channel == "logs":
+            level = LOG_LEVELS.get(message.get("level"))
+            if level is not None:
+                for w in windows:
+                    w.logs[level] += 1
+            if message.get("level") == 1:
+                device.errors += 1
+        elif channel == "":
+            event = message.get("event")
+            for w in windows:
+                w.events[event if event in w.events else "other"] += 1
+            if event == "connected":
+                device.fw = str(message.get("FW_Ver", device.fw))
+                device.hw = str(message.get("HW_Ver", device.hw))
+                device.transport = str(message.get("transport", device.transport))
+
+    def on_summary(self, device, message, windows):
+        device.summaries += 1
+        device.fw = str(message.get("fw", device.fw))
+        device.hw = str(message.get("hw", device.hw))
+        window_s = max(message.get("window", 0), 1) / 1000.0
+        pubs = message.get("pubs", 0)
+        device.pubs += pubs
+        device.fails += message.get("fails", 0)
+        device.dropped += message.get("dropped", 0)
+        device.reconnects += message.get("reconnects", 0)
+        device.rounds += message.get("rounds", 0)
+        device.rate = pubs / window_s
+        device.heap_min = message.get("heapMin", device.heap_min)
+        device.rssi = message.get("rssi", device.rssi)
+        for w in windows:
+            w.summaries += 1
+            w.partial += 1 if message.get("partial") else 0
+            for key in ("pubs", "fails", "rx", "dropped", "reconnects", "rounds"):
+                setattr(w, key, getattr(w, key) + message.get(key, 0))
+        for key in ("touch", "transit"):
+            latency = message.get(key)
+            if not isinstance(latency, dict):
+                continue
+            if key == "transit":
+                device.transit_p99 = latency.get("p99", 0)
+            else:
+                device.touch_p99 = latency.get("p99", 0)
+            buckets = latency.get("b")
+            if not isinstance(buckets, list):
+                continue  # Partial summary, the quantiles above are all there is
+            pairs = [tuple(b) for b in buckets if isinstance(b, list) and len(b) == 2]
+            for w in windows:
+                getattr(w, key).add_buckets(pairs, latency.get("max", 0))
+
+    def report(self, now):
+        """The interval's summary as a dict, then starts the next interval."""
+        online = [d for d in self.devices.values() if now - d.last_seen <= OFFLINE_AFTER]
+        firmware = {}
+        for d in online:
+            firmware[d.fw] = firmware.get(d.fw, 0) + 1
+        elapsed = max(now - (self.interval_started if self.interval_started is not None else now), 1e-9)
+        w = self.interval
+
+        def worst(key, field):
+            ranked = sorted(((getattr(d, field), device_id) for device_id, d in self.devices.items()
+                             if now - d.last_seen <= OFFLINE_AFTER and getattr(d, field) > 0), reverse=True)
+            return [[device_id, value] for value, device_id in ranked[:WORST]]
+
+        report = {
+            "time": now,
+            "devices": len(self.devices),
+            "online": len(online),
+            "firmware": dict(sorted(firmware.items(), key=lambda kv: -kv[1])),
+            "seconds": round(elapsed, 1),
+            "messages_per_s": round(w.messages / elapsed, 1),
+            "device_pubs_per_s": round(sum(d.rate for d in online), 1),
+            "summaries": w.summaries,
+            "partial": w.partial,
+            "malformed": w.malformed,
+            "pubs": w.pubs, "fails": w.fails, "rx": w.rx, "dropped": w.dropped,
+            "reconnects": w.reconnects, "rounds": w.rounds,
+            "logs": {k: v for k, v in w.logs.items() if v},
+            "events": {k: v for k, v in w.events.items() if v},
+            "touch_us": latency_dict(w.touch), "transit_ms": latency_dict(w.transit),
+            "total_touch_us": latency_dict(self.total.touch), "total_transit_ms": latency_dict(self.total.transit),
+            "worst_transit_p99": worst("transit", "transit_p99"),
+            "most_reconnects": worst("reconnects", "reconnects"),
+            "most_dropped": worst("dropped", "dropped"),
+            "traces": w.traces, "traces_joined": w.joined, "negative_transit": w.negative_transit,
+            "trace_us": {stage: latency_dict(h) for stage, h in w.stages.items() if h.n},
+            "slowest_traces": [{"trace": line, "total_us": total, "stages": breakdown}
+                               for total, line, breakdown in w.slowest],
+        }
+        self.traces.expire(now)
+        self.interval = Window()
+        self.interval_started = now
+        return report
+
+
+def latency_dict(histogram):
+    return {"n": histogram.n, "p50": histogram.quantile(0.5), "p90": histogram.quantile(0.9),
+            "p99": histogram.quantile(0.99), "max": histogram.max}
+
+
+def format_report(report):
+    def latency(d):
+        return "n %d p50 %d p90 %d p99 %d max %d" % (d["n"], d["p50"], d["p90"], d["p99"], d["max"]) if d["n"] else "none"
+
+    def ranked(pairs):
+        return ", ".join("%s %s" % (device, value) for device, value in pairs) or "-"
+
+    lines = [
+        "[%s] %d/%d devices online, firmware %s" % (
+            time.strftime("%H:%M:%S", time.localtime(report["time"])) if report["time"] > 1e9 else "%.0fs" % report["time"],
+            report["online"], report["devices"],
+            ", ".join("%s x%d" % kv for kv in report["firmware"].items()) or "-"),
+        "  last %.0fs: %.1f msg/s seen, devices publish %.1f/s, %d summaries (%d partial), fails %d, dropped %d, "
+        "reconnects %d, rounds %d" % (report["seconds"], report["messages_per_s"], report["device_pubs_per_s"],
+                                     report["summaries"], report["partial"], report["fails"], report["dropped"],
+                                     report["reconnects"], report["rounds"]),
+        "  logs %s, events %s" % (json.dumps(report["logs"]), json.dumps(report["events"])),
+        "  touch us    %s | since start %s" % (latency(report["touch_us"]), latency(report["total_touch_us"])),
+        "  transit ms  %s | since start %s" % (latency(report["transit_ms"]), latency(report["total_transit_ms"])),
+        "  worst transit p99: %s; most reconnects: %s; most dropped: %s" % (
+            ranked(report["worst_transit_p99"]), ranked(report["most_reconnects"]), ranked(report["most_dropped"])),
+    ]
+    if report["traces"]:
+        lines.append("  %d traced touches, %d receiver reports joined with their sender's%s" % (
+            report["traces"], report["traces_joined"],
+            ", %d with negative transit (clock offset)" % report["negative_transit"] if report["negative_transit"] else ""))
+        for stage, d in report["trace_us"].items():
+            lines.append("    %-12s us %s" % (stage, latency(d)))
+        for slow in report["slowest_traces"]:
+            lines.append("    slowest %d ms: %s: %s us" % (slow["total_us"] // 1000, slow["trace"],
+                                                           ", ".join("%s %d" % kv for kv in slow["stages"].items())))
+    if report["malformed"]:
+        lines.append("  %d messages were not JSON" % report["malformed"])
+    return "\n".join(lines)
+
+
+class LoadGenerator:
+    """Synthetic fleet: what N devices would publish, as (time, topic, payload) in time order.
+
+    Every device announces itself, then sends a summary each SUMMARY_INTERVAL with histograms of
+    lognormal touch and transit latencies, logs at a few per minute and the odd reconnect. A few
+    devices sit on a slow network so the "worst" lists have something to find. Every round is also
+    traced: the sender's report and one from each of a few receivers, in shuffled order so the
+    join sees receivers first too. Every sample also goes into `truth`, the histograms the merged
+    and joined ones must match.
+    """
+
+    FIRMWARE = (("1.0.5", 0.7), ("1.0.4", 0.25), ("1.0.3", 0.05))
+
+    def __init__(self, devices, seed):
+        self.rng = random.Random(seed)
+        self.truth_touch = Histogram()
+        self.truth_transit = Histogram()
+        self.truth_stages = {stage: Histogram() for stage in TRACE_STAGES[:6]}  # The measured ones
+        self.devices = []
+        for i in range(devices):
+            pick = self.rng.random()
+            fw = next((v for v, share in self.cumulative() if pick < share), self.FIRMWARE[0][0])
+            self.devices.append({
+                "id": "A4CF12%06X" % i,
+                "fw": fw,
+                "slow": self.rng.random() < 0.02,
+                "next": self.rng.uniform(0, SUMMARY_INTERVAL),  # Devices don't boot in step
+                "log": self.rng.expovariate(1 / 20.0),
+                "window_started": 0.0,
+                "traced": 0,
+            })
+
+    def cumulative(self):
+        total = 0.0
+        for version, share in self.FIRMWARE:
+            total += share
+            yield version, total
+
+    def start(self):
+        for d in self.devices:
+            yield 0.0, "funger/device/%s" % d["id"], json.dumps({
+                "event": "connected", "device": d["id"], "FW_Ver": d["fw"], "HW_Ver": "B", "room": "load",
+                "transport": "espmqttclient"}, separators=(",", ":"))
+
+    def until(self, now):
+        """Everything due up to `now`, roughly in time order."""
+        out = []
+        for d in self.devices:
+            while d["log"] <= now:
+                level = self.rng.choices((1, 2, 3), (1, 10, 89))[0]
+                out.append((d["log"], "funger/device/%s/logs" % d["id"], json.dumps(
+                    {"level": level, "entry": "touch Event at delta of: %d" % self.rng.randint(50, 900)},
+                    separators=(",", ":"))))
+                d["log"] += self.rng.expovariate(1 / 20.0)
+            while d["next"] <= now:
+                summary = self.summary(d)
+                out.append((d["next"], "funger/device/%s/summary" % d["id"], summary))
+                out.extend((d["next"], topic, payload) for topic, payload in self.traces(d, json.loads(summary)["rounds"]))
+                if self.rng.random() < 0.01:
+                    out.append((d["next"], "funger/device/%s" % d["id"], json.dumps(
+                        {"event": "reconnected", "device": d["id"], "downtime": self.rng.randint(200, 9000)},
+                        separators=(",", ":"))))
+                d["next"] += SUMMARY_INTERVAL
+        out.sort(key=lambda m: m[0])
+        return out
+
+    def traces(self, d, rounds):
+        """The trace reports of the rounds d touched first in, what publishTrace() sends."""
+        out = []
+        for _ in range(rounds):
+            d["traced"] += 1
+            sender = {"id": d["traced"], "origin": d["id"],
+                      "isrToPickup": int(self.rng.lognormvariate(math.log(300), 0.5)),
+                      "pickupToPub": int(self.rng.lognormvariate(math.log(800), 0.4))}
+            reports = [(d, dict(sender, publish=int(self.rng.lognormvariate(math.log(1500), 0.4)),
+                                power=self.rng.choice(("idle", "active"))))]
+            for stage in ("isrToPickup", "pickupToPub", "publish"):
+                self.truth_stages[stage].add(reports[0][1][stage])
+            for receiver in self.rng.sample(self.devices, min(3, len(self.devices))):
+                if receiver is d:
+                    continue
+                transit = int(self.rng.lognormvariate(math.log(120 if receiver["slow"] else 25), 0.5))
+                report = dict(sender, receiver=receiver["id"], path=self.rng.choice(("lan", "mqtt")), transit=transit,
+                              recvToDecide=int(self.rng.lognormvariate(math.log(500), 0.4)),
+                              decide=int(self.rng.lognormvariate(math.log(80), 0.3)))
+                clock_offset = self.rng.randint(-3, 3)  # ms between the two NTP clocks
+                report["total"] = (sender["isrToPickup"] + sender["pickupToPub"] + report["recvToDecide"] +
+                                   report["decide"]) // 1000 + transit + clock_offset
+                for stage in ("transit", "recvToDecide", "decide"):
+                    self.truth_stages[stage].add(report[stage] * (1000 if stage == "transit" else 1))
+                reports.append((receiver, report))
+            self.rng.shuffle(reports)
+            out.extend(("funger/device/%s/trace" % device["id"], json.dumps(report, separators=(",", ":")))
+                       for device, report in reports)
+        return out
+
+    def summary(self, d):
+        touch, transit = Histogram(), Histogram()
+        rounds = self.rng.randint(0, 12)
+        for _ in range(rounds):
+            value = int(self.rng.lognormvariate(math.log(1800), 0.3))
+            touch.add(value)
+            self.truth_touch.add(value)
+        for _ in range(rounds * self.rng.randint(1, 8)):
+            value = int(self.rng.lognormvariate(math.log(120 if d["slow"] else 25), 0.5))
+            transit.add(value)
+            self.truth_transit.add(value)
+        window = int((d["next"] - d["window_started"]) * 1000) or SUMMARY_INTERVAL * 1000
+        d["window_started"] = d["next"]
+        message = {"event": "summary", "device": d["id"], "fw": d["fw"], "hw": "B", "up": int(d["next"]),
+                   "window": window, "pubs": rounds * 3 + 2, "fails": 0, "rx": rounds * 9,
+                   "dropped": self.rng.randint(0, 3) if d["slow"] else 0,
+                   "reconnects": 1 if self.rng.random() < 0.01 else 0, "rounds": rounds,
+                   "rssi": self.rng.randint(-85, -45), "heapMin": self.rng.randint(90000, 140000)}
+        for key, histogram in (("touch", touch), ("transit", transit)):
+            if histogram.n:
+                message[key] = {"n": histogram.n, "p50": histogram.quantile(0.5), "p99": histogram.quantile(0.99),
+                                "max": histogram.max,
+                                "b": [[i, c] for i, c in enumerate(histogram.counts) if c]}
+        return json.dumps(message, separators=(",", ":"))
+
+
+def emit(report, as_json):
+    print(json.dumps(report) if as_json else format_report(report), flush=True)
+
+
+def simulate(args):
+    generator = LoadGenerator(args.simulate, args.seed)
+    tracemalloc.start()
+    aggregator = Aggregator(args.max_devices)
+    baseline = tracemalloc.get_traced_memory()[0]
+    messages = 0
+    started = time.monotonic()
+    for at, topic, payload in generator.start():
+        aggregator.on_message(topic, payload, at)
+        messages += 1
+    now = 0.0
+    end = args.minutes * 60.0
+    while now < end:
+        now = min(now + args.interval, end)
+        for at, topic, payload in generator.until(now):
+            aggregator.on_message(topic, payload, at)
+            messages += 1
+        emit(aggregator.report(now), args.json)
+    elapsed = time.monotonic() - started
+    memory = tracemalloc.get_traced_memory()[0] - baseline
+    tracemalloc.stop()
+
+    # Merged from thousands of summaries, yet identical to histograms of every sample
+    exact = (aggregator.total.touch.counts == generator.truth_touch.counts and
+             aggregator.total.transit.counts == generator.truth_transit.counts and
+             all(aggregator.total.stages[stage].counts == h.counts for stage, h in generator.truth_stages.items()))
+    print("%d devices, %d messages in %.1f s (%.0f msg/s), aggregator state %.0f KB (%.0f bytes/device), "
+          "merged histograms %s" % (args.simulate, messages, elapsed, messages / max(elapsed, 1e-9), memory / 1024,
+                                    memory / max(args.simulate, 1), "exact" if exact else "DIFFER"))
+    return 0 if exact else 1
+
+
+def connect(args):
+    try:
+        import paho.mqtt.client as mqtt
+    except ImportError:
+        sys.exit("paho-mqtt is needed to talk to a broker: pip install paho-mqtt")
+    try:
+        client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    except AttributeError:
+        client = mqtt.Client()
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.connect(args.broker, args.port)
+    return client
+
+
+def aggregate(args):
+    aggregator = Aggregator(args.max_devices)
+
+    def on_message(client, userdata, message):
+        aggregator.on_message(message.topic, message.payload.decode(errors="replace"), time.time())
+
+    client = connect(args)
+    client.on_message = on_message
+    for topic in ("funger/device/+", "funger/device/+/summary", "funger/device/+/logs",
+                  "funger/device/+/trace"):
+        client.subscribe(topic)
+    next_report = time.time() + args.interval
+    try:
+        while True:
+            client.loop(timeout=0.2)
+            if time.time() >= next_report:
+                emit(aggregator.report(time.time()), args.json)
+                next_report += args.interval
+    except KeyboardInterrupt:
+        emit(aggregator.report(time.time()), args.json)
+    client.disconnect()
+    return 0
+
+
+def load(args):
+    generator = LoadGenerator(args.load, args.seed)
+    client = connect(args)
+    client.loop_start()
+    sent = 0
+    for _, topic, payload in generator.start():
+        client.publish(topic, payload)
+        sent += 1
+    started = time.monotonic()
+    simulated = 0.0
+    end = args.minutes * 60.0
+    print("%d devices publishing to %s:%d at %gx" % (args.load, args.broker, args.port, args.speedup), flush=True)
+    try:
+        while simulated < end:
+            time.sleep(0.05)
+            simulated = min((time.monotonic() - started) * args.speedup, end)
+            for _, topic, payload in generator.until(simulated):
+                client.publish(topic, payload)
+                sent += 1
+    except KeyboardInterrupt:
+        pass
+    client.loop_stop()
+    client.disconnect()
+    print("published %d messages, %.0f simulated minutes" % (sent, simulated / 60), flush=True)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--interval", type=float, default=SUMMARY_INTERVAL, help="seconds between fleet summaries")
+    parser.add_argument("--json", action="store_true", help="print each summary as one JSON line")
+    parser.add_argument("--max-devices", type=int, default=20000, help="devices remembered, the stalest is dropped")
+    target = parser.add_argument_group("broker")
+    target.add_argument("--broker", default="localhost")
+    target.add_argument("--port", type=int, default=1883)
+    target.add_argument("--user")
+    target.add_argument("--password")
+    gen = parser.add_argument_group("load generator")
+    gen.add_argument("--load", type=int, default=0, metavar="N", help="publish as N synthetic devices instead")
+    gen.add_argument("--simulate", type=int, default=0, metavar="N", help="aggregate N synthetic devices in-process")
+    gen.add_argument("--speedup", type=float, default=1, help="--load runs this many times faster than real time")
+    gen.add_argument("--minutes", type=float, default=10, help="simulated minutes for --load and --simulate")
+    gen.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if args.simulate:
+        return simulate(args)
+    if args.load:
+        return load(args)
+    return aggregate(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,399 @@
+#!/usr/bin/env python3
+"""Publish a firmware image to a room over MQTT in windowed chunks (the device side is the
+"otaMqtt" session in GreenGame.cpp).
+
+The image goes out once on funger/ota/<session>/chunks, whatever the number of devices. The
+devices ack on funger/ota/<session>/ack:
+  {"device", "next"}                  cumulative, every OTA_ACK_EVERY chunks written
+  {"device", "next", "missing": [..]} holes inside their window, resent selectively
+  {"device", "next", "stalled": true} nothing arrived for OTA_STALL_MS, resend from `next`
+  {"device", "next", "done": bool}    finished, the MD5 check decides `done`
+Flow control: nothing is sent past the slowest live device's `next` + OTA_WINDOW, which is
+what the devices can park. Devices silent for OTA_ABORT_MS have given up and stop holding the
+window back.
+
+  ota_publish.py firmware.bin --broker 10.0.0.2 --room lobby
+  ota_publish.py firmware.bin --simulate 50 --loss 0.02
+
+--simulate runs the same publisher against an in-process broker and N simulated devices that
+follow the firmware's receiver rules, then compares the bytes moved with N HTTP downloads.
+"""
+
+import argparse
+import base64
+import hashlib
+import heapq
+import json
+import random
+import sys
+import time
+
+# Must match GreenGame.h
+OTA_CHUNK_MAX = 512
+OTA_WINDOW = 8
+OTA_ACK_EVERY = 4
+OTA_NACK_MS = 200
+OTA_STALL_MS = 3000
+OTA_ABORT_MS = 60000
+
+RESEND_HOLDOFF_MS = 200  # A chunk several devices ask for at once goes out once
+HTTP_OVERHEAD = 400      # Request and response headers of one HTTP OTA download, roughly
+
+
+def mqtt_publish_size(topic, payload):
+    """Bytes of a QoS 0 PUBLISH packet on the wire."""
+    remaining = 2 + len(topic) + len(payload)
+    length_bytes = 1
+    while remaining >= 128 ** length_bytes:
+        length_bytes += 1
+    return 1 + length_bytes + remaining
+
+
+class OtaPublisher:
+    def __init__(self, image, session, chunk_size, rate):
+        self.image = image
+        self.session = session
+        self.chunk_size = chunk_size
+        self.chunks = (len(image) + chunk_size - 1) // chunk_size
+        self.chunk_topic = "funger/ota/%s/chunks" % session
+        self.ack_topic = "funger/ota/%s/ack" % session
+        self.interval = 1000.0 / rate if rate > 0 else 0
+        self.devices = {}       # device -> {"next", "done", "heard"}
+        self.sent_upto = 0      # First chunk never sent
+        self.resend = set()
+        self.last_sent = {}     # chunk -> ms of its last publish
+        self.next_send_at = 0
+        self.stats = {"published": 0, "resent": 0, "bytes": 0, "acks": 0, "ack_bytes": 0}
+
+    def start_event(self):
+        return {
+            "event": "otaMqtt",
+            "session": self.session,
+            "size": len(self.image),
+            "chunkSize": self.chunk_size,
+            "md5": hashlib.md5(self.image).hexdigest(),
+        }
+
+    def chunk_payload(self, n):
+        data = self.image[n * self.chunk_size:(n + 1) * self.chunk_size]
+        return json.dumps({"n": n, "d": base64.b64encode(data).decode()}, separators=(",", ":"))
+
+    def on_ack(self, raw, now):
+        self.stats["acks"] += 1
+        self.stats["ack_bytes"] += mqtt_publish_size(self.ack_topic, raw)
+        try:
+            ack = json.loads(raw)
+        except ValueError:
+            return
+        device = ack.get("device")
+        if not device:
+            return
+        state = self.devices.setdefault(device, {"next": 0, "done": None, "heard": now})
+        state["heard"] = now
+        state["next"] = max(state["next"], int(ack.get("next", 0)))
+        if "done" in ack:
+            state["done"] = bool(ack["done"])
+            return
+        for n in ack.get("missing", []):
+            if state["next"] <= n < self.sent_upto:
+                self.resend.add(n)
+        if ack.get("stalled"):
+            for n in range(state["next"], min(self.sent_upto, state["next"] + OTA_WINDOW)):
+                self.resend.add(n)
+
+    def live(self, now):
+        return [s for s in self.devices.values() if s["done"] is None and now - s["heard"] < OTA_ABORT_MS]
+
+    def finished(self, now):
+        return bool(self.devices) and not self.live(now)
+
+    def pump(self, now):
+        """Chunks to publish now, at most one per rate interval."""
+        out = []
+        while now >= self.next_send_at:
+            n = self.next_chunk(now)
+            if n is None:
+                break
+            out.append(n)
+            self.last_sent[n] = now
+            self.next_send_at = max(self.next_send_at + self.interval, now - self.interval)
+            if self.interval == 0 and len(out) >= OTA_WINDOW:
+                break
+        for n in out:
+            self.stats["published"] += 1
+            self.stats["bytes"] += mqtt_publish_size(self.chunk_topic, self.chunk_payload(n))
+        return out
+
+    def next_chunk(self, now):
+        # Holes first, they hold every device behind them
+        for n in sorted(self.resend):
+            self.resend.discard(n)
+            if now - self.last_sent.get(n, -RESEND_HOLDOFF_MS) >= RESEND_HOLDOFF_MS:
+                self.stats["resent"] += 1
+                return n
+        live = self.live(now)
+        if not live:
+            return None
+        base = min(s["next"] for s in live)
+        if self.sent_upto < min(self.chunks, base + OTA_WINDOW):
+            self.sent_upto += 1
+            return self.sent_upto - 1
+        return None
+
+
+class SimDevice:
+    """The receiver rules of startOtaSession()/receiveOtaChunk()/otaSessionLoop()."""
+
+    def __init__(self, name, start, publish, now):
+        self.name = name
+        self.publish = publish
+        self.size = start["size"]
+        self.chunk_size = start["chunkSize"]
+        self.chunks = (self.size + self.chunk_size - 1) // self.chunk_size
+        self.md5 = hashlib.md5()
+        self.expected_md5 = start["md5"]
+        self.ack_topic = "funger/ota/%s/ack" % start["session"]
+        self.next = 0
+        self.last_acked = 0
+        self.ahead = 0
+        self.window = {}
+        self.duplicates = 0
+        self.last_chunk = now
+        self.gap_since = 0
+        self.last_request = now
+        self.active = True
+        self.result = None
+        self.request(False, now)
+
+    def chunk_length(self, n):
+        return self.chunk_size if n + 1 < self.chunks else self.size - n * self.chunk_size
+
+    def on_chunk(self, raw, now):
+        if not self.active:
+            return
+        msg = json.loads(raw)
+        n = msg["n"]
+        if n >= self.chunks or n < self.next:
+            self.duplicates += 1
+            return
+        if n >= self.next + OTA_WINDOW:
+            self.duplicates += 1
+            self.ahead = max(self.ahead, n)
+            if self.gap_since == 0:
+                self.gap_since = now
+            return
+        slot = n % OTA_WINDOW
+        if slot in self.window and self.window[slot][0] == n:
+            self.duplicates += 1
+            return
+        data = base64.b64decode(msg["d"])
+        if len(data) != self.chunk_length(n):
+            return
+        self.last_chunk = now
+        self.window[slot] = (n, data)
+        while self.active and self.window.get(self.next % OTA_WINDOW, (None,))[0] == self.next:
+            _, ready = self.window.pop(self.next % OTA_WINDOW)
+            self.next += 1
+            self.md5.update(ready)
+            if self.next == self.chunks:
+                self.end(self.md5.hexdigest() == self.expected_md5)
+            elif self.next - self.last_acked >= OTA_ACK_EVERY:
+                self.request(False, now)
+        parked = self.ahead > self.next or bool(self.window)
+        if not parked:
+            self.gap_since = 0
+        elif self.gap_since == 0:
+            self.gap_since = now
+
+    def loop(self, now):
+        if not self.active:
+            return
+        if now - self.last_chunk >= OTA_ABORT_MS:
+            self.end(False)
+        elif self.gap_since and now - self.gap_since >= OTA_NACK_MS and now - self.last_request >= OTA_NACK_MS:
+            self.request(False, now)
+        elif now - self.last_chunk >= OTA_STALL_MS and now - self.last_request >= OTA_STALL_MS:
+            self.request(True, now)
+
+    def request(self, stalled, now):
+        ack = {"device": self.name, "next": self.next}
+        if stalled:
+            ack["stalled"] = True
+        highest = max([self.next] + [n for n, _ in self.window.values()])
+        if self.ahead > highest:
+            highest = min(self.next + OTA_WINDOW, self.ahead)
+        missing = [n for n in range(self.next, highest) if self.window.get(n % OTA_WINDOW, (None,))[0] != n]
+        if missing:
+            ack["missing"] = missing
+        self.publish(self.ack_topic, json.dumps(ack, separators=(",", ":")))
+        self.last_acked = self.next
+        self.last_request = now
+
+    def end(self, success):
+        self.active = False
+        self.result = success
+        self.publish(self.ack_topic, json.dumps({"device": self.name, "next": self.next, "done": success,
+                                                 "duplicates": self.duplicates}, separators=(",", ":")))
+
+
+class SimBroker:
+    """Fan-out with independent loss and latency per delivery, driven by simulated time."""
+
+    def __init__(self, loss, latency, rng):
+        self.loss = loss
+        self.latency = latency
+        self.rng = rng
+        self.subscribers = {}
+        self.queue = []
+        self.seq = 0
+        self.bytes_in = 0
+        self.bytes_out = 0
+        self.now = 0
+
+    def subscribe(self, topic, handler):
+        self.subscribers.setdefault(topic, []).append(handler)
+
+    def publish(self, topic, payload):
+        size = mqtt_publish_size(topic, payload)
+        self.bytes_in += size
+        for handler in self.subscribers.get(topic, []):
+            if self.rng.random() < self.loss:
+                continue
+            self.bytes_out += size
+            self.seq += 1
+            at = self.now + self.latency * (0.5 + self.rng.random())
+            heapq.heappush(self.queue, (at, self.seq, handler, payload))
+
+    def deliver_until(self, now):
+        while self.queue and self.queue[0][0] <= now:
+            _, _, handler, payload = heapq.heappop(self.queue)
+            handler(payload, now)
+
+
+def simulate(image, args):
+    rng = random.Random(args.seed)
+    broker = SimBroker(args.loss, args.latency, rng)
+    publisher = OtaPublisher(image, args.session, args.chunk_size, args.rate)
+    broker.subscribe(publisher.ack_topic, publisher.on_ack)
+    start = publisher.start_event()
+    devices = []
+    for i in range(args.simulate):
+        device = SimDevice("sim%04d" % i, start, broker.publish, 0)
+        broker.subscribe(publisher.chunk_topic, device.on_chunk)
+        devices.append(device)
+
+    step = 5
+    now = 0
+    while not publisher.finished(now) and now < args.timeout * 1000:
+        broker.now = now
+        broker.deliver_until(now)
+        for n in publisher.pump(now):
+            broker.publish(publisher.chunk_topic, publisher.chunk_payload(n))
+        for device in devices:
+            device.loop(now)
+        now += step
+
+    ok = sum(1 for d in devices if d.result)
+    http_bytes = args.simulate * (len(image) + HTTP_OVERHEAD)
+    print("%d devices, %d byte image in %d chunks of %d, %.1f%% loss per delivery"
+          % (args.simulate, len(image), publisher.chunks, args.chunk_size, args.loss * 100))
+    print("updated %d/%d in %.1f s (simulated)" % (ok, args.simulate, now / 1000.0))
+    print("chunks published %d (%d resent), acks %d" % (publisher.stats["published"], publisher.stats["resent"],
+                                                         publisher.stats["acks"]))
+    print()
+    print("%-34s %14s %14s" % ("", "MQTT chunks", "HTTP OTA"))
+    print("%-34s %14d %14d" % ("sent by the origin (publisher/web)", publisher.stats["bytes"], http_bytes))
+    print("%-34s %14d %14d" % ("into the broker (chunks + acks)", broker.bytes_in, 0))
+    print("%-34s %14d %14d" % ("delivered to devices", broker.bytes_out, http_bytes))
+    return 0 if ok == args.simulate else 1
+
+
+def publish(image, args):
+    try:
+        import paho.mqtt.client as mqtt
+    except ImportError:
+        sys.exit("paho-mqtt is needed to talk to a broker: pip install paho-mqtt")
+
+    if args.room:
+        target = "funger/rooms/%s/events" % args.room
+    elif args.device:
+        target = "funger/device/%s" % args.device
+    else:
+        target = "funger/events/"
+
+    publisher = OtaPublisher(image, args.session, args.chunk_size, args.rate)
+    millis = lambda: int(time.monotonic() * 1000)
+
+    def on_message(client, userdata, message):
+        publisher.on_ack(message.payload.decode(errors="replace"), millis())
+
+    try:
+        client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    except AttributeError:
+        client = mqtt.Client()
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.on_message = on_message
+    client.connect(args.broker, args.port)
+    client.subscribe(publisher.ack_topic)
+    client.loop(timeout=1.0)
+    client.publish(target, json.dumps(publisher.start_event()))
+    print("session %s: %d bytes in %d chunks to %s" % (args.session, len(image), publisher.chunks, target))
+
+    # Devices announce themselves with their first ack, give the room time to answer
+    join_until = millis() + args.join * 1000
+    while millis() < join_until and (args.devices == 0 or len(publisher.devices) < args.devices):
+        client.loop(timeout=0.05)
+    if not publisher.devices:
+        sys.exit("no device joined the session")
+
+    deadline = millis() + args.timeout * 1000
+    while not publisher.finished(millis()) and millis() < deadline:
+        client.loop(timeout=0.005)
+        for n in publisher.pump(millis()):
+            client.publish(publisher.chunk_topic, publisher.chunk_payload(n))
+
+    failed = 0
+    for device, state in sorted(publisher.devices.items()):
+        result = {True: "ok", False: "failed", None: "gave up at chunk %d" % state["next"]}[state["done"]]
+        failed += state["done"] is not True
+        print("%-18s %s" % (device, result))
+    print("published %d chunks (%d resent), %d bytes, %d acks"
+          % (publisher.stats["published"], publisher.stats["resent"], publisher.stats["bytes"], publisher.stats["acks"]))
+    print("HTTP OTA would have sent %d bytes from the web server" % (len(publisher.devices) * (len(image) + HTTP_OVERHEAD)))
+    client.disconnect()
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="firmware .bin")
+    parser.add_argument("--session", default="fw%d" % int(time.time()), help="session id, part of the topics")
+    parser.add_argument("--chunk-size", type=int, default=384, help="bytes per chunk before base64 (max %d)" % OTA_CHUNK_MAX)
+    parser.add_argument("--rate", type=float, default=100, help="chunks per second, 0 for as fast as the window allows")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds before giving up")
+    target = parser.add_argument_group("broker")
+    target.add_argument("--broker", default="localhost")
+    target.add_argument("--port", type=int, default=1883)
+    target.add_argument("--user")
+    target.add_argument("--password")
+    target.add_argument("--room", help="send the start event to this room")
+    target.add_argument("--device", help="send the start event to one device")
+    target.add_argument("--devices", type=int, default=0, help="devices to wait for before sending")
+    target.add_argument("--join", type=int, default=3, help="seconds to wait for devices to join")
+    sim = parser.add_argument_group("simulation")
+    sim.add_argument("--simulate", type=int, default=0, metavar="N", help="run against N simulated devices instead")
+    sim.add_argument("--loss", type=float, default=0.01, help="probability a delivery is lost")
+    sim.add_argument("--latency", type=float, default=20, help="mean broker delivery latency in ms")
+    sim.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if not 0 < args.chunk_size <= OTA_CHUNK_MAX:
+        sys.exit("--chunk-size must be 1..%d" % OTA_CHUNK_MAX)
+    with open(args.image, "rb") as f:
+        image = f.read()
+    return simulate(image, args) if args.simulate else publish(image, args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
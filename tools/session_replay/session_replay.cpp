@@ -0,0 +1,164 @@
+// Session replay: loads a device's session dump and runs it back through the firmware's event
+// parser and round engine with the recorded clock, the same replaySession() the device runs on
+// {"event":"session","action":"replay"}. Every recorded decision has to come out the same, then the
+// replay is repeated to time the decision engine.
+//
+//   pio run -e session_replay && .pio/build/session_replay/program dump.txt
+//
+// The dump is either the serial one ({"event":"session","action":"dump","serial":true}, copy
+// everything from the "SESSION" line on) or the MQTT one, one part per line as
+// `mosquitto_sub -t 'funger/device/<id>/session'` prints them. Lines that are neither are skipped.
+//
+//   --self ID         device the session was recorded on (default from the dump)
+//   --iterations N    timed replays after the checked one (default 1000)
+//
+// Exits 1 when a decision came out differently, the first mismatch is printed with the records
+// of its round.
+#include <Arduino.h>
+#include <chrono>
+#include <json_pool.h>
+#include <session_recorder.h>
+
+#define REPLAY_LINE_LEN 2048
+
+static SessionRecorder recorder;
+static char self[18] = "";
+
+static int64_t monotonicNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static size_t decodeHex(const char* hex, uint8_t* out, size_t size) {
+  size_t n = 0;
+  for (; hex[0] && hex[1] && n < size; hex += 2) {
+    int hi = hexValue(hex[0]);
+    int lo = hexValue(hex[1]);
+    if (hi < 0 || lo < 0) break;
+    out[n++] = hi << 4 | lo;
+  }
+  return n;
+}
+
+static size_t decodeBase64(const char* text, uint8_t* out, size_t size) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t bits = 0;
+  int count = 0;
+  size_t n = 0;
+  for (; *text && *text != '=' && n < size; text++) {
+    const char* at = strchr(alphabet, *text);
+    if (!at) continue;
+    bits = bits << 6 | (uint32_t)(at - alphabet);
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      out[n++] = (bits >> count) & 0xFF;
+    }
+  }
+  return n;
+}
+
+static bool loadLine(char* line, uint32_t& parts) {
+  static uint8_t data[REPLAY_LINE_LEN];
+  if (strncmp(line, "SESSION ", 8) == 0) {
+    if (self[0] == '\0') sscanf(line + 8, "%17s", self);
+    return true;
+  }
+  const char* json = strchr(line, '{');
+  if (json) {
+    // An MQTT part, the topic may come first
+    PooledJsonDocument part;
+    if (deserializeJson(part, json)) return true;
+    if (!part["d"].is<const char*>()) return true;
+    if (self[0] == '\0') strlcpy(self, part["device"] | "", sizeof(self));
+    if ((part["first"] | 0u) != recorder.count()) {
+      fprintf(stderr, "part starting at record %u skipped, %u loaded so far\n", part["first"] | 0u, recorder.count());
+      return true;
+    }
+    parts++;
+    return recorder.load(data, decodeBase64(part["d"], data, sizeof(data)));
+  }
+  size_t length = strcspn(line, "\r\n");
+  if (length == 0 || length % 2 != 0 || hexValue(line[0]) < 0) return true;
+  line[length] = '\0';
+  size_t n = decodeHex(line, data, sizeof(data));
+  if (n * 2 != length) return true;
+  parts++;
+  return recorder.load(data, n);
+}
+
+static void printRecord(uint16_t i) {
+  const SessionRecord& rec = recorder.at(i);
+  static const char* names[] = {"?", "touch", "sync", "decide", "window", "event"};
+  printf("  %4u at %10u sync %13llu %-6s %-17s value %-5u flags %02x", i, rec.at, (unsigned long long)rec.syncEpoch,
+         names[rec.type <= REC_EVENT ? rec.type : 0], rec.device, rec.value, rec.flags);
+  char msg[SESSION_EVENT_MAX + 1];
+  if (recorder.payload(rec, msg, SESSION_EVENT_MAX)) {
+    msg[rec.value] = '\0';
+    printf(" %s", msg);
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  uint32_t iterations = 1000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--self") == 0 && i + 1 < argc) strlcpy(self, argv[++i], sizeof(self));
+    else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) iterations = strtoul(argv[++i], nullptr, 10);
+    else if (argv[i][0] != '-' && !path) path = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [--self ID] [--iterations N] [dump]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  FILE* in = path ? fopen(path, "r") : stdin;
+  if (!in) {
+    perror(path);
+    return 2;
+  }
+  static char line[REPLAY_LINE_LEN * 2 + 256];
+  uint32_t parts = 0;
+  while (fgets(line, sizeof(line), in)) {
+    if (!loadLine(line, parts)) {
+      fprintf(stderr, "dump part %u is truncated\n", parts);
+      return 2;
+    }
+  }
+  if (path) fclose(in);
+  if (recorder.count() == 0 || self[0] == '\0') {
+    fprintf(stderr, "no session records or no device id, pass --self\n");
+    return 2;
+  }
+
+  uint64_t offset = recorder.at(0).epoch - recorder.at(0).at;
+  printf("%s: %u records in %u parts, epoch offset %llu ms\n", self, recorder.count(), parts, (unsigned long long)offset);
+  ReplayResult result = replaySession(recorder, self);
+  printf("rounds %u, mismatched %u, events %u, rejected %u, duplicates %u, unreadable %u, clock mismatched %u\n",
+         result.rounds, result.mismatched, result.events, result.rejected, result.duplicates, result.unreadable,
+         result.clockMismatched);
+
+  if (iterations > 0) {
+    int64_t start = monotonicNs();
+    for (uint32_t n = 0; n < iterations; n++) replaySession(recorder, self);
+    double seconds = (monotonicNs() - start) / 1e9;
+    printf("%u replays in %.3f s, %.0f rounds/s, %.0f records/s\n", iterations, seconds,
+           result.rounds * (double)iterations / seconds, recorder.count() * (double)iterations / seconds);
+  }
+
+  if (result.mismatched > 0) {
+    printf("first mismatch at record %d, its round:\n", result.firstMismatch);
+    int16_t from = result.firstMismatch;
+    while (from > 0 && recorder.at(from - 1).type != REC_DECIDE && recorder.at(from - 1).type != REC_SYNC) from--;
+    for (int16_t i = from > 0 ? from - 1 : 0; i <= result.firstMismatch; i++) printRecord(i);
+    return 1;
+  }
+  return 0;
+}